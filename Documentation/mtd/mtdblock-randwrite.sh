@@ -0,0 +1,78 @@
+#! /bin/sh
+# Random 4 KiB write IOPS and write amplification through mtdblock.
+#
+# usage: mtdblock-randwrite.sh [writes] [cache_blocks...]
+#
+# Runs randwrite (built from randwrite.c in this directory) against
+# /dev/mtdblockN on two simulated devices, once for every cache_blocks
+# value given (default 1 4 16):
+#
+#   - nandsim, a 256 MiB, 128 KiB eraseblock NAND chip.  It is loaded
+#     with rptwear, so it logs its total erase count, and the write
+#     amplification is the erased bytes divided by the written bytes;
+#   - mtdram, a 64 MiB RAM device with 128 KiB eraseblocks.  It keeps
+#     no erase counters, so only the IOPS are reported for it.
+#
+# Each run writes "writes" (default 2000) random 4 KiB blocks within the
+# first 32 MiB, followed by an fsync(), which forces the cache out.
+# nandsim logs the total every RPTWEAR (default 16) erases, so the erase
+# count may be that many short; use a smaller RPTWEAR for exact numbers
+# at the cost of a lot of log output.  The console log level is lowered
+# for the duration so the reports do not slow the writes down.
+#
+# Needs CONFIG_MTD_NAND_NANDSIM, MTD_MTDRAM and MTD_BLOCK as modules.
+
+set -e
+me=`basename $0`
+writes=${1:-2000}
+shift 2> /dev/null || true
+caches=${*:-1 4 16}
+rptwear=${RPTWEAR:-16}
+rw=`command -v randwrite || echo "\`dirname $0\`/randwrite"`
+printk=`cat /proc/sys/kernel/printk`
+
+test -x "$rw" || {
+	echo "$me Error: build randwrite.c first" 1>&2
+	exit 1
+}
+
+cleanup() {
+	rmmod mtdblock 2> /dev/null || true
+	rmmod nandsim 2> /dev/null || true
+	rmmod mtdram 2> /dev/null || true
+	echo $printk > /proc/sys/kernel/printk
+}
+
+mtd_index() {
+	awk -F: "/$1/ { sub(\"mtd\", \"\", \$1); print \$1 }" /proc/mtd
+}
+
+run() {
+	modprobe mtdblock cache_blocks=$2
+	mtd=`mtd_index "$1"`
+	dev=/dev/mtdblock$mtd
+	test -b $dev || mknod $dev b 31 $mtd
+	$rw -n $writes -s 32m $dev | sed 's/^/  /'
+	rmmod mtdblock
+}
+
+echo 4 > /proc/sys/kernel/printk
+trap cleanup 0
+
+for cache in $caches; do
+	echo "nandsim, cache_blocks=$cache"
+	modprobe nandsim first_id_byte=0xec second_id_byte=0xda \
+		third_id_byte=0x51 fourth_id_byte=0x95 rptwear=$rptwear
+	dmesg -c > /dev/null
+	run "NAND simulator" $cache
+	erases=`dmesg | sed -n 's/.*Total numbers of erases: *//p' | tail -1`
+	rmmod nandsim
+	echo "${erases:-0} $writes" | awk '{
+		printf "  %d erases, write amplification %.1f\n",
+		       $1, $1 * 131072 / ($2 * 4096) }'
+
+	echo "mtdram, cache_blocks=$cache"
+	modprobe mtdram total_size=65536 erase_size=128
+	run "mtdram" $cache
+	rmmod mtdram
+done
@@ -0,0 +1,106 @@
+#! /bin/sh
+# FAT throughput and write amplification on nandftl, against mtdblock.
+#
+# usage: nandftl-fat.sh [file-MiB] [writes]
+#
+# Loads nandsim as a 256 MiB, 128 KiB eraseblock NAND chip with rptwear
+# set, so it logs its total erase count, and puts a VFAT file system on
+# it through nandftl and then, for comparison, through mtdblock.  On
+# each the script:
+#
+#   - writes a file of "file-MiB" (default 32) sequentially with dd and
+#     fsync, and prints MB/s;
+#   - rewrites "writes" (default 2000) random 4 KiB blocks of that file
+#     with randwrite (built from randwrite.c in this directory), which
+#     is the FAT-style small write pattern, and prints IOPS;
+#   - prints the write amplification of both phases: erased bytes over
+#     the bytes the application wrote, so FAT metadata counts as
+#     overhead.
+#
+# nandsim logs the erase total every RPTWEAR (default 16) erases, so the
+# counts may be that many short.  The console log level is lowered for
+# the duration so the reports do not slow the writes down.  mtdblock-jz
+# is not measured: it drives the JZ NAND controller only.
+#
+# Needs CONFIG_MTD_NAND_NANDSIM, NAND_FTL, MTD_BLOCK and VFAT_FS, and
+# mkfs.vfat.
+
+set -e
+me=`basename $0`
+mb=${1:-32}
+writes=${2:-2000}
+rptwear=${RPTWEAR:-16}
+rw=`command -v randwrite || echo "\`dirname $0\`/randwrite"`
+mnt=/tmp/$me.mnt
+printk=`cat /proc/sys/kernel/printk`
+
+test -x "$rw" || {
+	echo "$me Error: build randwrite.c first" 1>&2
+	exit 1
+}
+
+cleanup() {
+	umount $mnt 2> /dev/null || true
+	rmdir $mnt 2> /dev/null || true
+	rmmod nandftl 2> /dev/null || true
+	rmmod mtdblock 2> /dev/null || true
+	rmmod nandsim 2> /dev/null || true
+	echo $printk > /proc/sys/kernel/printk
+}
+
+erases() {
+	n=`dmesg | sed -n 's/.*Total numbers of erases: *//p' | tail -1`
+	echo ${n:-0}
+}
+
+# erases before, erases after, bytes written
+amplification() {
+	echo "$1 $2 $3" | awk '{
+		printf "  %d erases, write amplification %.1f\n",
+		       $2 - $1, ($2 - $1) * 131072 / $3 }'
+}
+
+run() {
+	modprobe nandsim first_id_byte=0xec second_id_byte=0xda \
+		third_id_byte=0x51 fourth_id_byte=0x95 rptwear=$rptwear
+	dmesg -c > /dev/null
+	mtd=`awk -F: '/NAND simulator/ { sub("mtd", "", $1); print $1 }' \
+		/proc/mtd`
+	case $1 in
+	nandftl)
+		modprobe nandftl mtd=$mtd
+		dev=/dev/nandftl0
+		test -b $dev || mknod $dev b 240 0 ;;
+	mtdblock)
+		modprobe mtdblock
+		dev=/dev/mtdblock$mtd
+		test -b $dev || mknod $dev b 31 $mtd ;;
+	esac
+
+	mkfs.vfat $dev > /dev/null
+	mkdir -p $mnt
+	mount -t vfat $dev $mnt
+	e0=`erases`
+
+	t0=`date +%s.%N`
+	dd if=/dev/zero of=$mnt/file bs=1M count=$mb conv=fsync 2> /dev/null
+	t1=`date +%s.%N`
+	e1=`erases`
+	echo "$1 sequential: `echo "$mb / ($t1 - $t0)" | bc` MB/s"
+	amplification $e0 $e1 `expr $mb \* 1048576`
+
+	echo "$1 random 4 KiB:"
+	$rw -n $writes $mnt/file | sed 's/^/  /'
+	umount $mnt
+	e2=`erases`
+	amplification $e1 $e2 `expr $writes \* 4096`
+
+	rmmod $1
+	rmmod nandsim
+}
+
+echo 4 > /proc/sys/kernel/printk
+trap cleanup 0
+
+run nandftl
+run mtdblock
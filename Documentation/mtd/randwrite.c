@@ -0,0 +1,151 @@
+/*
+ * randwrite.c - random block writes to a file or block device
+ *
+ * Writes blocks of a fixed size at random, block aligned offsets of a
+ * file or block device and reports the write rate.  The final fsync()
+ * is part of the timed interval, so data a write-back cache is still
+ * holding is accounted for.
+ *
+ *	randwrite [-b bsize] [-n writes] [-s size] [-f every] [-r seed] path
+ *
+ *	-b bsize	block size in bytes (default 4096)
+ *	-n writes	number of writes (default 1000)
+ *	-s size		span of the writes in bytes; defaults to the size of
+ *			the file or device, and a new file is extended to it
+ *	-f every	also fsync() after every "every" writes (default 0:
+ *			only once at the end)
+ *	-r seed		random seed, to repeat a run exactly (default 1)
+ *
+ * Sizes take an optional k, m or g suffix.
+ *
+ * Compile with: gcc -O2 -Wall -o randwrite randwrite.c
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <linux/fs.h>
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static unsigned long long parse_size(const char *s)
+{
+	char *end;
+	unsigned long long v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G':
+		v <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		v <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		v <<= 10;
+	}
+	return v;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: randwrite [-b bsize] [-n writes] [-s size] "
+		"[-f every] [-r seed] path\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long size = 0, nr_blocks, blk;
+	unsigned long bsize = 4096, writes = 1000, every = 0, i;
+	unsigned int seed = 1;
+	struct timeval t0, t1;
+	struct stat st;
+	double elapsed;
+	char *buf;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "b:n:s:f:r:")) != -1) {
+		switch (c) {
+		case 'b':
+			bsize = parse_size(optarg);
+			break;
+		case 'n':
+			writes = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = parse_size(optarg);
+			break;
+		case 'f':
+			every = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || !bsize)
+		usage();
+
+	fd = open(argv[optind], O_WRONLY | O_CREAT, 0644);
+	if (fd < 0)
+		die(argv[optind]);
+	if (fstat(fd, &st) < 0)
+		die("fstat");
+	if (!size) {
+		if (S_ISBLK(st.st_mode)) {
+			if (ioctl(fd, BLKGETSIZE64, &size) < 0)
+				die("BLKGETSIZE64");
+		} else
+			size = st.st_size;
+	} else if (S_ISREG(st.st_mode) && st.st_size < size &&
+		   ftruncate(fd, size) < 0)
+		die("ftruncate");
+	nr_blocks = size / bsize;
+	if (!nr_blocks) {
+		fprintf(stderr, "randwrite: %s is smaller than one block\n",
+			argv[optind]);
+		return 1;
+	}
+
+	buf = malloc(bsize);
+	if (!buf)
+		die("malloc");
+	srandom(seed);
+	for (i = 0; i < bsize; i++)
+		buf[i] = random();
+
+	gettimeofday(&t0, NULL);
+	for (i = 1; i <= writes; i++) {
+		blk = (((unsigned long long)random() << 31) | random()) %
+		      nr_blocks;
+		/* make every block distinct, so nothing can dedupe them */
+		memcpy(buf, &i, sizeof(i));
+		if (pwrite(fd, buf, bsize, blk * bsize) != bsize)
+			die("pwrite");
+		if (every && i % every == 0 && fsync(fd) < 0)
+			die("fsync");
+	}
+	if (fsync(fd) < 0)
+		die("fsync");
+	gettimeofday(&t1, NULL);
+
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	printf("%lu writes of %lu bytes over %llu blocks in %.2f s, "
+	       "%.0f IOPS\n", writes, bsize, nr_blocks, elapsed,
+	       writes / elapsed);
+	return 0;
+}
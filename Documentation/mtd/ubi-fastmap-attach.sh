@@ -0,0 +1,99 @@
+#! /bin/sh
+# Time UBI attach with and without a fastmap on simulated NAND.
+#
+# usage: ubi-fastmap-attach.sh [size...]
+#
+# For each size (256, 1024 or 2048 MiB; all three by default) nandsim is
+# loaded as a 2 KiB page, 128 KiB eraseblock chip of that size.  UBI is
+# attached, one volume filling the device is created and written, and
+# UBI is detached again, which writes a fastmap.  Then the script times:
+#
+#   - attaching by fastmap (dmesg must say "attached by fastmap");
+#   - attaching by full scan, after erasing the fastmap anchor eraseblock
+#     so that UBI finds no fastmap and falls back to scanning.
+#
+# The detach times are printed as well, since detach writes the map.
+# 4 GiB cannot be simulated: mtd_info.size is 32 bits in this kernel.
+#
+# Needs CONFIG_MTD_NAND_NANDSIM and CONFIG_MTD_UBI as modules, with
+# MTD_UBI_FASTMAP=y, and ubiattach, ubidetach, ubimkvol, ubiupdatevol and
+# flash_erase from mtd-utils.  nandsim keeps the chip in RAM, so the
+# 2 GiB run needs more than 2 GiB of free memory.
+
+set -e
+me=`basename $0`
+sizes=${*:-256 1024 2048}
+img=/tmp/$me.img
+
+now() {
+	date +%s.%N
+}
+
+attach() {
+	t0=`now`
+	ubiattach /dev/ubi_ctrl -m $mtd > /dev/null
+	t1=`now`
+	echo "$t1 - $t0" | bc
+}
+
+detach() {
+	t0=`now`
+	ubidetach /dev/ubi_ctrl -m $mtd
+	t1=`now`
+	echo "$t1 - $t0" | bc
+}
+
+cleanup() {
+	ubidetach /dev/ubi_ctrl -m $mtd 2> /dev/null || true
+	rmmod nandsim 2> /dev/null || true
+	rm -f $img
+}
+
+modprobe ubi
+trap cleanup 0
+
+for size in $sizes; do
+	case $size in
+	256)	id=0xda ;;
+	1024)	id=0xd3 ;;
+	2048)	id=0xd5 ;;
+	*)	echo "$me Error: size must be 256, 1024 or 2048" 1>&2
+		exit 1 ;;
+	esac
+	modprobe nandsim first_id_byte=0xec second_id_byte=$id \
+		third_id_byte=0x51 fourth_id_byte=0x95
+	mtd=`awk -F: '/NAND simulator/ { sub("mtd", "", $1); print $1 }' \
+		/proc/mtd`
+
+	ubiattach /dev/ubi_ctrl -m $mtd > /dev/null
+	ubimkvol /dev/ubi0 -N fill -m > /dev/null
+	bytes=`cat /sys/class/ubi/ubi0_0/data_bytes`
+	dd if=/dev/zero of=$img bs=1 count=0 seek=$bytes 2> /dev/null
+	ubiupdatevol /dev/ubi0_0 $img
+	rm -f $img
+	fm_detach=`detach`
+
+	dmesg -c > /dev/null
+	fm_attach=`attach`
+	anchor=`dmesg | sed -n 's/.*attached by fastmap at PEB \([0-9]*\).*/\1/p'`
+	test -n "$anchor" || {
+		echo "$me Error: UBI did not attach by fastmap" 1>&2
+		exit 1
+	}
+	detach > /dev/null
+
+	peb=`awk "/^mtd$mtd:/ { print \\$3 }" /proc/mtd`
+	peb=`printf "%d" 0x$peb`
+	flash_erase /dev/mtd$mtd `expr $anchor \* $peb` 1 > /dev/null
+	dmesg -c > /dev/null
+	scan_attach=`attach`
+	dmesg | grep -q "attached by fastmap" && {
+		echo "$me Error: the fastmap was not invalidated" 1>&2
+		exit 1
+	}
+	scan_detach=`detach`
+
+	echo "$size MiB: fastmap attach $fm_attach s, scan attach" \
+	     "$scan_attach s; detach $fm_detach s / $scan_detach s"
+	rmmod nandsim
+done
@@ -0,0 +1,65 @@
+#! /bin/sh
+# Compare UBIFS sequential read speed with and without bulk-read.
+#
+# usage: ubifs-bulk-read.sh [file-MiB] [runs]
+#
+# Loads nandsim as a 256 MiB, 2 KiB page, 128 KiB eraseblock chip,
+# creates a UBIFS on it and writes one file of "file-MiB" (default 64)
+# of random data, so compression cannot shrink it.  The file is then
+# read with dd "runs" times (default 3) after remounting with
+# no_bulk_read and with bulk_read, dropping the page cache before every
+# read, and the MB/s of every read is printed.
+#
+# nandsim answers reads at memory speed unless told otherwise, which
+# hides most of the per-I/O cost bulk-read saves.  Set DELAYS=1 in the
+# environment to load it with do_delays=1 and typical large page timings
+# (access_delay=25 us, output_cycle=25 ns); that makes each run slower.
+#
+# Needs CONFIG_MTD_NAND_NANDSIM, MTD_UBI and UBIFS_FS as modules, and
+# ubiattach, ubidetach and ubimkvol from mtd-utils.
+
+set -e
+me=`basename $0`
+mb=${1:-64}
+runs=${2:-3}
+mnt=/tmp/$me.mnt
+
+cleanup() {
+	umount $mnt 2> /dev/null || true
+	rmdir $mnt 2> /dev/null || true
+	ubidetach /dev/ubi_ctrl -m $mtd 2> /dev/null || true
+	rmmod nandsim 2> /dev/null || true
+}
+
+delays=
+test "$DELAYS" = 1 && delays="do_delays=1 access_delay=25 output_cycle=25"
+modprobe nandsim first_id_byte=0xec second_id_byte=0xda \
+	third_id_byte=0x51 fourth_id_byte=0x95 $delays
+modprobe ubifs
+mtd=`awk -F: '/NAND simulator/ { sub("mtd", "", $1); print $1 }' /proc/mtd`
+trap cleanup 0
+
+ubiattach /dev/ubi_ctrl -m $mtd > /dev/null
+ubimkvol /dev/ubi0 -N bench -m > /dev/null
+mkdir -p $mnt
+mount -t ubifs ubi0:bench $mnt
+dd if=/dev/urandom of=$mnt/file bs=1M count=$mb 2> /dev/null
+sync
+
+read_file() {
+	echo 3 > /proc/sys/vm/drop_caches
+	t0=`date +%s.%N`
+	dd if=$mnt/file of=/dev/null bs=1M 2> /dev/null
+	t1=`date +%s.%N`
+	echo "$mb / ($t1 - $t0)" | bc
+}
+
+read_file > /dev/null		# warm up the index
+for opt in no_bulk_read bulk_read; do
+	mount -o remount,$opt $mnt
+	i=0
+	while test $i -lt $runs; do
+		echo "$opt: `read_file` MB/s"
+		i=`expr $i + 1`
+	done
+done
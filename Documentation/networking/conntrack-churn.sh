@@ -0,0 +1,95 @@
+#! /bin/sh
+# Compare conntrack cost for established flows and for flow churn.
+#
+# usage: conntrack-churn.sh [seconds] [buckets]
+#
+# Uses tapgen (built from tapgen.c in this directory) to feed UDP into a
+# tap device with conntrack loaded.  The first run cycles through 1024
+# flows, so after the first packets every packet is a hash lookup that
+# finds its entry.  The second run uses tapgen -C, where every packet is
+# a new 4-tuple and costs a lookup, an allocation and an insert.  If
+# "buckets" is given, net.netfilter.nf_conntrack_buckets is set to it
+# first, which resizes the table online.
+#
+# For each run the script prints the rate the UDP layer saw, the deltas
+# of the searched/found/new/insert/drop/early_drop counters from
+# /proc/net/stat/nf_conntrack and the table size and fill afterwards.
+# The difference of the per-packet times of the two runs gives a rough
+# per-insert cost.
+#
+# Needs CONFIG_NF_CONNTRACK_IPV4, TUN and iproute2.  nf_conntrack_max
+# is raised to 1M for the duration so the churn run does not measure
+# early drop alone; a full table takes a few hundred MB of memory.
+
+set -e
+me=`basename $0`
+secs=${1:-10}
+buckets=$2
+tap=${tap:-cttap0}
+gen=`command -v tapgen || echo "\`dirname $0\`/tapgen"`
+ct=/proc/sys/net/netfilter
+
+test -x "$gen" || {
+	echo "$me Error: build tapgen.c first" 1>&2
+	exit 1
+}
+
+udp_in() {
+	awk '/^Udp:/ { if (!n++) { for (i = 2; i <= NF; i++) col[$i] = i }
+		       else print $col["InDatagrams"] + $col["NoPorts"] }' \
+		/proc/net/snmp
+}
+
+# per-CPU hex counters summed into one line of decimal, header order
+ct_stat() {
+	awk 'function hex(s,  v, i) {
+		v = 0
+		for (i = 1; i <= length(s); i++)
+			v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+		return v
+	     }
+	     NR == 1 { next }
+	     { for (i = 1; i <= NF; i++) sum[i] += hex($i) }
+	     END { for (i = 1; i <= NF; i++) printf "%d ", sum[i]; print "" }' \
+		/proc/net/stat/nf_conntrack
+}
+
+run() {
+	s0=`ct_stat`
+	u0=`udp_in`
+	$gen $1 -t $secs $tap > /dev/null
+	u1=`udp_in`
+	s1=`ct_stat`
+	pps=`expr \( $u1 - $u0 \) / $secs`
+	echo "$2: $pps pps, table `cat $ct/nf_conntrack_count` of" \
+	     "`cat $ct/nf_conntrack_buckets` buckets"
+	# entries searched found new invalid ignore delete delete_list
+	# insert insert_failed drop early_drop ...
+	echo "$s0 $s1" | awk '{ n = NF / 2
+		printf "  searched %d found %d new %d insert %d drop %d" \
+		       " early_drop %d\n", $(n+2) - $2, $(n+3) - $3,
+		       $(n+4) - $4, $(n+9) - $9, $(n+11) - $11, $(n+12) - $12 }'
+	eval pps_$2=$pps
+}
+
+modprobe nf_conntrack_ipv4 2> /dev/null || true
+test -r /proc/net/stat/nf_conntrack || {
+	echo "$me Error: conntrack is not available" 1>&2
+	exit 1
+}
+max=`cat $ct/nf_conntrack_max`
+echo 1048576 > $ct/nf_conntrack_max
+
+$gen -c $tap
+trap "$gen -D $tap; echo $max > $ct/nf_conntrack_max" 0
+ip addr add 10.99.0.1/24 dev $tap
+ip link set $tap up
+ip neigh add 10.99.0.2 lladdr 02:00:00:00:00:02 dev $tap
+
+test -n "$buckets" && echo $buckets > $ct/nf_conntrack_buckets
+
+run "-f 1024" established
+run "-C" churn
+
+echo "$pps_established $pps_churn" | awk '$1 && $2 {
+	printf "per-insert cost about %.2f us\n", 1e6 / $2 - 1e6 / $1 }'
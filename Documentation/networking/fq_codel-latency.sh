@@ -0,0 +1,73 @@
+#! /bin/sh
+# Measure latency under load with fq_codel and with a plain FIFO.
+#
+# usage: fq_codel-latency.sh [rate] [delay] [seconds]
+#
+# Everything runs over the loopback device.  Its egress is limited to
+# "rate" (default 10mbit) by tbf, with either pfifo or fq_codel as the
+# tbf child, and its ingress is redirected to ifb0, where netem adds
+# "delay" (default 20ms) as the base round trip time.  A bulk TCP
+# transfer keeps the bottleneck saturated while ping measures the round
+# trip time of a sparse flow sharing it.  The ping summary and the qdisc
+# statistics are printed for both disciplines.
+#
+# Needs CONFIG_NET_SCH_TBF, NET_SCH_FQ_CODEL, NET_SCH_NETEM,
+# NET_SCH_INGRESS, NET_CLS_U32, NET_CLS_ACT, NET_ACT_MIRRED and IFB,
+# a tc that knows fq_codel, ethtool and nc.  The loopback MTU is set to
+# 1500 and TSO/GSO are switched off for the duration, so tbf sees
+# packets of a realistic size; the MTU is restored on exit.
+
+set -e
+rate=${1:-10mbit}
+delay=${2:-20ms}
+secs=${3:-30}
+mtu=`cat /sys/class/net/lo/mtu 2> /dev/null || echo 16436`
+
+cleanup() {
+	tc qdisc del dev lo root 2> /dev/null || true
+	tc qdisc del dev lo ingress 2> /dev/null || true
+	tc qdisc del dev ifb0 root 2> /dev/null || true
+	ip link set ifb0 down 2> /dev/null || true
+	ip link set lo mtu $mtu
+	ethtool -K lo tso on gso on 2> /dev/null || true
+	kill $sink 2> /dev/null || true
+}
+
+modprobe ifb 2> /dev/null || true
+ip link set ifb0 up
+ip link set lo mtu 1500
+ethtool -K lo tso off gso off
+trap cleanup 0
+
+tc qdisc add dev ifb0 root netem delay $delay limit 10000
+tc qdisc add dev lo ingress
+tc filter add dev lo parent ffff: protocol ip u32 match u32 0 0 \
+	action mirred egress redirect dev ifb0
+
+nc -l -p 5002 > /dev/null &
+sink=$!
+sleep 1
+
+run() {
+	tc qdisc del dev lo root 2> /dev/null || true
+	tc qdisc add dev lo root handle 1: tbf rate $rate burst 3000 \
+		latency 1s
+	tc qdisc add dev lo parent 1:1 handle 10: $1
+
+	dd if=/dev/zero bs=1M count=100000 2> /dev/null |
+		nc 127.0.0.1 5002 &
+	bulk=$!
+	sleep 5		# let the queue build up
+	echo "== $1"
+	ping -q -c `expr $secs \* 5` -i 0.2 127.0.0.1 | tail -1
+	kill $bulk 2> /dev/null || true
+	tc -s qdisc show dev lo
+	# a fresh sink for the next run
+	wait $sink 2> /dev/null || true
+	nc -l -p 5002 > /dev/null &
+	sink=$!
+	sleep 1
+}
+
+run pfifo
+run fq_codel
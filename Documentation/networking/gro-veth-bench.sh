@@ -0,0 +1,67 @@
+#! /bin/sh
+# Compare bulk TCP receive over a veth pair with GRO on and off.
+#
+# usage: gro-veth-bench.sh [megabytes]
+#
+# Needs CONFIG_VETH and CONFIG_NET_NS (which in this kernel means
+# SYSFS=n), iproute2, unshare(1) with -n, an ethtool that knows the
+# "gro" feature, and nc.  The receiving end of the pair is moved into a
+# new network namespace, so the transfer really crosses veth rather than
+# loopback.  There is no setns() in this kernel, so everything that has
+# to happen in the namespace is done by the shell started there.
+#
+# For each setting the script prints the transfer rate, the number of
+# TCP segments the stack received (with GRO on these are the merged
+# segments, so fewer is the point) and the system plus softirq time
+# spent on all CPUs, from /proc/stat.
+
+set -e
+me=`basename $0`
+mb=${1:-1024}
+pidfile=/tmp/$me.pid
+
+tcp_insegs() {
+	awk '/^Tcp:/ { if (!n++) { for (i = 2; i <= NF; i++) col[$i] = i }
+		       else print $col["InSegs"] }' /proc/net/snmp
+}
+
+# system + softirq jiffies summed over all CPUs
+cpu_ticks() {
+	awk '/^cpu / { print $4 + $8 }' /proc/stat
+}
+
+run() {
+	ip link add veth0 type veth peer name veth1
+	rm -f $pidfile
+	unshare -n sh -c "
+		echo \$\$ > $pidfile
+		while ! ip link show veth1 > /dev/null 2>&1; do sleep 0.1; done
+		ip addr add 10.98.0.2/24 dev veth1
+		ip link set lo up
+		ip link set veth1 up
+		ethtool -K veth1 gro $1
+		exec nc -l -p 5001 > /dev/null" &
+	while test ! -s $pidfile; do sleep 0.1; done
+	ip link set veth1 netns `cat $pidfile`
+	ip addr add 10.98.0.1/24 dev veth0
+	ip link set veth0 up
+	sleep 1
+
+	s0=`tcp_insegs`
+	c0=`cpu_ticks`
+	t0=`date +%s.%N`
+	dd if=/dev/zero bs=1M count=$mb 2> /dev/null | nc -q 0 10.98.0.2 5001
+	t1=`date +%s.%N`
+	c1=`cpu_ticks`
+	s1=`tcp_insegs`
+	wait
+
+	echo "gro $1: `echo "$mb * 8 / ($t1 - $t0)" | bc` Mbit/s," \
+	     "`expr $s1 - $s0` segments in, `expr $c1 - $c0` sys+softirq ticks"
+	ip link del veth0 2> /dev/null || true
+}
+
+trap "ip link del veth0 2> /dev/null; rm -f $pidfile" 0
+
+run off
+run on
@@ -0,0 +1,65 @@
+#! /bin/sh
+# Compare single-CPU and steered receive processing on a tap device.
+#
+# usage: rps-bench.sh [flows] [seconds] [threads]
+#
+# Needs CONFIG_RPS, CONFIG_TUN, iproute2 and tapgen (built from tapgen.c
+# in this directory and found in $PATH or next to this script).  The
+# script runs the generator twice, once with an empty rps_cpus mask and
+# once with every online CPU in it, and prints for each run the packet
+# rate the generator achieved, the rate the UDP layer saw and how the
+# backlog work was spread over the CPUs (/proc/net/softnet_stat).
+#
+# A veth pair in a network namespace is not used: network namespaces
+# need SYSFS=n in this kernel, and the rps_cpus mask lives in sysfs.
+
+set -e
+me=`basename $0`
+flows=${1:-64}
+secs=${2:-10}
+threads=${3:-1}
+tap=${tap:-rpstap0}
+gen=`command -v tapgen || echo "\`dirname $0\`/tapgen"`
+
+test -x "$gen" || {
+	echo "$me Error: build tapgen.c first" 1>&2
+	exit 1
+}
+
+# sum of InDatagrams and NoPorts: all packets that reached UDP
+udp_in() {
+	awk '/^Udp:/ { if (!n++) { for (i = 2; i <= NF; i++) col[$i] = i }
+		       else print $col["InDatagrams"] + $col["NoPorts"] }' \
+		/proc/net/snmp
+}
+
+# first (processed) column of softnet_stat, one line per CPU, in decimal
+softnet() {
+	while read processed rest; do
+		printf "%d\n" 0x$processed
+	done < /proc/net/softnet_stat
+}
+
+run() {
+	echo $1 > /sys/class/net/$tap/rps_cpus
+	softnet > /tmp/$me.before
+	u0=`udp_in`
+	$gen -f $flows -t $secs -T $threads $tap
+	u1=`udp_in`
+	softnet > /tmp/$me.after
+	echo "rps_cpus=$1: udp `expr \( $u1 - $u0 \) / $secs` pps"
+	paste /tmp/$me.before /tmp/$me.after |
+		awk '{ printf "  cpu%d: %d packets\n", NR - 1, $2 - $1 }'
+}
+
+$gen -c $tap
+trap "$gen -D $tap; rm -f /tmp/$me.before /tmp/$me.after" 0
+ip addr add 10.99.0.1/24 dev $tap
+ip link set $tap up
+ip neigh add 10.99.0.2 lladdr 02:00:00:00:00:02 dev $tap
+
+ncpus=`grep -c ^processor /proc/cpuinfo`
+mask=`printf "%x" $(( (1 << ncpus) - 1 ))`
+
+run 0
+run $mask
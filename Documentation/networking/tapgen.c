@@ -0,0 +1,281 @@
+/*
+ * tapgen.c - feed UDP flows into the receive path through a tap device
+ *
+ * Frames written to a tap device are received with netif_rx_ni() as if
+ * they had come from a NIC, so this drives the receive side of the stack
+ * (RPS, GRO, conntrack, ...) from a single machine without a second
+ * host or a network namespace.
+ *
+ *	tapgen -c tap0		create a persistent tap device and exit
+ *	tapgen -D tap0		delete it again
+ *	tapgen [options] tap0	send for a while, then print the rate
+ *
+ * Options for sending:
+ *	-f flows	number of UDP flows, cycled through (default 64)
+ *	-C		churn: every packet starts a new flow instead
+ *	-t seconds	how long to send (default 10)
+ *	-T threads	writer threads sharing the tap (default 1)
+ *	-l length	UDP payload length (default 18)
+ *	-s addr		source IPv4 address (default 10.99.0.2)
+ *	-d addr		destination IPv4 address (default 10.99.0.1)
+ *	-p port		destination UDP port (default 9)
+ *
+ * The destination address has to be configured on the tap device and
+ * the source needs a static neighbour entry, since nothing answers ARP:
+ *
+ *	ip addr add 10.99.0.1/24 dev tap0
+ *	ip link set tap0 up
+ *	ip neigh add 10.99.0.2 lladdr 02:00:00:00:00:02 dev tap0
+ *
+ * Compile with: gcc -O2 -Wall -o tapgen tapgen.c -lpthread
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define SRC_MAC		"\x02\x00\x00\x00\x00\x02"
+#define SPORT_BASE	20000
+#define CHURN_SPORTS	64512	/* source ports 1024-65535 */
+#define CHURN_DPORTS	256
+#define MAX_THREADS	64
+
+static int tap_fd;
+static unsigned char tap_mac[ETH_ALEN];
+static struct in_addr src_addr, dst_addr;
+static unsigned int nr_flows = 64, payload_len = 18, dport = 9;
+static unsigned int nr_threads = 1;
+static int churn;
+static volatile int stop;
+
+struct writer {
+	pthread_t thread;
+	unsigned int id;
+	unsigned long sent;
+};
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static int tap_open(const char *name, int persist)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR);
+	if (fd < 0)
+		die("/dev/net/tun");
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+		die("TUNSETIFF");
+	if (persist >= 0 && ioctl(fd, TUNSETPERSIST, persist) < 0)
+		die("TUNSETPERSIST");
+	return fd;
+}
+
+static void get_mac(const char *name)
+{
+	struct ifreq ifr;
+	int s;
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s < 0)
+		die("socket");
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (ioctl(s, SIOCGIFHWADDR, &ifr) < 0)
+		die("SIOCGIFHWADDR");
+	memcpy(tap_mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	close(s);
+}
+
+static unsigned short ip_csum(const void *buf, int len)
+{
+	const unsigned short *p = buf;
+	unsigned long sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* Build one frame from @src_port to @dst_port into @buf, returns its length */
+static int build_frame(unsigned char *buf, unsigned int src_port,
+		       unsigned int dst_port)
+{
+	struct ether_header *eh = (struct ether_header *)buf;
+	struct iphdr *iph = (struct iphdr *)(eh + 1);
+	struct udphdr *uh = (struct udphdr *)(iph + 1);
+	int len = sizeof(*iph) + sizeof(*uh) + payload_len;
+
+	memcpy(eh->ether_dhost, tap_mac, ETH_ALEN);
+	memcpy(eh->ether_shost, SRC_MAC, ETH_ALEN);
+	eh->ether_type = htons(ETHERTYPE_IP);
+
+	memset(iph, 0, sizeof(*iph));
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->tot_len = htons(len);
+	iph->saddr = src_addr.s_addr;
+	iph->daddr = dst_addr.s_addr;
+	iph->check = ip_csum(iph, sizeof(*iph));
+
+	uh->source = htons(src_port);
+	uh->dest = htons(dst_port);
+	uh->len = htons(sizeof(*uh) + payload_len);
+	uh->check = 0;		/* optional for IPv4 */
+	memset(uh + 1, 0, payload_len);
+
+	return sizeof(*eh) + len;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	unsigned char frame[ETH_FRAME_LEN];
+	unsigned int flow = w->id;
+	int len;
+
+	while (!stop) {
+		/*
+		 * In churn mode the threads interleave over the whole port
+		 * space, so no 4-tuple repeats before 16M packets.
+		 */
+		if (churn)
+			len = build_frame(frame, 1024 + flow % CHURN_SPORTS,
+					  dport + flow / CHURN_SPORTS %
+						  CHURN_DPORTS);
+		else
+			len = build_frame(frame, SPORT_BASE + flow % nr_flows,
+					  dport);
+		if (write(tap_fd, frame, len) == len)
+			w->sent++;
+		else if (errno != ENOBUFS && errno != EAGAIN)
+			die("write");
+		flow += churn ? nr_threads : 1;
+	}
+	return NULL;
+}
+
+static void on_alarm(int sig)
+{
+	stop = 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: tapgen -c|-D ifname\n"
+		"       tapgen [-f flows | -C] [-t seconds] [-T threads]\n"
+		"              [-l length] [-s srcaddr] [-d dstaddr] [-p port]\n"
+		"              ifname\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	struct writer w[MAX_THREADS];
+	unsigned int seconds = 10, i;
+	unsigned long sent = 0;
+	struct timeval t0, t1;
+	double elapsed;
+	int c, create = 0, destroy = 0;
+
+	inet_aton("10.99.0.2", &src_addr);
+	inet_aton("10.99.0.1", &dst_addr);
+
+	while ((c = getopt(argc, argv, "cCDf:t:T:l:s:d:p:")) != -1) {
+		switch (c) {
+		case 'c':
+			create = 1;
+			break;
+		case 'C':
+			churn = 1;
+			break;
+		case 'D':
+			destroy = 1;
+			break;
+		case 'f':
+			nr_flows = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			nr_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			payload_len = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (!inet_aton(optarg, &src_addr))
+				usage();
+			break;
+		case 'd':
+			if (!inet_aton(optarg, &dst_addr))
+				usage();
+			break;
+		case 'p':
+			dport = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+	if (!nr_flows || !nr_threads || nr_threads > MAX_THREADS ||
+	    payload_len > ETH_DATA_LEN - sizeof(struct iphdr) -
+			  sizeof(struct udphdr))
+		usage();
+
+	if (create || destroy) {
+		tap_open(argv[optind], create);
+		return 0;
+	}
+
+	tap_fd = tap_open(argv[optind], -1);
+	get_mac(argv[optind]);
+
+	signal(SIGALRM, on_alarm);
+	alarm(seconds);
+	gettimeofday(&t0, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		w[i].id = i;
+		w[i].sent = 0;
+		if (pthread_create(&w[i].thread, NULL, writer_thread, &w[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		sent += w[i].sent;
+	}
+	gettimeofday(&t1, NULL);
+
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	printf("sent %lu packets in %.2f s, %.0f pps\n",
+	       sent, elapsed, sent / elapsed);
+	return 0;
+}
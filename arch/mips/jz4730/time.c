@@ -13,6 +13,7 @@
 #include <linux/types.h>
 #include <linux/interrupt.h>
 #include <linux/time.h>
+#include <linux/clocksource.h>
 #include <linux/clockchips.h>
 
 #include <asm/time.h>
@@ -21,19 +22,55 @@
 #define JZ_TIMER_CHAN  0
 #define JZ_TIMER_IRQ   IRQ_OST0
 
+/* free running 32-bit down counter for the clocksource */
+#define JZ_CLOCKSOURCE_CHAN  1
+
 static unsigned int timer_latch;
 
 void (*jz_timer_callback)(void);
 
+static cycle_t jz_get_cycles(void)
+{
+	/* the counter counts down */
+	return 0xffffffff - __ost_get_count(JZ_CLOCKSOURCE_CHAN);
+}
+
+static struct clocksource jz_clocksource = {
+	.name		= "jz-ost",
+	.rating		= 300,
+	.read		= jz_get_cycles,
+	.mask		= CLOCKSOURCE_MASK(32),
+	.flags		= CLOCK_SOURCE_IS_CONTINUOUS,
+};
+
+static int jz_set_next_event(unsigned long evt,
+			     struct clock_event_device *cd)
+{
+	__ost_disable_channel(JZ_TIMER_CHAN);
+	__ost_clear_uf(JZ_TIMER_CHAN);
+	/* underflow after evt ticks, the irq handler stops the channel */
+	__ost_set_reload(JZ_TIMER_CHAN, 0xffffffff);
+	__ost_set_count(JZ_TIMER_CHAN, evt);
+	__ost_enable_channel(JZ_TIMER_CHAN);
+	return 0;
+}
+
 static void jz_set_mode(enum clock_event_mode mode,
 			struct clock_event_device *evt)
 {
 	switch (mode) {
 	case CLOCK_EVT_MODE_PERIODIC:
+		__ost_disable_channel(JZ_TIMER_CHAN);
+		__ost_set_reload(JZ_TIMER_CHAN, timer_latch);
+		__ost_set_count(JZ_TIMER_CHAN, timer_latch);
+		__ost_enable_channel(JZ_TIMER_CHAN);
                 break;
         case CLOCK_EVT_MODE_ONESHOT:
         case CLOCK_EVT_MODE_UNUSED:
         case CLOCK_EVT_MODE_SHUTDOWN:
+		/* oneshot events are armed by jz_set_next_event() */
+		__ost_disable_channel(JZ_TIMER_CHAN);
+		__ost_clear_uf(JZ_TIMER_CHAN);
                 break;
         case CLOCK_EVT_MODE_RESUME:
                 break;
@@ -42,13 +79,14 @@ static void jz_set_mode(enum clock_event_mode mode,
 
 static struct clock_event_device jz_clockevent_device = {
 	.name		= "jz-timer",
-	.features	= CLOCK_EVT_FEAT_PERIODIC,
+	.features	= CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
 
-	/* .mult, .shift, .max_delta_ns and .min_delta_ns left uninitialized */
+	/* .mult, .shift, .max_delta_ns and .min_delta_ns set in jz_timer_setup */
 
 	.rating		= 300,
 	.irq		= JZ_TIMER_IRQ,
 	.set_mode	= jz_set_mode,
+	.set_next_event	= jz_set_next_event,
 };
 
 static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
@@ -57,6 +95,9 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 
 	__ost_clear_uf(JZ_TIMER_CHAN); /* ACK timer */
 
+	if (cd->mode == CLOCK_EVT_MODE_ONESHOT)
+		__ost_disable_channel(JZ_TIMER_CHAN);
+
 	if (jz_timer_callback)
 		jz_timer_callback();
 
@@ -78,11 +119,25 @@ static void __init jz_timer_setup(void)
 	unsigned int cpu = smp_processor_id();
 
 	cd->cpumask = cpumask_of_cpu(cpu);
+	clockevent_set_clock(cd, JZ_EXTAL);
+	cd->max_delta_ns = clockevent_delta2ns(0x7fffffff, cd);
+	cd->min_delta_ns = clockevent_delta2ns(16, cd);
 	clockevents_register_device(cd);
 	action->dev_id = cd;
 	setup_irq(JZ_TIMER_IRQ, &jz_irqaction);
 }
 
+static void __init jz_clocksource_setup(void)
+{
+	__ost_set_mode(JZ_CLOCKSOURCE_CHAN, OST_TCSR_CKS_EXTAL); /* no irq */
+	__ost_set_reload(JZ_CLOCKSOURCE_CHAN, 0xffffffff);
+	__ost_set_count(JZ_CLOCKSOURCE_CHAN, 0xffffffff);
+	__ost_enable_channel(JZ_CLOCKSOURCE_CHAN);
+
+	clocksource_set_clock(&jz_clocksource, JZ_EXTAL);
+	clocksource_register(&jz_clocksource);
+}
+
 void __init plat_time_init(void)
 {
 	/* Init timer */
@@ -92,5 +147,6 @@ void __init plat_time_init(void)
 	__ost_set_count(JZ_TIMER_CHAN, timer_latch);
 	__ost_enable_channel(JZ_TIMER_CHAN);
 
+	jz_clocksource_setup();
 	jz_timer_setup();
 }
@@ -23,6 +23,7 @@
 #include <linux/types.h>
 #include <linux/interrupt.h>
 #include <linux/time.h>
+#include <linux/clocksource.h>
 #include <linux/clockchips.h>
 
 #include <asm/time.h>
@@ -32,21 +33,68 @@
 
 #define JZ_TIMER_CHAN  0
 #define JZ_TIMER_IRQ  IRQ_TCU2
+#define JZ_TIMER_CLOCK	(JZ_EXTAL >> 4)	/* EXTAL/16 */
+
+/*
+ * Free running channel for the clocksource. It runs slower than the
+ * event channel so that it cannot wrap within the longest event the
+ * clockevent device can program (0xffff ticks of JZ_TIMER_CLOCK).
+ */
+#define JZ_CLOCKSOURCE_CHAN  1
+#define JZ_CLOCKSOURCE_CLOCK	(JZ_EXTAL >> 6)	/* EXTAL/64 */
 
 static unsigned int latch;
 
 void (*jz_timer_callback)(void);
 
+static cycle_t jz_get_cycles(void)
+{
+	return REG_TCU_TCNT(JZ_CLOCKSOURCE_CHAN);
+}
+
+static struct clocksource jz_clocksource = {
+	.name		= "jz-tcu",
+	.rating		= 300,
+	.read		= jz_get_cycles,
+	.mask		= CLOCKSOURCE_MASK(16),
+	.flags		= CLOCK_SOURCE_IS_CONTINUOUS,
+};
+
+static void jz_timer_stop(void)
+{
+	REG_TCU_TECR = (1 << JZ_TIMER_CHAN); /* stop counting */
+	REG_TCU_TFCR = (1 << JZ_TIMER_CHAN); /* clear pending irq */
+}
+
+/* count up from 0, full match irq when reaching data */
+static void jz_timer_start(unsigned int data)
+{
+	REG_TCU_TCNT(JZ_TIMER_CHAN) = 0;
+	REG_TCU_TDFR(JZ_TIMER_CHAN) = data;
+	REG_TCU_TESR = (1 << JZ_TIMER_CHAN); /* start counting up */
+}
+
+static int jz_set_next_event(unsigned long evt,
+			     struct clock_event_device *cd)
+{
+	jz_timer_stop();
+	jz_timer_start(evt);
+	return 0;
+}
 
 static void jz_set_mode(enum clock_event_mode mode,
 			struct clock_event_device *evt)
 {
 	switch (mode) {
 	case CLOCK_EVT_MODE_PERIODIC:
+		jz_timer_stop();
+		jz_timer_start(latch);
                 break;
         case CLOCK_EVT_MODE_ONESHOT:
         case CLOCK_EVT_MODE_UNUSED:
         case CLOCK_EVT_MODE_SHUTDOWN:
+		/* oneshot events are armed by jz_set_next_event() */
+		jz_timer_stop();
                 break;
         case CLOCK_EVT_MODE_RESUME:
                 break;
@@ -55,13 +103,14 @@ static void jz_set_mode(enum clock_event_mode mode,
 
 static struct clock_event_device jz_clockevent_device = {
 	.name		= "jz-timer",
-	.features	= CLOCK_EVT_FEAT_PERIODIC,
+	.features	= CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
 
-	/* .mult, .shift, .max_delta_ns and .min_delta_ns left uninitialized */
+	/* .mult, .shift, .max_delta_ns and .min_delta_ns set in jz_timer_setup */
 
 	.rating		= 300,
 	.irq		= JZ_TIMER_IRQ,
 	.set_mode	= jz_set_mode,
+	.set_next_event	= jz_set_next_event,
 };
 
 static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
@@ -70,6 +119,10 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 
 	REG_TCU_TFCR = 1 << JZ_TIMER_CHAN; /* ACK timer */
 
+	/* the counter restarts from 0 on a full match, don't fire again */
+	if (cd->mode == CLOCK_EVT_MODE_ONESHOT)
+		REG_TCU_TECR = (1 << JZ_TIMER_CHAN);
+
 	if (jz_timer_callback)
 		jz_timer_callback();
 
@@ -91,11 +144,30 @@ static void __init jz_timer_setup(void)
 	unsigned int cpu = smp_processor_id();
 
 	cd->cpumask = cpumask_of_cpu(cpu);
+	clockevent_set_clock(cd, JZ_TIMER_CLOCK);
+	cd->max_delta_ns = clockevent_delta2ns(0xffff, cd);
+	cd->min_delta_ns = clockevent_delta2ns(4, cd);
 	clockevents_register_device(cd);
 	action->dev_id = cd;
 	setup_irq(JZ_TIMER_IRQ, &jz_irqaction);
 }
 
+static void __init jz_clocksource_setup(void)
+{
+	REG_TCU_TCSR(JZ_CLOCKSOURCE_CHAN) = TCU_TCSR_PRESCALE64 | TCU_TCSR_EXT_EN;
+	REG_TCU_TCNT(JZ_CLOCKSOURCE_CHAN) = 0;
+	REG_TCU_TDHR(JZ_CLOCKSOURCE_CHAN) = 0;
+	REG_TCU_TDFR(JZ_CLOCKSOURCE_CHAN) = 0xffff;
+
+	/* no irqs, just wrap around */
+	REG_TCU_TMSR = (1 << (JZ_CLOCKSOURCE_CHAN + 16)) | (1 << JZ_CLOCKSOURCE_CHAN);
+	REG_TCU_TSCR = (1 << JZ_CLOCKSOURCE_CHAN); /* enable timer clock */
+	REG_TCU_TESR = (1 << JZ_CLOCKSOURCE_CHAN); /* start counting up */
+
+	clocksource_set_clock(&jz_clocksource, JZ_CLOCKSOURCE_CLOCK);
+	clocksource_register(&jz_clocksource);
+}
+
 void __init plat_time_init(void)
 {
 	/* Init timer */
@@ -111,5 +183,6 @@ void __init plat_time_init(void)
 	REG_TCU_TSCR = (1 << JZ_TIMER_CHAN); /* enable timer clock */
 	REG_TCU_TESR = (1 << JZ_TIMER_CHAN); /* start counting up */
 
+	jz_clocksource_setup();
 	jz_timer_setup();
 }
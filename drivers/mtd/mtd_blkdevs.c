@@ -28,12 +28,6 @@
 
 static LIST_HEAD(blktrans_majors);
 
-struct mtd_blkcore_priv {
-	struct task_struct *thread;
-	struct request_queue *rq;
-	spinlock_t queue_lock;
-};
-
 static int do_blktrans_request(struct mtd_blktrans_ops *tr,
 			       struct mtd_blktrans_dev *dev,
 			       struct request *req)
@@ -76,8 +70,9 @@ static int do_blktrans_request(struct mtd_blktrans_ops *tr,
 
 static int mtd_blktrans_thread(void *arg)
 {
-	struct mtd_blktrans_ops *tr = arg;
-	struct request_queue *rq = tr->blkcore_priv->rq;
+	struct mtd_blktrans_dev *dev = arg;
+	struct mtd_blktrans_ops *tr = dev->tr;
+	struct request_queue *rq = dev->rq;
 
 	/* we might get involved when memory gets low, so use PF_MEMALLOC */
 	current->flags |= PF_MEMALLOC;
@@ -85,7 +80,6 @@ static int mtd_blktrans_thread(void *arg)
 	spin_lock_irq(rq->queue_lock);
 	while (!kthread_should_stop()) {
 		struct request *req;
-		struct mtd_blktrans_dev *dev;
 		int res = 0;
 
 		req = elv_next_request(rq);
@@ -98,9 +92,6 @@ static int mtd_blktrans_thread(void *arg)
 			continue;
 		}
 
-		dev = req->rq_disk->private_data;
-		tr = dev->tr;
-
 		spin_unlock_irq(rq->queue_lock);
 
 		mutex_lock(&dev->lock);
@@ -118,8 +109,17 @@ static int mtd_blktrans_thread(void *arg)
 
 static void mtd_blktrans_request(struct request_queue *rq)
 {
-	struct mtd_blktrans_ops *tr = rq->queuedata;
-	wake_up_process(tr->blkcore_priv->thread);
+	struct mtd_blktrans_dev *dev = rq->queuedata;
+	struct request *req;
+
+	if (dev) {
+		wake_up_process(dev->thread);
+		return;
+	}
+
+	/* The device is going away, its thread is gone */
+	while ((req = elv_next_request(rq)) != NULL)
+		end_request(req, 0);
 }
 
 
@@ -248,9 +248,9 @@ int add_mtd_blktrans_dev(struct mtd_blktrans_dev *new)
 		return -EBUSY;
 	}
 
-	mutex_init(&new->lock);
 	list_add_tail(&new->list, &tr->devs);
  added:
+	mutex_init(&new->lock);
 	if (!tr->writesect)
 		new->readonly = 1;
 
@@ -259,6 +259,28 @@ int add_mtd_blktrans_dev(struct mtd_blktrans_dev *new)
 		list_del(&new->list);
 		return -ENOMEM;
 	}
+
+	spin_lock_init(&new->queue_lock);
+	new->rq = blk_init_queue(mtd_blktrans_request, &new->queue_lock);
+	if (!new->rq) {
+		put_disk(gd);
+		list_del(&new->list);
+		return -ENOMEM;
+	}
+	new->rq->queuedata = new;
+	blk_queue_hardsect_size(new->rq, tr->blksize);
+
+	new->thread = kthread_run(mtd_blktrans_thread, new, "%s%d",
+				  tr->name, new->mtd->index);
+	if (IS_ERR(new->thread)) {
+		int ret = PTR_ERR(new->thread);
+
+		blk_cleanup_queue(new->rq);
+		put_disk(gd);
+		list_del(&new->list);
+		return ret;
+	}
+
 	gd->major = tr->major;
 	gd->first_minor = (new->devnum) << tr->part_bits;
 	gd->fops = &mtd_blktrans_ops;
@@ -282,7 +304,7 @@ int add_mtd_blktrans_dev(struct mtd_blktrans_dev *new)
 
 	gd->private_data = new;
 	new->blkcore_priv = gd;
-	gd->queue = tr->blkcore_priv->rq;
+	gd->queue = new->rq;
 
 	if (new->readonly)
 		set_disk_ro(gd, 1);
@@ -302,6 +324,18 @@ int del_mtd_blktrans_dev(struct mtd_blktrans_dev *old)
 	list_del(&old->list);
 
 	del_gendisk(old->blkcore_priv);
+
+	/* Stop the thread; requests still coming in are failed */
+	spin_lock_irq(&old->queue_lock);
+	old->rq->queuedata = NULL;
+	spin_unlock_irq(&old->queue_lock);
+	kthread_stop(old->thread);
+
+	spin_lock_irq(&old->queue_lock);
+	mtd_blktrans_request(old->rq);
+	spin_unlock_irq(&old->queue_lock);
+
+	blk_cleanup_queue(old->rq);
 	put_disk(old->blkcore_priv);
 
 	return 0;
@@ -353,44 +387,18 @@ int register_mtd_blktrans(struct mtd_blktrans_ops *tr)
 	if (!blktrans_notifier.list.next)
 		register_mtd_user(&blktrans_notifier);
 
-	tr->blkcore_priv = kzalloc(sizeof(*tr->blkcore_priv), GFP_KERNEL);
-	if (!tr->blkcore_priv)
-		return -ENOMEM;
-
 	mutex_lock(&mtd_table_mutex);
 
 	ret = register_blkdev(tr->major, tr->name);
 	if (ret) {
 		printk(KERN_WARNING "Unable to register %s block device on major %d: %d\n",
 		       tr->name, tr->major, ret);
-		kfree(tr->blkcore_priv);
 		mutex_unlock(&mtd_table_mutex);
 		return ret;
 	}
-	spin_lock_init(&tr->blkcore_priv->queue_lock);
 
-	tr->blkcore_priv->rq = blk_init_queue(mtd_blktrans_request, &tr->blkcore_priv->queue_lock);
-	if (!tr->blkcore_priv->rq) {
-		unregister_blkdev(tr->major, tr->name);
-		kfree(tr->blkcore_priv);
-		mutex_unlock(&mtd_table_mutex);
-		return -ENOMEM;
-	}
-
-	tr->blkcore_priv->rq->queuedata = tr;
-	blk_queue_hardsect_size(tr->blkcore_priv->rq, tr->blksize);
 	tr->blkshift = ffs(tr->blksize) - 1;
 
-	tr->blkcore_priv->thread = kthread_run(mtd_blktrans_thread, tr,
-			"%sd", tr->name);
-	if (IS_ERR(tr->blkcore_priv->thread)) {
-		blk_cleanup_queue(tr->blkcore_priv->rq);
-		unregister_blkdev(tr->major, tr->name);
-		kfree(tr->blkcore_priv);
-		mutex_unlock(&mtd_table_mutex);
-		return PTR_ERR(tr->blkcore_priv->thread);
-	}
-
 	INIT_LIST_HEAD(&tr->devs);
 	list_add(&tr->list, &blktrans_majors);
 
@@ -410,9 +418,6 @@ int deregister_mtd_blktrans(struct mtd_blktrans_ops *tr)
 
 	mutex_lock(&mtd_table_mutex);
 
-	/* Clean up the kernel thread */
-	kthread_stop(tr->blkcore_priv->thread);
-
 	/* Remove it from the list of active majors */
 	list_del(&tr->list);
 
@@ -421,13 +426,10 @@ int deregister_mtd_blktrans(struct mtd_blktrans_ops *tr)
 		tr->remove_dev(dev);
 	}
 
-	blk_cleanup_queue(tr->blkcore_priv->rq);
 	unregister_blkdev(tr->major, tr->name);
 
 	mutex_unlock(&mtd_table_mutex);
 
-	kfree(tr->blkcore_priv);
-
 	BUG_ON(!list_empty(&tr->devs));
 	return 0;
 }
@@ -11,24 +11,45 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/types.h>
 #include <linux/vmalloc.h>
 #include <linux/hdreg.h>
+#include <linux/bitops.h>
+#include <linux/workqueue.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/blktrans.h>
 #include <linux/mutex.h>
 
+static int cache_blocks = 4;
+module_param(cache_blocks, int, 0444);
+MODULE_PARM_DESC(cache_blocks, "Number of erase blocks cached per device (default 4)");
+
+static int flush_delay = 5;
+module_param(flush_delay, int, 0644);
+MODULE_PARM_DESC(flush_delay, "Seconds before dirty cached blocks are written back (default 5)");
+
+struct mtdblk_cache {
+	struct list_head list;
+	unsigned long offset;
+	unsigned long dirtied;
+	unsigned char *data;
+	unsigned long *valid;
+	enum { STATE_EMPTY, STATE_DIRTY } state;
+};
 
 static struct mtdblk_dev {
 	struct mtd_info *mtd;
 	int count;
 	struct mutex cache_mutex;
-	unsigned char *cache_data;
-	unsigned long cache_offset;
 	unsigned int cache_size;
-	enum { STATE_EMPTY, STATE_CLEAN, STATE_DIRTY } cache_state;
+	int cache_count;
+	int dirty_count;
+	int flush_error;
+	struct list_head cache_lru;
+	struct delayed_work flush_work;
 } *mtdblks[MAX_MTD_DEVICES];
 
 /*
@@ -37,8 +58,16 @@ static struct mtdblk_dev {
  * Since typical flash erasable sectors are much larger than what Linux's
  * buffer cache can handle, we must implement read-modify-write on flash
  * sectors for each block write requests.  To avoid over-erasing flash sectors
- * and to speed things up, we locally cache a whole flash sector while it is
- * being written to until a different sector is required.
+ * and to speed things up, we locally cache up to cache_blocks flash sectors
+ * while they are being written to, least recently used first out.
+ *
+ * A cached sector only holds what has been written to it, which is tracked
+ * per 512 byte block in the valid bitmap.  The rest is read from flash when
+ * the sector is written back, so a sector which has been completely
+ * rewritten, e.g. by a sequential writer, goes to flash without being read
+ * first.  Dirty sectors are written back in the background flush_delay
+ * seconds after they were dirtied, or earlier when more than half of the
+ * cache is dirty, so that writers rarely have to wait for an erase.
  */
 
 static void erase_callback(struct erase_info *done)
@@ -95,41 +124,222 @@ static int erase_write (struct mtd_info *mtd, unsigned long pos,
 	return 0;
 }
 
+static void drop_cache(struct mtdblk_dev *mtdblk, struct mtdblk_cache *c)
+{
+	if (c->state == STATE_DIRTY)
+		mtdblk->dirty_count--;
+	c->state = STATE_EMPTY;
+	list_move_tail(&c->list, &mtdblk->cache_lru);
+}
 
-static int write_cached_data (struct mtdblk_dev *mtdblk)
+static int write_cached_data (struct mtdblk_dev *mtdblk,
+			      struct mtdblk_cache *c)
 {
 	struct mtd_info *mtd = mtdblk->mtd;
-	int ret;
+	int nsect = mtdblk->cache_size >> 9;
+	int first, last, ret;
+	size_t retlen;
 
-	if (mtdblk->cache_state != STATE_DIRTY)
+	if (c->state != STATE_DIRTY)
 		return 0;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "mtdblock: writing cached data for \"%s\" "
 			"at 0x%lx, size 0x%x\n", mtd->name,
-			mtdblk->cache_offset, mtdblk->cache_size);
+			c->offset, mtdblk->cache_size);
+
+	/* Fill in whatever has not been written from flash */
+	first = find_first_zero_bit(c->valid, nsect);
+	while (first < nsect) {
+		last = find_next_bit(c->valid, nsect, first);
+		ret = mtd->read(mtd, c->offset + (first << 9),
+				(last - first) << 9, &retlen,
+				c->data + (first << 9));
+		if (ret)
+			return ret;
+		if (retlen != (last - first) << 9)
+			return -EIO;
+		first = find_next_zero_bit(c->valid, nsect, last);
+	}
 
-	ret = erase_write (mtd, mtdblk->cache_offset,
-			   mtdblk->cache_size, mtdblk->cache_data);
+	ret = erase_write (mtd, c->offset, mtdblk->cache_size, c->data);
 	if (ret)
 		return ret;
 
 	/*
-	 * Here we could argubly set the cache state to STATE_CLEAN.
+	 * Here we could argubly keep the sector around as clean.
 	 * However this could lead to inconsistency since we will not
 	 * be notified if this content is altered on the flash by other
 	 * means.  Let's declare it empty and leave buffering tasks to
 	 * the buffer cache instead.
 	 */
-	mtdblk->cache_state = STATE_EMPTY;
+	drop_cache(mtdblk, c);
 	return 0;
 }
 
+static int write_all_cached_data(struct mtdblk_dev *mtdblk)
+{
+	struct mtdblk_cache *c;
+	int ret, err = mtdblk->flush_error;
+
+	mtdblk->flush_error = 0;
+	while (!list_empty(&mtdblk->cache_lru)) {
+		c = list_entry(mtdblk->cache_lru.next, struct mtdblk_cache,
+			       list);
+		if (c->state != STATE_DIRTY)
+			break;
+		ret = write_cached_data(mtdblk, c);
+		if (ret) {
+			drop_cache(mtdblk, c);
+			err = ret;
+		}
+	}
+	return err;
+}
+
+static struct mtdblk_cache *find_cache(struct mtdblk_dev *mtdblk,
+				       unsigned long offset)
+{
+	struct mtdblk_cache *c;
+
+	list_for_each_entry(c, &mtdblk->cache_lru, list) {
+		if (c->state == STATE_EMPTY)
+			break;
+		if (c->offset == offset)
+			return c;
+	}
+	return NULL;
+}
+
+static struct mtdblk_cache *alloc_cache(struct mtdblk_dev *mtdblk)
+{
+	int nsect = mtdblk->cache_size >> 9;
+	struct mtdblk_cache *c;
+
+	c = kzalloc(sizeof(*c) + BITS_TO_LONGS(nsect) * sizeof(long),
+		    GFP_KERNEL);
+	if (!c)
+		return NULL;
+
+	c->data = vmalloc(mtdblk->cache_size);
+	if (!c->data) {
+		kfree(c);
+		return NULL;
+	}
+	c->valid = (unsigned long *)(c + 1);
+	c->state = STATE_EMPTY;
+	list_add_tail(&c->list, &mtdblk->cache_lru);
+	mtdblk->cache_count++;
+	return c;
+}
+
+static void kick_flush(struct mtdblk_dev *mtdblk, int now)
+{
+	if (now)
+		cancel_delayed_work(&mtdblk->flush_work);
+	schedule_delayed_work(&mtdblk->flush_work, now ? 0 : flush_delay * HZ);
+}
+
+/*
+ * Find the cache entry for the sector at @offset, or set one up, writing
+ * back the least recently used one if the cache is full.  Dirty entries are
+ * kept at the front of the LRU list, empty ones at the back.
+ */
+static struct mtdblk_cache *get_cache(struct mtdblk_dev *mtdblk,
+				      unsigned long offset)
+{
+	struct mtdblk_cache *c;
+	int ret;
+
+	c = find_cache(mtdblk, offset);
+	if (c) {
+		list_move(&c->list, &mtdblk->cache_lru);
+		return c;
+	}
+
+	c = NULL;
+	if (!list_empty(&mtdblk->cache_lru)) {
+		c = list_entry(mtdblk->cache_lru.prev, struct mtdblk_cache,
+			       list);
+		if (c->state != STATE_EMPTY && mtdblk->cache_count < cache_blocks)
+			c = alloc_cache(mtdblk) ? : c;
+	} else
+		c = alloc_cache(mtdblk);
+	if (!c)
+		return ERR_PTR(-ENOMEM);
+
+	if (c->state != STATE_EMPTY) {
+		ret = write_cached_data(mtdblk, c);
+		if (ret)
+			return ERR_PTR(ret);
+	}
+
+	c->offset = offset;
+	c->state = STATE_DIRTY;
+	c->dirtied = jiffies;
+	bitmap_zero(c->valid, mtdblk->cache_size >> 9);
+	list_move(&c->list, &mtdblk->cache_lru);
+
+	mtdblk->dirty_count++;
+	if (mtdblk->dirty_count > cache_blocks / 2)
+		kick_flush(mtdblk, 1);
+	else
+		kick_flush(mtdblk, 0);
+	return c;
+}
+
+static void mtdblock_flush_work(struct work_struct *work)
+{
+	struct mtdblk_dev *mtdblk = container_of(work, struct mtdblk_dev,
+						 flush_work.work);
+	struct mtdblk_cache *c;
+	long delay;
+	int ret;
+
+	mutex_lock(&mtdblk->cache_mutex);
+	while (1) {
+		/* Oldest first; drop the lock between sectors for writers */
+		list_for_each_entry_reverse(c, &mtdblk->cache_lru, list) {
+			if (c->state != STATE_DIRTY)
+				continue;
+			if (mtdblk->dirty_count > cache_blocks / 2 ||
+			    time_after_eq(jiffies, c->dirtied + flush_delay * HZ))
+				goto found;
+		}
+		break;
+
+found:
+		ret = write_cached_data(mtdblk, c);
+		if (ret) {
+			printk(KERN_WARNING "mtdblock: write back of 0x%lx "
+			       "on \"%s\" failed, error %d\n", c->offset,
+			       mtdblk->mtd->name, ret);
+			drop_cache(mtdblk, c);
+			mtdblk->flush_error = ret;
+		}
+		mutex_unlock(&mtdblk->cache_mutex);
+		cond_resched();
+		mutex_lock(&mtdblk->cache_mutex);
+	}
+
+	/* Come back when the oldest remaining dirty sector expires */
+	list_for_each_entry_reverse(c, &mtdblk->cache_lru, list) {
+		if (c->state != STATE_DIRTY)
+			continue;
+		delay = c->dirtied + flush_delay * HZ - jiffies;
+		if (delay < 0)
+			delay = 0;
+		schedule_delayed_work(&mtdblk->flush_work, delay);
+		break;
+	}
+	mutex_unlock(&mtdblk->cache_mutex);
+}
 
 static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 			    int len, const char *buf)
 {
 	struct mtd_info *mtd = mtdblk->mtd;
 	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *c;
 	size_t retlen;
 	int ret;
 
@@ -143,6 +353,8 @@ static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 		unsigned long sect_start = (pos/sect_size)*sect_size;
 		unsigned int offset = pos - sect_start;
 		unsigned int size = sect_size - offset;
+		int i;
+
 		if( size > len )
 			size = len;
 
@@ -152,38 +364,22 @@ static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 			 * need to bother with the cache while it may still be
 			 * useful for other partial writes.
 			 */
+			c = find_cache(mtdblk, sect_start);
+			if (c)
+				drop_cache(mtdblk, c);
 			ret = erase_write (mtd, pos, size, buf);
 			if (ret)
 				return ret;
 		} else {
 			/* Partial sector: need to use the cache */
-
-			if (mtdblk->cache_state == STATE_DIRTY &&
-			    mtdblk->cache_offset != sect_start) {
-				ret = write_cached_data(mtdblk);
-				if (ret)
-					return ret;
-			}
-
-			if (mtdblk->cache_state == STATE_EMPTY ||
-			    mtdblk->cache_offset != sect_start) {
-				/* fill the cache with the current sector */
-				mtdblk->cache_state = STATE_EMPTY;
-				ret = mtd->read(mtd, sect_start, sect_size,
-						&retlen, mtdblk->cache_data);
-				if (ret)
-					return ret;
-				if (retlen != sect_size)
-					return -EIO;
-
-				mtdblk->cache_offset = sect_start;
-				mtdblk->cache_size = sect_size;
-				mtdblk->cache_state = STATE_CLEAN;
-			}
+			c = get_cache(mtdblk, sect_start);
+			if (IS_ERR(c))
+				return PTR_ERR(c);
 
 			/* write data to our local cache */
-			memcpy (mtdblk->cache_data + offset, buf, size);
-			mtdblk->cache_state = STATE_DIRTY;
+			memcpy (c->data + offset, buf, size);
+			for (i = offset >> 9; i < (offset + size) >> 9; i++)
+				__set_bit(i, c->valid);
 		}
 
 		buf += size;
@@ -200,6 +396,7 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 {
 	struct mtd_info *mtd = mtdblk->mtd;
 	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *c;
 	size_t retlen;
 	int ret;
 
@@ -213,6 +410,8 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 		unsigned long sect_start = (pos/sect_size)*sect_size;
 		unsigned int offset = pos - sect_start;
 		unsigned int size = sect_size - offset;
+		int i;
+
 		if (size > len)
 			size = len;
 
@@ -222,16 +421,20 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 		 * contains what we want, otherwise we read the data directly
 		 * from flash.
 		 */
-		if (mtdblk->cache_state != STATE_EMPTY &&
-		    mtdblk->cache_offset == sect_start) {
-			memcpy (buf, mtdblk->cache_data + offset, size);
-		} else {
+		c = find_cache(mtdblk, sect_start);
+		if (!c || find_next_zero_bit(c->valid, (offset + size) >> 9,
+					     offset >> 9) < (offset + size) >> 9) {
 			ret = mtd->read(mtd, pos, size, &retlen, buf);
 			if (ret)
 				return ret;
 			if (retlen != size)
 				return -EIO;
 		}
+		if (c)
+			for (i = offset >> 9; i < (offset + size) >> 9; i++)
+				if (test_bit(i, c->valid))
+					memcpy(buf + (i << 9) - offset,
+					       c->data + (i << 9), 512);
 
 		buf += size;
 		pos += size;
@@ -245,23 +448,24 @@ static int mtdblock_readsect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
 	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
-	return do_cached_read(mtdblk, block<<9, 512, buf);
+	int ret;
+
+	mutex_lock(&mtdblk->cache_mutex);
+	ret = do_cached_read(mtdblk, block<<9, 512, buf);
+	mutex_unlock(&mtdblk->cache_mutex);
+	return ret;
 }
 
 static int mtdblock_writesect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
 	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
-	if (unlikely(!mtdblk->cache_data && mtdblk->cache_size)) {
-		mtdblk->cache_data = vmalloc(mtdblk->mtd->erasesize);
-		if (!mtdblk->cache_data)
-			return -EINTR;
-		/* -EINTR is not really correct, but it is the best match
-		 * documented in man 2 write for all cases.  We could also
-		 * return -EAGAIN sometimes, but why bother?
-		 */
-	}
-	return do_cached_write(mtdblk, block<<9, 512, buf);
+	int ret;
+
+	mutex_lock(&mtdblk->cache_mutex);
+	ret = do_cached_write(mtdblk, block<<9, 512, buf);
+	mutex_unlock(&mtdblk->cache_mutex);
+	return ret;
 }
 
 static int mtdblock_open(struct mtd_blktrans_dev *mbd)
@@ -286,11 +490,10 @@ static int mtdblock_open(struct mtd_blktrans_dev *mbd)
 	mtdblk->mtd = mtd;
 
 	mutex_init(&mtdblk->cache_mutex);
-	mtdblk->cache_state = STATE_EMPTY;
-	if ( !(mtdblk->mtd->flags & MTD_NO_ERASE) && mtdblk->mtd->erasesize) {
+	INIT_LIST_HEAD(&mtdblk->cache_lru);
+	INIT_DELAYED_WORK(&mtdblk->flush_work, mtdblock_flush_work);
+	if ( !(mtdblk->mtd->flags & MTD_NO_ERASE) && mtdblk->mtd->erasesize)
 		mtdblk->cache_size = mtdblk->mtd->erasesize;
-		mtdblk->cache_data = NULL;
-	}
 
 	mtdblks[dev] = mtdblk;
 
@@ -306,17 +509,26 @@ static int mtdblock_release(struct mtd_blktrans_dev *mbd)
 
    	DEBUG(MTD_DEBUG_LEVEL1, "mtdblock_release\n");
 
-	mutex_lock(&mtdblk->cache_mutex);
-	write_cached_data(mtdblk);
-	mutex_unlock(&mtdblk->cache_mutex);
-
 	if (!--mtdblk->count) {
+		struct mtdblk_cache *c, *next;
+
 		/* It was the last usage. Free the device */
 		mtdblks[dev] = NULL;
+		cancel_delayed_work_sync(&mtdblk->flush_work);
+		mutex_lock(&mtdblk->cache_mutex);
+		write_all_cached_data(mtdblk);
+		mutex_unlock(&mtdblk->cache_mutex);
 		if (mtdblk->mtd->sync)
 			mtdblk->mtd->sync(mtdblk->mtd);
-		vfree(mtdblk->cache_data);
+		list_for_each_entry_safe(c, next, &mtdblk->cache_lru, list) {
+			vfree(c->data);
+			kfree(c);
+		}
 		kfree(mtdblk);
+	} else {
+		mutex_lock(&mtdblk->cache_mutex);
+		write_all_cached_data(mtdblk);
+		mutex_unlock(&mtdblk->cache_mutex);
 	}
 	DEBUG(MTD_DEBUG_LEVEL1, "ok\n");
 
@@ -326,14 +538,15 @@ static int mtdblock_release(struct mtd_blktrans_dev *mbd)
 static int mtdblock_flush(struct mtd_blktrans_dev *dev)
 {
 	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
+	int ret;
 
 	mutex_lock(&mtdblk->cache_mutex);
-	write_cached_data(mtdblk);
+	ret = write_all_cached_data(mtdblk);
 	mutex_unlock(&mtdblk->cache_mutex);
 
 	if (mtdblk->mtd->sync)
 		mtdblk->mtd->sync(mtdblk->mtd);
-	return 0;
+	return ret;
 }
 
 static void mtdblock_add_mtd(struct mtd_blktrans_ops *tr, struct mtd_info *mtd)
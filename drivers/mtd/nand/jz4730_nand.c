@@ -56,7 +56,7 @@ static struct mtd_partition partition_info[] = {
 };
 
 /* Define max reserved bad blocks for each partition.
- * This is used by the mtdblock-jz.c NAND FTL driver only.
+ * This is used by the nandftl.c NAND FTL driver only.
  *
  * The NAND FTL driver reserves some good blocks which can't be
  * seen by the upper layer. When the bad block number of a partition
@@ -124,8 +124,7 @@ static int partition_reserved_badblocks[]={
 #endif
 
 /*-------------------------------------------------------------------------
- * Following three functions are exported and used by the mtdblock-jz.c
- * NAND FTL driver only.
+ * Following functions are exported for the NAND FTL drivers only.
  */
 
 unsigned short get_mtdblock_write_verify_enable(void)
@@ -149,6 +148,12 @@ int *get_jz_badblock_table(void)
 }
 EXPORT_SYMBOL(get_jz_badblock_table);
 
+int get_jz_badblock_table_size(void)
+{
+	return ARRAY_SIZE(partition_reserved_badblocks);
+}
+EXPORT_SYMBOL(get_jz_badblock_table_size);
+
 /*-------------------------------------------------------------------------*/
 
 static void jz_hwcontrol(struct mtd_info *mtd, int dat, 
@@ -15,11 +15,18 @@
 #include <linux/module.h>
 #include <linux/delay.h>
 #include <linux/init.h>
+#include <linux/async.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hrtimer.h>
 
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
 #include <linux/mtd/nand_ecc.h>
 #include <linux/mtd/partitions.h>
+#include <linux/mtd/jz4740_rs.h>
 
 #include <asm/io.h>
 #include <asm/jzsoc.h>
@@ -76,7 +83,7 @@ static struct mtd_partition partition_info[] = {
 
 
 /* Define max reserved bad blocks for each partition.
- * This is used by the mtdblock-jz.c NAND FTL driver only.
+ * This is used by the nandftl.c NAND FTL driver only.
  *
  * The NAND FTL driver reserves some good blocks which can't be
  * seen by the upper layer. When the bad block number of a partition
@@ -138,7 +145,7 @@ static struct mtd_partition partition_info[] = {
 };
 
 /* Define max reserved bad blocks for each partition.
- * This is used by the mtdblock-jz.c NAND FTL driver only.
+ * This is used by the nandftl.c NAND FTL driver only.
  *
  * The NAND FTL driver reserves some good blocks which can't be
  * seen by the upper layer. When the bad block number of a partition
@@ -172,7 +179,7 @@ static struct mtd_partition partition_info[] = {
 };
 
 /* Define max reserved bad blocks for each partition.
- * This is used by the mtdblock-jz.c NAND FTL driver only.
+ * This is used by the nandftl.c NAND FTL driver only.
  *
  * The NAND FTL driver reserves some good blocks which can't be
  * seen by the upper layer. When the bad block number of a partition
@@ -211,7 +218,7 @@ static struct mtd_partition partition_info[] = {
 
 
 /* Define max reserved bad blocks for each partition.
- * This is used by the mtdblock-jz.c NAND FTL driver only.
+ * This is used by the nandftl.c NAND FTL driver only.
  *
  * The NAND FTL driver reserves some good blocks which can't be
  * seen by the upper layer. When the bad block number of a partition
@@ -228,8 +235,7 @@ static int partition_reserved_badblocks[] = {
 					     20};	/* reserved blocks of mtd5 */
 #endif /* CONFIG_JZ4720_VIRGO */
 /*-------------------------------------------------------------------------
- * Following three functions are exported and used by the mtdblock-jz.c
- * NAND FTL driver only.
+ * Following functions are exported for the NAND FTL drivers only.
  */
 
 unsigned short get_mtdblock_write_verify_enable(void)
@@ -253,8 +259,173 @@ int *get_jz_badblock_table(void)
 }
 EXPORT_SYMBOL(get_jz_badblock_table);
 
+int get_jz_badblock_table_size(void)
+{
+	return ARRAY_SIZE(partition_reserved_badblocks);
+}
+EXPORT_SYMBOL(get_jz_badblock_table_size);
+
 /*-------------------------------------------------------------------------*/
 
+#ifdef CONFIG_MTD_NAND_JZ4740_STATS
+struct jz_nand_latency {
+	unsigned long count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+static struct {
+	struct jz_nand_latency read;
+	struct jz_nand_latency program;
+	unsigned long dma_xfers;
+	unsigned long pio_xfers;
+} nand_stats;
+
+#define NAND_STAT_INC(f)	(nand_stats.f++)
+#else
+#define NAND_STAT_INC(f)	do { } while (0)
+#endif
+
+/*
+ * Data transfers. Page data goes through an auto-request DMA channel
+ * when we have one; OOB and other short transfers, and buffers outside
+ * KSEG0 or not word aligned, are done by the CPU.
+ */
+static void jz_nand_pio_read(struct nand_chip *chip, u_char *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = readb(chip->IO_ADDR_R);
+	NAND_STAT_INC(pio_xfers);
+}
+
+static void jz_nand_pio_write(struct nand_chip *chip, const u_char *buf,
+			      int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		writeb(buf[i], chip->IO_ADDR_W);
+	NAND_STAT_INC(pio_xfers);
+}
+
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+
+#define NAND_DMA_MIN		256	/* shorter transfers use PIO */
+#define NAND_DMA_TIMEOUT	(HZ / 10)
+
+static int nand_dma_chan = -1;
+static DECLARE_COMPLETION(nand_dma_done);
+
+static irqreturn_t jz_nand_dma_irq(int irq, void *dev_id)
+{
+	int chan = nand_dma_chan;
+
+	disable_dma(chan);
+
+	if (__dmac_channel_address_error_detected(chan)) {
+		printk("NAND: DMA address error\n");
+		__dmac_channel_clear_address_error(chan);
+	}
+	if (__dmac_channel_transmit_end_detected(chan))
+		__dmac_channel_clear_transmit_end(chan);
+
+	complete(&nand_dma_done);
+	return IRQ_HANDLED;
+}
+
+/*
+ * Start moving len bytes between buf and the data port. Returns 0 when
+ * the transfer is running, nonzero when the caller has to use PIO.
+ */
+static int jz_nand_dma_start(struct nand_chip *chip, const u_char *buf,
+			     int len, int write)
+{
+	unsigned long addr = (unsigned long)buf;
+	int chan = nand_dma_chan;
+	u32 dcmd;
+	int unit;
+
+	if (chan < 0 || len < NAND_DMA_MIN || KSEGX(addr) != KSEG0)
+		return -1;
+
+	if (!(addr & 31) && !(len & 31)) {
+		dcmd = DMAC_DCMD_DS_32BYTE;
+		unit = 32;
+	} else if (!(addr & 3) && !(len & 3)) {
+		dcmd = DMAC_DCMD_DS_32BIT;
+		unit = 4;
+	} else
+		return -1;
+
+	INIT_COMPLETION(nand_dma_done);
+
+	if (write) {
+		dma_cache_wback(addr, len);
+		REG_DMAC_DSAR(chan) = CPHYSADDR(addr);
+		REG_DMAC_DTAR(chan) = CPHYSADDR((unsigned long)chip->IO_ADDR_W);
+		dcmd |= DMAC_DCMD_SAI | DMAC_DCMD_SWDH_32 | DMAC_DCMD_DWDH_8;
+	} else {
+		dma_cache_wback_inv(addr, len);
+		REG_DMAC_DSAR(chan) = CPHYSADDR((unsigned long)chip->IO_ADDR_R);
+		REG_DMAC_DTAR(chan) = CPHYSADDR(addr);
+		dcmd |= DMAC_DCMD_DAI | DMAC_DCMD_SWDH_8 | DMAC_DCMD_DWDH_32;
+	}
+
+	REG_DMAC_DTCR(chan) = len / unit;
+	REG_DMAC_DRSR(chan) = DMAC_DRSR_RS_AUTO;
+	REG_DMAC_DCMD(chan) = dcmd | DMAC_DCMD_RDIL_IGN | DMAC_DCMD_TIE;
+
+	enable_dma(chan);
+	REG_DMAC_DMACR = DMAC_DMACR_DMAE; /* global DMA enable bit */
+
+	NAND_STAT_INC(dma_xfers);
+	return 0;
+}
+
+static void jz_nand_dma_wait(void)
+{
+	if (!wait_for_completion_timeout(&nand_dma_done, NAND_DMA_TIMEOUT)) {
+		/* Leave the page to the ECC, the data has been consumed */
+		disable_dma(nand_dma_chan);
+		printk("NAND: DMA timeout\n");
+	}
+}
+
+#else /* !CONFIG_MTD_NAND_JZ4740_DMA */
+
+static inline int jz_nand_dma_start(struct nand_chip *chip, const u_char *buf,
+				    int len, int write)
+{
+	return -1;
+}
+
+static inline void jz_nand_dma_wait(void) { }
+
+#endif /* CONFIG_MTD_NAND_JZ4740_DMA */
+
+static void jz_nand_read_buf(struct mtd_info *mtd, u_char *buf, int len)
+{
+	struct nand_chip *chip = mtd->priv;
+
+	if (!jz_nand_dma_start(chip, buf, len, 0))
+		jz_nand_dma_wait();
+	else
+		jz_nand_pio_read(chip, buf, len);
+}
+
+static void jz_nand_write_buf(struct mtd_info *mtd, const u_char *buf,
+			      int len)
+{
+	struct nand_chip *chip = mtd->priv;
+
+	if (!jz_nand_dma_start(chip, buf, len, 1))
+		jz_nand_dma_wait();
+	else
+		jz_nand_pio_write(chip, buf, len);
+}
+
 static void jz_hwcontrol(struct mtd_info *mtd, int dat, 
 			 unsigned int ctrl)
 {
@@ -422,8 +593,35 @@ static int jzsoc_nand_hm_correct_data(struct mtd_info *mtd, u_char *dat,
 
 #ifdef CONFIG_MTD_HW_RS_ECC
 
+#ifdef CONFIG_MTD_NAND_JZ4740_SWRS
+/*
+ * Who does the RS work:
+ *  0 - the ECC controller
+ *  1 - the controller, with its parity checked against the software model
+ *  2 - software only, the controller is left off
+ */
+static int rs_mode;
+module_param(rs_mode, int, 0444);
+MODULE_PARM_DESC(rs_mode, "RS ECC: 0 hardware, 1 hardware verified by software, 2 software");
+
+static void jzsoc_nand_rs_verify(const u_char *dat, const u_char *ecc_code)
+{
+	static unsigned long mismatches;
+	u_char sw_ecc[PAR_SIZE];
+
+	jz4740_rs_calculate(dat, sw_ecc);
+	if (memcmp(sw_ecc, ecc_code, PAR_SIZE) && printk_ratelimit())
+		printk("NAND: RS software parity differs from hardware (%lu)\n",
+		       ++mismatches);
+}
+#endif
+
 static void jzsoc_nand_enable_rs_hwecc(struct mtd_info* mtd, int mode)
 {
+#ifdef CONFIG_MTD_NAND_JZ4740_SWRS
+	if (rs_mode == 2)
+		return;
+#endif
 	REG_EMC_NFINTS = 0x0;
  	__nand_ecc_enable();
 	__nand_select_rs_ecc();
@@ -462,6 +660,17 @@ static int jzsoc_nand_rs_correct_data(struct mtd_info *mtd, u_char *dat,
 	short k;
 	u32 stat;
 
+#ifdef CONFIG_MTD_NAND_JZ4740_SWRS
+	if (rs_mode == 2) {
+		k = jz4740_rs_correct(dat, read_ecc);
+		if (k < 0) {
+			printk("NAND: Uncorrectable ECC error\n");
+			return -1;
+		}
+		return 0;
+	}
+#endif
+
 	/* Set PAR values */
 	for (k = 0; k < PAR_SIZE; k++) {
 		*paraddr++ = read_ecc[k];
@@ -513,6 +722,13 @@ static int jzsoc_nand_calculate_rs_ecc(struct mtd_info* mtd, const u_char* dat,
 	volatile u8 *paraddr = (volatile u8 *)EMC_NFPAR0;
 	short i;
 
+#ifdef CONFIG_MTD_NAND_JZ4740_SWRS
+	if (rs_mode == 2) {
+		jz4740_rs_calculate(dat, ecc_code);
+		return 0;
+	}
+#endif
+
 	__nand_ecc_encode_sync(); 
 	__nand_ecc_disable();
 
@@ -520,15 +736,181 @@ static int jzsoc_nand_calculate_rs_ecc(struct mtd_info* mtd, const u_char* dat,
 		ecc_code[i] = *paraddr++;			
 	}
 
+#ifdef CONFIG_MTD_NAND_JZ4740_SWRS
+	if (rs_mode == 1)
+		jzsoc_nand_rs_verify(dat, ecc_code);
+#endif
+
 	return 0;
 }
 
 #endif /* CONFIG_MTD_HW_RS_ECC */
 
+#if defined(CONFIG_MTD_NAND_JZ4740_SWRS) && defined(CONFIG_MTD_NAND_JZ4740_DMA)
 /*
- * Main initialization routine
+ * Page read for rs_mode 2. Same flow as nand_read_page_hwecc_rs(), but
+ * with the decoder in software the DMA of the next step can run while
+ * we correct this one. The ECC controller decodes the data as it passes
+ * the port, so with it in use the steps have to stay sequential.
  */
-int __init jznand_init(void)
+static int jz_nand_read_page_swrs(struct mtd_info *mtd, struct nand_chip *chip,
+				  uint8_t *buf)
+{
+	int i, eccsize = chip->ecc.size;
+	int eccbytes = chip->ecc.bytes;
+	int eccsteps = chip->ecc.steps;
+	uint8_t *p = buf;
+	uint8_t *ecc_code = chip->buffers->ecccode;
+	uint32_t *eccpos = chip->ecc.layout->eccpos;
+	uint32_t page;
+	uint8_t flag = 0;
+	int busy;
+
+	page = (buf[3]<<24) + (buf[2]<<16) + (buf[1]<<8) + buf[0];
+
+	chip->cmdfunc(mtd, NAND_CMD_READOOB, 0, page);
+	chip->read_buf(mtd, chip->oob_poi, mtd->oobsize);
+	for (i = 0; i < chip->ecc.total; i++) {
+		ecc_code[i] = chip->oob_poi[eccpos[i]];
+		if (ecc_code[i] != 0xff) flag = 1;
+	}
+
+	chip->cmdfunc(mtd, NAND_CMD_READ0, 0x00, page);
+
+	/*
+	 * A correction dirties cache lines of the step just read, they must
+	 * not be shared with the step the DMA is writing.
+	 */
+	busy = !((unsigned long)buf & 31) &&
+		!jz_nand_dma_start(chip, p, eccsize, 0);
+
+	for (i = 0; eccsteps; eccsteps--, i += eccbytes, p += eccsize) {
+		int stat;
+
+		if (busy)
+			jz_nand_dma_wait();
+		else
+			chip->read_buf(mtd, p, eccsize);
+
+		busy = eccsteps > 1 && !((unsigned long)buf & 31) &&
+			!jz_nand_dma_start(chip, p + eccsize, eccsize, 0);
+
+		if (flag) {
+			stat = chip->ecc.correct(mtd, p, &ecc_code[i], NULL);
+			if (stat < 0)
+				mtd->ecc_stats.failed++;
+			else
+				mtd->ecc_stats.corrected += stat;
+		}
+	}
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_MTD_NAND_JZ4740_STATS
+static int (*jz_nand_read_page_hw)(struct mtd_info *mtd,
+				   struct nand_chip *chip, uint8_t *buf);
+static int (*jz_nand_write_page_hw)(struct mtd_info *mtd,
+				    struct nand_chip *chip, const uint8_t *buf,
+				    int page, int cached, int raw);
+static struct dentry *jz_nand_debugfs_dir, *jz_nand_debugfs_stats;
+
+static void jz_nand_account(struct jz_nand_latency *l, ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	l->count++;
+	l->total_ns += ns;
+	if (ns > l->max_ns)
+		l->max_ns = ns;
+}
+
+static int jz_nand_read_page_timed(struct mtd_info *mtd,
+				   struct nand_chip *chip, uint8_t *buf)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = jz_nand_read_page_hw(mtd, chip, buf);
+	jz_nand_account(&nand_stats.read, start);
+	return ret;
+}
+
+static int jz_nand_write_page_timed(struct mtd_info *mtd,
+				    struct nand_chip *chip, const uint8_t *buf,
+				    int page, int cached, int raw)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = jz_nand_write_page_hw(mtd, chip, buf, page, cached, raw);
+	jz_nand_account(&nand_stats.program, start);
+	return ret;
+}
+
+static void jz_nand_show_latency(struct seq_file *m, const char *name,
+				 struct jz_nand_latency *l)
+{
+	u64 avg = l->total_ns;
+
+	if (l->count)
+		do_div(avg, l->count);
+	seq_printf(m, "%-9s %10lu  avg %8llu ns  max %8llu ns\n", name,
+		   l->count, (unsigned long long)avg,
+		   (unsigned long long)l->max_ns);
+}
+
+static int jz_nand_stats_show(struct seq_file *m, void *v)
+{
+	jz_nand_show_latency(m, "read", &nand_stats.read);
+	jz_nand_show_latency(m, "program", &nand_stats.program);
+	seq_printf(m, "dma       %10lu\n", nand_stats.dma_xfers);
+	seq_printf(m, "pio       %10lu\n", nand_stats.pio_xfers);
+	return 0;
+}
+
+static int jz_nand_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, jz_nand_stats_show, NULL);
+}
+
+static ssize_t jz_nand_stats_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	memset(&nand_stats, 0, sizeof(nand_stats));
+	return count;
+}
+
+static const struct file_operations jz_nand_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= jz_nand_stats_open,
+	.read		= seq_read,
+	.write		= jz_nand_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void jz_nand_stats_init(struct nand_chip *this)
+{
+	jz_nand_read_page_hw = this->ecc.read_page;
+	this->ecc.read_page = jz_nand_read_page_timed;
+	jz_nand_write_page_hw = this->write_page;
+	this->write_page = jz_nand_write_page_timed;
+
+	jz_nand_debugfs_dir = debugfs_create_dir("jz4740_nand", NULL);
+	if (jz_nand_debugfs_dir)
+		jz_nand_debugfs_stats = debugfs_create_file("stats", S_IRUGO | S_IWUSR,
+				    jz_nand_debugfs_dir, NULL,
+				    &jz_nand_stats_fops);
+}
+#endif /* CONFIG_MTD_NAND_JZ4740_STATS */
+
+/*
+ * Probe and register the chip.  The bad block scan reads the OOB of every
+ * block, which takes a good part of a second on a big chip, so this runs
+ * asynchronously; users of the partitions wait with async_synchronize_full().
+ */
+static int __init jznand_probe(void)
 {
 	struct nand_chip *this;
 	int nr_partitions;
@@ -559,6 +941,15 @@ int __init jznand_init(void)
         this->IO_ADDR_W = (void __iomem *) NAND_DATA_PORT;
         this->cmd_ctrl = jz_hwcontrol;
         this->dev_ready = jz_device_ready;
+	this->read_buf = jz_nand_read_buf;
+	this->write_buf = jz_nand_write_buf;
+
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+	nand_dma_chan = jz_request_dma(DMA_ID_AUTO, "nand", jz_nand_dma_irq,
+				       IRQF_DISABLED, NULL);
+	if (nand_dma_chan < 0)
+		printk("NAND: no DMA channel, using PIO\n");
+#endif
 
 #ifdef CONFIG_MTD_HW_HM_ECC
 	this->ecc.calculate = jzsoc_nand_calculate_hm_ecc;
@@ -577,6 +968,17 @@ int __init jznand_init(void)
 	this->ecc.mode      = NAND_ECC_HW;
 	this->ecc.size      = 512;
 	this->ecc.bytes     = 9;
+
+#ifdef CONFIG_MTD_NAND_JZ4740_SWRS
+	if (rs_mode && jz4740_rs_init()) {
+		printk("NAND: no memory for software RS, using hardware only\n");
+		rs_mode = 0;
+	}
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+	if (rs_mode == 2)
+		this->ecc.read_page = jz_nand_read_page_swrs;
+#endif
+#endif
 #endif
 
 #ifdef  CONFIG_MTD_SW_HM_ECC	
@@ -587,16 +989,43 @@ int __init jznand_init(void)
 
 	/* Scan to find existance of the device */
 	if (nand_scan(jz_mtd, 1)) {
+#ifdef CONFIG_MTD_NAND_JZ4740_SWRS
+		jz4740_rs_exit();
+#endif
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+		if (nand_dma_chan >= 0)
+			jz_free_dma(nand_dma_chan);
+#endif
 		kfree (jz_mtd);
+		jz_mtd = NULL;
 		return -ENXIO;
 	}
 
+#ifdef CONFIG_MTD_NAND_JZ4740_STATS
+	jz_nand_stats_init(this);
+#endif
+
 	/* Register the partitions */
 	nr_partitions = sizeof(partition_info) / sizeof(struct mtd_partition);
 	add_mtd_partitions(jz_mtd, partition_info, nr_partitions);
 
 	return 0;
 }
+
+static void __init jznand_probe_async(void *data, async_cookie_t cookie)
+{
+	if (jznand_probe())
+		printk("NAND: JzSOC NAND probe failed\n");
+}
+
+/*
+ * Main initialization routine
+ */
+int __init jznand_init(void)
+{
+	async_schedule(jznand_probe_async, NULL);
+	return 0;
+}
 module_init(jznand_init);
 
 /*
@@ -607,15 +1036,32 @@ static void __exit jznand_cleanup(void)
 {
 	struct nand_chip *this = (struct nand_chip *) &jz_mtd[1];
 
+	if (!jz_mtd)
+		return;
+
 	/* Unregister partitions */
 	del_mtd_partitions(jz_mtd);
 	
 	/* Unregister the device */
 	del_mtd_device (jz_mtd);
 
+#ifdef CONFIG_MTD_NAND_JZ4740_STATS
+	debugfs_remove(jz_nand_debugfs_stats);
+	debugfs_remove(jz_nand_debugfs_dir);
+#endif
+
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+	if (nand_dma_chan >= 0)
+		jz_free_dma(nand_dma_chan);
+#endif
+
 	/* Free internal data buffers */
 	kfree (this->data_buf);
 
+#ifdef CONFIG_MTD_NAND_JZ4740_SWRS
+	jz4740_rs_exit();
+#endif
+
 	/* Free the MTD device structure */
 	kfree (jz_mtd);
 }
@@ -0,0 +1,164 @@
+/*
+ * linux/drivers/mtd/nand/jz4740_rs.c
+ *
+ * Software model of the JZ4740 NAND controller Reed-Solomon ECC
+ *
+ * The controller protects every 512 byte step with an RS code over
+ * GF(2^9) (field polynomial x^9 + x^4 + 1) with 8 parity symbols, which
+ * corrects up to 4 symbol errors. The data is taken as a stream of 9 bit
+ * symbols, least significant bit first, so the last of the 456 data
+ * symbols only holds bit 7 of byte 511. The 8 parity symbols are packed
+ * the same way into the 9 ECC bytes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/rslib.h>
+#include <linux/mtd/jz4740_rs.h>
+
+#define RS_SYMSIZE	9
+#define RS_GFPOLY	0x211
+#define RS_FCR		1
+#define RS_PRIM		1
+#define RS_NROOTS	8
+#define RS_SYMMASK	((1 << RS_SYMSIZE) - 1)
+
+/* 4096 data bits in 9 bit symbols */
+#define RS_DATA_SYMS	((JZ4740_RS_STEP * 8 + RS_SYMSIZE - 1) / RS_SYMSIZE)
+
+static struct rs_control *jz4740_rs;
+
+/* Symbol buffers are too big for the stack, the NAND layer serialises us anyway */
+static DEFINE_SPINLOCK(jz4740_rs_lock);
+static uint16_t rs_data[RS_DATA_SYMS];
+static uint16_t rs_par[RS_NROOTS];
+static uint16_t rs_corr[RS_NROOTS];
+static int rs_errloc[RS_NROOTS];
+
+/*
+ * Split len bytes into nsyms symbols. Once the bytes run out the
+ * remaining bits are zero.
+ */
+static void jz4740_rs_unpack(const u_char *buf, int len, uint16_t *sym,
+			     int nsyms)
+{
+	u32 acc = 0;
+	int bits = 0;
+	int i;
+
+	for (i = 0; i < nsyms; i++) {
+		while (bits < RS_SYMSIZE) {
+			if (len > 0) {
+				acc |= (u32)*buf++ << bits;
+				len--;
+			}
+			bits += 8;
+		}
+		sym[i] = acc & RS_SYMMASK;
+		acc >>= RS_SYMSIZE;
+		bits -= RS_SYMSIZE;
+	}
+}
+
+static void jz4740_rs_pack(const uint16_t *sym, int nsyms, u_char *buf)
+{
+	u32 acc = 0;
+	int bits = 0;
+	int i;
+
+	for (i = 0; i < nsyms; i++) {
+		acc |= (u32)sym[i] << bits;
+		bits += RS_SYMSIZE;
+		while (bits >= 8) {
+			*buf++ = acc & 0xff;
+			acc >>= 8;
+			bits -= 8;
+		}
+	}
+	if (bits)
+		*buf = acc & 0xff;
+}
+
+/* Same bit placement as the controller's error index/mask reports */
+static void jz4740_rs_fix(u_char *dat, int sym, uint16_t mask)
+{
+	int i = sym + (sym >> 3);
+	u32 m = (u32)mask << (sym & 0x7);
+
+	if (i >= JZ4740_RS_STEP)
+		return;
+
+	dat[i] ^= m & 0xff;
+	if (i < JZ4740_RS_STEP - 1)
+		dat[i + 1] ^= (m >> 8) & 0xff;
+}
+
+void jz4740_rs_calculate(const u_char *dat, u_char *ecc_code)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&jz4740_rs_lock, flags);
+
+	jz4740_rs_unpack(dat, JZ4740_RS_STEP, rs_data, RS_DATA_SYMS);
+	memset(rs_par, 0, sizeof(rs_par));
+	encode_rs16(jz4740_rs, rs_data, RS_DATA_SYMS, rs_par, 0);
+	jz4740_rs_pack(rs_par, RS_NROOTS, ecc_code);
+
+	spin_unlock_irqrestore(&jz4740_rs_lock, flags);
+}
+EXPORT_SYMBOL_GPL(jz4740_rs_calculate);
+
+int jz4740_rs_correct(u_char *dat, const u_char *read_ecc)
+{
+	unsigned long flags;
+	int count, i;
+
+	spin_lock_irqsave(&jz4740_rs_lock, flags);
+
+	jz4740_rs_unpack(dat, JZ4740_RS_STEP, rs_data, RS_DATA_SYMS);
+	jz4740_rs_unpack(read_ecc, JZ4740_RS_BYTES, rs_par, RS_NROOTS);
+	memset(rs_corr, 0, sizeof(rs_corr));
+
+	count = decode_rs16(jz4740_rs, rs_data, rs_par, RS_DATA_SYMS, NULL, 0,
+			    rs_errloc, 0, rs_corr);
+
+	/* Errors in the parity symbols need no fixing up */
+	for (i = 0; i < count; i++)
+		if (rs_errloc[i] < RS_DATA_SYMS)
+			jz4740_rs_fix(dat, rs_errloc[i], rs_corr[i]);
+
+	spin_unlock_irqrestore(&jz4740_rs_lock, flags);
+
+	return count < 0 ? -EBADMSG : count;
+}
+EXPORT_SYMBOL_GPL(jz4740_rs_correct);
+
+int jz4740_rs_init(void)
+{
+	/* init_rs() shares and refcounts identical codecs */
+	jz4740_rs = init_rs(RS_SYMSIZE, RS_GFPOLY, RS_FCR, RS_PRIM, RS_NROOTS);
+	if (!jz4740_rs)
+		return -ENOMEM;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(jz4740_rs_init);
+
+void jz4740_rs_exit(void)
+{
+	if (jz4740_rs)
+		free_rs(jz4740_rs);
+	jz4740_rs = NULL;
+}
+EXPORT_SYMBOL_GPL(jz4740_rs_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("JZ4740 NAND Reed-Solomon ECC software model");
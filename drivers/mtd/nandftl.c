@@ -0,0 +1,1231 @@
+/*
+ * nandftl.c -- log-structured flash translation layer for NAND
+ *
+ * Presents NAND partitions as block devices with 512 byte sectors, for
+ * FAT and the other file systems which expect to overwrite sectors in
+ * place. It is an open alternative to the JZ mtdblock-jz driver, which
+ * is only available as an object file.
+ *
+ * The disk is mapped a NAND page at a time. Pages are never rewritten in
+ * place: every write goes to the next free page of the current "head"
+ * eraseblock, with a tag in the free OOB bytes naming the logical page and
+ * a sequence number. Blocks are filled strictly in sequence number order,
+ * so replaying tags in that order rebuilds the map.
+ *
+ * When the device is closed the RAM map is written out as a checkpoint,
+ * together with the erase counters. Attaching then reads the first tag of
+ * each block, the checkpoint, and only the blocks written after it. If
+ * there is no usable checkpoint every written page is scanned.
+ *
+ * Garbage collection picks the block with the fewest valid pages, and new
+ * blocks are the free ones with the lowest erase count, which spreads the
+ * wear over all blocks taking writes. Blocks which fail to program or erase
+ * are marked bad. The spare blocks for that are the per-partition reserve
+ * declared by the JZ NAND drivers, or 2% of the partition elsewhere.
+ *
+ * Partitions are only used when asked for, e.g. nandftl.mtd=3, as the
+ * first write destroys whatever else is on them.
+ */
+
+#include <linux/hdreg.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mtd/blktrans.h>
+#include <linux/mtd/mtd.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/sort.h>
+#include <linux/crc32.h>
+
+#include <asm/byteorder.h>
+
+static int ftl_mtds[MAX_MTD_DEVICES];
+static unsigned int ftl_nr_mtds;
+module_param_array_named(mtd, ftl_mtds, int, &ftl_nr_mtds, 0444);
+MODULE_PARM_DESC(mtd, "MTD device numbers to use, e.g. mtd=3,5");
+
+#define PREFIX "nandftl: "
+
+/* From the block device range for local/experimental use */
+#ifndef NAND_FTL_MAJOR
+#define NAND_FTL_MAJOR		240
+#endif
+
+#define SECTOR_SIZE		512
+#define SECTOR_SHIFT		9
+
+#define FTL_NONE		0xffffffff	/* no page, no block */
+#define FTL_CKPT_PAGE		0x80000000	/* tag of a checkpoint page */
+#define FTL_CKPT_MAGIC		0x6e66746c	/* "nftl" */
+
+/* Free blocks which only the garbage collector may use */
+#define FTL_GC_RESERVE		2
+
+/* Percentage of blocks kept out of the disk, to keep GC cheap */
+#define FTL_OVERPROVISION	5
+
+/*
+ * Stored in the free OOB bytes of every page written. The sequence number
+ * grows with every page programmed and never wraps in the life of a chip.
+ */
+struct ftl_tag {
+	__le32 lpn;
+	__le32 seq;
+	__le32 crc;
+} __attribute__((packed));
+
+/*
+ * The checkpoint is this header followed by the map and the erase
+ * counters, all little endian 32 bit words, over as many pages as it
+ * takes. Each page is tagged FTL_CKPT_PAGE | page index, all with the
+ * sequence number of the checkpoint.
+ */
+struct ftl_ckpt_hdr {
+	__le32 magic;
+	__le32 seq;
+	__le32 nr_lpn;
+	__le32 nr_blocks;
+	__le32 head;
+	__le32 head_page;
+	__le32 crc;		/* of the map and erase counters */
+	__le32 hdr_crc;
+};
+
+#define CKPT_HDR_WORDS		(sizeof(struct ftl_ckpt_hdr) / 4)
+
+enum {
+	BLOCK_FREE,
+	BLOCK_DATA,
+	BLOCK_CKPT,
+	BLOCK_NEW_CKPT,
+	BLOCK_BAD
+};
+
+#define BLOCK_DIRTY		0x01	/* free, but must be erased first */
+#define BLOCK_RETIRE		0x02	/* program failed, move data off */
+
+struct ftl_block {
+	u32 erases;
+	u32 seq;		/* tag of the first page, at attach time */
+	u32 first;
+	u16 valid;		/* pages the map points to */
+	u8 state;
+	u8 flags;
+};
+
+struct nandftl {
+	struct mtd_blktrans_dev mbd;
+
+	u_int page_size;
+	u_int page_shift;
+	u_int sect_per_page;
+	u_int pages_per_block;
+	u_int nr_blocks;
+	u_int nr_lpn;			/* logical pages on the disk */
+	u_int free_blocks;
+
+	u32 *map;			/* logical page to physical page */
+	struct ftl_block *blocks;
+
+	u32 head;			/* block being written */
+	u_int head_page;		/* next free page in it */
+	u32 seq;			/* sequence number of the next page */
+	int ckpt_dirty;			/* changed since the last checkpoint */
+
+	u8 *wbuf;			/* page being assembled from sectors */
+	u32 wbuf_lpn;
+	u32 wbuf_mask;			/* sectors of wbuf written */
+	u8 *rbuf;			/* last page read */
+	u32 rbuf_ppn;
+	u8 *gcbuf;
+
+	/* For working out write amplification; printed on removal */
+	unsigned long host_sectors;
+	unsigned long host_pages;
+	unsigned long gc_pages;
+	unsigned long erases;
+};
+
+#if defined(CONFIG_MTD_NAND_JZ4740) || defined(CONFIG_MTD_NAND_JZ4730)
+extern int *get_jz_badblock_table(void);
+extern int get_jz_badblock_table_size(void);
+#endif
+
+static u_int ftl_reserved_blocks(struct mtd_info *mtd, u_int nr_blocks)
+{
+#if defined(CONFIG_MTD_NAND_JZ4740) || defined(CONFIG_MTD_NAND_JZ4730)
+	if (mtd->index < get_jz_badblock_table_size())
+		return get_jz_badblock_table()[mtd->index];
+#endif
+	return max_t(u_int, 2, nr_blocks / 50);
+}
+
+static inline u32 ftl_full_mask(struct nandftl *ftl)
+{
+	return ~0U >> (32 - ftl->sect_per_page);
+}
+
+static inline loff_t ftl_page_addr(struct nandftl *ftl, u32 ppn)
+{
+	return (loff_t)ppn << ftl->page_shift;
+}
+
+static void ftl_set_state(struct nandftl *ftl, u32 block, int state)
+{
+	struct ftl_block *blk = &ftl->blocks[block];
+
+	if (blk->state == BLOCK_FREE)
+		ftl->free_blocks--;
+	if (state == BLOCK_FREE)
+		ftl->free_blocks++;
+	blk->state = state;
+}
+
+/*
+ * Tags
+ */
+
+static u32 ftl_tag_crc(struct ftl_tag *tag)
+{
+	return crc32(FTL_CKPT_MAGIC, tag, offsetof(struct ftl_tag, crc));
+}
+
+enum { TAG_VALID, TAG_ERASED, TAG_GARBAGE };
+
+static int ftl_read_tag(struct nandftl *ftl, u32 ppn, struct ftl_tag *tag)
+{
+	struct mtd_info *mtd = ftl->mbd.mtd;
+	struct mtd_oob_ops ops;
+	int ret;
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.len = 0;
+	ops.datbuf = NULL;
+	ops.ooblen = sizeof(*tag);
+	ops.ooboffs = 0;
+	ops.oobbuf = (u8 *)tag;
+
+	ret = mtd->read_oob(mtd, ftl_page_addr(ftl, ppn), &ops);
+	if ((ret && ret != -EUCLEAN) || ops.oobretlen != sizeof(*tag))
+		return TAG_GARBAGE;
+
+	if (tag->lpn == cpu_to_le32(0xffffffff) &&
+	    tag->seq == cpu_to_le32(0xffffffff) &&
+	    tag->crc == cpu_to_le32(0xffffffff))
+		return TAG_ERASED;
+	if (le32_to_cpu(tag->crc) != ftl_tag_crc(tag))
+		return TAG_GARBAGE;
+	return TAG_VALID;
+}
+
+/*
+ * Flash access
+ */
+
+static int ftl_read_page(struct nandftl *ftl, u32 ppn, u8 *buf)
+{
+	struct mtd_info *mtd = ftl->mbd.mtd;
+	size_t retlen;
+	int ret;
+
+	ret = mtd->read(mtd, ftl_page_addr(ftl, ppn), ftl->page_size,
+			&retlen, buf);
+	if (ret == -EUCLEAN)
+		ret = 0;
+	if (!ret && retlen != ftl->page_size)
+		ret = -EIO;
+	if (ret)
+		printk(KERN_WARNING PREFIX "mtd%d: read error %d at page %u\n",
+		       mtd->index, ret, ppn);
+	return ret;
+}
+
+static int ftl_program(struct nandftl *ftl, u32 ppn, const u8 *buf,
+		       u32 lpn, u32 seq)
+{
+	struct mtd_info *mtd = ftl->mbd.mtd;
+	struct mtd_oob_ops ops;
+	struct ftl_tag tag;
+	int ret;
+
+	tag.lpn = cpu_to_le32(lpn);
+	tag.seq = cpu_to_le32(seq);
+	tag.crc = cpu_to_le32(ftl_tag_crc(&tag));
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.len = ftl->page_size;
+	ops.datbuf = (u8 *)buf;
+	ops.ooblen = sizeof(tag);
+	ops.ooboffs = 0;
+	ops.oobbuf = (u8 *)&tag;
+
+	ret = mtd->write_oob(mtd, ftl_page_addr(ftl, ppn), &ops);
+	if (!ret && ops.retlen != ftl->page_size)
+		ret = -EIO;
+	return ret;
+}
+
+static void ftl_mark_bad(struct nandftl *ftl, u32 block)
+{
+	struct mtd_info *mtd = ftl->mbd.mtd;
+
+	printk(KERN_WARNING PREFIX "mtd%d: marking block %u bad\n",
+	       mtd->index, block);
+	if (mtd->block_markbad)
+		mtd->block_markbad(mtd, (loff_t)block * mtd->erasesize);
+	ftl_set_state(ftl, block, BLOCK_BAD);
+}
+
+static void ftl_erase_callback(struct erase_info *erase)
+{
+	wake_up((wait_queue_head_t *)erase->priv);
+}
+
+static int ftl_erase_block(struct nandftl *ftl, u32 block)
+{
+	struct mtd_info *mtd = ftl->mbd.mtd;
+	struct ftl_block *blk = &ftl->blocks[block];
+	struct erase_info erase;
+	DECLARE_WAITQUEUE(wait, current);
+	wait_queue_head_t wait_q;
+	int ret;
+
+	if (ftl->rbuf_ppn != FTL_NONE &&
+	    ftl->rbuf_ppn / ftl->pages_per_block == block)
+		ftl->rbuf_ppn = FTL_NONE;
+
+	init_waitqueue_head(&wait_q);
+	memset(&erase, 0, sizeof(erase));
+	erase.mtd = mtd;
+	erase.callback = ftl_erase_callback;
+	erase.addr = block * mtd->erasesize;
+	erase.len = mtd->erasesize;
+	erase.priv = (u_long)&wait_q;
+
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	add_wait_queue(&wait_q, &wait);
+
+	ret = mtd->erase(mtd, &erase);
+	if (!ret)
+		schedule();  /* Wait for erase to finish. */
+	else
+		set_current_state(TASK_RUNNING);
+	remove_wait_queue(&wait_q, &wait);
+
+	if (!ret && erase.state != MTD_ERASE_DONE)
+		ret = -EIO;
+
+	ftl->erases++;
+	ftl->ckpt_dirty = 1;
+	if (ret) {
+		printk(KERN_WARNING PREFIX "mtd%d: erase error %d at block %u\n",
+		       mtd->index, ret, block);
+		ftl_mark_bad(ftl, block);
+		return ret;
+	}
+
+	blk->erases++;
+	blk->valid = 0;
+	blk->flags = 0;
+	ftl_set_state(ftl, block, BLOCK_FREE);
+	return 0;
+}
+
+/*
+ * Take the free block with the lowest erase count.
+ */
+static u32 ftl_alloc_block(struct nandftl *ftl, int state)
+{
+	u32 b, best;
+
+	do {
+		best = FTL_NONE;
+		for (b = 0; b < ftl->nr_blocks; b++) {
+			if (ftl->blocks[b].state != BLOCK_FREE)
+				continue;
+			if (best == FTL_NONE ||
+			    ftl->blocks[b].erases < ftl->blocks[best].erases)
+				best = b;
+		}
+		if (best == FTL_NONE)
+			return FTL_NONE;
+	} while ((ftl->blocks[best].flags & BLOCK_DIRTY) &&
+		 ftl_erase_block(ftl, best));
+
+	ftl_set_state(ftl, best, state);
+	return best;
+}
+
+/*
+ * Writing and garbage collection
+ */
+
+static int ftl_gc(struct nandftl *ftl);
+
+static int ftl_collect(struct nandftl *ftl, u_int want)
+{
+	u_int tries = 0;
+	int ret;
+
+	while (ftl->free_blocks < want) {
+		if (++tries > ftl->nr_blocks)
+			return -ENOSPC;
+		ret = ftl_gc(ftl);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int ftl_new_head(struct nandftl *ftl, int gc)
+{
+	u32 block;
+	int ret;
+
+	ftl->head = FTL_NONE;
+
+	/* The collector itself runs on the reserve */
+	if (!gc) {
+		ret = ftl_collect(ftl, FTL_GC_RESERVE + 1);
+		if (ret)
+			return ret;
+	}
+
+	block = ftl_alloc_block(ftl, BLOCK_DATA);
+	if (block == FTL_NONE)
+		return -ENOSPC;
+
+	ftl->head = block;
+	ftl->head_page = 0;
+	return 0;
+}
+
+static int ftl_write_page(struct nandftl *ftl, u32 lpn, const u8 *buf,
+			  int gc)
+{
+	u_int tries = 0;
+	u32 ppn, old;
+	int ret;
+
+	/*
+	 * Power loss while collecting can leave us short of the reserve.
+	 * Top it up before the head fills, while the interrupted victim
+	 * still fits in it.
+	 */
+	if (!gc && ftl->free_blocks < FTL_GC_RESERVE) {
+		ret = ftl_collect(ftl, FTL_GC_RESERVE + 1);
+		if (ret)
+			return ret;
+	}
+
+	while (1) {
+		if (ftl->head == FTL_NONE ||
+		    ftl->head_page == ftl->pages_per_block) {
+			ret = ftl_new_head(ftl, gc);
+			if (ret)
+				return ret;
+		}
+
+		ppn = ftl->head * ftl->pages_per_block + ftl->head_page++;
+		ret = ftl_program(ftl, ppn, buf, lpn, ftl->seq++);
+		if (!ret)
+			break;
+
+		printk(KERN_WARNING PREFIX "mtd%d: write error %d at page %u\n",
+		       ftl->mbd.mtd->index, ret, ppn);
+		if (++tries > 3)
+			return ret;
+
+		/* The collector moves what is left and marks it bad */
+		ftl->blocks[ftl->head].flags |= BLOCK_RETIRE;
+		ftl->head = FTL_NONE;
+	}
+
+	old = ftl->map[lpn];
+	if (old != FTL_NONE)
+		ftl->blocks[old / ftl->pages_per_block].valid--;
+	ftl->map[lpn] = ppn;
+	ftl->blocks[ppn / ftl->pages_per_block].valid++;
+	ftl->ckpt_dirty = 1;
+
+	if (gc)
+		ftl->gc_pages++;
+	else
+		ftl->host_pages++;
+	return 0;
+}
+
+static int ftl_move_page(struct nandftl *ftl, u32 lpn, u32 ppn)
+{
+	int ret;
+
+	ret = ftl_read_page(ftl, ppn, ftl->gcbuf);
+	if (ret) {
+		/* Nothing better to do than to forget it */
+		printk(KERN_ERR PREFIX "mtd%d: lost logical page %u\n",
+		       ftl->mbd.mtd->index, lpn);
+		ftl->map[lpn] = FTL_NONE;
+		ftl->blocks[ppn / ftl->pages_per_block].valid--;
+		ftl->ckpt_dirty = 1;
+		return 0;
+	}
+	return ftl_write_page(ftl, lpn, ftl->gcbuf, 1);
+}
+
+static int ftl_gc(struct nandftl *ftl)
+{
+	u_int ppb = ftl->pages_per_block;
+	struct ftl_block *blk;
+	struct ftl_tag tag;
+	u32 b, victim = FTL_NONE;
+	u32 lpn, ppn;
+	u_int page, room = ppb;
+	int ret;
+
+	/*
+	 * Without a free block the victim has to fit in the head. Power
+	 * loss in the middle of collecting can leave us there, but then
+	 * what is left of the interrupted victim always fits.
+	 */
+	if (!ftl->free_blocks)
+		room = ftl->head == FTL_NONE ? 0 : ppb - ftl->head_page;
+
+	for (b = 0; b < ftl->nr_blocks; b++) {
+		blk = &ftl->blocks[b];
+		if (blk->state != BLOCK_DATA || b == ftl->head ||
+		    blk->valid > room)
+			continue;
+		if (blk->flags & BLOCK_RETIRE) {
+			victim = b;
+			break;
+		}
+		if (victim == FTL_NONE || blk->valid < ftl->blocks[victim].valid)
+			victim = b;
+	}
+	if (victim == FTL_NONE)
+		return -ENOSPC;
+
+	blk = &ftl->blocks[victim];
+	if (blk->valid == ppb && !(blk->flags & BLOCK_RETIRE))
+		return -ENOSPC;
+
+	DEBUG(MTD_DEBUG_LEVEL1, PREFIX "collecting block %u, %u valid\n",
+	      victim, blk->valid);
+
+	for (page = 0; page < ppb && blk->valid; page++) {
+		ppn = victim * ppb + page;
+		if (ftl_read_tag(ftl, ppn, &tag) != TAG_VALID)
+			continue;
+		lpn = le32_to_cpu(tag.lpn);
+		if (lpn >= ftl->nr_lpn || ftl->map[lpn] != ppn)
+			continue;
+		ret = ftl_move_page(ftl, lpn, ppn);
+		if (ret)
+			return ret;
+	}
+
+	/* Tags we could not read; find what is left from the map instead */
+	for (lpn = 0; lpn < ftl->nr_lpn && blk->valid; lpn++) {
+		ppn = ftl->map[lpn];
+		if (ppn == FTL_NONE || ppn / ppb != victim)
+			continue;
+		ret = ftl_move_page(ftl, lpn, ppn);
+		if (ret)
+			return ret;
+	}
+
+	if (blk->flags & BLOCK_RETIRE)
+		ftl_mark_bad(ftl, victim);
+	else
+		ftl_erase_block(ftl, victim);
+	return 0;
+}
+
+/*
+ * Sectors are gathered into wbuf until a sector of another page is
+ * written; what was not written is then filled in from the old copy.
+ */
+static int ftl_flush_wbuf(struct nandftl *ftl)
+{
+	u32 lpn = ftl->wbuf_lpn;
+	u32 ppn;
+	u_int i;
+	int ret;
+
+	if (lpn == FTL_NONE)
+		return 0;
+
+	if (ftl->wbuf_mask != ftl_full_mask(ftl)) {
+		ppn = ftl->map[lpn];
+		if (ppn != FTL_NONE && ftl->rbuf_ppn != ppn) {
+			ftl->rbuf_ppn = FTL_NONE;
+			ret = ftl_read_page(ftl, ppn, ftl->rbuf);
+			if (ret)
+				goto out;
+			ftl->rbuf_ppn = ppn;
+		}
+		for (i = 0; i < ftl->sect_per_page; i++) {
+			u8 *sect = ftl->wbuf + (i << SECTOR_SHIFT);
+
+			if (ftl->wbuf_mask & (1U << i))
+				continue;
+			if (ppn == FTL_NONE)
+				memset(sect, 0, SECTOR_SIZE);
+			else
+				memcpy(sect, ftl->rbuf + (i << SECTOR_SHIFT),
+				       SECTOR_SIZE);
+		}
+	}
+
+	ret = ftl_write_page(ftl, lpn, ftl->wbuf, 0);
+out:
+	ftl->wbuf_lpn = FTL_NONE;
+	return ret;
+}
+
+/*
+ * Checkpoints
+ */
+
+static inline u_int ftl_ckpt_words(struct nandftl *ftl)
+{
+	return CKPT_HDR_WORDS + ftl->nr_lpn + ftl->nr_blocks;
+}
+
+/* Word @w of the map and erase counters, following the header */
+static __le32 ftl_ckpt_word(struct nandftl *ftl, u_int w)
+{
+	if (w < ftl->nr_lpn)
+		return cpu_to_le32(ftl->map[w]);
+	return cpu_to_le32(ftl->blocks[w - ftl->nr_lpn].erases);
+}
+
+static void ftl_ckpt_abort(struct nandftl *ftl)
+{
+	u32 b;
+
+	for (b = 0; b < ftl->nr_blocks; b++) {
+		if (ftl->blocks[b].state != BLOCK_NEW_CKPT)
+			continue;
+		ftl->blocks[b].flags |= BLOCK_DIRTY;
+		ftl_set_state(ftl, b, BLOCK_FREE);
+	}
+}
+
+static int ftl_write_ckpt(struct nandftl *ftl)
+{
+	struct mtd_info *mtd = ftl->mbd.mtd;
+	u_int wpp = ftl->page_size / 4;
+	u_int words = ftl_ckpt_words(ftl);
+	u_int pages = DIV_ROUND_UP(words, wpp);
+	u_int nr = DIV_ROUND_UP(pages, ftl->pages_per_block);
+	struct ftl_ckpt_hdr hdr;
+	__le32 *buf = (__le32 *)ftl->gcbuf;
+	u_int i, w, p;
+	u32 b, seq, crc;
+	__le32 word;
+	int ret;
+
+	if (!ftl->ckpt_dirty)
+		return 0;
+
+	/* Leave the reserve to the collector */
+	ret = ftl_collect(ftl, nr + FTL_GC_RESERVE);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nr; i++) {
+		if (ftl_alloc_block(ftl, BLOCK_NEW_CKPT) == FTL_NONE) {
+			ftl_ckpt_abort(ftl);
+			return -ENOSPC;
+		}
+	}
+
+	/* Only now are the erase counters final */
+	crc = ~0;
+	for (w = 0; w < words - CKPT_HDR_WORDS; w++) {
+		word = ftl_ckpt_word(ftl, w);
+		crc = crc32(crc, &word, 4);
+	}
+
+	seq = ftl->seq++;
+	hdr.magic = cpu_to_le32(FTL_CKPT_MAGIC);
+	hdr.seq = cpu_to_le32(seq);
+	hdr.nr_lpn = cpu_to_le32(ftl->nr_lpn);
+	hdr.nr_blocks = cpu_to_le32(ftl->nr_blocks);
+	hdr.head = cpu_to_le32(ftl->head);
+	hdr.head_page = cpu_to_le32(ftl->head_page);
+	hdr.crc = cpu_to_le32(crc);
+	hdr.hdr_crc = cpu_to_le32(crc32(~0, &hdr,
+					offsetof(struct ftl_ckpt_hdr, hdr_crc)));
+
+	/* The checkpoint blocks are used in order of block number */
+	b = 0;
+	for (p = 0; p < pages; p++) {
+		if (p % ftl->pages_per_block == 0)
+			while (ftl->blocks[b].state != BLOCK_NEW_CKPT)
+				b++;
+
+		for (i = 0; i < wpp; i++) {
+			w = p * wpp + i;
+			if (w < CKPT_HDR_WORDS)
+				buf[i] = ((__le32 *)&hdr)[w];
+			else if (w < words)
+				buf[i] = ftl_ckpt_word(ftl, w - CKPT_HDR_WORDS);
+			else
+				buf[i] = cpu_to_le32(0xffffffff);
+		}
+
+		ret = ftl_program(ftl, b * ftl->pages_per_block +
+				  p % ftl->pages_per_block, ftl->gcbuf,
+				  FTL_CKPT_PAGE | p, seq);
+		if (ret) {
+			printk(KERN_WARNING PREFIX "mtd%d: checkpoint write "
+			       "error %d\n", mtd->index, ret);
+			ftl_mark_bad(ftl, b);
+			ftl_ckpt_abort(ftl);
+			return ret;
+		}
+		/* Remaining pages of the block go unused */
+		if (p % ftl->pages_per_block == ftl->pages_per_block - 1)
+			b++;
+	}
+
+	/* Committed; the old checkpoint is erased when the block is reused */
+	for (b = 0; b < ftl->nr_blocks; b++) {
+		if (ftl->blocks[b].state == BLOCK_CKPT) {
+			ftl->blocks[b].flags |= BLOCK_DIRTY;
+			ftl_set_state(ftl, b, BLOCK_FREE);
+		} else if (ftl->blocks[b].state == BLOCK_NEW_CKPT)
+			ftl_set_state(ftl, b, BLOCK_CKPT);
+	}
+
+	DEBUG(MTD_DEBUG_LEVEL1, PREFIX "mtd%d: checkpoint %u, %u pages\n",
+	      mtd->index, seq, pages);
+	ftl->ckpt_dirty = 0;
+	return 0;
+}
+
+static u32 ftl_find_ckpt_block(struct nandftl *ftl, u32 seq, u32 first)
+{
+	u32 b;
+
+	for (b = 0; b < ftl->nr_blocks; b++)
+		if (ftl->blocks[b].state == BLOCK_CKPT &&
+		    ftl->blocks[b].seq == seq && ftl->blocks[b].first == first)
+			return b;
+	return FTL_NONE;
+}
+
+static int ftl_load_ckpt(struct nandftl *ftl, u32 seq)
+{
+	u_int ppb = ftl->pages_per_block;
+	u_int wpp = ftl->page_size / 4;
+	u_int words = ftl_ckpt_words(ftl);
+	u_int pages = DIV_ROUND_UP(words, wpp);
+	struct ftl_ckpt_hdr hdr;
+	__le32 *buf = (__le32 *)ftl->gcbuf;
+	u_int i, w, p;
+	u32 b, val, crc = ~0;
+
+	for (p = 0; p < pages; p++) {
+		b = ftl_find_ckpt_block(ftl, seq,
+					FTL_CKPT_PAGE | (p - p % ppb));
+		if (b == FTL_NONE)
+			return -EINVAL;
+		if (ftl_read_page(ftl, b * ppb + p % ppb, ftl->gcbuf))
+			return -EIO;
+
+		i = 0;
+		if (p == 0) {
+			memcpy(&hdr, buf, sizeof(hdr));
+			if (le32_to_cpu(hdr.magic) != FTL_CKPT_MAGIC ||
+			    le32_to_cpu(hdr.hdr_crc) != crc32(~0, &hdr,
+				    offsetof(struct ftl_ckpt_hdr, hdr_crc)) ||
+			    le32_to_cpu(hdr.seq) != seq ||
+			    le32_to_cpu(hdr.nr_lpn) != ftl->nr_lpn ||
+			    le32_to_cpu(hdr.nr_blocks) != ftl->nr_blocks)
+				return -EINVAL;
+			i = CKPT_HDR_WORDS;
+		}
+
+		for (; i < wpp; i++) {
+			w = p * wpp + i - CKPT_HDR_WORDS;
+			if (w >= words - CKPT_HDR_WORDS)
+				break;
+			crc = crc32(crc, &buf[i], 4);
+			val = le32_to_cpu(buf[i]);
+			if (w < ftl->nr_lpn) {
+				if (val != FTL_NONE &&
+				    val >= ftl->nr_blocks * ppb)
+					return -EINVAL;
+				ftl->map[w] = val;
+			} else
+				ftl->blocks[w - ftl->nr_lpn].erases = val;
+		}
+	}
+
+	if (crc != le32_to_cpu(hdr.crc))
+		return -EINVAL;
+
+	ftl->head = le32_to_cpu(hdr.head);
+	ftl->head_page = le32_to_cpu(hdr.head_page);
+	if (ftl->head >= ftl->nr_blocks || ftl->head_page > ppb)
+		ftl->head = FTL_NONE;
+	return 0;
+}
+
+/*
+ * Attaching
+ */
+
+/* Apply the tags of @block from @page on; returns the first free page */
+static u_int ftl_replay_block(struct nandftl *ftl, u32 block, u_int page)
+{
+	u_int ppb = ftl->pages_per_block;
+	struct ftl_tag tag;
+	u32 lpn, seq;
+
+	for (; page < ppb; page++) {
+		switch (ftl_read_tag(ftl, block * ppb + page, &tag)) {
+		case TAG_ERASED:
+			return page;
+		case TAG_GARBAGE:
+			continue;
+		}
+
+		lpn = le32_to_cpu(tag.lpn);
+		seq = le32_to_cpu(tag.seq);
+		if (seq >= ftl->seq)
+			ftl->seq = seq + 1;
+		if (lpn < ftl->nr_lpn)
+			ftl->map[lpn] = block * ppb + page;
+	}
+	return page;
+}
+
+struct ftl_replay {
+	u32 seq;
+	u32 block;
+};
+
+static int ftl_replay_cmp(const void *a, const void *b)
+{
+	const struct ftl_replay *ra = a, *rb = b;
+
+	if (ra->seq == rb->seq)
+		return 0;
+	return ra->seq < rb->seq ? -1 : 1;
+}
+
+static int ftl_mount(struct nandftl *ftl)
+{
+	struct mtd_info *mtd = ftl->mbd.mtd;
+	u_int ppb = ftl->pages_per_block;
+	struct ftl_replay *replay;
+	struct ftl_block *blk;
+	struct ftl_tag tag;
+	u_int nr_replay = 0, nr_bad = 0, nr_foreign = 0, i;
+	u32 b, lpn, ppn;
+	u32 ckpt_seq = 0;
+	int have_ckpt = 0;
+
+	ftl->seq = 1;
+	ftl->head = FTL_NONE;
+
+	for (b = 0; b < ftl->nr_blocks; b++) {
+		blk = &ftl->blocks[b];
+		blk->state = BLOCK_FREE;
+		blk->flags = BLOCK_DIRTY;
+
+		if (mtd->block_isbad &&
+		    mtd->block_isbad(mtd, (loff_t)b * mtd->erasesize)) {
+			blk->state = BLOCK_BAD;
+			nr_bad++;
+			continue;
+		}
+
+		switch (ftl_read_tag(ftl, b * ppb, &tag)) {
+		case TAG_ERASED:
+			continue;
+		case TAG_GARBAGE:
+			nr_foreign++;
+			continue;
+		}
+
+		blk->seq = le32_to_cpu(tag.seq);
+		blk->first = le32_to_cpu(tag.lpn);
+		blk->state = blk->first & FTL_CKPT_PAGE ? BLOCK_CKPT : BLOCK_DATA;
+		if (blk->seq >= ftl->seq)
+			ftl->seq = blk->seq + 1;
+	}
+
+	/* Newest checkpoint which reads back whole */
+	while (1) {
+		have_ckpt = 0;
+		for (b = 0; b < ftl->nr_blocks; b++) {
+			blk = &ftl->blocks[b];
+			if (blk->state != BLOCK_CKPT)
+				continue;
+			if (!have_ckpt || blk->seq > ckpt_seq)
+				ckpt_seq = blk->seq;
+			have_ckpt = 1;
+		}
+		if (!have_ckpt || !ftl_load_ckpt(ftl, ckpt_seq))
+			break;
+
+		printk(KERN_WARNING PREFIX "mtd%d: checkpoint %u unusable\n",
+		       mtd->index, ckpt_seq);
+		memset(ftl->map, 0xff, ftl->nr_lpn * sizeof(u32));
+		for (b = 0; b < ftl->nr_blocks; b++) {
+			blk = &ftl->blocks[b];
+			blk->erases = 0;
+			if (blk->state == BLOCK_CKPT && blk->seq == ckpt_seq)
+				blk->state = BLOCK_FREE;
+		}
+		ftl->head = FTL_NONE;
+	}
+
+	for (b = 0; b < ftl->nr_blocks; b++) {
+		blk = &ftl->blocks[b];
+		if (blk->state == BLOCK_CKPT && blk->seq != ckpt_seq)
+			blk->state = BLOCK_FREE;
+		else if (blk->state == BLOCK_CKPT || blk->state == BLOCK_DATA)
+			blk->flags = 0;
+	}
+
+	/* Replay whatever was written after the checkpoint, oldest first */
+	replay = vmalloc(ftl->nr_blocks * sizeof(*replay));
+	if (!replay)
+		return -ENOMEM;
+
+	for (b = 0; b < ftl->nr_blocks; b++) {
+		blk = &ftl->blocks[b];
+		if (blk->state != BLOCK_DATA ||
+		    (have_ckpt && blk->seq <= ckpt_seq))
+			continue;
+		replay[nr_replay].seq = blk->seq;
+		replay[nr_replay].block = b;
+		nr_replay++;
+	}
+	sort(replay, nr_replay, sizeof(*replay), ftl_replay_cmp, NULL);
+
+	if (ftl->head != FTL_NONE) {
+		blk = &ftl->blocks[ftl->head];
+		if (blk->state == BLOCK_DATA && blk->seq <= ckpt_seq)
+			ftl->head_page = ftl_replay_block(ftl, ftl->head,
+							  ftl->head_page);
+		else
+			ftl->head = FTL_NONE;
+	}
+	for (i = 0; i < nr_replay; i++) {
+		ftl->head = replay[i].block;
+		ftl->head_page = ftl_replay_block(ftl, ftl->head, 0);
+	}
+	vfree(replay);
+
+	if (ftl->head != FTL_NONE && ftl->head_page == ppb)
+		ftl->head = FTL_NONE;
+
+	/* Valid page counts follow from the map */
+	for (lpn = 0; lpn < ftl->nr_lpn; lpn++) {
+		ppn = ftl->map[lpn];
+		if (ppn == FTL_NONE)
+			continue;
+		blk = &ftl->blocks[ppn / ppb];
+		if (blk->state != BLOCK_DATA) {
+			ftl->map[lpn] = FTL_NONE;
+			continue;
+		}
+		blk->valid++;
+	}
+
+	ftl->free_blocks = 0;
+	for (b = 0; b < ftl->nr_blocks; b++)
+		if (ftl->blocks[b].state == BLOCK_FREE)
+			ftl->free_blocks++;
+
+	ftl->ckpt_dirty = !have_ckpt || nr_replay;
+
+	if (have_ckpt)
+		printk(KERN_INFO PREFIX "mtd%d: checkpoint %u, %u blocks "
+		       "replayed, %u bad\n", mtd->index, ckpt_seq, nr_replay,
+		       nr_bad);
+	else if (nr_replay)
+		printk(KERN_INFO PREFIX "mtd%d: no checkpoint, scanned %u "
+		       "blocks, %u bad\n", mtd->index, nr_replay, nr_bad);
+	else if (nr_foreign)
+		printk(KERN_NOTICE PREFIX "mtd%d: no FTL found, %u blocks of "
+		       "other data will be erased on use\n", mtd->index,
+		       nr_foreign);
+
+	if (nr_bad > ftl_reserved_blocks(mtd, ftl->nr_blocks))
+		printk(KERN_WARNING PREFIX "mtd%d: %u bad blocks, more than "
+		       "the %u reserved\n", mtd->index, nr_bad,
+		       ftl_reserved_blocks(mtd, ftl->nr_blocks));
+	return 0;
+}
+
+static int ftl_init(struct nandftl *ftl)
+{
+	struct mtd_info *mtd = ftl->mbd.mtd;
+	u_int ckpt_pages, ckpt_blocks, spare;
+
+	ftl->page_size = mtd->writesize;
+	ftl->page_shift = ffs(mtd->writesize) - 1;
+	ftl->sect_per_page = mtd->writesize >> SECTOR_SHIFT;
+	ftl->pages_per_block = mtd->erasesize >> ftl->page_shift;
+	ftl->nr_blocks = mtd->size / mtd->erasesize;
+
+	/* Two checkpoints may be on flash while a new one is written */
+	ckpt_pages = DIV_ROUND_UP(CKPT_HDR_WORDS + ftl->nr_blocks *
+				  (ftl->pages_per_block + 1),
+				  ftl->page_size / 4);
+	ckpt_blocks = DIV_ROUND_UP(ckpt_pages, ftl->pages_per_block);
+
+	spare = ftl_reserved_blocks(mtd, ftl->nr_blocks) + 2 * ckpt_blocks +
+		FTL_GC_RESERVE + 1 + ftl->nr_blocks * FTL_OVERPROVISION / 100;
+	if (spare >= ftl->nr_blocks) {
+		printk(KERN_WARNING PREFIX "mtd%d: too small, need more "
+		       "than %u blocks\n", mtd->index, spare);
+		return -EINVAL;
+	}
+	ftl->nr_lpn = (ftl->nr_blocks - spare) * ftl->pages_per_block;
+
+	ftl->map = vmalloc(ftl->nr_lpn * sizeof(u32));
+	ftl->blocks = vmalloc(ftl->nr_blocks * sizeof(struct ftl_block));
+	ftl->wbuf = kmalloc(ftl->page_size, GFP_KERNEL);
+	ftl->rbuf = kmalloc(ftl->page_size, GFP_KERNEL);
+	ftl->gcbuf = kmalloc(ftl->page_size, GFP_KERNEL);
+	if (!ftl->map || !ftl->blocks || !ftl->wbuf || !ftl->rbuf ||
+	    !ftl->gcbuf)
+		return -ENOMEM;
+
+	memset(ftl->map, 0xff, ftl->nr_lpn * sizeof(u32));
+	memset(ftl->blocks, 0, ftl->nr_blocks * sizeof(struct ftl_block));
+	ftl->wbuf_lpn = FTL_NONE;
+	ftl->rbuf_ppn = FTL_NONE;
+
+	return ftl_mount(ftl);
+}
+
+static void ftl_free(struct nandftl *ftl)
+{
+	vfree(ftl->map);
+	vfree(ftl->blocks);
+	kfree(ftl->wbuf);
+	kfree(ftl->rbuf);
+	kfree(ftl->gcbuf);
+	kfree(ftl);
+}
+
+/*
+ * Block device interface
+ */
+
+static int nandftl_readsect(struct mtd_blktrans_dev *dev,
+			    unsigned long block, char *buf)
+{
+	struct nandftl *ftl = (struct nandftl *)dev;
+	u_int sect = block & (ftl->sect_per_page - 1);
+	u32 lpn = block >> (ftl->page_shift - SECTOR_SHIFT);
+	u32 ppn;
+
+	if (lpn >= ftl->nr_lpn)
+		return -EIO;
+
+	if (lpn == ftl->wbuf_lpn && (ftl->wbuf_mask & (1U << sect))) {
+		memcpy(buf, ftl->wbuf + (sect << SECTOR_SHIFT), SECTOR_SIZE);
+		return 0;
+	}
+
+	ppn = ftl->map[lpn];
+	if (ppn == FTL_NONE) {
+		memset(buf, 0, SECTOR_SIZE);
+		return 0;
+	}
+
+	if (ftl->rbuf_ppn != ppn) {
+		ftl->rbuf_ppn = FTL_NONE;
+		if (ftl_read_page(ftl, ppn, ftl->rbuf))
+			return -EIO;
+		ftl->rbuf_ppn = ppn;
+	}
+	memcpy(buf, ftl->rbuf + (sect << SECTOR_SHIFT), SECTOR_SIZE);
+	return 0;
+}
+
+static int nandftl_writesect(struct mtd_blktrans_dev *dev,
+			     unsigned long block, char *buf)
+{
+	struct nandftl *ftl = (struct nandftl *)dev;
+	u_int sect = block & (ftl->sect_per_page - 1);
+	u32 lpn = block >> (ftl->page_shift - SECTOR_SHIFT);
+	int ret;
+
+	if (lpn >= ftl->nr_lpn)
+		return -EIO;
+
+	if (lpn != ftl->wbuf_lpn) {
+		ret = ftl_flush_wbuf(ftl);
+		if (ret)
+			return ret;
+		ftl->wbuf_lpn = lpn;
+		ftl->wbuf_mask = 0;
+	}
+
+	memcpy(ftl->wbuf + (sect << SECTOR_SHIFT), buf, SECTOR_SIZE);
+	ftl->wbuf_mask |= 1U << sect;
+	ftl->host_sectors++;
+
+	if (ftl->wbuf_mask == ftl_full_mask(ftl))
+		return ftl_flush_wbuf(ftl);
+	return 0;
+}
+
+static int nandftl_flush(struct mtd_blktrans_dev *dev)
+{
+	struct nandftl *ftl = (struct nandftl *)dev;
+	struct mtd_info *mtd = dev->mtd;
+	int ret;
+
+	mutex_lock(&dev->lock);
+	ret = ftl_flush_wbuf(ftl);
+	if (mtd->sync)
+		mtd->sync(mtd);
+	mutex_unlock(&dev->lock);
+	return ret;
+}
+
+static int nandftl_release(struct mtd_blktrans_dev *dev)
+{
+	struct nandftl *ftl = (struct nandftl *)dev;
+	struct mtd_info *mtd = dev->mtd;
+	int ret;
+
+	mutex_lock(&dev->lock);
+	ret = ftl_flush_wbuf(ftl);
+	if (!ret && !dev->readonly)
+		ftl_write_ckpt(ftl);
+	if (mtd->sync)
+		mtd->sync(mtd);
+	mutex_unlock(&dev->lock);
+
+	/* Failing the release would leak the references open took */
+	if (ret)
+		printk(KERN_ERR PREFIX "mtd%d: data lost on close, error %d\n",
+		       mtd->index, ret);
+	return 0;
+}
+
+static int nandftl_getgeo(struct mtd_blktrans_dev *dev,
+			  struct hd_geometry *geo)
+{
+	geo->heads = 4;
+	geo->sectors = 16;
+	geo->cylinders = dev->size / (4 * 16);
+	return 0;
+}
+
+static int ftl_wanted(struct mtd_info *mtd)
+{
+	int i;
+
+	for (i = 0; i < ftl_nr_mtds; i++)
+		if (ftl_mtds[i] == mtd->index)
+			return 1;
+	return 0;
+}
+
+static void nandftl_add_mtd(struct mtd_blktrans_ops *tr, struct mtd_info *mtd)
+{
+	struct nandftl *ftl;
+
+	if (mtd->type != MTD_NANDFLASH || !ftl_wanted(mtd))
+		return;
+
+	/* A page must fit in wbuf_mask */
+	if (mtd->writesize < SECTOR_SIZE || mtd->writesize > 32 * SECTOR_SIZE ||
+	    !mtd->read_oob || !mtd->write_oob ||
+	    mtd->oobavail < sizeof(struct ftl_tag)) {
+		printk(KERN_WARNING PREFIX "mtd%d: need pages of 512 bytes to "
+		       "16 KiB, with %zu free OOB bytes\n", mtd->index,
+		       sizeof(struct ftl_tag));
+		return;
+	}
+
+	ftl = kzalloc(sizeof(struct nandftl), GFP_KERNEL);
+	if (!ftl)
+		return;
+
+	ftl->mbd.mtd = mtd;
+	ftl->mbd.devnum = mtd->index;
+	ftl->mbd.tr = tr;
+
+	if (ftl_init(ftl))
+		goto out;
+
+	ftl->mbd.size = ftl->nr_lpn * ftl->sect_per_page;
+	if (!(mtd->flags & MTD_WRITEABLE))
+		ftl->mbd.readonly = 1;
+
+	printk(KERN_INFO PREFIX "mtd%d: \"%s\", %u KiB disk\n", mtd->index,
+	       mtd->name, ftl->nr_lpn * (ftl->page_size >> 10));
+
+	if (!add_mtd_blktrans_dev(&ftl->mbd))
+		return;
+out:
+	ftl_free(ftl);
+}
+
+static void nandftl_remove_dev(struct mtd_blktrans_dev *dev)
+{
+	struct nandftl *ftl = (struct nandftl *)dev;
+
+	del_mtd_blktrans_dev(dev);
+
+	if (!dev->readonly && !ftl_flush_wbuf(ftl))
+		ftl_write_ckpt(ftl);
+
+	printk(KERN_INFO PREFIX "mtd%d: %lu sectors written, %lu pages "
+	       "programmed, %lu by GC, %lu erases\n", dev->mtd->index,
+	       ftl->host_sectors, ftl->host_pages + ftl->gc_pages,
+	       ftl->gc_pages, ftl->erases);
+	ftl_free(ftl);
+}
+
+static struct mtd_blktrans_ops nandftl_tr = {
+	.name		= "nandftl",
+	.major		= NAND_FTL_MAJOR,
+	.part_bits	= 0,
+	.blksize 	= SECTOR_SIZE,
+
+	.readsect	= nandftl_readsect,
+	.writesect	= nandftl_writesect,
+	.flush		= nandftl_flush,
+	.release	= nandftl_release,
+	.getgeo		= nandftl_getgeo,
+	.add_mtd	= nandftl_add_mtd,
+	.remove_dev	= nandftl_remove_dev,
+	.owner		= THIS_MODULE,
+};
+
+static int __init init_nandftl(void)
+{
+	return register_mtd_blktrans(&nandftl_tr);
+}
+
+static void __exit cleanup_nandftl(void)
+{
+	deregister_mtd_blktrans(&nandftl_tr);
+}
+
+module_init(init_nandftl);
+module_exit(cleanup_nandftl);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Log-structured flash translation layer for NAND");
@@ -42,6 +42,7 @@
 #include <linux/miscdevice.h>
 #include <linux/log2.h>
 #include <linux/kthread.h>
+#include <linux/async.h>
 #include "ubi.h"
 
 /* Maximum length of the 'mtd=' parameter */
@@ -549,19 +550,22 @@ static void uif_close(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * If the device has a fastmap, only the fastmap and the physical eraseblocks
+ * of its pool are read. Full media scanning is the fall-back attaching method
+ * if there is no fastmap or if it is corrupted.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
 	int err;
 	struct ubi_scan_info *si;
 
-	si = ubi_scan(ubi);
-	if (IS_ERR(si))
+	si = ubi_scan_fastmap(ubi);
+	if (!si)
+		si = ubi_scan(ubi);
+	if (IS_ERR(si)) {
+		ubi_fastmap_close(ubi);
 		return PTR_ERR(si);
+	}
 
 	ubi->bad_peb_count = si->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
@@ -580,14 +584,21 @@ static int attach_by_scanning(struct ubi_device *ubi)
 	if (err)
 		goto out_wl;
 
+	err = ubi_fastmap_init(ubi, si);
+	if (err)
+		goto out_eba;
+
 	ubi_scan_destroy_si(si);
 	return 0;
 
+out_eba:
+	ubi_eba_close(ubi);
 out_wl:
 	ubi_wl_close(ubi);
 out_vtbl:
 	vfree(ubi->vtbl);
 out_si:
+	ubi_fastmap_close(ubi);
 	ubi_scan_destroy_si(si);
 	return err;
 }
@@ -873,6 +884,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->ckvol_mutex);
 	mutex_init(&ubi->volumes_mutex);
 	spin_lock_init(&ubi->volumes_lock);
+	init_rwsem(&ubi->fm_sem);
+	mutex_init(&ubi->fm_mutex);
 
 	dbg_msg("attaching mtd%d to ubi%d: VID header offset %d",
 		mtd->index, ubi_num, vid_hdr_offset);
@@ -952,6 +965,7 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 out_uif:
 	uif_close(ubi);
 out_detach:
+	ubi_fastmap_close(ubi);
 	ubi_eba_close(ubi);
 	ubi_wl_close(ubi);
 	vfree(ubi->vtbl);
@@ -1007,14 +1021,28 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	ubi_assert(ubi_num == ubi->ubi_num);
 	dbg_msg("detaching mtd%d from ubi%d", ubi->mtd->index, ubi_num);
 
+	/*
+	 * Save the final state, so that the next attach is fast. This has to
+	 * be done while the background thread is still alive, because writing
+	 * the fastmap schedules erasures of the old fastmap blocks.
+	 */
+	if (ubi->fm_enabled && !ubi->ro_mode)
+		ubi_update_fastmap(ubi);
+
 	/*
 	 * Before freeing anything, we have to stop the background thread to
 	 * prevent it from doing anything on this device while we are freeing.
+	 * Nobody may wake it up once it is gone; the works which are still
+	 * queued are cancelled by 'ubi_wl_close()'.
 	 */
+	spin_lock(&ubi->wl_lock);
+	ubi->thread_enabled = 0;
+	spin_unlock(&ubi->wl_lock);
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
 	uif_close(ubi);
+	ubi_fastmap_close(ubi);
 	ubi_eba_close(ubi);
 	ubi_wl_close(ubi);
 	vfree(ubi->vtbl);
@@ -1096,6 +1124,10 @@ static int __init ubi_init(void)
 	if (!ubi_wl_entry_slab)
 		goto out_dev_unreg;
 
+	/* The MTD devices may still be being probed asynchronously */
+	if (mtd_devs)
+		async_synchronize_full();
+
 	/* Attach MTD devices */
 	for (i = 0; i < mtd_devs; i++) {
 		struct mtd_dev_param *p = &mtd_dev_param[i];
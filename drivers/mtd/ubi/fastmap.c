@@ -0,0 +1,1047 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap unit.
+ *
+ * Attaching by scanning reads the EC and VID headers of every physical
+ * eraseblock, which takes time proportional to the flash size. The fastmap is
+ * a snapshot of the EBA tables and erase counters kept on the flash itself,
+ * so attaching only has to find and read it, and then scan the few physical
+ * eraseblocks which could have been written after the fastmap was.
+ *
+ * The snapshot is described by a super block (&struct ubi_fm_sb) stored in
+ * the anchor physical eraseblock, which is always one of the first
+ * %UBI_FM_MAX_START physical eraseblocks. The anchor and the other fastmap
+ * physical eraseblocks belong to "delete" compatible internal volumes, so
+ * implementations which do not know about fastmaps just erase them.
+ *
+ * For the fastmap to stay valid between two updates, the WL unit hands out
+ * physical eraseblocks only from a pool which is refilled, and recorded, each
+ * time the fastmap is written, and it does not erase physical eraseblocks the
+ * fastmap refers to as used until the next fastmap is written. The fastmap is
+ * written when the pool runs dry, when too many erasures have been held back,
+ * and when the device is detached.
+ *
+ * Whenever the fastmap does not look right, UBI falls back to full scanning,
+ * which drops the stale fastmap and writes a new one.
+ */
+
+#include <linux/crc32.h>
+#include <linux/bitops.h>
+#include "ubi.h"
+
+/* Minimum and maximum number of physical eraseblocks in the pool */
+#define FM_MIN_POOL_SIZE 8
+#define FM_MAX_POOL_SIZE 256
+
+/* States of physical eraseblocks while the fastmap is being built */
+enum {
+	FM_PEB_NONE = 0,
+	FM_PEB_FREE,
+	FM_PEB_POOL,
+	FM_PEB_USED,
+	FM_PEB_ERASE,
+	FM_PEB_FM,
+};
+
+/**
+ * fm_size - calculate the maximum size of a fastmap.
+ * @ubi: UBI device description object
+ */
+static int fm_size(const struct ubi_device *ubi)
+{
+	return sizeof(struct ubi_fm_sb) + sizeof(struct ubi_fm_hdr) +
+	       (UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) *
+	       sizeof(struct ubi_fm_volhdr) +
+	       FM_MAX_POOL_SIZE * sizeof(__be32) +
+	       ubi->peb_count * sizeof(struct ubi_fm_leb);
+}
+
+/**
+ * add_ec - account an erase counter in scanning information.
+ * @si: scanning information
+ * @ec: the erase counter
+ */
+static void add_ec(struct ubi_scan_info *si, int ec)
+{
+	if (ec == UBI_SCAN_UNKNOWN_EC)
+		return;
+
+	si->ec_sum += ec;
+	si->ec_count += 1;
+	if (ec > si->max_ec)
+		si->max_ec = ec;
+	if (ec < si->min_ec)
+		si->min_ec = ec;
+}
+
+/**
+ * find_anchor - find the newest fastmap anchor.
+ * @ubi: UBI device description object
+ * @vid_hdr: buffer to read VID headers to
+ * @stale: anchors which have been superseded are stored here
+ * @stale_count: how many elements of @stale are used is stored here
+ * @sqnum: sequence number of the anchor is stored here
+ *
+ * This function returns the anchor physical eraseblock number or %-ENOENT if
+ * there is no anchor.
+ */
+static int find_anchor(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr,
+		       int *stale, int *stale_count, unsigned long long *sqnum)
+{
+	int pnum, err, anchor = -ENOENT;
+	unsigned long long s;
+
+	*stale_count = 0;
+	for (pnum = 0; pnum < UBI_FM_MAX_START && pnum < ubi->peb_count;
+	     pnum++) {
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		s = be64_to_cpu(vid_hdr->sqnum);
+		dbg_bld("fastmap anchor at PEB %d, sqnum %llu", pnum, s);
+		if (anchor < 0) {
+			anchor = pnum;
+			*sqnum = s;
+		} else if (s > *sqnum) {
+			stale[(*stale_count)++] = anchor;
+			anchor = pnum;
+			*sqnum = s;
+		} else
+			stale[(*stale_count)++] = pnum;
+	}
+
+	return anchor;
+}
+
+/**
+ * read_fastmap - read the fastmap to a buffer.
+ * @ubi: UBI device description object
+ * @anchor: the anchor physical eraseblock
+ * @vid_hdr: buffer to read VID headers to
+ *
+ * This function returns a vmalloc'ed buffer containing the checked super
+ * block followed by the fastmap data, %NULL if there is no valid fastmap, or
+ * an error pointer.
+ */
+static void *read_fastmap(struct ubi_device *ubi, int anchor,
+			  struct ubi_vid_hdr *vid_hdr)
+{
+	int err, i, n, pnum, len, size;
+	struct ubi_fm_sb sb;
+	uint32_t crc;
+	void *buf;
+
+	err = ubi_io_read_data(ubi, &sb, anchor, 0, sizeof(struct ubi_fm_sb));
+	if (err && err != UBI_IO_BITFLIPS)
+		return NULL;
+
+	if (be32_to_cpu(sb.magic) != UBI_FM_SB_MAGIC ||
+	    sb.version != UBI_FM_FMT_VERSION) {
+		ubi_warn("bad fastmap super block at PEB %d", anchor);
+		return NULL;
+	}
+
+	crc = crc32(UBI_CRC32_INIT, &sb, UBI_FM_SB_SIZE_CRC);
+	if (crc != be32_to_cpu(sb.crc)) {
+		ubi_warn("bad fastmap super block CRC at PEB %d", anchor);
+		return NULL;
+	}
+
+	n = be32_to_cpu(sb.used_blocks);
+	size = sizeof(struct ubi_fm_sb) + be32_to_cpu(sb.data_size);
+	if (n < 1 || n > UBI_FM_MAX_BLOCKS ||
+	    be32_to_cpu(sb.block_loc[0]) != anchor ||
+	    be32_to_cpu(sb.data_size) < sizeof(struct ubi_fm_hdr) ||
+	    size > n * ubi->leb_size) {
+		ubi_warn("inconsistent fastmap super block at PEB %d", anchor);
+		return NULL;
+	}
+
+	buf = vmalloc(n * ubi->leb_size);
+	if (!buf)
+		return ERR_PTR(-ENOMEM);
+
+	for (i = 0; i < n; i++) {
+		pnum = be32_to_cpu(sb.block_loc[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			goto out_free;
+
+		if (i > 0) {
+			err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+			if (err && err != UBI_IO_BITFLIPS)
+				goto out_free;
+			if (be32_to_cpu(vid_hdr->vol_id) !=
+			    UBI_FM_DATA_VOLUME_ID ||
+			    be32_to_cpu(vid_hdr->lnum) != i)
+				goto out_free;
+		}
+
+		len = min_t(int, ubi->leb_size, size - i * ubi->leb_size);
+		if (len <= 0)
+			continue;
+
+		err = ubi_io_read_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+				       len);
+		if (err && err != UBI_IO_BITFLIPS)
+			goto out_free;
+	}
+
+	crc = crc32(UBI_CRC32_INIT, buf + sizeof(struct ubi_fm_sb),
+		    be32_to_cpu(sb.data_size));
+	if (crc != be32_to_cpu(sb.data_crc)) {
+		ubi_warn("bad fastmap data CRC");
+		goto out_free_nomsg;
+	}
+
+	memcpy(buf, &sb, sizeof(struct ubi_fm_sb));
+	return buf;
+
+out_free:
+	ubi_warn("cannot read fastmap block %d", i);
+out_free_nomsg:
+	vfree(buf);
+	return NULL;
+}
+
+/**
+ * take_peb - check a physical eraseblock number found in the fastmap.
+ * @ubi: UBI device description object
+ * @seen: physical eraseblocks the fastmap has already mentioned
+ * @pnum: the physical eraseblock number
+ *
+ * Returns zero if @pnum is valid and was not seen before, and %-EINVAL if not.
+ */
+static int take_peb(const struct ubi_device *ubi, uint8_t *seen, int pnum)
+{
+	if (pnum < 0 || pnum >= ubi->peb_count || seen[pnum]) {
+		ubi_warn("bad PEB %d in fastmap", pnum);
+		return -EINVAL;
+	}
+	seen[pnum] = 1;
+	return 0;
+}
+
+/**
+ * fm_ec - convert an on-flash fastmap erase counter.
+ * @ec: the on-flash erase counter
+ */
+static int fm_ec(__be32 ec)
+{
+	uint32_t e = be32_to_cpu(ec);
+
+	if (e > UBI_MAX_ERASECOUNTER)
+		return UBI_SCAN_UNKNOWN_EC;
+	return e;
+}
+
+/**
+ * parse_fastmap - build scanning information from a fastmap.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ * @buf: the fastmap (super block and data)
+ * @vid_hdr: buffer to use for the VID headers fed to the scanning unit
+ * @seen: zeroed array of @ubi->peb_count bytes
+ *
+ * This function returns zero in case of success, %-EINVAL if the fastmap is
+ * inconsistent and other negative error codes in case of failure.
+ */
+static int parse_fastmap(struct ubi_device *ubi, struct ubi_scan_info *si,
+			 void *buf, struct ubi_vid_hdr *vid_hdr, uint8_t *seen)
+{
+	struct ubi_fm_sb *sb = buf;
+	struct ubi_fm_hdr *hdr;
+	struct ubi_fm_volhdr *vh;
+	struct ubi_fm_leb *leb;
+	struct ubi_fm_ec *fec;
+	__be32 *pool_pebs;
+	int *pool = NULL;
+	int err, i, j, n, pnum, ec, vol_id, bad = 0, pos, end;
+	int vol_count, pool_count, free_count, erase_count;
+
+	end = sizeof(struct ubi_fm_sb) + be32_to_cpu(sb->data_size);
+	pos = sizeof(struct ubi_fm_sb);
+
+	for (i = 0; i < be32_to_cpu(sb->used_blocks); i++) {
+		err = take_peb(ubi, seen, be32_to_cpu(sb->block_loc[i]));
+		if (err)
+			return err;
+	}
+
+	hdr = buf + pos;
+	pos += sizeof(struct ubi_fm_hdr);
+	if (be32_to_cpu(hdr->magic) != UBI_FM_HDR_MAGIC)
+		goto out_inval;
+
+	vol_count = be32_to_cpu(hdr->vol_count);
+	pool_count = be32_to_cpu(hdr->pool_peb_count);
+	free_count = be32_to_cpu(hdr->free_peb_count);
+	erase_count = be32_to_cpu(hdr->erase_peb_count);
+	if (vol_count < 0 || vol_count > UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT ||
+	    pool_count < 0 || pool_count > FM_MAX_POOL_SIZE ||
+	    free_count < 0 || free_count > ubi->peb_count ||
+	    erase_count < 0 || erase_count > ubi->peb_count)
+		goto out_inval;
+
+	for (i = 0; i < vol_count; i++) {
+		vh = buf + pos;
+		pos += sizeof(struct ubi_fm_volhdr);
+		if (pos > end || be32_to_cpu(vh->magic) != UBI_FM_VHDR_MAGIC)
+			goto out_inval;
+
+		vol_id = be32_to_cpu(vh->vol_id);
+		n = be32_to_cpu(vh->leb_count);
+		if ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+		    vol_id != UBI_LAYOUT_VOLUME_ID)
+			goto out_inval;
+		if (vh->vol_type != UBI_VID_DYNAMIC &&
+		    vh->vol_type != UBI_VID_STATIC)
+			goto out_inval;
+		if (n < 0 || n > ubi->peb_count ||
+		    pos + n * sizeof(struct ubi_fm_leb) > end)
+			goto out_inval;
+
+		/*
+		 * The scanning unit wants VID headers. The fastmap knows
+		 * neither sequence numbers nor data CRCs, so zero sequence
+		 * numbers are used, which lose against any copy of the same
+		 * LEB found in the pool.
+		 */
+		memset(vid_hdr, 0, UBI_VID_HDR_SIZE);
+		vid_hdr->vol_type = vh->vol_type;
+		vid_hdr->compat = vh->compat;
+		vid_hdr->vol_id = vh->vol_id;
+		vid_hdr->data_pad = vh->data_pad;
+		vid_hdr->used_ebs = vh->used_ebs;
+		vid_hdr->data_size = vh->last_data_size;
+
+		for (j = 0; j < n; j++) {
+			leb = buf + pos;
+			pos += sizeof(struct ubi_fm_leb);
+
+			pnum = be32_to_cpu(leb->pnum);
+			err = take_peb(ubi, seen, pnum);
+			if (err)
+				return err;
+
+			ec = fm_ec(leb->ec);
+			vid_hdr->lnum = leb->lnum;
+			err = ubi_scan_add_used(ubi, si, pnum, ec, vid_hdr, 0);
+			if (err)
+				return err;
+			add_ec(si, ec);
+			__set_bit(pnum, ubi->fm_used);
+		}
+	}
+
+	if (pos + pool_count * sizeof(__be32) +
+	    (free_count + erase_count) * sizeof(struct ubi_fm_ec) != end)
+		goto out_inval;
+
+	pool = kmalloc((pool_count ? pool_count : 1) * sizeof(int),
+		       GFP_KERNEL);
+	if (!pool)
+		return -ENOMEM;
+
+	pool_pebs = buf + pos;
+	pos += pool_count * sizeof(__be32);
+	for (i = 0; i < pool_count; i++) {
+		pool[i] = be32_to_cpu(pool_pebs[i]);
+		err = take_peb(ubi, seen, pool[i]);
+		if (err)
+			goto out_pool;
+	}
+
+	for (i = 0; i < free_count + erase_count; i++) {
+		fec = buf + pos;
+		pos += sizeof(struct ubi_fm_ec);
+
+		pnum = be32_to_cpu(fec->pnum);
+		err = take_peb(ubi, seen, pnum);
+		if (err)
+			goto out_pool;
+
+		ec = fm_ec(fec->ec);
+		if (i < free_count && ec != UBI_SCAN_UNKNOWN_EC)
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->free);
+		else
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->erase);
+		if (err)
+			goto out_pool;
+		add_ec(si, ec);
+	}
+
+	/* Everything the fastmap does not mention has to be bad */
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (seen[pnum])
+			continue;
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			goto out_pool;
+		if (!err) {
+			ubi_warn("PEB %d is not in fastmap", pnum);
+			err = -EINVAL;
+			goto out_pool;
+		}
+		bad += 1;
+	}
+
+	if (bad != be32_to_cpu(hdr->bad_peb_count)) {
+		ubi_warn("fastmap has %d bad PEBs, but %d found",
+			 be32_to_cpu(hdr->bad_peb_count), bad);
+		err = -EINVAL;
+		goto out_pool;
+	}
+	si->bad_peb_count = bad;
+
+	dbg_bld("scan %d pool PEBs", pool_count);
+	err = ubi_scan_pebs(ubi, si, pool, pool_count);
+
+out_pool:
+	kfree(pool);
+	return err;
+
+out_inval:
+	ubi_warn("inconsistent fastmap data");
+	return -EINVAL;
+}
+
+/**
+ * ubi_scan_fastmap - attach using the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function looks for a fastmap and builds scanning information from it
+ * and from the physical eraseblocks in its pool. On success, the fastmap
+ * physical eraseblocks are stored in @ubi->fm_blocks, and the physical
+ * eraseblocks the fastmap refers to as used in @ubi->fm_used. Returns the
+ * scanning information, %NULL if there is no usable fastmap and full scanning
+ * is needed, or an error pointer.
+ */
+struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi)
+{
+	int err = -ENOMEM, anchor, i, n, stale_count;
+	int stale[UBI_FM_MAX_START];
+	unsigned long long sqnum = 0;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_scan_info *si = NULL;
+	struct ubi_scan_leb *seb, *tmp;
+	struct ubi_fm_sb *sb;
+	struct ubi_wl_entry *e;
+	uint8_t *seen = NULL;
+	void *buf;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		return ERR_PTR(-ENOMEM);
+
+	anchor = find_anchor(ubi, vid_hdr, stale, &stale_count, &sqnum);
+	if (anchor < 0) {
+		dbg_bld("no fastmap found");
+		ubi_free_vid_hdr(ubi, vid_hdr);
+		return NULL;
+	}
+
+	buf = read_fastmap(ubi, anchor, vid_hdr);
+	if (IS_ERR(buf) || !buf) {
+		ubi_free_vid_hdr(ubi, vid_hdr);
+		return buf;
+	}
+	sb = buf;
+	n = be32_to_cpu(sb->used_blocks);
+
+	seen = kzalloc(ubi->peb_count, GFP_KERNEL);
+	if (!seen)
+		goto out_free;
+
+	ubi->fm_used = kzalloc(BITS_TO_LONGS(ubi->peb_count) * sizeof(long),
+			       GFP_KERNEL);
+	if (!ubi->fm_used)
+		goto out_free;
+
+	si = ubi_scan_alloc_si();
+	if (!si)
+		goto out_free;
+	si->is_empty = 0;
+
+	err = parse_fastmap(ubi, si, buf, vid_hdr, seen);
+	if (err)
+		goto out_free;
+
+	ubi_scan_finish(ubi, si);
+	if (sqnum > si->max_sqnum)
+		si->max_sqnum = sqnum;
+
+	/*
+	 * Older anchors are on the fastmap's erase list. Erase them right
+	 * away, a later attach must not pick them up if this fastmap gets
+	 * lost.
+	 */
+	list_for_each_entry_safe(seb, tmp, &si->erase, u.list)
+		for (i = 0; i < stale_count; i++) {
+			if (seb->pnum != stale[i] || ubi->ro_mode)
+				continue;
+			if (ubi_scan_erase_peb(ubi, si, seb->pnum, seb->ec + 1))
+				break;
+			seb->ec += 1;
+			list_move_tail(&seb->u.list, &si->free);
+			break;
+		}
+
+	for (i = 0; i < n; i++) {
+		e = kmem_cache_alloc(ubi_wl_entry_slab, GFP_KERNEL);
+		if (!e) {
+			err = -ENOMEM;
+			goto out_blocks;
+		}
+		e->pnum = be32_to_cpu(sb->block_loc[i]);
+		e->ec = fm_ec(sb->block_ec[i]);
+		if (e->ec == UBI_SCAN_UNKNOWN_EC)
+			e->ec = si->mean_ec;
+		ubi->fm_blocks[i] = e;
+		ubi->fm_block_count = i + 1;
+	}
+
+	ubi_msg("attached by fastmap at PEB %d", anchor);
+	kfree(seen);
+	vfree(buf);
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return si;
+
+out_blocks:
+	for (i = 0; i < ubi->fm_block_count; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_blocks[i]);
+	ubi->fm_block_count = 0;
+out_free:
+	if (si)
+		ubi_scan_destroy_si(si);
+	kfree(ubi->fm_used);
+	ubi->fm_used = NULL;
+	kfree(seen);
+	vfree(buf);
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	if (err == -ENOMEM)
+		return ERR_PTR(err);
+
+	ubi_warn("fastmap is unusable, fall back to scanning");
+	return NULL;
+}
+
+/**
+ * fm_append - reserve space in the fastmap buffer.
+ * @ubi: UBI device description object
+ * @pos: current position, advanced by @len
+ * @len: how many bytes are needed
+ */
+static void *fm_append(struct ubi_device *ubi, int *pos, int len)
+{
+	void *p = ubi->fm_buf + *pos;
+
+	*pos += len;
+	ubi_assert(*pos <= ubi->fm_max_blocks * ubi->leb_size);
+	return p;
+}
+
+/**
+ * fm_build - build the fastmap in @ubi->fm_buf.
+ * @ubi: UBI device description object
+ * @blocks: the physical eraseblocks the fastmap is going to be written to
+ *
+ * This function has to be called with @ubi->fm_sem held in write mode. It
+ * returns the size of the fastmap data following the super block.
+ */
+static int fm_build(struct ubi_device *ubi, struct ubi_wl_entry **blocks)
+{
+	int i, j, pnum, pos = 0, n = ubi->fm_max_blocks, lebs;
+	int vol_count = 0, used = 0, pool = 0, free = 0, erase = 0, bad = 0;
+	struct ubi_fm_hdr *hdr;
+	struct ubi_fm_volhdr *vh;
+	struct ubi_fm_leb *leb;
+	struct ubi_fm_ec *fec;
+	struct ubi_volume *vol;
+	struct ubi_wl_entry *e;
+	struct rb_node *rb;
+	__be32 *p;
+
+	memset(ubi->fm_buf, 0, n * ubi->leb_size);
+	fm_append(ubi, &pos, sizeof(struct ubi_fm_sb));
+	hdr = fm_append(ubi, &pos, sizeof(struct ubi_fm_hdr));
+
+	spin_lock(&ubi->wl_lock);
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		e = ubi->lookuptbl[pnum];
+		if (e) {
+			/* Pending erasures and everything else not below */
+			ubi->fm_state[pnum] = FM_PEB_ERASE;
+			ubi->fm_ec[pnum] = e->ec;
+		} else {
+			ubi->fm_state[pnum] = FM_PEB_NONE;
+			ubi->fm_ec[pnum] = UBI_SCAN_UNKNOWN_EC;
+		}
+	}
+	ubi_rb_for_each_entry(rb, e, &ubi->free, rb)
+		ubi->fm_state[e->pnum] = FM_PEB_FREE;
+	ubi_rb_for_each_entry(rb, e, &ubi->fm_pool, rb)
+		ubi->fm_state[e->pnum] = FM_PEB_POOL;
+	for (i = 0; i < n; i++)
+		ubi->fm_state[blocks[i]->pnum] = FM_PEB_FM;
+	spin_unlock(&ubi->wl_lock);
+
+	spin_lock(&ubi->volumes_lock);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		vol_count += 1;
+		vh = fm_append(ubi, &pos, sizeof(struct ubi_fm_volhdr));
+		vh->magic = cpu_to_be32(UBI_FM_VHDR_MAGIC);
+		vh->vol_id = cpu_to_be32(vol->vol_id);
+		vh->data_pad = cpu_to_be32(vol->data_pad);
+		if (vol->vol_id == UBI_LAYOUT_VOLUME_ID)
+			vh->compat = UBI_LAYOUT_VOLUME_COMPAT;
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME)
+			vh->vol_type = UBI_VID_DYNAMIC;
+		else {
+			vh->vol_type = UBI_VID_STATIC;
+			vh->used_ebs = cpu_to_be32(vol->used_ebs);
+			vh->last_data_size = cpu_to_be32(vol->last_eb_bytes);
+		}
+
+		for (j = 0, lebs = 0; j < vol->reserved_pebs; j++) {
+			pnum = vol->eba_tbl[j];
+			if (pnum < 0)
+				continue;
+
+			leb = fm_append(ubi, &pos, sizeof(struct ubi_fm_leb));
+			leb->lnum = cpu_to_be32(j);
+			leb->pnum = cpu_to_be32(pnum);
+			leb->ec = cpu_to_be32(ubi->fm_ec[pnum]);
+			ubi->fm_state[pnum] = FM_PEB_USED;
+			lebs += 1;
+		}
+		vh->leb_count = cpu_to_be32(lebs);
+		used += lebs;
+	}
+	spin_unlock(&ubi->volumes_lock);
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++)
+		if (ubi->fm_state[pnum] == FM_PEB_POOL) {
+			p = fm_append(ubi, &pos, sizeof(__be32));
+			*p = cpu_to_be32(pnum);
+			pool += 1;
+		}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++)
+		if (ubi->fm_state[pnum] == FM_PEB_FREE) {
+			fec = fm_append(ubi, &pos, sizeof(struct ubi_fm_ec));
+			fec->pnum = cpu_to_be32(pnum);
+			fec->ec = cpu_to_be32(ubi->fm_ec[pnum]);
+			free += 1;
+		}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (ubi->fm_state[pnum] == FM_PEB_NONE) {
+			/*
+			 * Not known to the WL unit - either bad, or dropped
+			 * after an erase failure.
+			 */
+			if (ubi_io_is_bad(ubi, pnum)) {
+				bad += 1;
+				continue;
+			}
+		} else if (ubi->fm_state[pnum] != FM_PEB_ERASE)
+			continue;
+
+		fec = fm_append(ubi, &pos, sizeof(struct ubi_fm_ec));
+		fec->pnum = cpu_to_be32(pnum);
+		fec->ec = cpu_to_be32(ubi->fm_ec[pnum]);
+		erase += 1;
+	}
+
+	hdr->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+	hdr->vol_count = cpu_to_be32(vol_count);
+	hdr->used_peb_count = cpu_to_be32(used);
+	hdr->pool_peb_count = cpu_to_be32(pool);
+	hdr->free_peb_count = cpu_to_be32(free);
+	hdr->erase_peb_count = cpu_to_be32(erase);
+	hdr->bad_peb_count = cpu_to_be32(bad);
+
+	dbg_bld("fastmap: %d volumes, %d used, %d pool, %d free, %d erase, "
+		"%d bad PEBs", vol_count, used, pool, free, erase, bad);
+	return pos - sizeof(struct ubi_fm_sb);
+}
+
+/**
+ * fm_write_block - write one fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @vid_hdr: VID header to use
+ * @e: the physical eraseblock, which has to be erased
+ * @i: index of the block in the fastmap
+ * @size: size of the whole fastmap
+ */
+static int fm_write_block(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr,
+			  struct ubi_wl_entry *e, int i, int size)
+{
+	int err, len;
+	void *buf = ubi->fm_buf + i * ubi->leb_size;
+
+	vid_hdr->vol_id = cpu_to_be32(i ? UBI_FM_DATA_VOLUME_ID :
+					  UBI_FM_SB_VOLUME_ID);
+	vid_hdr->lnum = cpu_to_be32(i);
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+	if (i == 0) {
+		struct ubi_fm_sb *sb = buf;
+
+		sb->sqnum = vid_hdr->sqnum;
+		sb->crc = cpu_to_be32(crc32(UBI_CRC32_INIT, sb,
+					    UBI_FM_SB_SIZE_CRC));
+	}
+
+	err = ubi_io_write_vid_hdr(ubi, e->pnum, vid_hdr);
+	if (err)
+		return err;
+
+	len = min_t(int, ubi->leb_size, size - i * ubi->leb_size);
+	if (len <= 0)
+		return 0;
+
+	len = ALIGN(len, ubi->min_io_size);
+	if (i * ubi->leb_size + len > size)
+		memset(ubi->fm_buf + size, 0xFF, i * ubi->leb_size + len - size);
+	return ubi_io_write_data(ubi, buf, e->pnum, 0, len);
+}
+
+/**
+ * ubi_update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function writes the current EBA tables and erase counters to the flash
+ * and refills the pool. If the fastmap cannot be written, any fastmap on the
+ * flash is invalidated and UBI stops using fastmaps. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int err = 0, i, n, size, reused;
+	struct ubi_wl_entry *blocks[UBI_FM_MAX_BLOCKS];
+	struct ubi_wl_entry *old_anchor = NULL;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_fm_sb *sb;
+
+	if (ubi->ro_mode)
+		return -EROFS;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	mutex_lock(&ubi->fm_mutex);
+	down_write(&ubi->fm_sem);
+	if (!ubi->fm_enabled)
+		goto out_unlock;
+
+	n = ubi->fm_max_blocks;
+	if (ubi->fm_block_count)
+		old_anchor = ubi->fm_blocks[0];
+
+	/*
+	 * Take new physical eraseblocks from the pool, and reuse the old ones
+	 * only if there are no free physical eraseblocks left.
+	 */
+	ubi_wl_fill_pool(ubi);
+	memset(blocks, 0, sizeof(blocks));
+	for (i = 0; i < n; i++) {
+		blocks[i] = ubi_wl_get_fm_peb(ubi, i == 0);
+		if (!blocks[i] && i < ubi->fm_block_count)
+			blocks[i] = ubi->fm_blocks[i];
+		if (!blocks[i]) {
+			ubi_err("no PEBs for the fastmap");
+			err = -ENOSPC;
+			goto out_fail;
+		}
+	}
+
+	ubi_wl_fill_pool(ubi);
+	size = sizeof(struct ubi_fm_sb) + fm_build(ubi, blocks);
+
+	/* Reused blocks have to be erased, the anchor first */
+	for (i = 0; i < n; i++) {
+		if (i >= ubi->fm_block_count || blocks[i] != ubi->fm_blocks[i])
+			continue;
+		err = ubi_wl_erase_fm_peb(ubi, blocks[i]);
+		if (err)
+			goto out_fail;
+	}
+
+	sb = ubi->fm_buf;
+	sb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	sb->version = UBI_FM_FMT_VERSION;
+	sb->data_size = cpu_to_be32(size - sizeof(struct ubi_fm_sb));
+	sb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT,
+					 ubi->fm_buf + sizeof(struct ubi_fm_sb),
+					 size - sizeof(struct ubi_fm_sb)));
+	sb->used_blocks = cpu_to_be32(n);
+	for (i = 0; i < n; i++) {
+		sb->block_loc[i] = cpu_to_be32(blocks[i]->pnum);
+		sb->block_ec[i] = cpu_to_be32(blocks[i]->ec);
+	}
+
+	vid_hdr->vol_type = UBI_VID_DYNAMIC;
+	vid_hdr->compat = UBI_FM_VOLUME_COMPAT;
+
+	/* The anchor goes last, the fastmap is valid only when it is there */
+	for (i = 1; i < n; i++) {
+		err = fm_write_block(ubi, vid_hdr, blocks[i], i, size);
+		if (err)
+			goto out_fail;
+	}
+	err = fm_write_block(ubi, vid_hdr, blocks[0], 0, size);
+	if (err)
+		goto out_fail;
+
+	/*
+	 * The new fastmap is in place. Get rid of the old anchor right away,
+	 * so that a stale fastmap can never be found again.
+	 */
+	if (old_anchor && old_anchor != blocks[0]) {
+		reused = !ubi_wl_erase_fm_peb(ubi, old_anchor);
+		if (!reused)
+			ubi_warn("cannot erase old fastmap anchor PEB %d",
+				 old_anchor->pnum);
+		ubi_wl_put_fm_peb(ubi, old_anchor, reused);
+	}
+	for (i = 1; i < ubi->fm_block_count; i++)
+		if (i >= n || ubi->fm_blocks[i] != blocks[i])
+			ubi_wl_put_fm_peb(ubi, ubi->fm_blocks[i], 0);
+
+	for (i = 0; i < n; i++)
+		ubi->fm_blocks[i] = blocks[i];
+	ubi->fm_block_count = n;
+
+	spin_lock(&ubi->wl_lock);
+	bitmap_zero(ubi->fm_used, ubi->peb_count);
+	for (i = 0; i < ubi->peb_count; i++)
+		if (ubi->fm_state[i] == FM_PEB_USED)
+			__set_bit(i, ubi->fm_used);
+	spin_unlock(&ubi->wl_lock);
+	ubi_wl_release_deferred(ubi);
+
+	dbg_bld("fastmap written, anchor PEB %d", blocks[0]->pnum);
+	goto out_unlock;
+
+out_fail:
+	ubi_err("cannot write fastmap, error %d", err);
+
+	/* Make sure no fastmap is left on the flash */
+	if ((blocks[0] && ubi_wl_erase_fm_peb(ubi, blocks[0])) ||
+	    (old_anchor && old_anchor != blocks[0] &&
+	     ubi_wl_erase_fm_peb(ubi, old_anchor))) {
+		ubi_err("cannot invalidate fastmap");
+		for (i = 0; i < n; i++) {
+			if (!blocks[i] || (i < ubi->fm_block_count &&
+					   blocks[i] == ubi->fm_blocks[i]))
+				continue;
+			ubi_wl_put_fm_peb(ubi, blocks[i], 0);
+		}
+		ubi_ro_mode(ubi);
+		goto out_unlock;
+	}
+
+	for (i = 0; i < n; i++)
+		if (blocks[i])
+			ubi_wl_put_fm_peb(ubi, blocks[i], 0);
+	for (i = 0; i < ubi->fm_block_count; i++)
+		if (i >= n || ubi->fm_blocks[i] != blocks[i])
+			ubi_wl_put_fm_peb(ubi, ubi->fm_blocks[i], 0);
+	ubi->fm_block_count = 0;
+
+	ubi_msg("fastmap disabled");
+	ubi_wl_disable_fastmap(ubi);
+
+out_unlock:
+	up_write(&ubi->fm_sem);
+	mutex_unlock(&ubi->fm_mutex);
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return err;
+}
+
+/**
+ * ubi_fastmap_refill - write a new fastmap if it is time to.
+ * @ubi: UBI device description object
+ *
+ * This function is called before a physical eraseblock is taken from the
+ * pool. A new fastmap is written if the pool is empty or if too many erasures
+ * are waiting for it. Returns zero in case of success and a negative error
+ * code in case of failure.
+ */
+int ubi_fastmap_refill(struct ubi_device *ubi)
+{
+	int need, err;
+
+	spin_lock(&ubi->wl_lock);
+	need = !ubi->fm_pool.rb_node ||
+	       ubi->fm_deferred_count >= ubi->fm_pool_size;
+	spin_unlock(&ubi->wl_lock);
+	if (!need)
+		return 0;
+
+	/*
+	 * If the fastmap could not be written, it has been disabled and the
+	 * free physical eraseblocks are used directly.
+	 */
+	err = ubi_update_fastmap(ubi);
+	if (err && ubi->ro_mode)
+		return err;
+	return 0;
+}
+
+/**
+ * ubi_fastmap_init - initialize the fastmap unit.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ *
+ * This function is called when the EBA and WL units have been initialized.
+ * It reserves physical eraseblocks for the fastmap and writes one if the
+ * device was attached by scanning. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubi_fastmap_init(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int i, err, pool_count;
+
+	ubi->fm_max_blocks = DIV_ROUND_UP(fm_size(ubi), ubi->leb_size);
+	ubi->fm_pool_size = ubi->peb_count / 20;
+	ubi->fm_pool_size = max_t(int, ubi->fm_pool_size, FM_MIN_POOL_SIZE);
+	ubi->fm_pool_size = min_t(int, ubi->fm_pool_size, FM_MAX_POOL_SIZE);
+
+	for (i = 0; i < ubi->fm_block_count; i++)
+		ubi->lookuptbl[ubi->fm_blocks[i]->pnum] = ubi->fm_blocks[i];
+
+	if (ubi->fm_max_blocks > UBI_FM_MAX_BLOCKS) {
+		ubi_msg("too many PEBs for fastmap");
+		goto out_disable;
+	}
+	if (ubi->ro_mode || si->alien_peb_count)
+		goto out_disable;
+
+	spin_lock(&ubi->volumes_lock);
+	if (ubi->avail_pebs < ubi->fm_max_blocks) {
+		spin_unlock(&ubi->volumes_lock);
+		ubi_msg("not enough PEBs for fastmap (%d, need %d)",
+			ubi->avail_pebs, ubi->fm_max_blocks);
+		goto out_disable;
+	}
+	ubi->avail_pebs -= ubi->fm_max_blocks;
+	ubi->rsvd_pebs += ubi->fm_max_blocks;
+	spin_unlock(&ubi->volumes_lock);
+
+	err = -ENOMEM;
+	ubi->fm_buf = vmalloc(ubi->fm_max_blocks * ubi->leb_size);
+	if (!ubi->fm_buf)
+		goto out_free;
+	ubi->fm_state = vmalloc(ubi->peb_count);
+	if (!ubi->fm_state)
+		goto out_free;
+	ubi->fm_ec = vmalloc(ubi->peb_count * sizeof(int));
+	if (!ubi->fm_ec)
+		goto out_free;
+	if (!ubi->fm_used) {
+		ubi->fm_used = kzalloc(BITS_TO_LONGS(ubi->peb_count) *
+				       sizeof(long), GFP_KERNEL);
+		if (!ubi->fm_used)
+			goto out_free;
+	}
+
+	ubi->fm_enabled = 1;
+	pool_count = ubi->fm_pool_count;
+	ubi_wl_fill_pool(ubi);
+	ubi_msg("fastmap: %d PEBs, pool of %d PEBs", ubi->fm_max_blocks,
+		ubi->fm_pool_size);
+
+	/*
+	 * When attached by scanning, write the fastmap for the next time.
+	 * When attached from a fastmap, the pool may just have been topped up
+	 * with PEBs which the fastmap on the flash records as free, and which
+	 * therefore would not be scanned after an unclean shutdown: the
+	 * fastmap has to be rewritten before any of them is handed out.
+	 */
+	if (!ubi->fm_block_count || ubi->fm_pool_count != pool_count) {
+		err = ubi_update_fastmap(ubi);
+		if (err && ubi->ro_mode)
+			return err;
+	}
+	return 0;
+
+out_free:
+	vfree(ubi->fm_buf);
+	vfree(ubi->fm_state);
+	vfree(ubi->fm_ec);
+	ubi->fm_buf = ubi->fm_ec = NULL;
+	ubi->fm_state = NULL;
+	spin_lock(&ubi->volumes_lock);
+	ubi->avail_pebs += ubi->fm_max_blocks;
+	ubi->rsvd_pebs -= ubi->fm_max_blocks;
+	spin_unlock(&ubi->volumes_lock);
+	return err;
+
+out_disable:
+	/* A fastmap we are not going to maintain must not be used next time */
+	if (ubi->fm_block_count && !ubi->ro_mode) {
+		err = ubi_wl_erase_fm_peb(ubi, ubi->fm_blocks[0]);
+		if (err) {
+			ubi_err("cannot invalidate fastmap");
+			return err;
+		}
+		ubi_wl_put_fm_peb(ubi, ubi->fm_blocks[0], 1);
+		for (i = 1; i < ubi->fm_block_count; i++)
+			ubi_wl_put_fm_peb(ubi, ubi->fm_blocks[i], 0);
+		ubi->fm_block_count = 0;
+	}
+	if (!ubi->ro_mode)
+		ubi_wl_disable_fastmap(ubi);
+	return 0;
+}
+
+/**
+ * ubi_fastmap_close - close the fastmap unit.
+ * @ubi: UBI device description object
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < ubi->fm_block_count; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_blocks[i]);
+	ubi->fm_block_count = 0;
+	ubi->fm_enabled = 0;
+	vfree(ubi->fm_buf);
+	vfree(ubi->fm_state);
+	vfree(ubi->fm_ec);
+	kfree(ubi->fm_used);
+	ubi->fm_buf = ubi->fm_ec = NULL;
+	ubi->fm_state = NULL;
+	ubi->fm_used = NULL;
+}
@@ -56,7 +56,7 @@ static struct ubi_ec_hdr *ech;
 static struct ubi_vid_hdr *vidh;
 
 /**
- * add_to_list - add physical eraseblock to a list.
+ * ubi_scan_add_to_list - add physical eraseblock to a list.
  * @si: scanning information
  * @pnum: physical eraseblock number to add
  * @ec: erase counter of the physical eraseblock
@@ -66,8 +66,8 @@ static struct ubi_vid_hdr *vidh;
  * alien lists. Returns zero in case of success and a negative error code in
  * case of failure.
  */
-static int add_to_list(struct ubi_scan_info *si, int pnum, int ec,
-		       struct list_head *list)
+int ubi_scan_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			 struct list_head *list)
 {
 	struct ubi_scan_leb *seb;
 
@@ -491,11 +491,11 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 				return err;
 
 			if (cmp_res & 4)
-				err = add_to_list(si, seb->pnum, seb->ec,
-						  &si->corr);
+				err = ubi_scan_add_to_list(si, seb->pnum,
+							   seb->ec, &si->corr);
 			else
-				err = add_to_list(si, seb->pnum, seb->ec,
-						  &si->erase);
+				err = ubi_scan_add_to_list(si, seb->pnum,
+							   seb->ec, &si->erase);
 			if (err)
 				return err;
 
@@ -516,9 +516,9 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 			 * previously.
 			 */
 			if (cmp_res & 4)
-				return add_to_list(si, pnum, ec, &si->corr);
+				return ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 			else
-				return add_to_list(si, pnum, ec, &si->erase);
+				return ubi_scan_add_to_list(si, pnum, ec, &si->erase);
 		}
 	}
 
@@ -777,7 +777,8 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 	else if (err == UBI_IO_BITFLIPS)
 		bitflips = 1;
 	else if (err == UBI_IO_PEB_EMPTY)
-		return add_to_list(si, pnum, UBI_SCAN_UNKNOWN_EC, &si->erase);
+		return ubi_scan_add_to_list(si, pnum, UBI_SCAN_UNKNOWN_EC,
+					    &si->erase);
 	else if (err == UBI_IO_BAD_EC_HDR) {
 		/*
 		 * We have to also look at the VID header, possibly it is not
@@ -825,19 +826,53 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 	else if (err == UBI_IO_BAD_VID_HDR ||
 		 (err == UBI_IO_PEB_FREE && ec_corr)) {
 		/* VID header is corrupted */
-		err = add_to_list(si, pnum, ec, &si->corr);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 		if (err)
 			return err;
 		goto adjust_mean_ec;
 	} else if (err == UBI_IO_PEB_FREE) {
 		/* No VID header - the physical eraseblock is free */
-		err = add_to_list(si, pnum, ec, &si->free);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->free);
 		if (err)
 			return err;
 		goto adjust_mean_ec;
 	}
 
 	vol_id = be32_to_cpu(vidh->vol_id);
+	if (vol_id == UBI_FM_SB_VOLUME_ID || vol_id == UBI_FM_DATA_VOLUME_ID) {
+		unsigned long long sqnum = be64_to_cpu(vidh->sqnum);
+
+		/*
+		 * A fastmap left over from an earlier session. We are doing
+		 * full scanning, so it is not needed, and it may be out of
+		 * date. The anchor is erased right away, otherwise a later
+		 * attach could pick up the stale fastmap.
+		 */
+		if (sqnum > si->max_sqnum)
+			si->max_sqnum = sqnum;
+
+		if (vol_id == UBI_FM_SB_VOLUME_ID && !ec_corr &&
+		    !ubi->ro_mode) {
+			dbg_bld("erase fastmap anchor PEB %d", pnum);
+			err = ubi_scan_erase_peb(ubi, si, pnum, ec + 1);
+			if (!err) {
+				ec += 1;
+				err = ubi_scan_add_to_list(si, pnum, ec,
+							   &si->free);
+				if (err)
+					return err;
+				goto adjust_mean_ec;
+			}
+			if (err != -EIO)
+				return err;
+		}
+
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->erase);
+		if (err)
+			return err;
+		goto adjust_mean_ec;
+	}
+
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
 		int lnum = be32_to_cpu(vidh->lnum);
 
@@ -846,10 +881,10 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 		case UBI_COMPAT_DELETE:
 			ubi_msg("\"delete\" compatible internal volume %d:%d"
 				" found, remove it", vol_id, lnum);
-			err = add_to_list(si, pnum, ec, &si->corr);
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 			if (err)
 				return err;
-			break;
+			goto adjust_mean_ec;
 
 		case UBI_COMPAT_RO:
 			ubi_msg("read-only compatible internal volume %d:%d"
@@ -861,7 +896,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 		case UBI_COMPAT_PRESERVE:
 			ubi_msg("\"preserve\" compatible internal volume %d:%d"
 				" found", vol_id, lnum);
-			err = add_to_list(si, pnum, ec, &si->alien);
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->alien);
 			if (err)
 				return err;
 			si->alien_peb_count += 1;
@@ -893,23 +928,18 @@ adjust_mean_ec:
 }
 
 /**
- * ubi_scan - scan an MTD device.
- * @ubi: UBI device description object
+ * ubi_scan_alloc_si - allocate and initialize scanning information.
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * This function returns a pointer to the new, empty scanning information
+ * object, or %NULL if there is no memory.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+struct ubi_scan_info *ubi_scan_alloc_si(void)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
 	if (!si)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&si->corr);
 	INIT_LIST_HEAD(&si->free);
@@ -917,26 +947,66 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	INIT_LIST_HEAD(&si->alien);
 	si->volumes = RB_ROOT;
 	si->is_empty = 1;
+	return si;
+}
+
+/**
+ * ubi_scan_pebs - scan a set of physical eraseblocks.
+ * @ubi: UBI device description object
+ * @si: scanning information to add the results to
+ * @pebs: the physical eraseblocks to scan
+ * @count: how many elements @pebs has
+ *
+ * This function reads the UBI headers of the given physical eraseblocks and
+ * adds them to @si exactly like full scanning does. It is used to scan the
+ * physical eraseblocks a fastmap cannot say anything certain about. Returns
+ * zero in case of success and a negative error code in case of failure.
+ */
+int ubi_scan_pebs(struct ubi_device *ubi, struct ubi_scan_info *si,
+		  const int *pebs, int count)
+{
+	int err = -ENOMEM, i;
 
-	err = -ENOMEM;
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
-		goto out_si;
+		return err;
 
 	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
 	if (!vidh)
 		goto out_ech;
 
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+	for (i = 0; i < count; i++) {
 		cond_resched();
 
-		dbg_msg("process PEB %d", pnum);
-		err = process_eb(ubi, si, pnum);
+		dbg_msg("process PEB %d", pebs[i]);
+		err = process_eb(ubi, si, pebs[i]);
 		if (err < 0)
 			goto out_vidh;
 	}
+	err = 0;
 
-	dbg_msg("scanning is finished");
+out_vidh:
+	ubi_free_vid_hdr(ubi, vidh);
+	vidh = NULL;
+out_ech:
+	kfree(ech);
+	ech = NULL;
+	return err;
+}
+
+/**
+ * ubi_scan_finish - finish building scanning information.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ *
+ * This function calculates the mean erase counter and assigns it to the
+ * physical eraseblocks whose erase counter is unknown.
+ */
+void ubi_scan_finish(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
 
 	/* Calculate mean erase counter */
 	if (si->ec_count) {
@@ -969,6 +1039,45 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	list_for_each_entry(seb, &si->erase, u.list)
 		if (seb->ec == UBI_SCAN_UNKNOWN_EC)
 			seb->ec = si->mean_ec;
+}
+
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function does full scanning of an MTD device and returns complete
+ * information about it. In case of failure, an error code is returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+{
+	int err, pnum;
+	struct ubi_scan_info *si;
+
+	si = ubi_scan_alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+
+	err = -ENOMEM;
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ech)
+		goto out_si;
+
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh)
+		goto out_ech;
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		cond_resched();
+
+		dbg_msg("process PEB %d", pnum);
+		err = process_eb(ubi, si, pnum);
+		if (err < 0)
+			goto out_vidh;
+	}
+
+	dbg_msg("scanning is finished");
+
+	ubi_scan_finish(ubi, si);
 
 	err = paranoid_check_si(ubi, si);
 	if (err) {
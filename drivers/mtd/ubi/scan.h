@@ -150,6 +150,8 @@ static inline void ubi_scan_move_to_list(struct ubi_scan_volume *sv,
 int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 		      int pnum, int ec, const struct ubi_vid_hdr *vid_hdr,
 		      int bitflips);
+int ubi_scan_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			 struct list_head *list);
 struct ubi_scan_volume *ubi_scan_find_sv(const struct ubi_scan_info *si,
 					 int vol_id);
 struct ubi_scan_leb *ubi_scan_find_seb(const struct ubi_scan_volume *sv,
@@ -159,6 +161,10 @@ struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 					   struct ubi_scan_info *si);
 int ubi_scan_erase_peb(struct ubi_device *ubi, const struct ubi_scan_info *si,
 		       int pnum, int ec);
+struct ubi_scan_info *ubi_scan_alloc_si(void);
+int ubi_scan_pebs(struct ubi_device *ubi, struct ubi_scan_info *si,
+		  const int *pebs, int count);
+void ubi_scan_finish(struct ubi_device *ubi, struct ubi_scan_info *si);
 struct ubi_scan_info *ubi_scan(struct ubi_device *ubi);
 void ubi_scan_destroy_si(struct ubi_scan_info *si);
 
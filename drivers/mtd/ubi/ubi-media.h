@@ -306,6 +306,15 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The fastmap is kept in two more internal volumes. They are not real volumes
+ * and have no volume table records. The fastmap super block lives in the
+ * anchor physical eraseblock, the rest of the fastmap in data eraseblocks.
+ */
+#define UBI_FM_SB_VOLUME_ID      (UBI_INTERNAL_VOL_START + 1)
+#define UBI_FM_DATA_VOLUME_ID    (UBI_INTERNAL_VOL_START + 2)
+#define UBI_FM_VOLUME_COMPAT     UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -369,4 +378,140 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __attribute__ ((packed));
 
+/* Fastmap super block magic number (ASCII "UBF#") */
+#define UBI_FM_SB_MAGIC   0x55424623
+/* Fastmap header magic number (ASCII "UBF!") */
+#define UBI_FM_HDR_MAGIC  0x55424621
+/* Fastmap volume record magic number (ASCII "UBFV") */
+#define UBI_FM_VHDR_MAGIC 0x55424656
+
+/* Fastmap on-flash format version */
+#define UBI_FM_FMT_VERSION 1
+
+/* The anchor has to be one of this many first physical eraseblocks */
+#define UBI_FM_MAX_START 64
+
+/* The maximum number of physical eraseblocks a fastmap may occupy */
+#define UBI_FM_MAX_BLOCKS 32
+
+/* Size of the fastmap super block without the ending CRC */
+#define UBI_FM_SB_SIZE_CRC (sizeof(struct ubi_fm_sb) - sizeof(__be32))
+
+/**
+ * struct ubi_fm_sb - fastmap super block.
+ * @magic: fastmap super block magic number (%UBI_FM_SB_MAGIC)
+ * @version: format version of this fastmap
+ * @padding1: reserved for future, zeroes
+ * @data_size: size of the fastmap data following the super block
+ * @data_crc: CRC32 checksum of the fastmap data
+ * @used_blocks: number of physical eraseblocks the fastmap occupies
+ * @block_loc: physical eraseblocks the fastmap occupies, the first one is the
+ *             anchor
+ * @block_ec: erase counters of the @block_loc physical eraseblocks
+ * @sqnum: highest sequence number in use when the fastmap was written
+ * @padding2: reserved for future, zeroes
+ * @crc: super block CRC checksum
+ *
+ * The fastmap is an on-flash snapshot of the EBA tables and of the erase
+ * counters of all physical eraseblocks. It saves UBI from reading the headers
+ * of every physical eraseblock when attaching. The super block is stored at
+ * the beginning of the anchor physical eraseblock, which is always one of the
+ * first %UBI_FM_MAX_START physical eraseblocks, so that it may be found
+ * quickly. The fastmap data (&struct ubi_fm_hdr and the tables after it)
+ * follows the super block and continues in the other @block_loc physical
+ * eraseblocks, at the beginning of their logical eraseblock area.
+ */
+struct ubi_fm_sb {
+	__be32 magic;
+	__u8   version;
+	__u8   padding1[3];
+	__be32 data_size;
+	__be32 data_crc;
+	__be32 used_blocks;
+	__be32 block_loc[UBI_FM_MAX_BLOCKS];
+	__be32 block_ec[UBI_FM_MAX_BLOCKS];
+	__be64 sqnum;
+	__u8   padding2[32];
+	__be32 crc;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_hdr - fastmap data header.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @vol_count: number of &struct ubi_fm_volhdr records
+ * @used_peb_count: number of mapped physical eraseblocks
+ * @pool_peb_count: number of physical eraseblocks in the pool
+ * @free_peb_count: number of free physical eraseblocks
+ * @erase_peb_count: number of physical eraseblocks which have to be erased
+ * @bad_peb_count: number of bad physical eraseblocks
+ * @padding: reserved for future, zeroes
+ *
+ * The header is followed by @vol_count volume records, each followed by its
+ * &struct ubi_fm_leb entries, then by @pool_peb_count big-endian 32-bit
+ * physical eraseblock numbers, then by @free_peb_count and @erase_peb_count
+ * &struct ubi_fm_ec entries. Physical eraseblocks which are not mentioned
+ * anywhere, and are not the fastmap itself, are bad.
+ *
+ * The pool is the set of free physical eraseblocks UBI may write to until the
+ * next fastmap is written. They are the only ones whose contents may differ
+ * from what the fastmap says, so they are scanned when attaching.
+ */
+struct ubi_fm_hdr {
+	__be32 magic;
+	__be32 vol_count;
+	__be32 used_peb_count;
+	__be32 pool_peb_count;
+	__be32 free_peb_count;
+	__be32 erase_peb_count;
+	__be32 bad_peb_count;
+	__u8   padding[4];
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_volhdr - fastmap volume record.
+ * @magic: fastmap volume record magic number (%UBI_FM_VHDR_MAGIC)
+ * @vol_id: volume ID
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @compat: compatibility flags of the volume
+ * @padding1: reserved for future, zeroes
+ * @data_pad: how many bytes at the end of logical eraseblocks are not used
+ * @used_ebs: number of used logical eraseblocks (static volumes only)
+ * @last_data_size: data size in the last logical eraseblock (static volumes
+ *                  only)
+ * @leb_count: number of &struct ubi_fm_leb entries following this record
+ */
+struct ubi_fm_volhdr {
+	__be32 magic;
+	__be32 vol_id;
+	__u8   vol_type;
+	__u8   compat;
+	__u8   padding1[2];
+	__be32 data_pad;
+	__be32 used_ebs;
+	__be32 last_data_size;
+	__be32 leb_count;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_leb - fastmap record of a mapped logical eraseblock.
+ * @lnum: logical eraseblock number
+ * @pnum: physical eraseblock it is mapped to
+ * @ec: erase counter of @pnum
+ */
+struct ubi_fm_leb {
+	__be32 lnum;
+	__be32 pnum;
+	__be32 ec;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_ec - fastmap record of a free or to be erased eraseblock.
+ * @pnum: physical eraseblock number
+ * @ec: its erase counter, or %0xFFFFFFFF if it is unknown
+ */
+struct ubi_fm_ec {
+	__be32 pnum;
+	__be32 ec;
+} __attribute__ ((packed));
+
 #endif /* !__UBI_MEDIA_H__ */
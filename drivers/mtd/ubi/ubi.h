@@ -298,8 +298,8 @@ struct ubi_wl_entry;
  * @prot.pnum: protection tree indexed by physical eraseblock numbers
  * @prot.aec: protection tree indexed by absolute erase counter value
  * @wl_lock: protects the @used, @free, @prot, @lookuptbl, @abs_ec, @move_from,
- *           @move_to, @move_to_put @erase_pending, @wl_scheduled, and @works
- *           fields
+ *           @move_to, @move_to_put @erase_pending, @wl_scheduled, @works and
+ *           the fastmap pool and deferred works fields
  * @move_mutex: serializes eraseblock moves
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
  * @lookuptbl: a table to quickly find a &struct ubi_wl_entry object for any
@@ -336,6 +336,28 @@ struct ubi_wl_entry;
  *               not
  * @mtd: MTD device descriptor
  *
+ * @fm_enabled: non-zero if this device keeps a fastmap
+ * @fm_sem: held in read mode by everyone who takes physical eraseblocks from
+ *          the pool and maps them, and in write mode while the fastmap is
+ *          written, so that the fastmap sees consistent EBA tables
+ * @fm_mutex: serializes fastmap writers
+ * @fm_pool: RB-tree of free physical eraseblocks which may be used until the
+ *           next fastmap is written
+ * @fm_pool_count: count of physical eraseblocks in @fm_pool
+ * @fm_pool_size: how many physical eraseblocks the pool is filled up to
+ * @fm_deferred: erase works for physical eraseblocks the on-flash fastmap
+ *               still refers to as used
+ * @fm_deferred_count: count of works in @fm_deferred
+ * @fm_used: bitmap of physical eraseblocks the on-flash fastmap refers to as
+ *           used
+ * @fm_blocks: WL entries of the physical eraseblocks holding the fastmap,
+ *             the first one is the anchor
+ * @fm_block_count: count of valid @fm_blocks entries
+ * @fm_max_blocks: how many physical eraseblocks the fastmap may take
+ * @fm_buf: buffer the fastmap is built in
+ * @fm_state: per-PEB state used while the fastmap is built
+ * @fm_ec: per-PEB erase counters used while the fastmap is built
+ *
  * @peb_buf1: a buffer of PEB size used for different purposes
  * @peb_buf2: another buffer of PEB size used for different purposes
  * @buf_mutex: proptects @peb_buf1 and @peb_buf2
@@ -416,6 +438,23 @@ struct ubi_device {
 	int bad_allowed;
 	struct mtd_info *mtd;
 
+	/* Fastmap stuff */
+	int fm_enabled;
+	struct rw_semaphore fm_sem;
+	struct mutex fm_mutex;
+	struct rb_root fm_pool;
+	int fm_pool_count;
+	int fm_pool_size;
+	struct list_head fm_deferred;
+	int fm_deferred_count;
+	unsigned long *fm_used;
+	struct ubi_wl_entry *fm_blocks[UBI_FM_MAX_BLOCKS];
+	int fm_block_count;
+	int fm_max_blocks;
+	void *fm_buf;
+	uint8_t *fm_state;
+	int *fm_ec;
+
 	void *peb_buf1;
 	void *peb_buf2;
 	struct mutex buf_mutex;
@@ -472,6 +511,7 @@ void ubi_gluebi_updated(struct ubi_volume *vol);
 #endif
 
 /* eba.c */
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 int ubi_eba_unmap_leb(struct ubi_device *ubi, struct ubi_volume *vol,
 		      int lnum);
 int ubi_eba_read_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
@@ -496,6 +536,35 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor);
+void ubi_wl_fill_pool(struct ubi_device *ubi);
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e);
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int erased);
+void ubi_wl_release_deferred(struct ubi_device *ubi);
+void ubi_wl_disable_fastmap(struct ubi_device *ubi);
+
+/* fastmap.c */
+#ifdef CONFIG_MTD_UBI_FASTMAP
+struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi);
+int ubi_fastmap_init(struct ubi_device *ubi, struct ubi_scan_info *si);
+int ubi_update_fastmap(struct ubi_device *ubi);
+int ubi_fastmap_refill(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+#else
+static inline struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi)
+{
+	return NULL;
+}
+static inline int ubi_fastmap_init(struct ubi_device *ubi,
+				   struct ubi_scan_info *si)
+{
+	return 0;
+}
+static inline int ubi_update_fastmap(struct ubi_device *ubi) { return 0; }
+static inline int ubi_fastmap_refill(struct ubi_device *ubi) { return 0; }
+static inline void ubi_fastmap_close(struct ubi_device *ubi) { }
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -57,6 +57,13 @@
  * eraseblocks are kept in a set of different RB-trees: @wl->used,
  * @wl->prot.pnum, @wl->prot.aec, and @wl->scrub.
  *
+ * When the device keeps a fastmap, physical eraseblocks are not handed out
+ * from @wl->free directly but from a small pool (@ubi->fm_pool) which is
+ * refilled each time the fastmap is written. Only the pool has to be scanned
+ * when attaching. For the same reason, physical eraseblocks which the on-flash
+ * fastmap refers to as used are not erased until a newer fastmap is written -
+ * their erase works are parked in @ubi->fm_deferred meanwhile.
+ *
  * Note, in this implementation, we keep a small in-RAM object for each physical
  * eraseblock. This is surely not a scalable solution. But it appears to be good
  * enough for moderately large flashes and it is simple. In future, one may
@@ -438,12 +445,17 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
  *
  * This function returns a physical eraseblock in case of success and a
  * negative error code in case of failure. Might sleep.
+ *
+ * On success @ubi->fm_sem is held in read mode, so that no fastmap is written
+ * while the PEB is in flight. The caller has to release it once the PEB is in
+ * the EBA table or has been put back.
  */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 {
-	int err, protect, medium_ec;
+	int err, protect, medium_ec, no_free;
 	struct ubi_wl_entry *e, *first, *last;
 	struct ubi_wl_prot_entry *pe;
+	struct rb_root *root;
 
 	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
 		   dtype == UBI_UNKNOWN);
@@ -453,21 +465,41 @@ int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 		return -ENOMEM;
 
 retry:
+	if (ubi->fm_enabled) {
+		err = ubi_fastmap_refill(ubi);
+		if (err) {
+			kfree(pe);
+			return err;
+		}
+	}
+
+	down_read(&ubi->fm_sem);
 	spin_lock(&ubi->wl_lock);
-	if (!ubi->free.rb_node) {
-		if (ubi->works_count == 0) {
+	root = ubi->fm_enabled ? &ubi->fm_pool : &ubi->free;
+	if (!root->rb_node) {
+		no_free = !ubi->free.rb_node;
+		if (no_free && ubi->works_count == 0 &&
+		    ubi->fm_deferred_count == 0) {
 			ubi_assert(list_empty(&ubi->works));
 			ubi_err("no free eraseblocks");
 			spin_unlock(&ubi->wl_lock);
+			up_read(&ubi->fm_sem);
 			kfree(pe);
 			return -ENOSPC;
 		}
 		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->fm_sem);
 
-		err = produce_free_peb(ubi);
-		if (err < 0) {
-			kfree(pe);
-			return err;
+		/*
+		 * If there are free PEBs, or only erasures waiting for the
+		 * next fastmap, the refill above gets us going.
+		 */
+		if (no_free && ubi->works_count) {
+			err = produce_free_peb(ubi);
+			if (err < 0) {
+				kfree(pe);
+				return err;
+			}
 		}
 		goto retry;
 	}
@@ -480,7 +512,7 @@ retry:
 			 * counter we can pick is bounded by the the lowest
 			 * erase counter plus %WL_FREE_MAX_DIFF.
 			 */
-			e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+			e = find_wl_entry(root, WL_FREE_MAX_DIFF);
 			protect = LT_PROTECTION;
 			break;
 		case UBI_UNKNOWN:
@@ -491,17 +523,17 @@ retry:
 			 * equivalent than the lowest erase counter plus
 			 * %WL_FREE_MAX_DIFF.
 			 */
-			first = rb_entry(rb_first(&ubi->free),
+			first = rb_entry(rb_first(root),
 					 struct ubi_wl_entry, rb);
-			last = rb_entry(rb_last(&ubi->free),
+			last = rb_entry(rb_last(root),
 					struct ubi_wl_entry, rb);
 
 			if (last->ec - first->ec < WL_FREE_MAX_DIFF)
-				e = rb_entry(ubi->free.rb_node,
+				e = rb_entry(root->rb_node,
 						struct ubi_wl_entry, rb);
 			else {
 				medium_ec = (first->ec + WL_FREE_MAX_DIFF)/2;
-				e = find_wl_entry(&ubi->free, medium_ec);
+				e = find_wl_entry(root, medium_ec);
 			}
 			protect = U_PROTECTION;
 			break;
@@ -511,7 +543,7 @@ retry:
 			 * with the lowest erase counter as we expect it will
 			 * be erased soon.
 			 */
-			e = rb_entry(rb_first(&ubi->free),
+			e = rb_entry(rb_first(root),
 				     struct ubi_wl_entry, rb);
 			protect = ST_PROTECTION;
 			break;
@@ -525,8 +557,10 @@ retry:
 	 * Move the physical eraseblock to the protection trees where it will
 	 * be protected from being moved for some time.
 	 */
-	paranoid_check_in_wl_tree(e, &ubi->free);
-	rb_erase(&e->rb, &ubi->free);
+	paranoid_check_in_wl_tree(e, root);
+	rb_erase(&e->rb, root);
+	if (ubi->fm_enabled)
+		ubi->fm_pool_count -= 1;
 	prot_tree_add(ubi, e, pe, protect);
 
 	dbg_wl("PEB %d EC %d, protection %d", e->pnum, e->ec, protect);
@@ -679,21 +713,34 @@ static void check_protection_over(struct ubi_device *ubi)
 }
 
 /**
- * schedule_ubi_work - schedule a work.
+ * __schedule_ubi_work - schedule a work.
  * @ubi: UBI device description object
  * @wrk: the work to schedule
  *
  * This function enqueues a work defined by @wrk to the tail of the pending
- * works list.
+ * works list. The caller has to hold @ubi->wl_lock.
  */
-static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
+static void __schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 {
-	spin_lock(&ubi->wl_lock);
 	list_add_tail(&wrk->list, &ubi->works);
 	ubi_assert(ubi->works_count >= 0);
 	ubi->works_count += 1;
 	if (ubi->thread_enabled)
 		wake_up_process(ubi->bgt_thread);
+}
+
+/**
+ * schedule_ubi_work - schedule a work.
+ * @ubi: UBI device description object
+ * @wrk: the work to schedule
+ *
+ * This function enqueues a work defined by @wrk to the tail of the pending
+ * works list.
+ */
+static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
+{
+	spin_lock(&ubi->wl_lock);
+	__schedule_ubi_work(ubi, wrk);
 	spin_unlock(&ubi->wl_lock);
 }
 
@@ -725,10 +772,38 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	wl_wrk->e = e;
 	wl_wrk->torture = torture;
 
-	schedule_ubi_work(ubi, wl_wrk);
+	spin_lock(&ubi->wl_lock);
+	if (ubi->fm_used && test_bit(e->pnum, ubi->fm_used)) {
+		/*
+		 * The on-flash fastmap still maps a LEB to this PEB. Erasing
+		 * it now would make that LEB point to an empty PEB after an
+		 * unclean reboot, so wait for the next fastmap.
+		 */
+		dbg_wl("defer erasure of PEB %d", e->pnum);
+		list_add_tail(&wl_wrk->list, &ubi->fm_deferred);
+		ubi->fm_deferred_count += 1;
+	} else
+		__schedule_ubi_work(ubi, wl_wrk);
+	spin_unlock(&ubi->wl_lock);
 	return 0;
 }
 
+/**
+ * wl_entry_destroy - destroy a wear-leveling entry.
+ * @ubi: UBI device description object
+ * @e: the wear-leveling entry to destroy
+ *
+ * This function drops @e from the lookup table before freeing it, because the
+ * fastmap code walks the lookup table.
+ */
+static void wl_entry_destroy(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	spin_lock(&ubi->wl_lock);
+	ubi->lookuptbl[e->pnum] = NULL;
+	spin_unlock(&ubi->wl_lock);
+	kmem_cache_free(ubi_wl_entry_slab, e);
+}
+
 /**
  * wear_leveling_worker - wear-leveling worker function.
  * @ubi: UBI device description object
@@ -746,6 +821,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	struct ubi_wl_prot_entry *uninitialized_var(pe);
 	struct ubi_wl_entry *e1, *e2;
 	struct ubi_vid_hdr *vid_hdr;
+	struct rb_root *root;
 
 	kfree(wrk);
 
@@ -757,11 +833,14 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		return -ENOMEM;
 
 	mutex_lock(&ubi->move_mutex);
+	/* The target PEB comes from the pool, keep the fastmap out */
+	down_read(&ubi->fm_sem);
 	spin_lock(&ubi->wl_lock);
 	ubi_assert(!ubi->move_from && !ubi->move_to);
 	ubi_assert(!ubi->move_to_put);
 
-	if (!ubi->free.rb_node ||
+	root = ubi->fm_enabled ? &ubi->fm_pool : &ubi->free;
+	if (!root->rb_node ||
 	    (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
 		/*
 		 * No free physical eraseblocks? Well, they must be waiting in
@@ -774,7 +853,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * triggered again.
 		 */
 		dbg_wl("cancel WL, a list is empty: free %d, used %d",
-		       !ubi->free.rb_node, !ubi->used.rb_node);
+		       !root->rb_node, !ubi->used.rb_node);
 		goto out_cancel;
 	}
 
@@ -785,7 +864,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(root, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -800,14 +879,16 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(root, WL_FREE_MAX_DIFF);
 		paranoid_check_in_wl_tree(e1, &ubi->scrub);
 		rb_erase(&e1->rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	paranoid_check_in_wl_tree(e2, &ubi->free);
-	rb_erase(&e2->rb, &ubi->free);
+	paranoid_check_in_wl_tree(e2, root);
+	rb_erase(&e2->rb, root);
+	if (ubi->fm_enabled)
+		ubi->fm_pool_count -= 1;
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -901,6 +982,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 
 
 	dbg_wl("done");
+	up_read(&ubi->fm_sem);
 	mutex_unlock(&ubi->move_mutex);
 	return 0;
 
@@ -924,6 +1006,7 @@ out_not_moved:
 	if (err)
 		goto out_error;
 
+	up_read(&ubi->fm_sem);
 	mutex_unlock(&ubi->move_mutex);
 	return 0;
 
@@ -937,16 +1020,18 @@ out_error:
 	ubi->move_to_put = ubi->wl_scheduled = 0;
 	spin_unlock(&ubi->wl_lock);
 
-	kmem_cache_free(ubi_wl_entry_slab, e1);
-	kmem_cache_free(ubi_wl_entry_slab, e2);
+	wl_entry_destroy(ubi, e1);
+	wl_entry_destroy(ubi, e2);
 	ubi_ro_mode(ubi);
 
+	up_read(&ubi->fm_sem);
 	mutex_unlock(&ubi->move_mutex);
 	return err;
 
 out_cancel:
 	ubi->wl_scheduled = 0;
 	spin_unlock(&ubi->wl_lock);
+	up_read(&ubi->fm_sem);
 	mutex_unlock(&ubi->move_mutex);
 	ubi_free_vid_hdr(ubi, vid_hdr);
 	return 0;
@@ -966,8 +1051,10 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	struct ubi_wl_entry *e1;
 	struct ubi_wl_entry *e2;
 	struct ubi_work *wrk;
+	struct rb_root *root;
 
 	spin_lock(&ubi->wl_lock);
+	root = ubi->fm_enabled ? &ubi->fm_pool : &ubi->free;
 	if (ubi->wl_scheduled)
 		/* Wear-leveling is already in the work queue */
 		goto out_unlock;
@@ -977,7 +1064,7 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	 * the WL worker has to be scheduled anyway.
 	 */
 	if (!ubi->scrub.rb_node) {
-		if (!ubi->used.rb_node || !ubi->free.rb_node)
+		if (!ubi->used.rb_node || !root->rb_node)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
 
@@ -988,7 +1075,7 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		 * %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(root, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -1066,7 +1153,6 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 
 	ubi_err("failed to erase PEB %d, error %d", pnum, err);
 	kfree(wl_wrk);
-	kmem_cache_free(ubi_wl_entry_slab, e);
 
 	if (err == -EINTR || err == -ENOMEM || err == -EAGAIN ||
 	    err == -EBUSY) {
@@ -1075,11 +1161,15 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 		/* Re-schedule the LEB for erasure */
 		err1 = schedule_erase(ubi, e, 0);
 		if (err1) {
+			wl_entry_destroy(ubi, e);
 			err = err1;
 			goto out_ro;
 		}
 		return err;
-	} else if (err != -EIO) {
+	}
+
+	wl_entry_destroy(ubi, e);
+	if (err != -EIO) {
 		/*
 		 * If this is not %-EIO, we have no idea what to do. Scheduling
 		 * this physical eraseblock for erasure again would cause
@@ -1288,6 +1378,16 @@ int ubi_wl_flush(struct ubi_device *ubi)
 {
 	int err;
 
+	/*
+	 * Erasures of PEBs the fastmap refers to wait for the next fastmap,
+	 * write it so that they are flushed too.
+	 */
+	if (ubi->fm_deferred_count && !ubi->ro_mode) {
+		err = ubi_update_fastmap(ubi);
+		if (err)
+			return err;
+	}
+
 	/*
 	 * Erase while the pending works queue is not empty, but not more then
 	 * the number of currently pending works.
@@ -1423,6 +1523,16 @@ static void cancel_pending(struct ubi_device *ubi)
 		ubi->works_count -= 1;
 		ubi_assert(ubi->works_count >= 0);
 	}
+
+	while (!list_empty(&ubi->fm_deferred)) {
+		struct ubi_work *wrk;
+
+		wrk = list_entry(ubi->fm_deferred.next, struct ubi_work, list);
+		list_del(&wrk->list);
+		wrk->func(ubi, wrk, 1);
+		ubi->fm_deferred_count -= 1;
+		ubi_assert(ubi->fm_deferred_count >= 0);
+	}
 }
 
 /**
@@ -1445,11 +1555,13 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 
 	ubi->used = ubi->free = ubi->scrub = RB_ROOT;
 	ubi->prot.pnum = ubi->prot.aec = RB_ROOT;
+	ubi->fm_pool = RB_ROOT;
 	spin_lock_init(&ubi->wl_lock);
 	mutex_init(&ubi->move_mutex);
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = si->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
+	INIT_LIST_HEAD(&ubi->fm_deferred);
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
 
@@ -1551,6 +1663,174 @@ out_free:
 	return err;
 }
 
+/**
+ * ubi_wl_get_fm_peb - get a physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @anchor: non-zero if the physical eraseblock is going to be the anchor
+ *
+ * This function takes a physical eraseblock out of the pool and returns its
+ * WL entry, which is not in any tree afterwards. The anchor has to be one of
+ * the first %UBI_FM_MAX_START physical eraseblocks, the least worn out one is
+ * picked. Returns %NULL if there is no suitable physical eraseblock.
+ */
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor)
+{
+	struct ubi_wl_entry *e = NULL, *e1;
+	struct rb_node *rb;
+
+	spin_lock(&ubi->wl_lock);
+	if (anchor) {
+		ubi_rb_for_each_entry(rb, e1, &ubi->fm_pool, rb)
+			if (e1->pnum < UBI_FM_MAX_START) {
+				e = e1;
+				break;
+			}
+	} else if (ubi->fm_pool.rb_node)
+		e = rb_entry(rb_first(&ubi->fm_pool), struct ubi_wl_entry, rb);
+
+	if (e) {
+		paranoid_check_in_wl_tree(e, &ubi->fm_pool);
+		rb_erase(&e->rb, &ubi->fm_pool);
+		ubi->fm_pool_count -= 1;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	return e;
+}
+
+/**
+ * ubi_wl_fill_pool - refill the pool from the free physical eraseblocks.
+ * @ubi: UBI device description object
+ *
+ * Physical eraseblocks with low and high erase counters are taken in turn,
+ * so that 'ubi_wl_get_peb()' can still honour the data type hints. One of
+ * the first %UBI_FM_MAX_START physical eraseblocks is always put to the pool,
+ * if there is any, for the next fastmap anchor.
+ */
+void ubi_wl_fill_pool(struct ubi_device *ubi)
+{
+	int i = 0, anchor = 0;
+	struct ubi_wl_entry *e;
+	struct rb_node *rb;
+
+	spin_lock(&ubi->wl_lock);
+	ubi_rb_for_each_entry(rb, e, &ubi->fm_pool, rb)
+		if (e->pnum < UBI_FM_MAX_START) {
+			anchor = 1;
+			break;
+		}
+
+	if (!anchor)
+		ubi_rb_for_each_entry(rb, e, &ubi->free, rb)
+			if (e->pnum < UBI_FM_MAX_START) {
+				rb_erase(&e->rb, &ubi->free);
+				wl_tree_add(e, &ubi->fm_pool);
+				ubi->fm_pool_count += 1;
+				break;
+			}
+
+	while (ubi->fm_pool_count < ubi->fm_pool_size && ubi->free.rb_node) {
+		if (i++ & 1)
+			e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		else
+			e = rb_entry(rb_first(&ubi->free),
+				     struct ubi_wl_entry, rb);
+		rb_erase(&e->rb, &ubi->free);
+		wl_tree_add(e, &ubi->fm_pool);
+		ubi->fm_pool_count += 1;
+	}
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_erase_fm_peb - synchronously erase a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the WL entry of the physical eraseblock
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	return sync_erase(ubi, e, 0);
+}
+
+/**
+ * ubi_wl_put_fm_peb - return a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the WL entry of the physical eraseblock
+ * @erased: non-zero if the physical eraseblock has just been erased
+ *
+ * The physical eraseblock goes back to the free ones, it is scheduled for
+ * erasure first unless @erased is set. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int erased)
+{
+	if (!erased)
+		return schedule_erase(ubi, e, 0);
+
+	spin_lock(&ubi->wl_lock);
+	wl_tree_add(e, &ubi->free);
+	spin_unlock(&ubi->wl_lock);
+	return 0;
+}
+
+/**
+ * ubi_wl_release_deferred - schedule the erasures a fastmap held back.
+ * @ubi: UBI device description object
+ *
+ * This function is called when @ubi->fm_used has changed. Erase works of
+ * physical eraseblocks the on-flash fastmap does not refer to any more are
+ * moved to the pending works queue.
+ */
+void ubi_wl_release_deferred(struct ubi_device *ubi)
+{
+	struct ubi_work *wrk, *tmp;
+
+	spin_lock(&ubi->wl_lock);
+	list_for_each_entry_safe(wrk, tmp, &ubi->fm_deferred, list) {
+		if (ubi->fm_used && test_bit(wrk->e->pnum, ubi->fm_used))
+			continue;
+
+		list_del(&wrk->list);
+		ubi->fm_deferred_count -= 1;
+		ubi_assert(ubi->fm_deferred_count >= 0);
+		__schedule_ubi_work(ubi, wrk);
+	}
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_disable_fastmap - stop using the fastmap pool.
+ * @ubi: UBI device description object
+ *
+ * This function returns the pool to the free physical eraseblocks, forgets
+ * about the on-flash fastmap and schedules the erasures it held back. The
+ * caller has to make sure no valid fastmap is left on the flash.
+ */
+void ubi_wl_disable_fastmap(struct ubi_device *ubi)
+{
+	struct ubi_wl_entry *e;
+	unsigned long *used;
+
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_enabled = 0;
+	while (ubi->fm_pool.rb_node) {
+		e = rb_entry(rb_first(&ubi->fm_pool), struct ubi_wl_entry, rb);
+		rb_erase(&e->rb, &ubi->fm_pool);
+		wl_tree_add(e, &ubi->free);
+	}
+	ubi->fm_pool_count = 0;
+	used = ubi->fm_used;
+	ubi->fm_used = NULL;
+	spin_unlock(&ubi->wl_lock);
+
+	kfree(used);
+	ubi_wl_release_deferred(ubi);
+}
+
 /**
  * protection_trees_destroy - destroy the protection RB-trees.
  * @ubi: UBI device description object
@@ -1596,6 +1876,7 @@ void ubi_wl_close(struct ubi_device *ubi)
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	tree_destroy(&ubi->fm_pool);
 	kfree(ubi->lookuptbl);
 }
 
@@ -22,12 +22,14 @@
 #include <linux/errno.h>
 #include <linux/delay.h>
 #include <linux/pm.h>
+#include <linux/log2.h>
 
 #include <asm/io.h>
 #include <asm/addrspace.h>
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
 #include <asm/cacheops.h>
+#include <asm/div64.h>
 #include <asm/jzsoc.h>
 
 #include "jz_eth.h"
@@ -63,16 +65,29 @@ static struct net_device *netdev;
 static char * hwaddr = NULL;
 static int debug = -1;
 static struct mii_if_info mii_info;
+static int rx_copybreak = 256;
+/*
+ * Kept out of jz_eth_private: the private area is only accessed through
+ * KSEG1 (uncached), which the atomic bitops of NAPI can't be used on.
+ */
+static struct napi_struct jz_eth_napi;
 
 module_param(debug, int, 0);
 MODULE_PARM_DESC(debug, "debug flag");
 module_param(hwaddr, charp, 0);
 MODULE_PARM_DESC(hwaddr,"hardware MAC address");
+module_param(rx_copybreak, int, 0);
+MODULE_PARM_DESC(rx_copybreak, "copy received frames shorter than this");
 
 /*
  * Local routines
  */
 static irqreturn_t jz_eth_interrupt(int irq, void *dev_id);
+static struct sk_buff *jz_eth_alloc_rx_skb(struct net_device *dev);
+static void jz_eth_give_rx_skb(struct jz_eth_private *np, int entry,
+			       struct sk_buff *skb);
+static void jz_eth_free_rx_skbs(struct net_device *dev);
+static void jz_eth_free_tx_skbs(struct net_device *dev);
 
 static int link_check_thread (void *data); 
 
@@ -189,6 +204,7 @@ static int get_mac_address(struct net_device *dev)
 /*---------------------------------------------------------------------*/
 
 static u32 jz_eth_curr_mode(struct net_device *dev);
+static void jz_eth_set_mode(struct net_device *dev);
 
 /*
  * Ethernet START/STOP routines
@@ -258,7 +274,8 @@ static int link_check_thread(void *data)
 	current->comm[sizeof(current->comm) - 1] = '\0';
 
 	while (1) {
-		timeout = 3*HZ;
+		/* Poll quickly while auto-negotiation may still be running */
+		timeout = np->link_state ? 3*HZ : HZ/5;
 		do {
 			timeout = interruptible_sleep_on_timeout (&np->thr_wait, timeout);
 			/* make swsusp happy with our thread */
@@ -279,7 +296,7 @@ static int link_check_thread(void *data)
 		if (np->link_state!=current_link) {
 			if (current_link) {
 				infoprintk("%s: Ethernet Link OK!\n",dev->name);
-				jz_eth_curr_mode(dev);
+				jz_eth_set_mode(dev);
 				netif_carrier_on(dev);
 			}
 			else {
@@ -577,27 +594,6 @@ static void mii_db_out(struct net_device *dev)
 }
 #endif
 
-/*
- * Start Auto-Negotiation function for PHY 
- */
-static int jz_autonet_complete(struct net_device *dev)
-{
-	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
-	int count;
-	u32 mii_reg1, timeout = 3000;
-
-	for (count = 0; count < timeout; count++) {
-		mdelay(1);
-		mii_reg1 = mdio_read(dev,np->valid_phy,MII_BMSR);
-		if (mii_reg1 & 0x0020) break;
-	}
-	//mii_db_out(dev);  //for debug to display all register of MII
-	if (count >= timeout) 
-		return 1;     //auto negotiation  error
-	else
-		return 0;
-}  
-
 /*
  * Get current mode of eth phy
  */
@@ -633,6 +629,29 @@ static u32 jz_eth_curr_mode(struct net_device *dev)
 	return flag;
 }
 
+/*
+ * Apply the negotiated speed and duplex to a running MAC
+ */
+static void jz_eth_set_mode(struct net_device *dev)
+{
+	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
+	unsigned long flags;
+	u32 flag, omr, mcr;
+
+	flag = jz_eth_curr_mode(dev);
+
+	spin_lock_irqsave(&np->lock, flags);
+	STOP_ETH;
+	omr = (readl(DMA_OMR) & ~OMR_TTM) | flag;
+	writel(omr, DMA_OMR);
+	mcr = readl(MAC_MCR) & ~MCR_FDX;
+	if (np->full_duplex)
+		mcr |= MCR_FDX;
+	writel(mcr, MAC_MCR);
+	START_ETH;
+	spin_unlock_irqrestore(&np->lock, flags);
+}
+
 /*
  * Ethernet device hardware init
  * This routine initializes the ethernet device hardware and PHY
@@ -683,8 +702,6 @@ static int jz_init_hw(struct net_device *dev)
 	ecmd.autoneg = AUTONEG_ENABLE;
         
 	//mii_ethtool_sset(&mii_info, &ecmd);
-	if (jz_autonet_complete(dev)) 
-		errprintk("%s: Ethernet Module AutoNegotiation failed\n",dev->name);
 	mii_ethtool_gset(&mii_info,&ecmd);
 	
 	infoprintk("%s: Provide Modes: ",dev->name);
@@ -693,7 +710,17 @@ static int jz_init_hw(struct net_device *dev)
 			printk("(%d)%s", i+1, media_types[i]);
 	printk("\n");  
 
-	flag = jz_eth_curr_mode(dev);
+	/*
+	 * Don't busy-wait for auto-negotiation here, it can take seconds
+	 * and this also runs from the tx watchdog.  If the link isn't up
+	 * yet, link_check_thread sets the negotiated mode once it is.
+	 */
+	np->link_state = mii_link_ok(&mii_info);
+	if (np->link_state) {
+		flag = jz_eth_curr_mode(dev);
+		netif_carrier_on(dev);
+	} else
+		netif_carrier_off(dev);
 
 	/* Config OMR register */
 	omr = readl(DMA_OMR) & ~OMR_TTM;
@@ -736,36 +763,57 @@ static int jz_init_hw(struct net_device *dev)
 	return 0;
 }
 
-static int jz_eth_open(struct net_device *dev)
+/*
+ * Chain the descriptors and hand the rx buffers in np->rx_skb[] to the
+ * DMA. The DMA has to be stopped.
+ */
+static void jz_eth_init_rings(struct net_device *dev)
 {
 	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
-	int retval, i;
-
-	retval = request_irq(dev->irq, jz_eth_interrupt, 0, dev->name, dev);
-	if (retval) {
-		errprintk("%s: unable to get IRQ %d .\n", dev->name, dev->irq);
-		return -EAGAIN;
-	}
+	int i;
 
-	for (i = 0; i < NUM_RX_DESCS; i++) {
-		np->rx_ring[i].status = cpu_to_le32(R_OWN);
-		np->rx_ring[i].desc1 = cpu_to_le32(RX_BUF_SIZE | RD_RCH);
-		np->rx_ring[i].buf1_addr = cpu_to_le32(np->dma_rx_buf + i*RX_BUF_SIZE);
+	for (i = 0; i < np->num_rx_descs; i++) {
 		np->rx_ring[i].next_addr = cpu_to_le32(np->dma_rx_ring + (i+1) * sizeof (jz_desc_t));
+		jz_eth_give_rx_skb(np, i, np->rx_skb[i]);
 	}
-	np->rx_ring[NUM_RX_DESCS - 1].next_addr = cpu_to_le32(np->dma_rx_ring);
+	np->rx_ring[np->num_rx_descs - 1].next_addr = cpu_to_le32(np->dma_rx_ring);
 
-	for (i = 0; i < NUM_TX_DESCS; i++) {
+	for (i = 0; i < np->num_tx_descs; i++) {
 		np->tx_ring[i].status = cpu_to_le32(0);
 		np->tx_ring[i].desc1  = cpu_to_le32(TD_TCH);
 		np->tx_ring[i].buf1_addr = 0;
 		np->tx_ring[i].next_addr = cpu_to_le32(np->dma_tx_ring + (i+1) * sizeof (jz_desc_t));
 	}
-	np->tx_ring[NUM_TX_DESCS - 1].next_addr = cpu_to_le32(np->dma_tx_ring);
+	np->tx_ring[np->num_tx_descs - 1].next_addr = cpu_to_le32(np->dma_tx_ring);
 
 	np->rx_head = 0;
 	np->tx_head = np->tx_tail = 0;
+	np->tx_full = 0;
+	np->tx_pending = 0;
+}
+
+static int jz_eth_open(struct net_device *dev)
+{
+	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
+	int retval, i;
+
+	for (i = 0; i < np->num_rx_descs; i++) {
+		np->rx_skb[i] = jz_eth_alloc_rx_skb(dev);
+		if (!np->rx_skb[i]) {
+			jz_eth_free_rx_skbs(dev);
+			return -ENOMEM;
+		}
+	}
+
+	retval = request_irq(dev->irq, jz_eth_interrupt, 0, dev->name, dev);
+	if (retval) {
+		errprintk("%s: unable to get IRQ %d .\n", dev->name, dev->irq);
+		jz_eth_free_rx_skbs(dev);
+		return -EAGAIN;
+	}
 
+	jz_eth_init_rings(dev);
+	napi_enable(&jz_eth_napi);
 	jz_init_hw(dev);
 
 	dev->trans_start = jiffies;
@@ -778,9 +826,12 @@ static int jz_eth_open(struct net_device *dev)
 static int jz_eth_close(struct net_device *dev)
 {
 	netif_stop_queue(dev);
+	napi_disable(&jz_eth_napi);
 	close_check(dev);
 	STOP_ETH;
 	free_irq(dev->irq, dev);
+	jz_eth_free_tx_skbs(dev);
+	jz_eth_free_rx_skbs(dev);
 	return 0;
 }
 
@@ -791,14 +842,109 @@ static int jz_eth_close(struct net_device *dev)
 static struct net_device_stats * jz_eth_get_stats(struct net_device *dev)
 {
 	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
+	struct jz_eth_xstats *xs = &np->xstats;
+	unsigned long elapsed;
+	u64 bytes;
 	int tmp;
 	
 	tmp = readl(DMA_MFC); // After read clear to zero
 	np->stats.rx_missed_errors += (tmp & MFC_CNT2) + ((tmp & MFC_CNT1) >> 16);
+
+	/* Sample the tx throughput, at most once a second */
+	elapsed = jiffies - xs->tx_bps_stamp;
+	if (elapsed >= HZ) {
+		bytes = (u64)(np->stats.tx_bytes - xs->tx_bps_bytes) * HZ;
+		do_div(bytes, elapsed);
+		xs->tx_bps = bytes;
+		xs->tx_bps_bytes = np->stats.tx_bytes;
+		xs->tx_bps_stamp += elapsed;
+	}
 	
 	return &np->stats;
 }
 
+static const char jz_eth_gstrings[][ETH_GSTRING_LEN] = {
+	"interrupts",
+	"rx_interrupts",
+	"tx_interrupts",
+	"napi_polls",
+	"tx_reclaims",
+	"tx_descs_reclaimed",
+	"tx_sg_frames",
+	"tx_frags",
+	"tx_ring_busy",
+	"tx_bytes_per_sec",
+};
+#define JZ_ETH_NUM_STATS	ARRAY_SIZE(jz_eth_gstrings)
+
+/*
+ * Resize the rings; we are called with the rtnl lock held. When running,
+ * the rx buffers for the new ring are allocated before the device is
+ * stopped, so that a failure leaves it running on the old rings.
+ */
+static int jz_eth_set_ringparam(struct net_device *dev,
+				struct ethtool_ringparam *ring)
+{
+	struct jz_eth_private *np = dev->priv;
+	int running = netif_running(dev);
+	unsigned int rx, tx, i;
+	struct sk_buff_head spare;
+	struct sk_buff *skb;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending ||
+	    ring->rx_pending < MIN_RX_DESCS || ring->rx_pending > MAX_RX_DESCS ||
+	    ring->tx_pending < MIN_TX_DESCS || ring->tx_pending > MAX_TX_DESCS)
+		return -EINVAL;
+
+	rx = roundup_pow_of_two(ring->rx_pending);
+	tx = roundup_pow_of_two(ring->tx_pending);
+
+	if (running) {
+		skb_queue_head_init(&spare);
+		for (i = np->num_rx_descs; i < rx; i++) {
+			skb = netdev_alloc_skb(dev, RX_BUF_SIZE + NET_IP_ALIGN);
+			if (!skb) {
+				skb_queue_purge(&spare);
+				return -ENOMEM;
+			}
+			skb_reserve(skb, NET_IP_ALIGN);
+			__skb_queue_tail(&spare, skb);
+		}
+
+		netif_stop_queue(dev);
+		napi_disable(&jz_eth_napi);
+		close_check(dev);
+		spin_lock_irq(&np->lock);
+		STOP_ETH;
+		spin_unlock_irq(&np->lock);
+		jz_eth_free_tx_skbs(dev);
+
+		/* keep the rx buffers the new ring has room for */
+		for (i = rx; i < np->num_rx_descs; i++) {
+			np->rx_ring[i].status = 0;
+			dev_kfree_skb(np->rx_skb[i]);
+			np->rx_skb[i] = NULL;
+		}
+		for (i = np->num_rx_descs; i < rx; i++)
+			np->rx_skb[i] = __skb_dequeue(&spare);
+	}
+
+	np->num_rx_descs = rx;
+	np->num_tx_descs = tx;
+	if (np->tx_coalesce > np->num_tx_descs / 2)
+		np->tx_coalesce = np->num_tx_descs / 2;
+
+	if (running) {
+		jz_eth_init_rings(dev);
+		napi_enable(&jz_eth_napi);
+		jz_init_hw(dev);
+		dev->trans_start = jiffies;
+		netif_wake_queue(dev);
+		start_check(dev);
+	}
+	return 0;
+}
+
 /*
  * ethtool routines
  */
@@ -820,6 +966,7 @@ static int jz_ethtool_ioctl(struct net_device *dev, void *useraddr)
 		strcpy (info.driver, DRV_NAME);
 		strcpy (info.version, DRV_VERSION);
 		strcpy (info.bus_info, "OCS");
+		info.n_stats = JZ_ETH_NUM_STATS;
 		if (copy_to_user (useraddr, &info, sizeof (info)))
 			return -EFAULT;
 		return 0;
@@ -876,6 +1023,84 @@ static int jz_ethtool_ioctl(struct net_device *dev, void *useraddr)
 		return 0;
 	}
 
+	/* get/set ring sizes */
+	case ETHTOOL_GRINGPARAM: {
+		struct ethtool_ringparam ring = { ETHTOOL_GRINGPARAM };
+		ring.rx_max_pending = MAX_RX_DESCS;
+		ring.tx_max_pending = MAX_TX_DESCS;
+		ring.rx_pending = np->num_rx_descs;
+		ring.tx_pending = np->num_tx_descs;
+		if (copy_to_user(useraddr, &ring, sizeof(ring)))
+			return -EFAULT;
+		return 0;
+	}
+	case ETHTOOL_SRINGPARAM: {
+		struct ethtool_ringparam ring;
+		if (copy_from_user(&ring, useraddr, sizeof(ring)))
+			return -EFAULT;
+		return jz_eth_set_ringparam(dev, &ring);
+	}
+
+	/* get/set tx completion coalescing (frames per interrupt) */
+	case ETHTOOL_GCOALESCE: {
+		struct ethtool_coalesce ec = { ETHTOOL_GCOALESCE };
+		ec.tx_max_coalesced_frames = np->tx_coalesce;
+		if (copy_to_user(useraddr, &ec, sizeof(ec)))
+			return -EFAULT;
+		return 0;
+	}
+	case ETHTOOL_SCOALESCE: {
+		struct ethtool_coalesce ec;
+		if (copy_from_user(&ec, useraddr, sizeof(ec)))
+			return -EFAULT;
+		if (ec.tx_max_coalesced_frames < 1 ||
+		    ec.tx_max_coalesced_frames > np->num_tx_descs / 2)
+			return -EINVAL;
+		np->tx_coalesce = ec.tx_max_coalesced_frames;
+		return 0;
+	}
+
+	/* driver statistics */
+	case ETHTOOL_GSTRINGS: {
+		struct ethtool_gstrings gstrings = { ETHTOOL_GSTRINGS };
+		if (copy_from_user(&gstrings, useraddr, sizeof(gstrings)))
+			return -EFAULT;
+		if (gstrings.string_set != ETH_SS_STATS)
+			return -EOPNOTSUPP;
+		gstrings.len = JZ_ETH_NUM_STATS;
+		if (copy_to_user(useraddr, &gstrings, sizeof(gstrings)))
+			return -EFAULT;
+		useraddr += offsetof(struct ethtool_gstrings, data);
+		if (copy_to_user(useraddr, jz_eth_gstrings, sizeof(jz_eth_gstrings)))
+			return -EFAULT;
+		return 0;
+	}
+	case ETHTOOL_GSTATS: {
+		struct ethtool_stats estats = { ETHTOOL_GSTATS };
+		struct jz_eth_xstats *xs = &np->xstats;
+		u64 data[JZ_ETH_NUM_STATS];
+
+		jz_eth_get_stats(dev);		/* refresh tx_bps */
+		data[0] = xs->irqs;
+		data[1] = xs->rx_irqs;
+		data[2] = xs->tx_irqs;
+		data[3] = xs->polls;
+		data[4] = xs->tx_reclaims;
+		data[5] = xs->tx_reclaimed;
+		data[6] = xs->tx_sg_frames;
+		data[7] = xs->tx_frags;
+		data[8] = xs->tx_busy;
+		data[9] = xs->tx_bps;
+
+		estats.n_stats = JZ_ETH_NUM_STATS;
+		if (copy_to_user(useraddr, &estats, sizeof(estats)))
+			return -EFAULT;
+		useraddr += offsetof(struct ethtool_stats, data);
+		if (copy_to_user(useraddr, data, sizeof(data)))
+			return -EFAULT;
+		return 0;
+	}
+
 
 	default:
 		break;
@@ -948,18 +1173,75 @@ static int jz_eth_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 }
 
 /*
- * Received one packet
+ * Receive buffers
+ *
+ * The rx descriptors point straight at the data of preallocated skbs.
+ * Frames of at least rx_copybreak bytes are passed up in the buffer
+ * they were received in and the descriptor gets a new skb, preferably
+ * one recycled from tx completion. Shorter frames are copied into a
+ * fresh small skb and the buffer stays in the ring.
  */
-static void eth_rxready(struct net_device *dev)
+static struct sk_buff *jz_eth_alloc_rx_skb(struct net_device *dev)
 {
-	struct jz_eth_private *np = (struct jz_eth_private*)dev->priv;
+	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
 	struct sk_buff *skb;
-	unsigned char *pkt_ptr;
+
+	skb = __skb_dequeue(&np->rx_recycle);
+	if (skb)
+		skb->dev = dev;
+	else
+		skb = netdev_alloc_skb(dev, RX_BUF_SIZE + NET_IP_ALIGN);
+	/* align the IP header behind the 14 byte ethernet header */
+	if (skb)
+		skb_reserve(skb, NET_IP_ALIGN);
+	return skb;
+}
+
+static void jz_eth_give_rx_skb(struct jz_eth_private *np, int entry,
+			       struct sk_buff *skb)
+{
+	/* drop any cached (possibly stale) lines of the buffer */
+	dma_cache_wback_inv((unsigned long)skb->data, RX_BUF_SIZE);
+	np->rx_skb[entry] = skb;
+	np->rx_ring[entry].buf1_addr = cpu_to_le32(virt_to_bus(skb->data));
+	np->rx_ring[entry].desc1 = cpu_to_le32(RX_BUF_SIZE | RD_RCH);
+	np->rx_ring[entry].status = cpu_to_le32(R_OWN);
+}
+
+static void jz_eth_free_rx_skbs(struct net_device *dev)
+{
+	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
+	int i;
+
+	for (i = 0; i < np->num_rx_descs; i++) {
+		np->rx_ring[i].status = 0;
+		if (np->rx_skb[i]) {
+			dev_kfree_skb(np->rx_skb[i]);
+			np->rx_skb[i] = NULL;
+		}
+	}
+	skb_queue_purge(&np->rx_recycle);
+}
+
+/*
+ * Received packets, called from the NAPI poll routine
+ */
+static int eth_rxready(struct net_device *dev, int budget)
+{
+	struct jz_eth_private *np = (struct jz_eth_private*)dev->priv;
+	struct sk_buff *skb, *new_skb;
+	int received = 0;
 	u32 pkt_len;
 	u32 status;
 
-	status = le32_to_cpu(np->rx_ring[np->rx_head].status);
-	while (!(status & R_OWN)) {               /* owner bit = 0 */
+	while (received < budget) {
+		int entry = np->rx_head;
+
+		status = le32_to_cpu(np->rx_ring[entry].status);
+		if (status & R_OWN)                /* owner bit = 1 */
+			break;
+
+		skb = np->rx_skb[entry];
 		if (status & RD_ES) {              /* error summary */
 			np->stats.rx_errors++;    /* Update the error stats. */
 			if (status & (RD_RF | RD_TL))
@@ -969,38 +1251,50 @@ static void eth_rxready(struct net_device *dev)
 			if (status & RD_TL)
 				np->stats.rx_length_errors++;
 		} else {
-			pkt_ptr = bus_to_virt(le32_to_cpu(np->rx_ring[np->rx_head].buf1_addr));
 			pkt_len = ((status & RD_FL) >> 16) - 4;
 
-			skb = dev_alloc_skb(pkt_len + 2);
-			if (skb == NULL) {
-				printk("%s: Memory squeeze, dropping.\n",
-				       dev->name);
+			if (pkt_len < rx_copybreak) {
+				new_skb = netdev_alloc_skb(dev, pkt_len + NET_IP_ALIGN);
+				if (new_skb) {
+					skb_reserve(new_skb, NET_IP_ALIGN);
+					memcpy(skb_put(new_skb, pkt_len),
+					       skb->data, pkt_len);
+					/* skb stays in the ring */
+					skb = new_skb;
+				}
+			} else {
+				new_skb = jz_eth_alloc_rx_skb(dev);
+				if (new_skb) {
+					skb_put(skb, pkt_len);
+					np->rx_skb[entry] = new_skb;
+				}
+			}
+
+			if (new_skb) {
+				//eth_dbg_rx(skb, pkt_len);
+				skb->protocol = eth_type_trans(skb,dev);
+				netif_receive_skb(skb);	/* pass the packet to upper layers */
+				dev->last_rx = jiffies;
+				np->stats.rx_packets++;
+				np->stats.rx_bytes += pkt_len;
+			} else {
+				/* keep the old buffer in the ring */
 				np->stats.rx_dropped++;
-				break;
 			}
-			skb->dev = dev;
-			skb_reserve(skb, 2); /* 16 byte align */
-
-			//pkt_ptr = P1ADDR(pkt_ptr);
-			//dma_cache_inv(pkt_ptr, pkt_len);
-			memcpy(skb->data, pkt_ptr, pkt_len);
-			skb_put(skb, pkt_len);
-
-			//eth_dbg_rx(skb, pkt_len);
-			skb->protocol = eth_type_trans(skb,dev);
-			netif_rx(skb);	/* pass the packet to upper layers */
-			dev->last_rx = jiffies;
-			np->stats.rx_packets++;
-			np->stats.rx_bytes += pkt_len;
 		}
-		np->rx_ring[np->rx_head].status = cpu_to_le32(R_OWN);
+		/* hand the (possibly new) buffer back to the DMA */
+		jz_eth_give_rx_skb(np, entry, np->rx_skb[entry]);
 
 		np->rx_head ++;
-		if (np->rx_head >= NUM_RX_DESCS)
+		if (np->rx_head >= np->num_rx_descs)
 			np->rx_head = 0;
-		status = le32_to_cpu(np->rx_ring[np->rx_head].status);
+		received++;
 	}
+
+	if (received)
+		writel(1, DMA_RPD);	/* resume a suspended receiver */
+
+	return received;
 }
 
 /*
@@ -1016,57 +1310,93 @@ static void jz_eth_tx_timeout(struct net_device *dev)
 }
 
 /*
- * One packet was transmitted
+ * Transmit descriptors
+ *
+ * A frame takes one chained descriptor for its linear part and one for
+ * each page fragment; the skb is kept with the last one. Completion
+ * interrupts are only requested every np->tx_coalesce frames and when
+ * the ring is about to fill up; in between, descriptors are reclaimed
+ * by jz_eth_poll() whenever it runs, and at the latest on the "transmit
+ * buffer unavailable" interrupt raised once the ring has drained.
+ */
+static inline unsigned int jz_eth_tx_avail(struct jz_eth_private *np)
+{
+	return np->num_tx_descs - (np->tx_head - np->tx_tail);
+}
+
+/*
+ * Reclaim transmitted packets. The skbs are moved to @done, to be freed
+ * or recycled by the caller once np->lock is dropped.
  */
-static void eth_txdone(struct net_device *dev)
+static void eth_txdone(struct net_device *dev, struct sk_buff_head *done)
 {
 	struct jz_eth_private *np = (struct jz_eth_private*)dev->priv;
-	int tx_tail = np->tx_tail;
+	unsigned int tx_tail = np->tx_tail;
 
 	while (tx_tail != np->tx_head) {
-		int entry = tx_tail % NUM_TX_DESCS;
+		int entry = tx_tail % np->num_tx_descs;
 		s32 status = le32_to_cpu(np->tx_ring[entry].status);
 		if(status < 0) break;
+		tx_tail++;
+		/* The status is only valid in the last descriptor of a frame */
+		if (!np->tx_skb[entry])
+			continue;
 		if (status & TD_ES ) {       /* Error summary */
 			np->stats.tx_errors++;
 			if (status & TD_NC) np->stats.tx_carrier_errors++;
 			if (status & TD_LC) np->stats.tx_window_errors++;
 			if (status & TD_UF) np->stats.tx_fifo_errors++;
 			if (status & TD_DE) np->stats.tx_aborted_errors++;
-			if (np->tx_head != np->tx_tail)
+			if (np->tx_head != tx_tail)
 				writel(1, DMA_TPD);  /* Restart a stalled TX */
 		} else
 			np->stats.tx_packets++;
 		/* Update the collision counter */
 		np->stats.collisions += ((status & TD_EC) ? 16 : ((status & TD_CC) >> 3));
 		/* Free the original skb */
-		if (np->tx_skb[entry]) {
-			dev_kfree_skb_irq(np->tx_skb[entry]);
-			np->tx_skb[entry] = 0;
-		}
-		tx_tail++;
+		__skb_queue_tail(done, np->tx_skb[entry]);
+		np->tx_skb[entry] = NULL;
+	}
+	if (tx_tail != np->tx_tail) {
+		np->xstats.tx_reclaims++;
+		np->xstats.tx_reclaimed += tx_tail - np->tx_tail;
 	}
-	if (np->tx_full && (tx_tail + NUM_TX_DESCS > np->tx_head + 1)) {
+	np->tx_tail = tx_tail;
+	if (np->tx_full && jz_eth_tx_avail(np) >= TX_DESCS_PER_SKB) {
 		/* The ring is no longer full */
 		np->tx_full = 0;
-		netif_start_queue(dev);
+		netif_wake_queue(dev);
 	}
-	np->tx_tail = tx_tail;
+}
+
+static void jz_eth_free_tx_skbs(struct net_device *dev)
+{
+	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
+	int i;
+
+	for (i = 0; i < np->num_tx_descs; i++) {
+		np->tx_ring[i].status = 0;
+		if (np->tx_skb[i]) {
+			dev_kfree_skb(np->tx_skb[i]);
+			np->tx_skb[i] = NULL;
+		}
+	}
+	np->tx_head = np->tx_tail = 0;
 }
 
 /*
  * Update the tx descriptor
  */
-static void load_tx_packet(struct net_device *dev, char *buf, u32 flags, struct sk_buff *skb)
+static void load_tx_packet(struct jz_eth_private *np, int entry, void *buf,
+			   u32 flags, u32 own)
 {
-	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
-	int entry = np->tx_head % NUM_TX_DESCS;
-	
+	u32 length = flags & TD_TBS1;
+
+	dma_cache_wback((unsigned long)buf, length);
 	np->tx_ring[entry].buf1_addr = cpu_to_le32(virt_to_bus(buf));
 	np->tx_ring[entry].desc1 &= cpu_to_le32((TD_TER | TD_TCH));
 	np->tx_ring[entry].desc1 |= cpu_to_le32(flags);
-	np->tx_ring[entry].status = cpu_to_le32(T_OWN);
-	np->tx_skb[entry] = skb;
+	np->tx_ring[entry].status = cpu_to_le32(own);
 }
 
 /*
@@ -1075,30 +1405,130 @@ static void load_tx_packet(struct net_device *dev, char *buf, u32 flags, struct
 static int jz_eth_send_packet(struct sk_buff *skb, struct net_device *dev)
 {
 	struct jz_eth_private *np = (struct jz_eth_private *)dev->priv;
-	u32 length;
-
-	if (np->tx_full) {
-		return 0;
+	unsigned int nr_frags = skb_shinfo(skb)->nr_frags;
+	unsigned int first, entry, i;
+	u32 length, flags;
+
+	/*
+	 * The MAC can't checksum; do it here, over the fragments where they
+	 * are, rather than having the stack copy them into a linear buffer.
+	 */
+	if (skb->ip_summed == CHECKSUM_PARTIAL && skb_checksum_help(skb)) {
+		dev_kfree_skb(skb);
+		np->stats.tx_dropped++;
+		return NETDEV_TX_OK;
 	}
-	udelay(500);	/* FIXME: can we remove this delay ? */
-	length = (skb->len < ETH_ZLEN) ? ETH_ZLEN : skb->len;
-	dma_cache_wback((unsigned long)skb->data, length);
-	load_tx_packet(dev, (char *)skb->data, TD_IC | TD_LS | TD_FS | length, skb);
+
 	spin_lock_irq(&np->lock);
-	np->tx_head ++;
-	np->stats.tx_bytes += length;
+	if (jz_eth_tx_avail(np) < nr_frags + 1) {
+		/* can only happen if the queue was woken too early */
+		np->xstats.tx_busy++;
+		np->tx_full = 1;
+		netif_stop_queue(dev);
+		spin_unlock_irq(&np->lock);
+		return NETDEV_TX_BUSY;
+	}
+
+	flags = TD_LS;
+	if (++np->tx_pending >= np->tx_coalesce ||
+	    jz_eth_tx_avail(np) - (nr_frags + 1) < TX_DESCS_PER_SKB) {
+		flags |= TD_IC;
+		np->tx_pending = 0;
+	}
+
+	/*
+	 * Fill the descriptors back to front, so that the DMA can't run
+	 * into a half built frame once the first one is handed over.
+	 */
+	first = np->tx_head % np->num_tx_descs;
+	for (i = nr_frags; i > 0; i--) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i - 1];
+
+		entry = (np->tx_head + i) % np->num_tx_descs;
+		load_tx_packet(np, entry,
+			       page_address(frag->page) + frag->page_offset,
+			       flags | frag->size, T_OWN);
+		if (i == nr_frags)
+			np->tx_skb[entry] = skb;
+		flags &= ~(TD_IC | TD_LS);
+	}
+	if (!nr_frags)
+		np->tx_skb[first] = skb;
+
+	length = skb_headlen(skb);
+	if (!nr_frags && length < ETH_ZLEN)
+		length = ETH_ZLEN;
+	load_tx_packet(np, first, skb->data, flags | TD_FS | length, 0);
+	/*
+	 * The cache writebacks above only reach the write buffer: drain it
+	 * before the DMA may fetch the frame, and make the owner bit visible
+	 * before the transmitter is kicked. This used to be covered by a
+	 * 500us delay on every packet.
+	 */
+	wmb();
+	np->tx_ring[first].status = cpu_to_le32(T_OWN);
+	wmb();
+
+	np->tx_head += nr_frags + 1;
+	np->stats.tx_bytes += skb->len;
+	if (nr_frags) {
+		np->xstats.tx_sg_frames++;
+		np->xstats.tx_frags += nr_frags;
+	}
 	writel(1, DMA_TPD);		/* Start the TX */
 	dev->trans_start = jiffies;	/* for timeout */
-	if (np->tx_tail + NUM_TX_DESCS > np->tx_head + 1) {
-		np->tx_full = 0;
-	}
-	else {
+	if (jz_eth_tx_avail(np) < TX_DESCS_PER_SKB) {
 		np->tx_full = 1;
 		netif_stop_queue(dev);
 	}
 	spin_unlock_irq(&np->lock);
 
-	return 0;
+	return NETDEV_TX_OK;
+}
+
+/*
+ * NAPI poll routine: tx reclaim and rx, with rx/tx interrupts masked
+ */
+static int jz_eth_poll(struct napi_struct *napi, int budget)
+{
+	struct net_device *dev = napi->dev;
+	struct jz_eth_private *np = dev->priv;
+	struct sk_buff_head done;
+	struct sk_buff *skb;
+	unsigned long flags;
+	int work_done;
+
+	np->xstats.polls++;
+	skb_queue_head_init(&done);
+	spin_lock_irqsave(&np->lock, flags);
+	eth_txdone(dev, &done);
+	spin_unlock_irqrestore(&np->lock, flags);
+
+	while ((skb = __skb_dequeue(&done)) != NULL) {
+		if (skb_queue_len(&np->rx_recycle) < np->num_rx_descs &&
+		    skb_recycle_check(skb, RX_BUF_SIZE + NET_IP_ALIGN))
+			__skb_queue_head(&np->rx_recycle, skb);
+		else
+			dev_kfree_skb(skb);
+	}
+
+	work_done = eth_rxready(dev, budget);
+
+	if (work_done < budget) {
+		spin_lock_irqsave(&np->lock, flags);
+		__netif_rx_complete(dev, napi);
+		writel(IMR_DEFAULT | IMR_ENABLE, DMA_IMR);
+		/*
+		 * A frame that completed after eth_rxready() gave up on the
+		 * ring would wait for the next interrupt: poll again.
+		 */
+		if (!(le32_to_cpu(np->rx_ring[np->rx_head].status) & R_OWN) &&
+		    netif_rx_reschedule(dev, napi))
+			writel(readl(DMA_IMR) & ~IMR_NAPI, DMA_IMR);
+		spin_unlock_irqrestore(&np->lock, flags);
+	}
+
+	return work_done;
 }
 
 /*
@@ -1113,6 +1543,7 @@ static irqreturn_t jz_eth_interrupt(int irq, void *dev_id)
 
 	spin_lock(&np->lock);
 
+	np->xstats.irqs++;
 	writel((readl(DMA_IMR) & ~IMR_ENABLE), DMA_IMR); /* Disable interrupt */
 
 	for (i = 0; i < 100; i++) {
@@ -1121,10 +1552,16 @@ static irqreturn_t jz_eth_interrupt(int irq, void *dev_id)
 
 		if (!(sts & IMR_DEFAULT)) break;
 
-		if (sts & (DMA_INT_RI | DMA_INT_RU)) /* Rx IRQ */
-			eth_rxready(dev);
-		if (sts & (DMA_INT_TI | DMA_INT_TU)) /* Tx IRQ */
-			eth_txdone(dev); 
+		if (sts & (DMA_INT_RI | DMA_INT_RU))
+			np->xstats.rx_irqs++;
+		if (sts & (DMA_INT_TI | DMA_INT_TU))
+			np->xstats.tx_irqs++;
+
+		/* Rx and Tx are handled in jz_eth_poll() */
+		if (sts & IMR_NAPI) {
+			writel(readl(DMA_IMR) & ~IMR_NAPI, DMA_IMR);
+			netif_rx_schedule(dev, &jz_eth_napi);
+		}
 
 		/* check error conditions */
 		if (sts & DMA_INT_FB){      /* fatal bus error */
@@ -1253,22 +1690,17 @@ static int __init jz_eth_init(void)
 	dev->priv = np;
 	memset(np, 0, sizeof(struct jz_eth_private));
 
-	np->vaddr_rx_buf = (u32)dma_alloc_noncoherent(NULL, NUM_RX_DESCS*RX_BUF_SIZE, 
-						      &np->dma_rx_buf, 0);
-
-	if (!np->vaddr_rx_buf) {
-		printk(KERN_ERR "%s: Cannot alloc dma buffers\n", DRV_NAME);
-		unregister_netdev(dev);
-		free_netdev(dev);
-		return -ENOMEM;
-	}
-
 	np->dma_rx_ring = virt_to_bus(np->rx_ring);
 	np->dma_tx_ring = virt_to_bus(np->tx_ring);
+	np->num_rx_descs = NUM_RX_DESCS;
+	np->num_tx_descs = NUM_TX_DESCS;
+	np->tx_coalesce = TX_COALESCE_FRAMES;
+	np->xstats.tx_bps_stamp = jiffies;
 	np->full_duplex = 1;
 	np->link_state = 1;
 
 	spin_lock_init(&np->lock);
+	skb_queue_head_init(&np->rx_recycle);
 
 	ether_setup(dev);
 	dev->irq = IRQ_ETH;
@@ -1280,6 +1712,9 @@ static int __init jz_eth_init(void)
 	dev->do_ioctl = jz_eth_ioctl;
 	dev->tx_timeout = jz_eth_tx_timeout;
 	dev->watchdog_timeo = ETH_TX_TIMEOUT;
+	/* checksums are done in software by jz_eth_send_packet() */
+	dev->features |= NETIF_F_SG | NETIF_F_IP_CSUM;
+	netif_napi_add(dev, &jz_eth_napi, jz_eth_poll, 64);
 
 	/* configure MAC address */
 	get_mac_address(dev);
@@ -1303,11 +1738,8 @@ static int __init jz_eth_init(void)
 static void __exit jz_eth_exit(void)
 {
 	struct net_device *dev = netdev;
-	struct jz_eth_private *np = dev->priv;
 
 	unregister_netdev(dev);
-	dma_free_noncoherent(NULL, NUM_RX_DESCS * RX_BUF_SIZE,
-			     (void *)np->vaddr_rx_buf, np->dma_rx_buf);
 	free_netdev(dev);
 }	
 
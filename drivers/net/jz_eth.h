@@ -231,6 +231,9 @@
                          DMA_INT_FB )
 
 #define IMR_ENABLE     (DMA_INT_NI | DMA_INT_AI)
+/* masked while the NAPI poll routine runs */
+#define IMR_NAPI       ( DMA_INT_TI | DMA_INT_RI |	\
+                         DMA_INT_TU | DMA_INT_RU )
 
 #define CRC_POLYNOMIAL_BE 0x04c11db7UL  /* Ethernet CRC, big endian */
 #define CRC_POLYNOMIAL_LE 0xedb88320UL  /* Ethernet CRC, little endian */
@@ -350,14 +353,47 @@
 
 #define RX_BUF_SIZE		1536
 
+/*
+ * Ring sizes, adjustable through ethtool -G. They are kept powers of two
+ * so the free running tx_head/tx_tail counters can be used modulo the
+ * ring size. A scatter-gather frame takes up to MAX_SKB_FRAGS + 1 tx
+ * descriptors, and the tx ring must hold at least two of them.
+ */
 #define NUM_RX_DESCS		32
-#define NUM_TX_DESCS		16
+#define NUM_TX_DESCS		64
+#define MIN_RX_DESCS		8
+#define MAX_RX_DESCS		128
+#define MIN_TX_DESCS		64
+#define MAX_TX_DESCS		256
+
+#define TX_DESCS_PER_SKB	(MAX_SKB_FRAGS + 1)
+
+/* Request a tx completion interrupt every TX_COALESCE_FRAMES frames */
+#define TX_COALESCE_FRAMES	16
 
 static const char *media_types[] = {
 	"10BaseT-HD ", "10BaseT-FD ","100baseTx-HD ", 
 	"100baseTx-FD", "100baseT4", 0
 };
 
+/*
+ * Driver counters, reported through ethtool -S
+ */
+struct jz_eth_xstats {
+	unsigned long irqs;			/* interrupts taken */
+	unsigned long rx_irqs;			/* ... with rx work */
+	unsigned long tx_irqs;			/* ... with tx completions */
+	unsigned long polls;			/* NAPI poll calls */
+	unsigned long tx_reclaims;		/* tx reclaim runs freeing work */
+	unsigned long tx_reclaimed;		/* tx descriptors reclaimed */
+	unsigned long tx_sg_frames;		/* frames sent from page fragments */
+	unsigned long tx_frags;			/* page fragments sent */
+	unsigned long tx_busy;			/* xmit found the ring full */
+	unsigned long tx_bps;			/* tx throughput, bytes per second */
+	unsigned long tx_bps_bytes;		/* tx_bytes at the last tx_bps sample */
+	unsigned long tx_bps_stamp;		/* jiffies at the last tx_bps sample */
+};
+
 typedef struct {
 	unsigned int status;
 	unsigned int desc1;
@@ -366,20 +402,25 @@ typedef struct {
 } jz_desc_t;	
 
 struct jz_eth_private {
-	jz_desc_t tx_ring[NUM_TX_DESCS];	/* transmit descriptors */
-	jz_desc_t rx_ring[NUM_RX_DESCS];	/* receive descriptors */
+	jz_desc_t tx_ring[MAX_TX_DESCS];	/* transmit descriptors */
+	jz_desc_t rx_ring[MAX_RX_DESCS];	/* receive descriptors */
 	dma_addr_t dma_tx_ring;                 /* bus address of tx ring */
 	dma_addr_t dma_rx_ring;                 /* bus address of rx ring */
-	dma_addr_t dma_rx_buf;			/* DMA address of rx buffer  */	
-	unsigned int vaddr_rx_buf;		/* virtual address of rx buffer  */
+	unsigned int num_tx_descs;		/* tx descriptors in use */
+	unsigned int num_rx_descs;		/* rx descriptors in use */
+	struct sk_buff *rx_skb[MAX_RX_DESCS];	/* rx buffers, owned by the ring */
+	struct sk_buff_head rx_recycle;		/* spare rx buffers */
 
 	unsigned int rx_head;			/* first rx descriptor */
 	unsigned int tx_head;			/* first tx descriptor */
 	unsigned int tx_tail;  			/* last unacked transmit packet */
 	unsigned int tx_full;			/* transmit buffers are full */
-	struct sk_buff *tx_skb[NUM_TX_DESCS];	/* skbuffs for packets to transmit */
+	unsigned int tx_coalesce;		/* frames per tx completion irq */
+	unsigned int tx_pending;		/* frames queued since the last TD_IC */
+	struct sk_buff *tx_skb[MAX_TX_DESCS];	/* skbuffs, on the last descriptor of a frame */
 
 	struct net_device_stats stats;
+	struct jz_eth_xstats xstats;
 	spinlock_t lock;
 
 	int media;				/* Media (eg TP), mode (eg 100B)*/
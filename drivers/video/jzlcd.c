@@ -24,6 +24,8 @@
 #include <linux/pm.h>
 #include <linux/pm_legacy.h>
 #include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
 
 #include <asm/irq.h>
 #include <asm/pgtable.h>
@@ -242,58 +244,382 @@ static void print_regs(void)	/* debug */
 #endif
 
 #if defined(CONFIG_JZLCD_FRAMEBUFFER_ROTATE_SUPPORT)
-static int jzfb_rotate_daemon_thread(void *info)
-{
-	int i,j;
-	struct fb_info *fb = &jzlcd_info->fb;
-
-	while (!kthread_should_stop()) {
+/*
+ * Rotation engine.
+ *
+ * Applications draw into lcd_frame_user_fb, the daemon copies (rotates)
+ * only the damaged parts of it into lcd_frame[0] which is scanned out by
+ * the LCD controller. Damage comes from three places:
+ *  - faults on the mmap'd user framebuffer, one page at a time
+ *    (see jzfb_rotate_fault()),
+ *  - the in-kernel drawing hooks used by fbcon,
+ *  - the FBIODAMAGE ioctl, which also forces an immediate update.
+ * The daemon sleeps until there is damage instead of polling the frame.
+ */
 #if (CONFIG_JZLCD_FRAMEBUFFER_BPP == 8)
-		unsigned char *plcd_frame = (unsigned char *)lcd_frame[0];
-		unsigned char *pfb = (unsigned char *) (fb->screen_base);
+typedef unsigned char jzfb_pixel_t;
 #elif (CONFIG_JZLCD_FRAMEBUFFER_BPP == 16)
-		unsigned short *plcd_frame = (unsigned short *)lcd_frame[0];
-		unsigned short *pfb = (unsigned short *) (fb->screen_base);
+typedef unsigned short jzfb_pixel_t;
 #elif (CONFIG_JZLCD_FRAMEBUFFER_BPP == 32)
-		unsigned int *plcd_frame = (unsigned int *)lcd_frame[0];
-		unsigned int *pfb = (unsigned int *) (fb->screen_base);
+typedef unsigned int jzfb_pixel_t;
 #else
 #error	"ERROR, rotate not support this bpp."
 #endif
-		switch ( rotate_angle ) {
-		case FB_ROTATE_UR:
-			printk("%s, Warning, this shouldn't reache\n", __FUNCTION__);
-			ssleep(1);
-			break;
-		case FB_ROTATE_UD: /* cost about 30ms, can be accelrated by dma in the future */
-			plcd_frame += jzfb.w*jzfb.h -1;
-			for (i=0;i<jzfb.h*jzfb.w;i++)
-				*plcd_frame-- = *pfb++;
-			msleep(75);
-			break;
-		case FB_ROTATE_CW:  /* cost about 80ms */
-			for (i=1;i<fb->var.height+1; i++) {
-				for (j=1; j < fb->var.width+1; j++)
-					plcd_frame[j*fb->var.height-i] = *pfb++;
-			}
-			msleep(100); /* sleep 100ms */
-			break;
-		case FB_ROTATE_CCW:  /* cost about 80ms */
-			for (i=0;i<fb->var.height;i++) {
-				for ( j=fb->var.width-1;j>=0;j--)
-					plcd_frame[j*fb->var.height+i] = *pfb++;
+
+/* transpose in square tiles of one cache line per tile row */
+#define JZFB_TILE		(L1_CACHE_BYTES / sizeof(jzfb_pixel_t))
+#define JZFB_DAMAGE_RECTS	8
+/* collect page faults for about one frame before copying */
+#define JZFB_ROTATE_DEFER	(HZ / 50 ? HZ / 50 : 1)
+
+struct jzfb_rect {
+	int x0, y0, x1, y1;	/* x1, y1 exclusive */
+};
+
+static struct {
+	spinlock_t		lock;
+	wait_queue_head_t	wait;
+	struct mutex		copy_lock;	/* vs. jzfb_rotate_change() */
+	struct address_space	*mapping;	/* of the user mappings, */
+	int			nr_maps;	/* under copy_lock */
+	int			nr_rects;
+	struct jzfb_rect	rects[JZFB_DAMAGE_RECTS];
+	unsigned long		*dirty_pages;	/* pages of lcd_frame_user_fb */
+	unsigned int		nr_pages;
+	int			pending;
+	int			flush;		/* copy without deferring */
+	struct jz_fb_rotate_stats stats;
+} jzfb_damage;
+
+static void jzfb_rect_union(struct jzfb_rect *r, const struct jzfb_rect *n)
+{
+	r->x0 = min(r->x0, n->x0);
+	r->y0 = min(r->y0, n->y0);
+	r->x1 = max(r->x1, n->x1);
+	r->y1 = max(r->y1, n->y1);
+}
+
+static void __jzfb_add_damage(struct jzfb_rect *r)
+{
+	struct fb_info *fb = &jzlcd_info->fb;
+	int i;
+
+	r->x0 = max(r->x0, 0);
+	r->y0 = max(r->y0, 0);
+	r->x1 = min_t(int, r->x1, fb->var.xres);
+	r->y1 = min_t(int, r->y1, fb->var.yres);
+	if (r->x0 >= r->x1 || r->y0 >= r->y1)
+		return;
+
+	for (i = 0; i < jzfb_damage.nr_rects; i++) {
+		struct jzfb_rect *d = &jzfb_damage.rects[i];
+
+		/* already covered or overlapping: grow the existing one */
+		if (r->x0 <= d->x1 && d->x0 <= r->x1 &&
+		    r->y0 <= d->y1 && d->y0 <= r->y1) {
+			jzfb_rect_union(d, r);
+			return;
+		}
+	}
+	if (jzfb_damage.nr_rects < JZFB_DAMAGE_RECTS)
+		jzfb_damage.rects[jzfb_damage.nr_rects++] = *r;
+	else
+		jzfb_rect_union(&jzfb_damage.rects[JZFB_DAMAGE_RECTS - 1], r);
+}
+
+static void jzfb_damage_rect(int x, int y, int w, int h, int flush)
+{
+	struct jzfb_rect r = { x, y, x + w, y + h };
+	unsigned long flags;
+
+	spin_lock_irqsave(&jzfb_damage.lock, flags);
+	__jzfb_add_damage(&r);
+	jzfb_damage.pending = 1;
+	jzfb_damage.flush |= flush;
+	spin_unlock_irqrestore(&jzfb_damage.lock, flags);
+	wake_up(&jzfb_damage.wait);
+}
+
+static void jzfb_damage_all(void)
+{
+	struct fb_info *fb = &jzlcd_info->fb;
+
+	jzfb_damage_rect(0, 0, fb->var.xres, fb->var.yres, 1);
+}
+
+static void jzfb_rotate_fillrect(struct fb_info *info,
+				 const struct fb_fillrect *rect)
+{
+	cfb_fillrect(info, rect);
+	jzfb_damage_rect(rect->dx, rect->dy, rect->width, rect->height, 0);
+}
+
+static void jzfb_rotate_copyarea(struct fb_info *info,
+				 const struct fb_copyarea *area)
+{
+	cfb_copyarea(info, area);
+	jzfb_damage_rect(area->dx, area->dy, area->width, area->height, 0);
+}
+
+static void jzfb_rotate_imageblit(struct fb_info *info,
+				  const struct fb_image *image)
+{
+	cfb_imageblit(info, image);
+	jzfb_damage_rect(image->dx, image->dy, image->width, image->height, 0);
+}
+
+/*
+ * Copy one damaged rectangle of the user framebuffer (in user
+ * coordinates) to the panel framebuffer, cache-line tile by tile so
+ * that both the source rows and the destination columns of a tile stay
+ * in the D-cache while it is transposed.
+ */
+static unsigned int jzfb_rotate_rect(int angle, const struct jzfb_rect *r)
+{
+	struct fb_info *fb = &jzlcd_info->fb;
+	const jzfb_pixel_t *src = (const jzfb_pixel_t *)lcd_frame_user_fb;
+	jzfb_pixel_t *dst = (jzfb_pixel_t *)lcd_frame[0];
+	int sw = fb->var.xres, sh = fb->var.yres;
+	int tx, ty, txe, tye, x, y;
+	unsigned int len = (r->x1 - r->x0) * sizeof(jzfb_pixel_t);
+
+	switch (angle) {
+	case FB_ROTATE_UR:
+		/* the controller scans lcd_frame_user_fb itself */
+		for (y = r->y0; y < r->y1; y++)
+			dma_cache_wback((unsigned long)(src + y * sw + r->x0),
+					len);
+		return 0;
+	case FB_ROTATE_UD:
+		for (y = r->y0; y < r->y1; y++) {
+			const jzfb_pixel_t *s = src + y * sw;
+			jzfb_pixel_t *d = dst + (sh - 1 - y) * sw + (sw - 1);
+
+			for (x = r->x0; x < r->x1; x++)
+				d[-x] = s[x];
+			dma_cache_wback((unsigned long)(d - (r->x1 - 1)), len);
+		}
+		break;
+	case FB_ROTATE_CW:
+	case FB_ROTATE_CCW:
+		for (ty = r->y0; ty < r->y1; ty += JZFB_TILE) {
+			tye = min_t(int, ty + JZFB_TILE, r->y1);
+			for (tx = r->x0; tx < r->x1; tx += JZFB_TILE) {
+				txe = min_t(int, tx + JZFB_TILE, r->x1);
+				for (x = tx; x < txe; x++) {
+					const jzfb_pixel_t *s = src + x;
+					jzfb_pixel_t *d;
+
+					if (angle == FB_ROTATE_CW) {
+						d = dst + x * sh + (sh - 1);
+						for (y = ty; y < tye; y++)
+							d[-y] = s[y * sw];
+					} else {
+						d = dst + (sw - 1 - x) * sh;
+						for (y = ty; y < tye; y++)
+							d[y] = s[y * sw];
+					}
+				}
 			}
-			msleep(100); /* sleep 100ms */
+		}
+		/* every source column became a destination row */
+		len = (r->y1 - r->y0) * sizeof(jzfb_pixel_t);
+		for (x = r->x0; x < r->x1; x++) {
+			jzfb_pixel_t *d;
+
+			if (angle == FB_ROTATE_CW)
+				d = dst + x * sh + (sh - r->y1);
+			else
+				d = dst + (sw - 1 - x) * sh + r->y0;
+			dma_cache_wback((unsigned long)d, len);
+		}
+		break;
+	default:
+		return 0;
+	}
+	return (r->x1 - r->x0) * (r->y1 - r->y0) * sizeof(jzfb_pixel_t);
+}
+
+static int jzfb_rotate_daemon_thread(void *info)
+{
+	struct fb_info *fb = &jzlcd_info->fb;
+	struct jzfb_rect rects[JZFB_DAMAGE_RECTS];
+	unsigned long *dirty;
+	unsigned int nr_longs;
+	int i, nr_rects;
+
+	nr_longs = BITS_TO_LONGS(jzfb_damage.nr_pages);
+	dirty = kmalloc(nr_longs * sizeof(unsigned long), GFP_KERNEL);
+	if (!dirty)
+		return -ENOMEM;
+
+	while (!kthread_should_stop()) {
+		unsigned int bytes = 0;
+		ktime_t start;
+		s64 usec;
+
+		wait_event_interruptible(jzfb_damage.wait,
+					 jzfb_damage.pending ||
+					 kthread_should_stop());
+		if (kthread_should_stop())
 			break;
-		default:	/* FB_ROTATE_UR */
-			dprintk("Unknown rotate(%d) type\n", rotate_angle);
-			ssleep(1);
+		/* let the client finish its frame before we look at it */
+		if (!jzfb_damage.flush)
+			schedule_timeout_interruptible(JZFB_ROTATE_DEFER);
+
+		mutex_lock(&jzfb_damage.copy_lock);
+		spin_lock_irq(&jzfb_damage.lock);
+		memcpy(dirty, jzfb_damage.dirty_pages,
+		       nr_longs * sizeof(unsigned long));
+		memset(jzfb_damage.dirty_pages, 0,
+		       nr_longs * sizeof(unsigned long));
+		jzfb_damage.pending = 0;
+		jzfb_damage.flush = 0;
+		spin_unlock_irq(&jzfb_damage.lock);
+
+		start = ktime_get();
+		/*
+		 * Unmap the pages before reading them, so that anything
+		 * drawn while we copy faults and is picked up by the next
+		 * pass. Each dirty page damages the rows it overlaps.
+		 */
+		for (i = find_first_bit(dirty, jzfb_damage.nr_pages);
+		     i < jzfb_damage.nr_pages;
+		     i = find_next_bit(dirty, jzfb_damage.nr_pages, i + 1)) {
+			struct jzfb_rect r;
+
+			/* the next access faults and marks it again */
+			if (jzfb_damage.mapping)
+				unmap_mapping_range(jzfb_damage.mapping,
+						    (loff_t)i << PAGE_SHIFT,
+						    PAGE_SIZE, 1);
+
+			r.x0 = 0;
+			r.x1 = fb->var.xres;
+			r.y0 = (i << PAGE_SHIFT) / fb->fix.line_length;
+			r.y1 = (((i + 1) << PAGE_SHIFT) - 1) /
+				fb->fix.line_length + 1;
+			spin_lock_irq(&jzfb_damage.lock);
+			__jzfb_add_damage(&r);
+			spin_unlock_irq(&jzfb_damage.lock);
 		}
 
-		dma_cache_wback_inv((unsigned int)(lcd_frame_user_fb), fb->fix.smem_len);
+		spin_lock_irq(&jzfb_damage.lock);
+		nr_rects = jzfb_damage.nr_rects;
+		memcpy(rects, jzfb_damage.rects, nr_rects * sizeof(rects[0]));
+		jzfb_damage.nr_rects = 0;
+		spin_unlock_irq(&jzfb_damage.lock);
+
+		for (i = 0; i < nr_rects; i++)
+			bytes += jzfb_rotate_rect(rotate_angle, &rects[i]);
+		mutex_unlock(&jzfb_damage.copy_lock);
+
+		usec = ktime_to_us(ktime_sub(ktime_get(), start));
+		jzfb_damage.stats.frames++;
+		jzfb_damage.stats.bytes += bytes;
+		jzfb_damage.stats.last_bytes = bytes;
+		jzfb_damage.stats.last_usec = usec;
+		if (usec > jzfb_damage.stats.max_usec)
+			jzfb_damage.stats.max_usec = usec;
+	}
+
+	kfree(dirty);
+	return 0;
+}
+
+/*
+ * Map in a page of lcd_frame_user_fb. Every fault counts as damage to
+ * the page, reads included: the daemon unmaps the page again before it
+ * copies it, so a page is only ever mapped (and writable) while it is
+ * marked dirty, and the next write after the copy faults again.
+ */
+static int jzfb_rotate_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct fb_info *fb = vma->vm_private_data;
+	unsigned long flags;
+	struct page *page;
+
+	if (vmf->pgoff >= jzfb_damage.nr_pages ||
+	    (vmf->pgoff << PAGE_SHIFT) >= fb->fix.smem_len)
+		return VM_FAULT_SIGBUS;
+
+	page = virt_to_page(lcd_frame_user_fb + (vmf->pgoff << PAGE_SHIFT));
+	get_page(page);
+	vmf->page = page;
+
+	spin_lock_irqsave(&jzfb_damage.lock, flags);
+	set_bit(vmf->pgoff, jzfb_damage.dirty_pages);
+	jzfb_damage.pending = 1;
+	jzfb_damage.stats.faults++;
+	spin_unlock_irqrestore(&jzfb_damage.lock, flags);
+	wake_up(&jzfb_damage.wait);
+	return 0;
+}
+
+static void jzfb_rotate_vm_open(struct vm_area_struct *vma)
+{
+	mutex_lock(&jzfb_damage.copy_lock);
+	jzfb_damage.nr_maps++;
+	mutex_unlock(&jzfb_damage.copy_lock);
+}
+
+static void jzfb_rotate_vm_close(struct vm_area_struct *vma)
+{
+	mutex_lock(&jzfb_damage.copy_lock);
+	if (--jzfb_damage.nr_maps == 0)
+		jzfb_damage.mapping = NULL;
+	mutex_unlock(&jzfb_damage.copy_lock);
+}
+
+static struct vm_operations_struct jzfb_rotate_vm_ops = {
+	.open		= jzfb_rotate_vm_open,
+	.close		= jzfb_rotate_vm_close,
+	.fault		= jzfb_rotate_fault,
+};
+
+/*
+ * The user framebuffer is mapped page by page (and cacheable) so that
+ * writes to it can be tracked through faults. The daemon unmaps the
+ * pages through the device's address_space; they are not page cache and
+ * are not tied to it in any other way.
+ */
+static int jzfb_rotate_mmap(struct fb_info *info, struct vm_area_struct *vma)
+{
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+	struct address_space *mapping = vma->vm_file->f_mapping;
+
+	if ((vma->vm_end - vma->vm_start + off) > PAGE_ALIGN(info->fix.smem_len))
+		return -EINVAL;
+
+	/* all mappings have to be unmappable through one address_space */
+	mutex_lock(&jzfb_damage.copy_lock);
+	if (jzfb_damage.mapping && jzfb_damage.mapping != mapping) {
+		mutex_unlock(&jzfb_damage.copy_lock);
+		return -EBUSY;
 	}
+	jzfb_damage.mapping = mapping;
+	jzfb_damage.nr_maps++;
+	mutex_unlock(&jzfb_damage.copy_lock);
+
+	vma->vm_ops = &jzfb_rotate_vm_ops;
+	vma->vm_flags |= (VM_IO | VM_RESERVED | VM_DONTEXPAND);
+	vma->vm_private_data = info;
 	return 0;
 }
+
+static int jzfb_rotate_init(struct fb_info *fb)
+{
+	spin_lock_init(&jzfb_damage.lock);
+	init_waitqueue_head(&jzfb_damage.wait);
+	mutex_init(&jzfb_damage.copy_lock);
+	jzfb_damage.nr_pages = PAGE_ALIGN(fb->fix.smem_len) >> PAGE_SHIFT;
+	jzfb_damage.dirty_pages = kzalloc(BITS_TO_LONGS(jzfb_damage.nr_pages) *
+					  sizeof(unsigned long), GFP_KERNEL);
+	if (!jzfb_damage.dirty_pages)
+		return -ENOMEM;
+	return 0;
+}
+
 /* 
  * rotate param angle:
  * 	0: FB_ROTATE_UR, 0'C
@@ -305,6 +631,12 @@ static int jzfb_rotate_change( int angle )
 {
 	struct fb_info *fb = &jzlcd_info->fb;
 
+	if (angle < FB_ROTATE_UR || angle > FB_ROTATE_CCW) {
+		printk("Invalid angle(%d)\n", (unsigned int)angle);
+		return -EINVAL;
+	}
+
+	mutex_lock(&jzfb_damage.copy_lock);
 	/* clear frame buffer */
 	memset((void*)lcd_frame_user_fb, 0x00, fb->fix.smem_len);
 	switch ( angle ) {
@@ -313,9 +645,6 @@ static int jzfb_rotate_change( int angle )
 		fb->var.height	= fb->var.yres = fb->var.yres_virtual = jzfb.h;
 		/* change lcd controller's data buffer to lcd_frame_user_fb*/
 		lcd_frame_desc0->databuf = virt_to_phys((void *)lcd_frame_user_fb);
-		if ( rotate_angle != FB_ROTATE_UR )
-			kthread_stop(jzlcd_info->rotate_daemon_thread);
-		rotate_angle = angle;
 		break;
 	case FB_ROTATE_UD:
 	case FB_ROTATE_CW:
@@ -330,16 +659,30 @@ static int jzfb_rotate_change( int angle )
 		}
 		/* change lcd controller's data buffer to lcd_frame[0]*/
 		lcd_frame_desc0->databuf = virt_to_phys((void *)lcd_frame[0]);
-		if ( rotate_angle == FB_ROTATE_UR ||		\
-		     jzlcd_info->rotate_daemon_thread == NULL) 
-				jzlcd_info->rotate_daemon_thread = kthread_run( jzfb_rotate_daemon_thread, jzlcd_info, "%s", "jzlcd-rotate-daemon"); /* start rotate daemon */
-		rotate_angle = angle;
 		break;
-	default:
-		printk("Invalid angle(%d)\n", (unsigned int)angle);
 	}
+	rotate_angle = angle;
 	fb->fix.line_length = fb->var.xres * CONFIG_JZLCD_FRAMEBUFFER_BPP/8;
+	/* pending damage is in the old geometry */
+	spin_lock_irq(&jzfb_damage.lock);
+	jzfb_damage.nr_rects = 0;
+	spin_unlock_irq(&jzfb_damage.lock);
 	dma_cache_wback_inv((unsigned int)(lcd_frame_desc0), sizeof(struct lcd_desc));	
+	mutex_unlock(&jzfb_damage.copy_lock);
+
+	/* start rotate daemon, it also serves FB_ROTATE_UR */
+	if (jzlcd_info->rotate_daemon_thread == NULL) {
+		struct task_struct *t;
+
+		t = kthread_run(jzfb_rotate_daemon_thread, jzlcd_info,
+				"%s", "jzlcd-rotate-daemon");
+		if (IS_ERR(t)) {
+			printk("jzlcd: cannot start the rotate daemon\n");
+			return PTR_ERR(t);
+		}
+		jzlcd_info->rotate_daemon_thread = t;
+	}
+	jzfb_damage_all();
 	return 0;
 }
 
@@ -470,6 +813,20 @@ static int jzfb_ioctl (struct fb_info *fb, unsigned int cmd, unsigned long arg )
 	case FBIOROTATE:
 		ret = jzfb_rotate_change(arg);
 		break;
+	case FBIODAMAGE:
+	{
+		struct jz_fb_damage_rect r;
+
+		if (copy_from_user(&r, argp, sizeof(r)))
+			return -EFAULT;
+		jzfb_damage_rect(r.x, r.y, r.width, r.height, 1);
+		break;
+	}
+	case FBIOGETROTSTATS:
+		if (copy_to_user(argp, &jzfb_damage.stats,
+				 sizeof(struct jz_fb_rotate_stats)))
+			return -EFAULT;
+		break;
 #endif	/* defined(CONFIG_JZLCD_FRAMEBUFFER_ROTATE_SUPPORT) */
 	default:
 		printk("Warn: Command(%x) not support\n", cmd);
@@ -611,10 +968,17 @@ static struct fb_ops jzfb_ops = {
 	.fb_set_par 		= jzfb_set_par,
 	.fb_blank		= jzfb_blank,
 	.fb_pan_display		= jzfb_pan_display,
+#if !defined(CONFIG_JZLCD_FRAMEBUFFER_ROTATE_SUPPORT)
 	.fb_fillrect		= cfb_fillrect,
 	.fb_copyarea		= cfb_copyarea,
 	.fb_imageblit		= cfb_imageblit,
 	.fb_mmap		= jzfb_mmap,
+#else
+	.fb_fillrect		= jzfb_rotate_fillrect,
+	.fb_copyarea		= jzfb_rotate_copyarea,
+	.fb_imageblit		= jzfb_rotate_imageblit,
+	.fb_mmap		= jzfb_rotate_mmap,
+#endif
 	.fb_ioctl		= jzfb_ioctl,
 #if defined(CONFIG_JZLCD_FRAMEBUFFER_ROTATE_SUPPORT)
 	.fb_rotate		= jzfb_fb_rotate,
@@ -907,7 +1271,8 @@ static int jzfb_map_smem(struct lcd_cfb_info *cfb)
 	cfb->fb.screen_base =
 		(unsigned char *)(((unsigned int)lcd_frame[0] & 0x1fffffff) | 0xa0000000);
 #else  /* Framebuffer rotate */
-	lcd_frame_user_fb = (unsigned char *)__get_free_pages(GFP_KERNEL, page_shift);
+	/* compound, so that the pages can be refcounted by user mappings */
+	lcd_frame_user_fb = (unsigned char *)__get_free_pages(GFP_KERNEL | __GFP_COMP, page_shift);
 	if ((!lcd_frame_user_fb)) {
 		printk("no mem for fb[%d]\n", t);
 		return -ENOMEM;
@@ -924,7 +1289,11 @@ static int jzfb_map_smem(struct lcd_cfb_info *cfb)
 	       (unsigned int)virt_to_phys((void *)lcd_frame_user_fb));
 	cfb->fb.fix.smem_start = virt_to_phys((void *)lcd_frame_user_fb);
 	cfb->fb.fix.smem_len = (PAGE_SIZE << page_shift);
-	cfb->fb.screen_base = (unsigned char *)(((unsigned int)lcd_frame_user_fb & 0x1fffffff) | 0xa0000000);
+	/*
+	 * Cached like the user mappings, the rotate daemon writes back
+	 * whatever it copies.
+	 */
+	cfb->fb.screen_base = lcd_frame_user_fb;
 
 #endif	/* #if defined(CONFIG_JZLCD_FRAMEBUFFER_ROTATE_SUPPORT) */
 	if (!cfb->fb.screen_base) {
@@ -995,8 +1364,11 @@ static void jzfb_unmap_smem(struct lcd_cfb_info *cfb)
 		     tmp += PAGE_SIZE) {
 			map = virt_to_page(tmp);
 			clear_bit(PG_reserved, &map->flags);
+			/* set by writes through the user mappings */
+			ClearPageDirty(map);
 		}
 		free_pages((int)lcd_frame_user_fb, page_shift);
+		kfree(jzfb_damage.dirty_pages);
 	}
 	
 #endif
@@ -1509,7 +1881,12 @@ static int __init jzfb_init(void)
 //	__lcd_enable_ifu0_intr(); /* needn't enable InFifo underrun */
 
 #if defined(CONFIG_JZLCD_FRAMEBUFFER_ROTATE_SUPPORT)
-	jzfb_rotate_change(rotate_angle);
+	err = jzfb_rotate_init(&cfb->fb);
+	if (err)
+		goto failed;
+	err = jzfb_rotate_change(rotate_angle);
+	if (err)
+		goto failed;
 	/* sleep n??? */
 #endif
 	err = register_framebuffer(&cfb->fb);
@@ -1566,7 +1943,8 @@ static struct device_driver jzfb_driver = {
 static void __exit jzfb_cleanup(void)
 {
 #if defined(CONFIG_JZLCD_FRAMEBUFFER_ROTATE_SUPPORT)
-	kthread_stop(jzlcd_info->rotate_daemon_thread);
+	if (jzlcd_info->rotate_daemon_thread)
+		kthread_stop(jzlcd_info->rotate_daemon_thread);
 #endif
 //	driver_unregister(&jzfb_driver);
 //	jzfb_remove();
@@ -75,6 +75,8 @@ struct lcd_desc{
 #define FBIOPRINT_REGS		0x468c
 #define FBIOGETBUFADDRS		0x468d
 #define FBIOROTATE		0x46a0 /* rotated fb */
+#define FBIODAMAGE		0x46a1 /* rotated fb: copy this area now */
+#define FBIOGETROTSTATS		0x46a2 /* rotated fb: copy statistics */
 
 struct jz_lcd_buffer_addrs_t {
 	int fb_num;
@@ -82,6 +84,24 @@ struct jz_lcd_buffer_addrs_t {
 	unsigned int fb_phys_addr[CONFIG_JZLCD_FRAMEBUFFER_MAX];
 };
 
+/* FBIODAMAGE argument, in the coordinates of the rotated framebuffer */
+struct jz_fb_damage_rect {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+/* FBIOGETROTSTATS result */
+struct jz_fb_rotate_stats {
+	unsigned int frames;		/* copy passes */
+	unsigned int faults;		/* write faults on the mmap'd fb */
+	unsigned long long bytes;	/* bytes copied in total */
+	unsigned int last_bytes;	/* bytes copied by the last pass */
+	unsigned int last_usec;		/* duration of the last pass */
+	unsigned int max_usec;
+};
+
 
 /*
  * LCD panel specific definition
@@ -90,7 +90,11 @@
 #endif /* #if DEBUG_EPI != 0 */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+/* Event bits that may be combined with EPOLLEXCLUSIVE */
+#define EPOLLEXCLUSIVE_OK_BITS (POLLIN | POLLOUT | POLLERR | POLLHUP | \
+				EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of poll wake up nests we are allowing */
 #define EP_MAX_POLLWAKE_NESTS 4
@@ -608,10 +612,15 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  * This is the callback that is passed to the wait queue wakeup
  * machanism. It is called by the stored file descriptors when they
  * have events to report.
+ *
+ * Items added with EPOLLEXCLUSIVE sit on the target wait queue as
+ * exclusive entries. For those we only report a wakeup when we really
+ * woke a task in epoll_wait(), so that the wake up moves on to the next
+ * epoll instance if nobody was waiting on this one.
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
+	int pwake = 0, ewake = 0;
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
@@ -655,9 +664,11 @@ is_linked:
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
-	if (waitqueue_active(&ep->wq))
+	if (waitqueue_active(&ep->wq)) {
+		ewake = 1;
 		__wake_up_locked(&ep->wq, TASK_UNINTERRUPTIBLE |
 				 TASK_INTERRUPTIBLE);
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
@@ -668,6 +679,9 @@ out_unlock:
 	if (pwake)
 		ep_poll_safewake(&psw, &ep->poll_wait);
 
+	if (epi->event.events & EPOLLEXCLUSIVE)
+		return ewake;
+
 	return 1;
 }
 
@@ -685,7 +699,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1163,6 +1180,19 @@ asmlinkage long sys_epoll_ctl(int epfd, int op, int fd,
 	 */
 	ep = file->private_data;
 
+	/*
+	 * EPOLLEXCLUSIVE is only accepted on EPOLL_CTL_ADD, with a limited
+	 * set of events, and not for nested epoll files: the wake up
+	 * accounting in ep_poll_callback() can't see through those.
+	 */
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD)
+			goto error_tgt_fput;
+		if (is_file_epoll(tfile) ||
+		    (epds.events & ~EPOLLEXCLUSIVE_OK_BITS))
+			goto error_tgt_fput;
+	}
+
 	mutex_lock(&ep->mtx);
 
 	/*
@@ -1190,6 +1220,9 @@ asmlinkage long sys_epoll_ctl(int epfd, int op, int fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
+			/* Exclusive items can't change their wait queue mode */
+			if (epi->event.events & EPOLLEXCLUSIVE)
+				break;
 			epds.events |= POLLERR | POLLHUP;
 			error = ep_modify(ep, epi, &epds);
 		} else
@@ -54,6 +54,44 @@
 #include "ubifs.h"
 #include <linux/mount.h>
 
+/**
+ * read_block - uncompress a data node into a page.
+ * @inode: inode the data node belongs to
+ * @addr: page address
+ * @dn: the data node
+ *
+ * Returns zero in case of success and %-EINVAL if the data node is bad.
+ */
+static int read_block(struct inode *inode, void *addr,
+		      struct ubifs_data_node *dn)
+{
+	int err, len, out_len;
+	unsigned int dlen;
+
+	ubifs_assert(dn->ch.sqnum > ubifs_inode(inode)->creat_sqnum);
+
+	len = le32_to_cpu(dn->size);
+	if (len <= 0 || len > PAGE_CACHE_SIZE)
+		return -EINVAL;
+
+	dlen = le32_to_cpu(dn->ch.len) - UBIFS_DATA_NODE_SZ;
+	out_len = PAGE_CACHE_SIZE;
+	err = ubifs_decompress(&dn->data, dlen, addr, &out_len,
+			       le16_to_cpu(dn->compr_type));
+	if (err || len != out_len)
+		return -EINVAL;
+
+	/*
+	 * Data length can be less than a full page, even for blocks that are
+	 * not the last in the file (e.g., as a result of making a hole and
+	 * appending data). Ensure that the remainder is zeroed out.
+	 */
+	if (len < PAGE_CACHE_SIZE)
+		memset(addr + len, 0, PAGE_CACHE_SIZE - len);
+
+	return 0;
+}
+
 /* TODO: remove compatibility stuff as late as possible */
 #ifdef UBIFS_COMPAT_USE_OLD_PREPARE_WRITE
 int ubifs_do_readpage(struct page *page)
@@ -62,12 +100,11 @@ static int do_readpage(struct page *page)
 #endif
 {
 	void *addr;
-	int err, len, out_len;
+	int err;
 	union ubifs_key key;
 	struct ubifs_data_node *dn;
 	struct inode *inode = page->mapping->host;
 	struct ubifs_info *c = inode->i_sb->s_fs_info;
-	unsigned int dlen;
 	loff_t i_size =  i_size_read(inode);
 
 	dbg_gen("ino %lu, pg %lu, i_size %lld, flags %#lx",
@@ -106,27 +143,10 @@ static int do_readpage(struct page *page)
 		goto error;
 	}
 
-	ubifs_assert(dn->ch.sqnum > ubifs_inode(inode)->creat_sqnum);
-
-	len = le32_to_cpu(dn->size);
-	if (len <= 0 || len > PAGE_CACHE_SIZE)
-		goto dump;
-
-	dlen = le32_to_cpu(dn->ch.len) - UBIFS_DATA_NODE_SZ;
-	out_len = PAGE_CACHE_SIZE;
-	err = ubifs_decompress(&dn->data, dlen, addr, &out_len,
-			       le16_to_cpu(dn->compr_type));
-	if (err || len != out_len)
+	err = read_block(inode, addr, dn);
+	if (err)
 		goto dump;
 
-	/*
-	 * Data length can be less than a full page, even for blocks that are
-	 * not the last in the file (e.g., as a result of making a hole and
-	 * appending data). Ensure that the remainder is zeroed out.
-	 */
-	if (len < PAGE_CACHE_SIZE)
-		memset(addr + len, 0, PAGE_CACHE_SIZE - len);
-
 out_free:
 	kfree(dn);
 out:
@@ -137,7 +157,6 @@ out:
 	return 0;
 
 dump:
-	err = -EINVAL;
 	ubifs_err("bad data node (page %lu, inode %lu)",
 		  page->index, inode->i_ino);
 	dbg_dump_node(c, dn);
@@ -349,8 +368,144 @@ out:
 
 #endif /* UBIFS_COMPAT_USE_OLD_PREPARE_WRITE */
 
+/**
+ * populate_page - fill a page from bulk-read data nodes.
+ * @c: UBIFS file-system description object
+ * @page: the page to fill, locked
+ * @bu: bulk-read information
+ * @n: index of the next data node to look at in @bu, advanced here
+ *
+ * Pages the bulk-read does not have a data node for are holes. Returns zero in
+ * case of success and %-EINVAL if the data node is bad.
+ */
+static int populate_page(struct ubifs_info *c, struct page *page,
+			 struct bu_info *bu, int *n)
+{
+	int i = *n, err = 0;
+	void *addr, *dn;
+	struct inode *inode = page->mapping->host;
+
+	dbg_gen("ino %lu, pg %lu", inode->i_ino, page->index);
+	addr = kmap(page);
+
+	while (i < bu->cnt && key_block(c, &bu->zbranch[i].key) < page->index)
+		i++;
+	if (i < bu->cnt && key_block(c, &bu->zbranch[i].key) == page->index) {
+		dn = bu->buf + bu->zbranch[i].offs - bu->zbranch[0].offs;
+		err = read_block(inode, addr, dn);
+		i++;
+	} else {
+		SetPageChecked(page);
+		memset(addr, 0, PAGE_CACHE_SIZE);
+	}
+	*n = i;
+
+	if (err) {
+		ubifs_err("bad data node (page %lu, inode %lu)",
+			  page->index, inode->i_ino);
+		ClearPageUptodate(page);
+		SetPageError(page);
+	} else {
+		SetPageUptodate(page);
+		ClearPageError(page);
+	}
+	flush_dcache_page(page);
+	kunmap(page);
+	return err;
+}
+
+/**
+ * ubifs_bulk_read - read a page and the pages which follow it in one go.
+ * @page: the page to read, locked
+ *
+ * Reading a file page by page costs a TNC look-up and a flash I/O per page.
+ * When a file is read sequentially and its data nodes sit one after another
+ * in a LEB, as they usually do after the file has been written sequentially,
+ * this function reads them with one I/O and puts the pages following @page
+ * into the page cache as well. Returns %1 if @page has been read and
+ * unlocked, and %0 if the caller has to read it.
+ */
+static int ubifs_bulk_read(struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	struct inode *inode = mapping->host;
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	pgoff_t index = page->index, last_page_read = ui->last_page_read;
+	loff_t i_size = i_size_read(inode);
+	struct bu_info *bu = &c->bu;
+	pgoff_t end_index;
+	int i, n = 0;
+
+	/* These are just hints, so no locking */
+	ui->last_page_read = index;
+	if (!c->bulk_read)
+		return 0;
+
+	if (index != last_page_read + 1) {
+		ui->read_in_a_row = 1;
+		return 0;
+	}
+	ui->read_in_a_row += 1;
+	if (ui->read_in_a_row < BULK_READ_THRESHOLD || i_size == 0)
+		return 0;
+
+	end_index = (i_size - 1) >> PAGE_CACHE_SHIFT;
+	if (index > end_index)
+		return 0;
+
+	/* Do not wait for somebody else's bulk-read, read the page instead */
+	if (!mutex_trylock(&c->bu_mutex))
+		return 0;
+
+	if (!bu->buf) {
+		bu->buf = vmalloc(c->max_bu_buf_len);
+		if (!bu->buf)
+			goto out_unlock;
+	}
+
+	bu->buf_len = c->max_bu_buf_len;
+	bu->blk_cnt = UBIFS_MAX_BULK_READ;
+	if (bu->blk_cnt > end_index - index + 1)
+		bu->blk_cnt = end_index - index + 1;
+	data_key_init(c, &bu->key, inode->i_ino, index);
+
+	/* Not worth it if the page is a hole or the next node is elsewhere */
+	if (ubifs_tnc_get_bu(c, bu) || bu->cnt < 2)
+		goto out_unlock;
+
+	if (ubifs_tnc_bulk_read(c, bu))
+		goto out_unlock;
+
+	if (populate_page(c, page, bu, &n))
+		goto out_unlock;
+	unlock_page(page);
+
+	for (i = 1; i < bu->blk_cnt; i++) {
+		struct page *p;
+
+		p = grab_cache_page_nowait(mapping, index + i);
+		if (!p)
+			continue;
+		if (!PageUptodate(p) && !PagePrivate(p) && !PageChecked(p))
+			populate_page(c, p, bu, &n);
+		unlock_page(p);
+		page_cache_release(p);
+	}
+
+	ui->last_page_read = index + bu->blk_cnt - 1;
+	mutex_unlock(&c->bu_mutex);
+	return 1;
+
+out_unlock:
+	mutex_unlock(&c->bu_mutex);
+	return 0;
+}
+
 static int ubifs_readpage(struct file *file, struct page *page)
 {
+	if (ubifs_bulk_read(page))
+		return 0;
 	do_readpage(page);
 	unlock_page(page);
 	return 0;
@@ -1718,6 +1718,175 @@ out:
 	return err;
 }
 
+/**
+ * ubifs_tnc_get_bu - build information for a bulk-read.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read parameters and results
+ *
+ * Looks up the data node with key @bu->key and the data nodes of the same
+ * inode which follow it. Only nodes which sit one after another in the same
+ * LEB are taken, so that they may be read with one I/O. On entry @bu->blk_cnt
+ * is the maximum number of data blocks to consider, on exit it is the number
+ * of blocks the found nodes cover, including holes. This function returns
+ * zero in case of success, %-ENOENT if there is no data node with key
+ * @bu->key, and a negative error code in case of failure.
+ */
+int ubifs_tnc_get_bu(struct ubifs_info *c, struct bu_info *bu)
+{
+	int n, err, lnum = -1, start = 0, offs = 0;
+	unsigned int block = key_block(c, &bu->key), first_block = block;
+	unsigned int max_block = block + bu->blk_cnt - 1;
+	ino_t inum = key_ino(c, &bu->key);
+	struct ubifs_znode *znode;
+	struct ubifs_zbranch *zbr;
+
+	bu->cnt = 0;
+	bu->blk_cnt = 0;
+
+	mutex_lock(&c->tnc_mutex);
+	err = lookup_level0(c, &bu->key, &znode, &n);
+	if (err <= 0) {
+		if (err == 0)
+			err = -ENOENT;
+		goto out;
+	}
+
+	while (1) {
+		zbr = &znode->zbranch[n];
+		if (key_ino(c, &zbr->key) != inum ||
+		    key_type(c, &zbr->key) != UBIFS_DATA_KEY)
+			break;
+
+		block = key_block(c, &zbr->key);
+		if (block > max_block)
+			break;
+
+		if (lnum < 0) {
+			lnum = zbr->lnum;
+			start = zbr->offs;
+		} else if (zbr->lnum != lnum || zbr->offs != offs)
+			/* The node has to directly follow the previous one */
+			break;
+
+		if (zbr->offs + zbr->len - start > bu->buf_len)
+			break;
+		offs = ALIGN(zbr->offs + zbr->len, 8);
+
+		bu->zbranch[bu->cnt++] = *zbr;
+		bu->blk_cnt = block - first_block + 1;
+		if (bu->cnt >= UBIFS_MAX_BULK_READ)
+			break;
+
+		err = tnc_next(c, &znode, &n);
+		if (err == -ENOENT) {
+			err = 0;
+			break;
+		}
+		if (err)
+			goto out;
+	}
+	err = 0;
+
+	dbg_tnc("bulk-read %d nodes, %d blocks at LEB %d:%d",
+		bu->cnt, bu->blk_cnt, lnum, start);
+out:
+	mutex_unlock(&c->tnc_mutex);
+	return err;
+}
+
+/**
+ * read_wbuf - bulk-read from a LEB with a write-buffer.
+ * @wbuf: the write-buffer
+ * @buf: buffer to read into
+ * @len: how many bytes to read
+ * @lnum: LEB number
+ * @offs: offset to read from
+ *
+ * Same as 'ubi_read()', but the data which has not been written to the flash
+ * yet is taken from the write-buffer. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static int read_wbuf(struct ubifs_wbuf *wbuf, void *buf, int len, int lnum,
+		     int offs)
+{
+	const struct ubifs_info *c = wbuf->c;
+	int rlen, overlap;
+
+	spin_lock(&wbuf->lock);
+	overlap = (lnum == wbuf->lnum && offs + len > wbuf->offs);
+	if (!overlap) {
+		spin_unlock(&wbuf->lock);
+		return ubi_read(c->ubi, lnum, buf, offs, len);
+	}
+
+	/* Don't read under wbuf */
+	rlen = wbuf->offs - offs;
+	if (rlen < 0)
+		rlen = 0;
+
+	/* Copy the rest from the write-buffer */
+	memcpy(buf + rlen, wbuf->buf + offs + rlen - wbuf->offs, len - rlen);
+	spin_unlock(&wbuf->lock);
+
+	if (rlen > 0)
+		return ubi_read(c->ubi, lnum, buf, offs, rlen);
+	return 0;
+}
+
+/**
+ * ubifs_tnc_bulk_read - read the data nodes found by 'ubifs_tnc_get_bu()'.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ *
+ * Reads all the nodes of @bu with one I/O and checks them. The nodes may have
+ * been moved by the garbage collector or by a write since 'ubifs_tnc_get_bu()'
+ * looked them up, in which case %-EAGAIN is returned and the caller has to
+ * read the nodes one by one. Returns zero in case of success and a negative
+ * error code in case of failure.
+ */
+int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu)
+{
+	int lnum = bu->zbranch[0].lnum, offs = bu->zbranch[0].offs, len, err, i;
+	struct ubifs_zbranch *zbr;
+	struct ubifs_wbuf *wbuf;
+	union ubifs_key key;
+	void *buf;
+
+	zbr = &bu->zbranch[bu->cnt - 1];
+	len = zbr->offs + zbr->len - offs;
+	ubifs_assert(len <= bu->buf_len);
+
+	wbuf = ubifs_get_wbuf(c, lnum);
+	if (wbuf)
+		err = read_wbuf(wbuf, bu->buf, len, lnum, offs);
+	else
+		err = ubi_read(c->ubi, lnum, bu->buf, offs, len);
+	if (err && err != -EBADMSG) {
+		ubifs_err("failed to bulk-read %d bytes from LEB %d:%d, "
+			  "error %d", len, lnum, offs, err);
+		return err;
+	}
+
+	for (i = 0; i < bu->cnt; i++) {
+		struct ubifs_ch *ch;
+
+		zbr = &bu->zbranch[i];
+		buf = bu->buf + zbr->offs - offs;
+		ch = buf;
+
+		if (ch->node_type != UBIFS_DATA_NODE ||
+		    le32_to_cpu(ch->len) != zbr->len ||
+		    ubifs_check_node(c, buf, lnum, zbr->offs, 1))
+			return -EAGAIN;
+
+		key_read(c, buf + UBIFS_KEY_OFFSET, &key);
+		if (keys_cmp(c, &zbr->key, &key))
+			return -EAGAIN;
+	}
+
+	return 0;
+}
+
 /**
  * do_lookup_nm- look up a "hashed" node.
  * directory entry file-system node.
@@ -124,6 +124,12 @@
 /* Maximum expected tree height for use by bottom_up_buf */
 #define BOTTOM_UP_HEIGHT 64
 
+/* Maximum number of data nodes to bulk-read */
+#define UBIFS_MAX_BULK_READ 32
+
+/* How many pages have to be read in a row before bulk-read kicks in */
+#define BULK_READ_THRESHOLD 3
+
 /*
  * Znode flags (actually, bit numbers which store the flags).
  *
@@ -294,6 +300,8 @@ struct ubifs_gced_idx_leb {
  * @compr_type: default compression type used for this inode
  * @data_len: length of the data attached to the inode
  * @data: inode's data
+ * @last_page_read: page number of last page read (for bulk-read)
+ * @read_in_a_row: number of consecutive pages read in a row (for bulk-read)
  *
  * UBIFS has its own inode mutex, besides the VFS 'i_mutex'. The reason for
  * this is budgeting - UBIFS has to budget each operation. So, if an operation
@@ -325,6 +333,8 @@ struct ubifs_inode {
 	int compr_type;
 	int data_len;
 	void *data;
+	pgoff_t last_page_read;
+	pgoff_t read_in_a_row;
 };
 
 /**
@@ -782,9 +792,29 @@ struct ubifs_orphan {
 /**
  * struct ubifs_mount_opts - UBIFS-specific mount options information.
  * @unmount_mode: selected unmount mode (%0 default, %1 normal, %2 fast)
+ * @bulk_read: enable bulk-reads (%0 default, %1 disable, %2 enable)
  */
 struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
+	unsigned int bulk_read:2;
+};
+
+/**
+ * struct bu_info - bulk-read information.
+ * @key: first data node key
+ * @zbranch: zbranches of data nodes to bulk read
+ * @buf: buffer to read into
+ * @buf_len: buffer length
+ * @cnt: number of data nodes for bulk read
+ * @blk_cnt: number of data blocks including holes
+ */
+struct bu_info {
+	union ubifs_key key;
+	struct ubifs_zbranch zbranch[UBIFS_MAX_BULK_READ];
+	void *buf;
+	int buf_len;
+	int cnt;
+	int blk_cnt;
 };
 
 /**
@@ -824,6 +854,11 @@ struct ubifs_mount_opts {
  * @cmt_wq: wait queue to sleep on if the log is full and a commit is running
  * @fast_unmount: do not run journal commit before unmounting
  * @big_lpt: flag that LPT is too big to write whole during commit
+ * @bulk_read: enable bulk-reads
+ *
+ * @bu_mutex: protects @bu
+ * @bu: bulk-read information, the buffer is allocated on first use
+ * @max_bu_buf_len: maximum bulk-read buffer length
  *
  * @tnc_mutex: protects the Tree Node Cache (TNC), @zroot, @cnext, @enext, and
  *             @calc_idx_sz
@@ -1052,6 +1087,11 @@ struct ubifs_info {
 	wait_queue_head_t cmt_wq;
 	unsigned int fast_unmount:1;
 	unsigned int big_lpt:1;
+	unsigned int bulk_read:1;
+
+	struct mutex bu_mutex;
+	struct bu_info bu;
+	int max_bu_buf_len;
 
 	struct mutex tnc_mutex;
 	struct ubifs_zbranch zroot;
@@ -1385,6 +1425,8 @@ int ubifs_dirty_idx_node(struct ubifs_info *c, union ubifs_key *key, int level,
 			 int lnum, int offs);
 int ubifs_validate_entry(struct ubifs_info *c,
 			 const struct ubifs_dent_node *dent);
+int ubifs_tnc_get_bu(struct ubifs_info *c, struct bu_info *bu);
+int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu);
 /* Shared by tnc.c for tnc_commit.c */
 void destroy_old_idx(struct ubifs_info *c);
 int is_idx_node_in_tnc(struct ubifs_info *c, union ubifs_key *key, int level,
@@ -61,6 +61,7 @@ static int yaffs_CheckpointErase(yaffs_Device *dev)
 	}
 	
 	dev->blocksInCheckpoint = 0;
+	dev->erasedFifoValid = 0;	/* pick up the blocks freed above */
 	
 	return 1;
 }
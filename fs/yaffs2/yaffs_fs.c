@@ -421,6 +421,8 @@ static int yaffs_dump_dev1(yaffs_Device * dev)
 	printk("tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	printk("tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
 	printk("cacheHits.......... %d\n", dev->cacheHits);
+	printk("cacheMisses........ %d\n", dev->cacheMisses);
+	printk("cacheEvictions..... %d\n", dev->cacheEvictions);
 	printk("nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	printk("nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	printk("nBackgroudDeletions %d\n", dev->nBackgroundDeletions);
@@ -1729,7 +1731,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->nDataBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = 10;	/* Enable short op caching */
+	dev->nShortOpCaches = CONFIG_YAFFS_SHORT_OP_CACHES;	/* Enable short op caching */
 
 	/* ... and the functions. */
 	if (yaffsVersion == 2) {
@@ -1942,6 +1944,8 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %d\n", dev->cacheHits);
+	buf += sprintf(buf, "cacheMisses........ %d\n", dev->cacheMisses);
+	buf += sprintf(buf, "cacheEvictions..... %d\n", dev->cacheEvictions);
 	buf += sprintf(buf, "nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	buf +=
@@ -77,6 +77,7 @@ static int yaffs_DeleteWorker(yaffs_Object * in, yaffs_Tnode * tn, __u32 level,
 static int yaffs_DoGenericObjectDeletion(yaffs_Object * in);
 
 static yaffs_BlockInfo *yaffs_GetBlockInfo(yaffs_Device * dev, int blockNo);
+static void yaffs_UpdateGCCandidate(yaffs_Device * dev, int blockNo);
 
 static __u8 *yaffs_GetTempBuffer(yaffs_Device * dev, int lineNo);
 static void yaffs_ReleaseTempBuffer(yaffs_Device * dev, __u8 * buffer,
@@ -492,6 +493,7 @@ static void yaffs_RetireBlock(yaffs_Device * dev, int blockInNAND)
 	bi->blockState = YAFFS_BLOCK_STATE_DEAD;
 	bi->gcPrioritise = 0;
 	bi->needsRetiring = 0;
+	yaffs_UpdateGCCandidate(dev, blockInNAND);
 
 	dev->nRetiredBlocks++;
 }
@@ -586,6 +588,126 @@ static __u16 yaffs_CalcNameSum(const YCHAR * name)
 	return sum;
 }
 
+/* FNV-1a; the name sum alone clusters too much to hash on */
+static __u32 yaffs_CalcNameHash(const YCHAR * name)
+{
+	__u32 hash = 2166136261U;
+	int i = 0;
+
+	YUCHAR *bname = (YUCHAR *) name;
+	if (bname) {
+		while ((*bname) && (i < YAFFS_MAX_NAME_LENGTH)) {
+
+#ifdef CONFIG_YAFFS_CASE_INSENSITIVE
+			hash ^= yaffs_toupper(*bname);
+#else
+			hash ^= *bname;
+#endif
+			hash *= 16777619U;
+			i++;
+			bname++;
+		}
+	}
+	return hash;
+}
+
+/*---------------- Directory name index ------------
+ *
+ * yaffs_FindObjectByName() builds a hash index over the children of a
+ * directory once a lookup has had to walk more than
+ * YAFFS_DIR_INDEX_THRESHOLD of them. It is kept up to date as objects
+ * are added to, removed from or renamed in the directory.
+ * Objects whose header is not loaded yet have no name hash; they stay
+ * on the unhashed list (with lost+found) until a lookup loads them.
+ */
+
+static yaffs_DirectoryIndex *yaffs_AllocateDirectoryIndex(int nBuckets)
+{
+	yaffs_DirectoryIndex *index;
+	int i;
+
+	index = YMALLOC(sizeof(yaffs_DirectoryIndex) +
+			(nBuckets - 1) * sizeof(struct list_head));
+	if (!index)
+		return NULL;
+
+	index->nBuckets = nBuckets;
+	index->nEntries = 0;
+	INIT_LIST_HEAD(&index->unhashed);
+	for (i = 0; i < nBuckets; i++)
+		INIT_LIST_HEAD(&index->bucket[i]);
+
+	return index;
+}
+
+static void yaffs_IndexObject(yaffs_DirectoryIndex * index, yaffs_Object * obj)
+{
+	if (obj->lazyLoaded || obj->objectId == YAFFS_OBJECTID_LOSTNFOUND)
+		list_add(&obj->nameHashLink, &index->unhashed);
+	else
+		list_add(&obj->nameHashLink,
+			 &index->bucket[obj->nameHash & (index->nBuckets - 1)]);
+	index->nEntries++;
+}
+
+static void yaffs_UnindexObject(yaffs_Object * obj)
+{
+	if (!list_empty(&obj->nameHashLink)) {
+		list_del_init(&obj->nameHashLink);
+		obj->parent->variant.directoryVariant.index->nEntries--;
+	}
+}
+
+static void yaffs_FreeDirectoryIndex(yaffs_Object * dir)
+{
+	yaffs_DirectoryIndex *index = dir->variant.directoryVariant.index;
+	struct list_head *i;
+
+	if (!index)
+		return;
+
+	list_for_each(i, &dir->variant.directoryVariant.children)
+		INIT_LIST_HEAD(&list_entry(i, yaffs_Object, siblings)->nameHashLink);
+	dir->variant.directoryVariant.index = NULL;
+	YFREE(index);
+}
+
+/* (Re)build the index of dir, sized for its current number of children.
+ * On failure any old index is left as it was.
+ */
+static int yaffs_BuildDirectoryIndex(yaffs_Object * dir, int nChildren)
+{
+	yaffs_DirectoryIndex *index;
+	struct list_head *i;
+	int nBuckets = YAFFS_DIR_INDEX_MIN_BUCKETS;
+
+	while (nBuckets < nChildren)
+		nBuckets <<= 1;
+
+	index = yaffs_AllocateDirectoryIndex(nBuckets);
+	if (!index)
+		return YAFFS_FAIL;	/* stay with what we have */
+
+	yaffs_FreeDirectoryIndex(dir);
+	list_for_each(i, &dir->variant.directoryVariant.children)
+		yaffs_IndexObject(index, list_entry(i, yaffs_Object, siblings));
+	dir->variant.directoryVariant.index = index;
+	return YAFFS_OK;
+}
+
+/* Move an object to the right bucket after its name changed */
+static void yaffs_ReindexObject(yaffs_Object * obj)
+{
+	if (!list_empty(&obj->nameHashLink)) {
+		yaffs_DirectoryIndex *index =
+		    obj->parent->variant.directoryVariant.index;
+
+		list_del(&obj->nameHashLink);
+		index->nEntries--;
+		yaffs_IndexObject(index, obj);
+	}
+}
+
 static void yaffs_SetObjectName(yaffs_Object * obj, const YCHAR * name)
 {
 #ifdef CONFIG_YAFFS_SHORT_NAMES_IN_RAM
@@ -596,6 +718,8 @@ static void yaffs_SetObjectName(yaffs_Object * obj, const YCHAR * name)
 	}
 #endif
 	obj->sum = yaffs_CalcNameSum(name);
+	obj->nameHash = yaffs_CalcNameHash(name);
+	yaffs_ReindexObject(obj);
 }
 
 /*-------------------- TNODES -------------------
@@ -1128,6 +1252,7 @@ static void yaffs_SoftDeleteChunk(yaffs_Device * dev, int chunk)
 	if (theBlock) {
 		theBlock->softDeletions++;
 		dev->nFreeChunks++;
+		yaffs_UpdateGCCandidate(dev, chunk / dev->nChunksPerBlock);
 	}
 }
 
@@ -1381,6 +1506,8 @@ static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device * dev)
 		INIT_LIST_HEAD(&(tn->hardLinks));
 		INIT_LIST_HEAD(&(tn->hashLink));
 		INIT_LIST_HEAD(&tn->siblings);
+		INIT_LIST_HEAD(&tn->nameHashLink);
+		INIT_LIST_HEAD(&tn->cachedChunks);
 
 		/* Add it to the lost and found directory.
 		 * NB Can't put root or lostNFound in lostNFound so
@@ -1447,6 +1574,9 @@ static void yaffs_FreeObject(yaffs_Object * tn)
 
 	yaffs_UnhashObject(tn);
 
+	if (tn->variantType == YAFFS_OBJECT_TYPE_DIRECTORY)
+		yaffs_FreeDirectoryIndex(tn);
+
 	/* Link into the free list. */
 	tn->siblings.next = (struct list_head *)(dev->freeObjects);
 	dev->freeObjects = tn;
@@ -1469,6 +1599,21 @@ static void yaffs_DeinitialiseObjects(yaffs_Device * dev)
 	/* Free the list of allocated Objects */
 
 	yaffs_ObjectList *tmp;
+	struct list_head *i;
+	yaffs_Object *obj;
+	int bucket;
+
+	/* and the directory indices hanging off them */
+	for (bucket = 0; bucket < YAFFS_NOBJECT_BUCKETS; bucket++) {
+		list_for_each(i, &dev->objectBucket[bucket].list) {
+			obj = list_entry(i, yaffs_Object, hashLink);
+			if (obj->variantType == YAFFS_OBJECT_TYPE_DIRECTORY &&
+			    obj->variant.directoryVariant.index) {
+				YFREE(obj->variant.directoryVariant.index);
+				obj->variant.directoryVariant.index = NULL;
+			}
+		}
+	}
 
 	while (dev->allocatedObjectList) {
 		tmp = dev->allocatedObjectList->next;
@@ -1645,6 +1790,7 @@ yaffs_Object *yaffs_CreateNewObject(yaffs_Device * dev, int number,
 		case YAFFS_OBJECT_TYPE_DIRECTORY:
 			INIT_LIST_HEAD(&theObject->variant.directoryVariant.
 				       children);
+			theObject->variant.directoryVariant.index = NULL;
 			break;
 		case YAFFS_OBJECT_TYPE_SYMLINK:
 		case YAFFS_OBJECT_TYPE_HARDLINK:
@@ -1940,6 +2086,7 @@ int yaffs_RenameObject(yaffs_Object * oldDir, const YCHAR * oldName,
 static int yaffs_InitialiseBlocks(yaffs_Device * dev)
 {
 	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int nInts;
 	
 	dev->allocationBlock = -1;	/* force it to get a new one */
 
@@ -1961,10 +2108,26 @@ static int yaffs_InitialiseBlocks(yaffs_Device * dev)
 	}
 	else
 		dev->chunkBitsAlt = 0;
+
+	/* Erased block fifo and gc buckets share one allocation */
+	nInts = 4 * nBlocks + dev->nChunksPerBlock + 1;
+	dev->erasedFifo = YMALLOC(nInts * sizeof(int));
+	if(!dev->erasedFifo){
+		dev->erasedFifo = YMALLOC_ALT(nInts * sizeof(int));
+		dev->blockListsAlt = 1;
+	}
+	else
+		dev->blockListsAlt = 0;
+	dev->erasedFifoValid = 0;
+	dev->gcBucketsValid = 0;
 	
-	if (dev->blockInfo && dev->chunkBits) {
+	if (dev->blockInfo && dev->chunkBits && dev->erasedFifo) {
 		memset(dev->blockInfo, 0, nBlocks * sizeof(yaffs_BlockInfo));
 		memset(dev->chunkBits, 0, dev->chunkBitmapStride * nBlocks);
+		dev->gcNext = dev->erasedFifo + nBlocks;
+		dev->gcPrev = dev->gcNext + nBlocks;
+		dev->gcLive = dev->gcPrev + nBlocks;
+		dev->gcBucket = dev->gcLive + nBlocks;
 		return YAFFS_OK;
 	}
 
@@ -1988,6 +2151,167 @@ static void yaffs_DeinitialiseBlocks(yaffs_Device * dev)
 		YFREE(dev->chunkBits);
 	dev->chunkBitsAlt = 0;
 	dev->chunkBits = NULL;
+
+	if(dev->blockListsAlt)
+		YFREE_ALT(dev->erasedFifo);
+	else
+		YFREE(dev->erasedFifo);
+	dev->blockListsAlt = 0;
+	dev->erasedFifo = NULL;
+	dev->erasedFifoValid = 0;
+	dev->gcBucketsValid = 0;
+}
+
+/* The erased block fifo and the gc buckets are rebuilt from blockInfo on
+ * first use, and again whenever blockInfo is changed wholesale (scan,
+ * checkpoint restore).
+ */
+static void yaffs_InvalidateBlockLists(yaffs_Device * dev)
+{
+	dev->erasedFifoValid = 0;
+	dev->gcBucketsValid = 0;
+}
+
+static void yaffs_PushErasedBlock(yaffs_Device * dev, int blockNo)
+{
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int tail;
+
+	if (!dev->erasedFifoValid)
+		return;
+
+	if (dev->erasedFifoCount >= nBlocks) {
+		/* Full of stale entries, start again */
+		dev->erasedFifoValid = 0;
+		return;
+	}
+
+	tail = dev->erasedFifoHead + dev->erasedFifoCount;
+	if (tail >= nBlocks)
+		tail -= nBlocks;
+	dev->erasedFifo[tail] = blockNo;
+	dev->erasedFifoCount++;
+}
+
+static void yaffs_BuildErasedFifo(yaffs_Device * dev)
+{
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int blk = dev->allocationBlockFinder;
+	int i;
+
+	dev->erasedFifoHead = 0;
+	dev->erasedFifoCount = 0;
+	dev->erasedFifoValid = 1;
+
+	/* Start after the last allocated block to keep the round robin */
+	for (i = 0; i < nBlocks; i++) {
+		blk++;
+		if (blk < dev->internalStartBlock || blk > dev->internalEndBlock)
+			blk = dev->internalStartBlock;
+
+		if (yaffs_GetBlockInfo(dev, blk)->blockState ==
+		    YAFFS_BLOCK_STATE_EMPTY)
+			yaffs_PushErasedBlock(dev, blk);
+	}
+}
+
+static int yaffs_PopErasedBlock(yaffs_Device * dev)
+{
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int blk;
+
+	while (dev->erasedFifoCount > 0) {
+		blk = dev->erasedFifo[dev->erasedFifoHead];
+		if (++dev->erasedFifoHead >= nBlocks)
+			dev->erasedFifoHead = 0;
+		dev->erasedFifoCount--;
+
+		/* Checkpointing may have taken the block meanwhile */
+		if (yaffs_GetBlockInfo(dev, blk)->blockState ==
+		    YAFFS_BLOCK_STATE_EMPTY)
+			return blk;
+	}
+
+	return -1;
+}
+
+static void yaffs_UnfileGCCandidate(yaffs_Device * dev, int slot)
+{
+	int live = dev->gcLive[slot];
+	int next = dev->gcNext[slot];
+	int prev = dev->gcPrev[slot];
+
+	if (next == slot) {
+		dev->gcBucket[live] = -1;
+	} else {
+		dev->gcNext[prev] = next;
+		dev->gcPrev[next] = prev;
+		if (dev->gcBucket[live] == slot)
+			dev->gcBucket[live] = next;
+	}
+	dev->gcLive[slot] = -1;
+}
+
+/* Keep a block filed under its number of live pages while it is FULL.
+ * Called whenever blockState, pagesInUse or softDeletions change.
+ */
+static void yaffs_UpdateGCCandidate(yaffs_Device * dev, int blockNo)
+{
+	yaffs_BlockInfo *bi;
+	int slot = blockNo - dev->internalStartBlock;
+	int live = -1;
+	int head;
+
+	if (!dev->gcBucketsValid)
+		return;
+
+	bi = yaffs_GetBlockInfo(dev, blockNo);
+	if (bi->blockState == YAFFS_BLOCK_STATE_FULL) {
+		live = bi->pagesInUse - bi->softDeletions;
+		if (live < 0)
+			live = 0;
+		if (live > dev->nChunksPerBlock)
+			live = dev->nChunksPerBlock;
+	}
+
+	if (live == dev->gcLive[slot])
+		return;
+
+	if (dev->gcLive[slot] >= 0)
+		yaffs_UnfileGCCandidate(dev, slot);
+
+	if (live < 0)
+		return;
+
+	/* Add at the tail so equally dirty blocks are taken oldest first */
+	head = dev->gcBucket[live];
+	if (head < 0) {
+		dev->gcBucket[live] = slot;
+		dev->gcNext[slot] = slot;
+		dev->gcPrev[slot] = slot;
+	} else {
+		dev->gcNext[slot] = head;
+		dev->gcPrev[slot] = dev->gcPrev[head];
+		dev->gcNext[dev->gcPrev[head]] = slot;
+		dev->gcPrev[head] = slot;
+	}
+	dev->gcLive[slot] = live;
+}
+
+static void yaffs_BuildGCBuckets(yaffs_Device * dev)
+{
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int i;
+
+	for (i = 0; i <= dev->nChunksPerBlock; i++)
+		dev->gcBucket[i] = -1;
+	for (i = 0; i < nBlocks; i++)
+		dev->gcLive[i] = -1;
+
+	dev->gcBucketsValid = 1;
+
+	for (i = dev->internalStartBlock; i <= dev->internalEndBlock; i++)
+		yaffs_UpdateGCCandidate(dev, i);
 }
 
 static int yaffs_BlockNotDisqualifiedFromGC(yaffs_Device * dev,
@@ -2028,18 +2352,19 @@ static int yaffs_BlockNotDisqualifiedFromGC(yaffs_Device * dev,
 
 }
 
-/* FindDiretiestBlock is used to select the dirtiest block (or close enough)
- * for garbage collection.
+/* FindDiretiestBlock is used to select the dirtiest block for garbage
+ * collection. Full blocks are kept in buckets by live page count, so this
+ * only looks at the cleanest bucket(s) instead of scanning the whole array.
  */
 
 static int yaffs_FindBlockForGarbageCollection(yaffs_Device * dev,
 					       int aggressive)
 {
 
-	int b = dev->currentDirtyChecker;
+	int b;
 
 	int i;
-	int iterations;
+	int live;
 	int dirtiest = -1;
 	int pagesInUse;
 	int prioritised=0;
@@ -2084,50 +2409,26 @@ static int yaffs_FindBlockForGarbageCollection(yaffs_Device * dev,
 		pagesInUse =
 	    		(aggressive) ? dev->nChunksPerBlock : YAFFS_PASSIVE_GC_CHUNKS + 1;
 
-	if (aggressive) {
-		iterations =
-		    dev->internalEndBlock - dev->internalStartBlock + 1;
-	} else {
-		iterations =
-		    dev->internalEndBlock - dev->internalStartBlock + 1;
-		iterations = iterations / 16;
-		if (iterations > 200) {
-			iterations = 200;
-		}
-	}
-
-	for (i = 0; i <= iterations && pagesInUse > 0 && !prioritised; i++) {
-		b++;
-		if (b < dev->internalStartBlock || b > dev->internalEndBlock) {
-			b = dev->internalStartBlock;
-		}
-
-		if (b < dev->internalStartBlock || b > dev->internalEndBlock) {
-			T(YAFFS_TRACE_ERROR,
-			  (TSTR("**>> Block %d is not valid" TENDSTR), b));
-			YBUG();
-		}
-
-		bi = yaffs_GetBlockInfo(dev, b);
+	if (!dev->gcBucketsValid)
+		yaffs_BuildGCBuckets(dev);
 
-#if 0
-		if (bi->blockState == YAFFS_BLOCK_STATE_CHECKPOINT) {
-			dirtiest = b;
-			pagesInUse = 0;
-		}
-		else 
-#endif
+	/* Take the dirtiest full block that is not disqualified */
+	for (live = 0; live < pagesInUse && !prioritised && dirtiest < 0; live++) {
+		b = dev->gcBucket[live];
+		if (b < 0)
+			continue;
 
-		if (bi->blockState == YAFFS_BLOCK_STATE_FULL &&
-		       (bi->pagesInUse - bi->softDeletions) < pagesInUse &&
-		        yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
-			dirtiest = b;
-			pagesInUse = (bi->pagesInUse - bi->softDeletions);
-		}
+		do {
+			bi = &dev->blockInfo[b];
+			if (yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
+				dirtiest = b + dev->internalStartBlock;
+				pagesInUse = live;
+				break;
+			}
+			b = dev->gcNext[b];
+		} while (b != dev->gcBucket[live]);
 	}
 
-	dev->currentDirtyChecker = b;
-
 	if (dirtiest > 0) {
 		T(YAFFS_TRACE_GC,
 		  (TSTR("GC Selected block %d with %d free, prioritised:%d" TENDSTR), dirtiest,
@@ -2192,6 +2493,8 @@ static void yaffs_BlockBecameDirty(yaffs_Device * dev, int blockNo)
 		bi->skipErasedCheck = 1;  /* This is clean, so no need to check */
 		bi->gcPrioritise = 0;
 		yaffs_ClearChunkBits(dev, blockNo);
+		yaffs_UpdateGCCandidate(dev, blockNo);
+		yaffs_PushErasedBlock(dev, blockNo);
 
 		T(YAFFS_TRACE_ERASE,
 		  (TSTR("Erased block %d" TENDSTR), blockNo));
@@ -2206,7 +2509,7 @@ static void yaffs_BlockBecameDirty(yaffs_Device * dev, int blockNo)
 
 static int yaffs_FindBlockForAllocation(yaffs_Device * dev)
 {
-	int i;
+	int blk;
 
 	yaffs_BlockInfo *bi;
 
@@ -2220,28 +2523,29 @@ static int yaffs_FindBlockForAllocation(yaffs_Device * dev)
 		return -1;
 	}
 	
-	/* Find an empty block. */
+	/* Take the block that has been erased longest. */
 
-	for (i = dev->internalStartBlock; i <= dev->internalEndBlock; i++) {
-		dev->allocationBlockFinder++;
-		if (dev->allocationBlockFinder < dev->internalStartBlock
-		    || dev->allocationBlockFinder > dev->internalEndBlock) {
-			dev->allocationBlockFinder = dev->internalStartBlock;
-		}
+	if (!dev->erasedFifoValid)
+		yaffs_BuildErasedFifo(dev);
 
-		bi = yaffs_GetBlockInfo(dev, dev->allocationBlockFinder);
-
-		if (bi->blockState == YAFFS_BLOCK_STATE_EMPTY) {
-			bi->blockState = YAFFS_BLOCK_STATE_ALLOCATING;
-			dev->sequenceNumber++;
-			bi->sequenceNumber = dev->sequenceNumber;
-			dev->nErasedBlocks--;
-			T(YAFFS_TRACE_ALLOCATE,
-			  (TSTR("Allocated block %d, seq  %d, %d left" TENDSTR),
-			   dev->allocationBlockFinder, dev->sequenceNumber,
-			   dev->nErasedBlocks));
-			return dev->allocationBlockFinder;
-		}
+	blk = yaffs_PopErasedBlock(dev);
+	if (blk < 0) {
+		/* Out of step with blockInfo, have another look */
+		yaffs_BuildErasedFifo(dev);
+		blk = yaffs_PopErasedBlock(dev);
+	}
+
+	if (blk >= 0) {
+		bi = yaffs_GetBlockInfo(dev, blk);
+		bi->blockState = YAFFS_BLOCK_STATE_ALLOCATING;
+		dev->sequenceNumber++;
+		bi->sequenceNumber = dev->sequenceNumber;
+		dev->nErasedBlocks--;
+		dev->allocationBlockFinder = blk;
+		T(YAFFS_TRACE_ALLOCATE,
+		  (TSTR("Allocated block %d, seq  %d, %d left" TENDSTR),
+		   blk, dev->sequenceNumber, dev->nErasedBlocks));
+		return blk;
 	}
 
 	T(YAFFS_TRACE_ALWAYS,
@@ -2308,6 +2612,7 @@ static int yaffs_AllocateChunk(yaffs_Device * dev, int useReserve, yaffs_BlockIn
 		/* If the block is full set the state to full */
 		if (dev->allocationPage >= dev->nChunksPerBlock) {
 			bi->blockState = YAFFS_BLOCK_STATE_FULL;
+			yaffs_UpdateGCCandidate(dev, dev->allocationBlock);
 			dev->allocationBlock = -1;
 		}
 
@@ -2360,6 +2665,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device * dev, int block)
 	isCheckpointBlock = (bi->blockState == YAFFS_BLOCK_STATE_CHECKPOINT);
 	
 	bi->blockState = YAFFS_BLOCK_STATE_COLLECTING;
+	yaffs_UpdateGCCandidate(dev, block);
 
 	T(YAFFS_TRACE_TRACING,
 	  (TSTR("Collecting block %d, in use %d, shrink %d, " TENDSTR), block,
@@ -2944,6 +3250,8 @@ void yaffs_DeleteChunk(yaffs_Device * dev, int chunkId, int markNAND, int lyn)
 		    bi->blockState != YAFFS_BLOCK_STATE_ALLOCATING &&
 		    bi->blockState != YAFFS_BLOCK_STATE_NEEDS_SCANNING) {
 			yaffs_BlockBecameDirty(dev, block);
+		} else {
+			yaffs_UpdateGCCandidate(dev, block);
 		}
 
 	} else {
@@ -3168,21 +3476,38 @@ int yaffs_UpdateObjectHeader(yaffs_Object * in, const YCHAR * name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write 
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   Cache entries are hashed on (object, chunkId), kept on an LRU list and on
+ *   a per-object list, so a device can have thousands of them without any
+ *   operation having to look at all of them.
  */
 
+static Y_INLINE struct list_head *yaffs_ChunkCacheBucket(yaffs_Device * dev,
+							 const yaffs_Object * obj,
+							 int chunkId)
+{
+	__u32 h = (obj->objectId * 0x9E3779B1U) ^ chunkId;
+
+	return &dev->srHash[(h ^ (h >> 16)) & dev->srHashMask];
+}
+
+/* Take an entry out of use */
+static void yaffs_ReleaseChunkCache(yaffs_Device * dev, yaffs_ChunkCache * cache)
+{
+	cache->object = NULL;
+	cache->dirty = 0;
+	list_del_init(&cache->hashLink);
+	list_del_init(&cache->objectLink);
+	list_move(&cache->lruLink, &dev->srFree);
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
-	yaffs_Device *dev = obj->myDev;
-	int i;
+	struct list_head *i;
 	yaffs_ChunkCache *cache;
-	int nCaches = obj->myDev->nShortOpCaches;
 	
-	for(i = 0; i < nCaches; i++){
-		cache = &dev->srCache[i];
-		if (cache->object == obj &&
-		    cache->dirty)
+	list_for_each(i, &obj->cachedChunks) {
+		cache = list_entry(i, yaffs_ChunkCache, objectLink);
+		if (cache->dirty)
 			return 1;
 	}
 	
@@ -3193,9 +3518,9 @@ static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 static void yaffs_FlushFilesChunkCache(yaffs_Object * obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
+	struct list_head *i;
 	yaffs_ChunkCache *cache;
+	yaffs_ChunkCache *c;
 	int chunkWritten = 0;
 	int nCaches = obj->myDev->nShortOpCaches;
 
@@ -3204,16 +3529,11 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object * obj)
 			cache = NULL;
 
 			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
+			list_for_each(i, &obj->cachedChunks) {
+				c = list_entry(i, yaffs_ChunkCache, objectLink);
+				if (c->dirty &&
+				    (!cache || c->chunkId < cache->chunkId))
+					cache = c;
 			}
 
 			if (cache && !cache->locked) {
@@ -3225,8 +3545,7 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object * obj)
 								 cache->data,
 								 cache->nBytes,
 								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+				yaffs_ReleaseChunkCache(dev, cache);
 			}
 
 		} while (cache && chunkWritten > 0);
@@ -3249,19 +3568,20 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object * obj)
 void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 {
 	yaffs_Object *obj;
-	int nCaches = dev->nShortOpCaches;
-	int i;
+	yaffs_ChunkCache *cache;
+	struct list_head *i;
 	
 	/* Find a dirty object in the cache and flush it...
 	 * until there are no further dirty objects.
 	 */
 	do {
 		obj = NULL;
-		for( i = 0; i < nCaches && !obj; i++) {
-			if (dev->srCache[i].object &&
-			    dev->srCache[i].dirty)
-				obj = dev->srCache[i].object;
-			    
+		list_for_each(i, &dev->srLru) {
+			cache = list_entry(i, yaffs_ChunkCache, lruLink);
+			if (cache->dirty) {
+				obj = cache->object;
+				break;
+			}
 		}
 		if(obj)
 			yaffs_FlushFilesChunkCache(obj);
@@ -3273,88 +3593,52 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 
 /* Grab us a cache chunk for use.
  * First look for an empty one. 
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+ * Then push out the least recently used one, flushing its object if dirty.
  */
 static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device * dev)
 {
-	int i;
-	int usage;
-	int theOne;
-
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].object) 
-				return &dev->srCache[i];
-		}
-
-		return NULL;
-
-		theOne = -1;
-		usage = 0;	/* just to stop the compiler grizzling */
-
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].dirty &&
-			    ((dev->srCache[i].lastUse < usage && theOne >= 0) ||
-			     theOne < 0)) {
-				usage = dev->srCache[i].lastUse;
-				theOne = i;
-			}
-		}
-
-
-		return theOne >= 0 ? &dev->srCache[theOne] : NULL;
-	} else {
+	if (list_empty(&dev->srFree))
 		return NULL;
-	}
 
+	return list_entry(dev->srFree.next, yaffs_ChunkCache, lruLink);
 }
 
-static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device * dev)
+static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Object * obj, int chunkId)
 {
+	yaffs_Device *dev = obj->myDev;
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
-	int i;
-	int pushout;
+	struct list_head *i;
 
 	if (dev->nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
-
 		cache = yaffs_GrabChunkCacheWorker(dev);
 
 		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
-
-			/* With locking we can't assume we can use entry zero */
-
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
-
-			for (i = 0; i < dev->nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache))
-				{
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
+			/* With locking we can't assume we can use the head */
+			list_for_each(i, &dev->srLru) {
+				cache = list_entry(i, yaffs_ChunkCache, lruLink);
+				if (!cache->locked)
+					break;
+				cache = NULL;
 			}
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
+			if (cache) {
+				dev->cacheEvictions++;
+				if (cache->dirty)
+					yaffs_FlushFilesChunkCache(cache->object);
+				else
+					yaffs_ReleaseChunkCache(dev, cache);
 			}
 
+			cache = yaffs_GrabChunkCacheWorker(dev);
+		}
+
+		if (cache) {
+			cache->object = obj;
+			cache->chunkId = chunkId;
+			list_add(&cache->hashLink,
+				 yaffs_ChunkCacheBucket(dev, obj, chunkId));
+			list_add_tail(&cache->objectLink, &obj->cachedChunks);
+			list_move_tail(&cache->lruLink, &dev->srLru);
 		}
 		return cache;
 	} else
@@ -3362,23 +3646,36 @@ static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device * dev)
 
 }
 
+static yaffs_ChunkCache *yaffs_LookupChunkCache(const yaffs_Object * obj,
+						int chunkId)
+{
+	yaffs_Device *dev = obj->myDev;
+	yaffs_ChunkCache *cache;
+	struct list_head *i;
+
+	list_for_each(i, yaffs_ChunkCacheBucket(dev, obj, chunkId)) {
+		cache = list_entry(i, yaffs_ChunkCache, hashLink);
+		if (cache->object == obj && cache->chunkId == chunkId)
+			return cache;
+	}
+	return NULL;
+}
+
 /* Find a cached chunk */
 static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object * obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
-				dev->cacheHits++;
+	yaffs_ChunkCache *cache = NULL;
 
-				return &dev->srCache[i];
-			}
-		}
+	if (dev->nShortOpCaches > 0) {
+		cache = yaffs_LookupChunkCache(obj, chunkId);
+		if (cache)
+			dev->cacheHits++;
+		else
+			dev->cacheMisses++;
 	}
-	return NULL;
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -3387,18 +3684,7 @@ static void yaffs_UseChunkCache(yaffs_Device * dev, yaffs_ChunkCache * cache,
 {
 
 	if (dev->nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->nShortOpCaches; i++) {
-				dev->srCache[i].lastUse = 0;
-			}
-			dev->srLastUse = 0;
-		}
-
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
+		list_move_tail(&cache->lruLink, &dev->srLru);
 
 		if (isAWrite) {
 			cache->dirty = 1;
@@ -3413,10 +3699,10 @@ static void yaffs_UseChunkCache(yaffs_Device * dev, yaffs_ChunkCache * cache,
 static void yaffs_InvalidateChunkCache(yaffs_Object * object, int chunkId)
 {
 	if (object->myDev->nShortOpCaches > 0) {
-		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
+		yaffs_ChunkCache *cache = yaffs_LookupChunkCache(object, chunkId);
 
 		if (cache) {
-			cache->object = NULL;
+			yaffs_ReleaseChunkCache(object->myDev, cache);
 		}
 	}
 }
@@ -3426,15 +3712,15 @@ static void yaffs_InvalidateChunkCache(yaffs_Object * object, int chunkId)
  */
 static void yaffs_InvalidateWholeChunkCache(yaffs_Object * in)
 {
-	int i;
+	struct list_head *i, *n;
 	yaffs_Device *dev = in->myDev;
 
 	if (dev->nShortOpCaches > 0) {
 		/* Invalidate it. */
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == in) {
-				dev->srCache[i].object = NULL;
-			}
+		list_for_each_safe(i, n, &in->cachedChunks) {
+			yaffs_ReleaseChunkCache(dev,
+						list_entry(i, yaffs_ChunkCache,
+							   objectLink));
 		}
 	}
 }
@@ -3945,9 +4231,7 @@ int yaffs_ReadDataFromFile(yaffs_Object * in, __u8 * buffer, loff_t offset,
 				/* If we can't find the data in the cache, then load it up. */
 
 				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
+					cache = yaffs_GrabChunkCache(in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_ReadChunkDataFromObject(in, chunk,
@@ -4086,9 +4370,7 @@ int yaffs_WriteDataToFile(yaffs_Object * in, const __u8 * buffer, loff_t offset,
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
+					cache = yaffs_GrabChunkCache(in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_ReadChunkDataFromObject(in, chunk,
@@ -5030,6 +5312,8 @@ static int yaffs_Scan(yaffs_Device * dev)
 						INIT_LIST_HEAD(&parent->variant.
 							       directoryVariant.
 							       children);
+						parent->variant.directoryVariant.
+						    index = NULL;
 					} else if (parent->variantType !=
 						   YAFFS_OBJECT_TYPE_DIRECTORY)
 					{
@@ -5715,6 +5999,8 @@ static int yaffs_ScanBackwards(yaffs_Device * dev)
 						INIT_LIST_HEAD(&parent->variant.
 							       directoryVariant.
 							       children);
+						parent->variant.directoryVariant.
+						    index = NULL;
 					} else if (parent->variantType !=
 						   YAFFS_OBJECT_TYPE_DIRECTORY)
 					{
@@ -5874,6 +6160,7 @@ static void yaffs_RemoveObjectFromDirectory(yaffs_Object * obj)
 	if(dev && dev->removeObjectCallback)
 		dev->removeObjectCallback(obj);
 	   
+	yaffs_UnindexObject(obj);
 	list_del_init(&obj->siblings);
 	obj->parent = NULL;
 }
@@ -5882,6 +6169,7 @@ static void yaffs_RemoveObjectFromDirectory(yaffs_Object * obj)
 static void yaffs_AddObjectToDirectory(yaffs_Object * directory,
 				       yaffs_Object * obj)
 {
+	yaffs_DirectoryIndex *index;
 
 	if (!directory) {
 		T(YAFFS_TRACE_ALWAYS,
@@ -5910,6 +6198,15 @@ static void yaffs_AddObjectToDirectory(yaffs_Object * directory,
 	list_add(&obj->siblings, &directory->variant.directoryVariant.children);
 	obj->parent = directory;
 
+	index = directory->variant.directoryVariant.index;
+	if (index) {
+		/* If the index cannot grow, the old one has to take obj */
+		if (index->nEntries < 2 * index->nBuckets ||
+		    yaffs_BuildDirectoryIndex(directory, 2 * index->nEntries)
+		    != YAFFS_OK)
+			yaffs_IndexObject(index, obj);
+	}
+
 	if (directory == obj->myDev->unlinkedDir
 	    || directory == obj->myDev->deletedDir) {
 		obj->unlinked = 1;
@@ -5918,14 +6215,84 @@ static void yaffs_AddObjectToDirectory(yaffs_Object * directory,
 	}
 }
 
-yaffs_Object *yaffs_FindObjectByName(yaffs_Object * directory,
-				     const YCHAR * name)
+/* Does l go by name (with name sum sum)? */
+static int yaffs_ObjectNameMatches(yaffs_Object * l, const YCHAR * name,
+				   int sum, YCHAR * buffer)
 {
-	int sum;
+	yaffs_CheckObjectDetailsLoaded(l);
+
+	/* Special case for lost-n-found */
+	if (l->objectId == YAFFS_OBJECTID_LOSTNFOUND)
+		return yaffs_strcmp(name, YAFFS_LOSTNFOUND_NAME) == 0;
 
+	if (yaffs_SumCompare(l->sum, sum) || l->chunkId <= 0) {
+		/* LostnFound cunk called Objxxx
+		 * Do a real check
+		 */
+		yaffs_GetObjectName(l, buffer, YAFFS_MAX_NAME_LENGTH);
+		return yaffs_strcmp(name, buffer) == 0;
+	}
+	return 0;
+}
+
+static yaffs_Object *yaffs_FindObjectByNameLinear(yaffs_Object * directory,
+						  const YCHAR * name, int sum,
+						  int *nSearched)
+{
 	struct list_head *i;
 	YCHAR buffer[YAFFS_MAX_NAME_LENGTH + 1];
+	yaffs_Object *l;
+
+	*nSearched = 0;
+	list_for_each(i, &directory->variant.directoryVariant.children) {
+		l = list_entry(i, yaffs_Object, siblings);
+		(*nSearched)++;
+		if (yaffs_ObjectNameMatches(l, name, sum, buffer))
+			return l;
+	}
+
+	return NULL;
+}
+
+static yaffs_Object *yaffs_FindObjectByNameIndexed(yaffs_Object * directory,
+						   const YCHAR * name, int sum)
+{
+	yaffs_DirectoryIndex *index = directory->variant.directoryVariant.index;
+	YCHAR buffer[YAFFS_MAX_NAME_LENGTH + 1];
+	struct list_head *i, *n;
+	yaffs_Object *l;
+	__u32 hash;
+	int nSearched;
+
+	/* Loading the details of an unhashed object moves it to its bucket */
+	list_for_each_safe(i, n, &index->unhashed) {
+		l = list_entry(i, yaffs_Object, nameHashLink);
+		if (yaffs_ObjectNameMatches(l, name, sum, buffer))
+			return l;
+	}
+
+	hash = yaffs_CalcNameHash(name);
+	list_for_each(i, &index->bucket[hash & (index->nBuckets - 1)]) {
+		l = list_entry(i, yaffs_Object, nameHashLink);
+		if ((l->nameHash == hash || l->chunkId <= 0) &&
+		    yaffs_ObjectNameMatches(l, name, sum, buffer))
+			return l;
+	}
+
+	/* Objects without a header are known by a made up name */
+	if (yaffs_strncmp(name, YAFFS_LOSTNFOUND_PREFIX,
+			  yaffs_strlen(YAFFS_LOSTNFOUND_PREFIX)) == 0)
+		return yaffs_FindObjectByNameLinear(directory, name, sum,
+						    &nSearched);
 
+	return NULL;
+}
+
+yaffs_Object *yaffs_FindObjectByName(yaffs_Object * directory,
+				     const YCHAR * name)
+{
+	int sum;
+	int nSearched;
 	yaffs_Object *l;
 
 	if (!name) {
@@ -5948,33 +6315,14 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object * directory,
 
 	sum = yaffs_CalcNameSum(name);
 
-	list_for_each(i, &directory->variant.directoryVariant.children) {
-		if (i) {
-			l = list_entry(i, yaffs_Object, siblings);
-			
-			yaffs_CheckObjectDetailsLoaded(l);
+	if (directory->variant.directoryVariant.index)
+		return yaffs_FindObjectByNameIndexed(directory, name, sum);
 
-			/* Special case for lost-n-found */
-			if (l->objectId == YAFFS_OBJECTID_LOSTNFOUND) {
-				if (yaffs_strcmp(name, YAFFS_LOSTNFOUND_NAME) == 0) {
-					return l;
-				}
-			} else if (yaffs_SumCompare(l->sum, sum) || l->chunkId <= 0)	
-			{
-				/* LostnFound cunk called Objxxx
-				 * Do a real check
-				 */
-				yaffs_GetObjectName(l, buffer,
-						    YAFFS_MAX_NAME_LENGTH);
-				if (yaffs_strcmp(name, buffer) == 0) {
-					return l;
-				}
+	l = yaffs_FindObjectByNameLinear(directory, name, sum, &nSearched);
+	if (nSearched > YAFFS_DIR_INDEX_THRESHOLD)
+		yaffs_BuildDirectoryIndex(directory, nSearched);
 
-			}
-		}
-	}
-
-	return NULL;
+	return l;
 }
 
 
@@ -6437,7 +6785,6 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 	/* More device initialisation */
 	dev->garbageCollections = 0;
 	dev->passiveGarbageCollections = 0;
-	dev->currentDirtyChecker = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
 	dev->nDeletedFiles = 0;
@@ -6462,26 +6809,76 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 		}
 	}
 	
+	INIT_LIST_HEAD(&dev->srLru);
+	INIT_LIST_HEAD(&dev->srFree);
+
 	if (dev->nShortOpCaches > 0) {
-		int i;
+		int nBuckets = 1;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES) {
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 		}
 
+		/* With thousands of entries these are far too big for kmalloc */
 		dev->srCache =
-		    YMALLOC(dev->nShortOpCaches * sizeof(yaffs_ChunkCache));
+		    YMALLOC_ALT(dev->nShortOpCaches * sizeof(yaffs_ChunkCache));
+
+		while (nBuckets < dev->nShortOpCaches)
+			nBuckets <<= 1;
+		dev->srHash = YMALLOC_ALT(nBuckets * sizeof(struct list_head));
+
+		if (!dev->srCache || !dev->srHash) {
+			T(YAFFS_TRACE_ALWAYS,
+			  (TSTR("yaffs: no memory for %d short op caches, "
+				"running uncached" TENDSTR), dev->nShortOpCaches));
+			if (dev->srCache)
+				YFREE_ALT(dev->srCache);
+			if (dev->srHash)
+				YFREE_ALT(dev->srHash);
+			dev->srCache = NULL;
+			dev->srHash = NULL;
+			dev->nShortOpCaches = 0;
+		}
+	}
+
+	if (dev->nShortOpCaches > 0) {
+		int i;
+		int nBuckets = 1;
+
+		while (nBuckets < dev->nShortOpCaches)
+			nBuckets <<= 1;
+		dev->srHashMask = nBuckets - 1;
+		for (i = 0; i < nBuckets; i++)
+			INIT_LIST_HEAD(&dev->srHash[i]);
 
 		for (i = 0; i < dev->nShortOpCaches; i++) {
+			dev->srCache[i].data = YMALLOC_DMA(dev->nDataBytesPerChunk);
+			if (!dev->srCache[i].data) {
+				/* Make do with the caches we have got */
+				T(YAFFS_TRACE_ALWAYS,
+				  (TSTR("yaffs: only %d short op caches"
+					TENDSTR), i));
+				dev->nShortOpCaches = i;
+				break;
+			}
 			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
 			dev->srCache[i].dirty = 0;
-			dev->srCache[i].data = YMALLOC_DMA(dev->nDataBytesPerChunk);
+			dev->srCache[i].locked = 0;
+			INIT_LIST_HEAD(&dev->srCache[i].hashLink);
+			INIT_LIST_HEAD(&dev->srCache[i].objectLink);
+			list_add_tail(&dev->srCache[i].lruLink, &dev->srFree);
+		}
+		if (!dev->nShortOpCaches) {
+			YFREE_ALT(dev->srCache);
+			YFREE_ALT(dev->srHash);
+			dev->srCache = NULL;
+			dev->srHash = NULL;
 		}
-		dev->srLastUse = 0;
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
+	dev->cacheEvictions = 0;
 	
 	dev->gcCleanupList = YMALLOC(dev->nChunksPerBlock * sizeof(__u32));
 
@@ -6519,6 +6916,9 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 	}else
 		yaffs_Scan(dev);
 
+	/* The scan and checkpoint restore rewrite blockInfo behind our backs */
+	yaffs_InvalidateBlockLists(dev);
+
 	/* Zero out stats */
 	dev->nPageReads = 0;
 	dev->nPageWrites = 0;
@@ -6549,7 +6949,8 @@ void yaffs_Deinitialise(yaffs_Device * dev)
 				YFREE(dev->srCache[i].data);
 			}
 
-			YFREE(dev->srCache);
+			YFREE_ALT(dev->srCache);
+			YFREE_ALT(dev->srHash);
 		}
 
 		YFREE(dev->gcCleanupList);
@@ -60,6 +60,10 @@
 
 #define YAFFS_NOBJECT_BUCKETS		256
 
+/* Directories with more children than this get a name index */
+#define YAFFS_DIR_INDEX_THRESHOLD	32
+#define YAFFS_DIR_INDEX_MIN_BUCKETS	64
+
 
 #define YAFFS_OBJECT_SPACE		0x40000
 
@@ -90,7 +94,7 @@
 
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	4096
 
 #define YAFFS_N_TEMP_BUFFERS		4
 
@@ -108,7 +112,9 @@
 typedef struct {
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
+	struct list_head hashLink;	/* in dev->srHash while object is set */
+	struct list_head lruLink;	/* in dev->srLru, or dev->srFree if unused */
+	struct list_head objectLink;	/* in object->cachedChunks */
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -371,8 +377,17 @@ typedef struct {
 	yaffs_Tnode *top;
 } yaffs_FileStructure;
 
+/* Hash index of the children of a large directory, by name hash */
+typedef struct {
+	int nBuckets;			/* a power of 2 */
+	int nEntries;			/* objects in the index */
+	struct list_head unhashed;	/* lost+found and objects not loaded yet */
+	struct list_head bucket[1];	/* nBuckets of them */
+} yaffs_DirectoryIndex;
+
 typedef struct {
 	struct list_head children;	/* list of child links */
+	yaffs_DirectoryIndex *index;	/* name index, built on demand */
 } yaffs_DirectoryStructure;
 
 typedef struct {
@@ -412,6 +427,7 @@ struct yaffs_ObjectStruct {
 
 	__u8 serial;		/* serial number of chunk in NAND. Cached here */
 	__u16 sum;		/* sum of the name to speed searching */
+	__u32 nameHash;		/* hash of the name for the directory index */
 
 	struct yaffs_DeviceStruct *myDev;	/* The device I'm on */
 
@@ -423,6 +439,8 @@ struct yaffs_ObjectStruct {
 	/* also used for linking up the free list */
 	struct yaffs_ObjectStruct *parent; 
 	struct list_head siblings;
+	struct list_head nameHashLink;	/* entry in the parent's name index */
+	struct list_head cachedChunks;	/* short op cache entries of this object */
 
 	/* Where's my object header in NAND? */
 	int chunkId;		
@@ -665,6 +683,15 @@ struct yaffs_DeviceStruct {
 	__u32 allocationPage;
 	int allocationBlockFinder;	/* Used to search for next allocation block */
 
+	/* Erased blocks in the order they became free. May hold stale entries,
+	 * the block state is checked when an entry is taken off.
+	 */
+	int *erasedFifo;
+	int erasedFifoHead;
+	int erasedFifoCount;
+	unsigned erasedFifoValid:1;	/* cleared to force a rebuild from blockInfo */
+	unsigned blockListsAlt:1;	/* was allocated using alternative strategy */
+
 	/* Runtime state */
 	int nTnodesCreated;
 	yaffs_Tnode *freeTnodes;
@@ -683,7 +710,14 @@ struct yaffs_DeviceStruct {
 
 	int nFreeChunks;
 
-	int currentDirtyChecker;	/* Used to find current dirtiest block */
+	/* Full blocks filed by number of live pages, for picking gc victims.
+	 * Each bucket is a circular list threaded through gcNext/gcPrev.
+	 */
+	int *gcBucket;		/* nChunksPerBlock + 1 list heads, -1 if empty */
+	int *gcNext;
+	int *gcPrev;
+	int *gcLive;		/* bucket each block is filed in, -1 if none */
+	int gcBucketsValid;
 
 	__u32 *gcCleanupList;	/* objects to delete at the end of a GC. */
 
@@ -719,9 +753,14 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	struct list_head *srHash;	/* srCache entries hashed on (object, chunkId) */
+	int srHashMask;
+	struct list_head srLru;		/* entries in use, least recently used first */
+	struct list_head srFree;
 
 	int cacheHits;
+	int cacheMisses;
+	int cacheEvictions;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
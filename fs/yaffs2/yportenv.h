@@ -73,6 +73,7 @@
 
 #define yaffs_SumCompare(x,y) ((x) == (y))
 #define yaffs_strcmp(a,b) strcmp(a,b)
+#define yaffs_strncmp(a,b,c) strncmp(a,b,c)
 
 #define TENDSTR "\n"
 #define TSTR(x) KERN_WARNING x
@@ -125,6 +126,7 @@
 
 #define yaffs_SumCompare(x,y) ((x) == (y))
 #define yaffs_strcmp(a,b) strcmp(a,b)
+#define yaffs_strncmp(a,b,c) strncmp(a,b,c)
 
 #else
 /* Should have specified a configuration type */
@@ -22,6 +22,12 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Only wake one of the epoll instances waiting on the target file for
+ * an event, instead of all of them. EPOLL_CTL_ADD only.
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
@@ -43,6 +43,8 @@ struct sockaddr_ll
 #define PACKET_COPY_THRESH		7
 #define PACKET_AUXDATA			8
 #define PACKET_ORIGDEV			9
+#define PACKET_VERSION			10
+#define PACKET_HDRLEN			11
 
 struct tpacket_stats
 {
@@ -50,6 +52,19 @@ struct tpacket_stats
 	unsigned int	tp_drops;
 };
 
+struct tpacket_stats_v3
+{
+	unsigned int	tp_packets;
+	unsigned int	tp_drops;
+	unsigned int	tp_freeze_q_cnt;
+};
+
+union tpacket_stats_u
+{
+	struct tpacket_stats	stats1;
+	struct tpacket_stats_v3	stats3;
+};
+
 struct tpacket_auxdata
 {
 	__u32		tp_status;
@@ -67,6 +82,8 @@ struct tpacket_hdr
 #define TP_STATUS_COPY		2
 #define TP_STATUS_LOSING	4
 #define TP_STATUS_CSUMNOTREADY	8
+#define TP_STATUS_VLAN_VALID	16	/* tp_vlan_tci is valid */
+#define TP_STATUS_BLK_TMO	32	/* block retired by the timer */
 	unsigned int	tp_len;
 	unsigned int	tp_snaplen;
 	unsigned short	tp_mac;
@@ -79,8 +96,92 @@ struct tpacket_hdr
 #define TPACKET_ALIGN(x)	(((x)+TPACKET_ALIGNMENT-1)&~(TPACKET_ALIGNMENT-1))
 #define TPACKET_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket_hdr)) + sizeof(struct sockaddr_ll))
 
+struct tpacket2_hdr
+{
+	__u32		tp_status;
+	__u32		tp_len;
+	__u32		tp_snaplen;
+	__u16		tp_mac;
+	__u16		tp_net;
+	__u32		tp_sec;
+	__u32		tp_nsec;
+	__u16		tp_vlan_tci;
+	__u16		tp_padding;
+};
+
+#define TPACKET2_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket2_hdr)) + sizeof(struct sockaddr_ll))
+
+struct tpacket_hdr_variant1
+{
+	__u32		tp_rxhash;
+	__u32		tp_vlan_tci;
+};
+
+struct tpacket3_hdr
+{
+	__u32		tp_next_offset;	/* to the next packet in the block, 0 for the last */
+	__u32		tp_sec;
+	__u32		tp_nsec;
+	__u32		tp_snaplen;
+	__u32		tp_len;
+	__u32		tp_status;
+	__u16		tp_mac;
+	__u16		tp_net;
+	/* pkt_hdr variants */
+	union {
+		struct tpacket_hdr_variant1 hv1;
+	};
+	__u8		tp_padding[8];
+};
+
+#define TPACKET3_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + sizeof(struct sockaddr_ll))
+
+struct tpacket_bd_ts
+{
+	unsigned int	ts_sec;
+	unsigned int	ts_nsec;
+};
+
+struct tpacket_hdr_v1
+{
+	__u32		block_status;
+	__u32		num_pkts;
+	__u32		offset_to_first_pkt;
+
+	/* Number of valid bytes in the block, including the descriptor
+	 * and the private area.
+	 */
+	__u32		blk_len;
+
+	/* Incremented for every block handed to user space, lets the
+	 * reader spot blocks it has missed.
+	 */
+	__u64		seq_num __attribute__((aligned(8)));
+
+	struct tpacket_bd_ts	ts_first_pkt, ts_last_pkt;
+};
+
+union tpacket_bd_header_u
+{
+	struct tpacket_hdr_v1 bh1;
+};
+
+struct tpacket_block_desc
+{
+	__u32		version;
+	__u32		offset_to_priv;
+	union tpacket_bd_header_u hdr;
+};
+
+enum tpacket_versions
+{
+	TPACKET_V1,
+	TPACKET_V2,
+	TPACKET_V3,
+};
+
 /*
-   Frame structure:
+   Frame structure (TPACKET_V1, TPACKET_V2):
 
    - Start. Frame must be aligned to TPACKET_ALIGNMENT=16
    - struct tpacket_hdr
@@ -90,6 +191,16 @@ struct tpacket_hdr
    - Start+tp_mac: [ Optional MAC header ]
    - Start+tp_net: Packet data, aligned to TPACKET_ALIGNMENT=16.
    - Pad to align to TPACKET_ALIGNMENT=16
+
+   Block structure (TPACKET_V3):
+
+   - Start. Block must be aligned to TPACKET_ALIGNMENT=16
+   - struct tpacket_block_desc
+   - pad to TPACKET_ALIGNMENT=16
+   - Optional private area of tp_sizeof_priv bytes (offset_to_priv)
+   - pad to TPACKET_ALIGNMENT=16
+   - Packets, each a struct tpacket3_hdr laid out like a V1/V2 frame but
+     only as long as the captured data, chained by tp_next_offset
  */
 
 struct tpacket_req
@@ -100,6 +211,23 @@ struct tpacket_req
 	unsigned int	tp_frame_nr;	/* Total number of frames */
 };
 
+struct tpacket_req3
+{
+	unsigned int	tp_block_size;	/* Minimal size of contiguous block */
+	unsigned int	tp_block_nr;	/* Number of blocks */
+	unsigned int	tp_frame_size;	/* Maximum size of one packet */
+	unsigned int	tp_frame_nr;	/* Total number of frames */
+	unsigned int	tp_retire_blk_tov; /* block timeout in msecs */
+	unsigned int	tp_sizeof_priv;	/* private area per block */
+	unsigned int	tp_feature_req_word;
+};
+
+union tpacket_req_u
+{
+	struct tpacket_req	req;
+	struct tpacket_req3	req3;
+};
+
 struct packet_mreq
 {
 	int		mr_ifindex;
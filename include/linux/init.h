@@ -86,6 +86,7 @@ extern initcall_t __security_initcall_start[], __security_initcall_end[];
 extern char __initdata boot_command_line[];
 extern char *saved_command_line;
 extern unsigned int reset_devices;
+extern int initcall_debug;
 
 /* used by init/main.c */
 void setup_arch(char **);
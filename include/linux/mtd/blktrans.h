@@ -11,12 +11,15 @@
 #define __MTD_TRANS_H__
 
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 
 struct hd_geometry;
 struct mtd_info;
 struct mtd_blktrans_ops;
 struct file;
 struct inode;
+struct request_queue;
+struct task_struct;
 
 struct mtd_blktrans_dev {
 	struct mtd_blktrans_ops *tr;
@@ -27,9 +30,13 @@ struct mtd_blktrans_dev {
 	unsigned long size;
 	int readonly;
 	void *blkcore_priv; /* gendisk in 2.5, devfs_handle in 2.4 */
-};
 
-struct blkcore_priv; /* Differs for 2.4 and 2.5 kernels; private */
+	/* Each device has its own queue and thread, so that slow erases
+	   on one device do not hold up the others */
+	struct request_queue *rq;
+	spinlock_t queue_lock;
+	struct task_struct *thread;
+};
 
 struct mtd_blktrans_ops {
 	char *name;
@@ -60,8 +67,6 @@ struct mtd_blktrans_ops {
 	struct list_head devs;
 	struct list_head list;
 	struct module *owner;
-
-	struct mtd_blkcore_priv *blkcore_priv;
 };
 
 extern int register_mtd_blktrans(struct mtd_blktrans_ops *tr);
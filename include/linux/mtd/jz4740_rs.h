@@ -0,0 +1,31 @@
+/*
+ *  include/linux/mtd/jz4740_rs.h
+ *
+ *  Software model of the JZ4740 NAND controller Reed-Solomon ECC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __MTD_JZ4740_RS_H__
+#define __MTD_JZ4740_RS_H__
+
+#define JZ4740_RS_STEP		512	/* data bytes per ECC step */
+#define JZ4740_RS_BYTES		9	/* parity bytes per ECC step */
+
+int jz4740_rs_init(void);
+void jz4740_rs_exit(void);
+
+/*
+ * Calculate the 9 parity bytes the controller writes for a 512 byte step
+ */
+void jz4740_rs_calculate(const u_char *dat, u_char *ecc_code);
+
+/*
+ * Correct up to 4 symbol errors in a 512 byte step. Returns the number of
+ * corrected symbols or -EBADMSG.
+ */
+int jz4740_rs_correct(u_char *dat, const u_char *read_ecc);
+
+#endif /* __MTD_JZ4740_RS_H__ */
@@ -3,7 +3,7 @@
 
 #define PIPEFS_MAGIC 0x50495045
 
-#define PIPE_BUFFERS (16)
+#define PIPE_DEF_BUFFERS	16
 
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
@@ -40,6 +40,7 @@ struct pipe_buffer {
  *	@fasync_readers: reader side fasync
  *	@fasync_writers: writer side fasync
  *	@inode: inode this pipe is attached to
+ *	@buffers: number of entries in @bufs, a power of 2
  *	@bufs: the circular array of pipe buffers
  **/
 struct pipe_inode_info {
@@ -54,7 +55,8 @@ struct pipe_inode_info {
 	struct fasync_struct *fasync_readers;
 	struct fasync_struct *fasync_writers;
 	struct inode *inode;
-	struct pipe_buffer bufs[PIPE_BUFFERS];
+	unsigned int buffers;
+	struct pipe_buffer *bufs;
 };
 
 /*
@@ -141,6 +143,14 @@ struct pipe_inode_info * alloc_pipe_info(struct inode * inode);
 void free_pipe_info(struct inode * inode);
 void __free_pipe_info(struct pipe_inode_info *);
 
+/* for F_SETPIPE_SZ and F_GETPIPE_SZ */
+struct ctl_table;
+struct file;
+extern unsigned int pipe_max_size, pipe_min_size;
+long pipe_fcntl(struct file *, unsigned int, unsigned long arg);
+int pipe_proc_fn(struct ctl_table *, int, struct file *, void __user *,
+		 size_t *, loff_t *);
+
 /* Generic pipe buffer ops functions */
 void *generic_pipe_buf_map(struct pipe_inode_info *, struct pipe_buffer *, int);
 void generic_pipe_buf_unmap(struct pipe_inode_info *, struct pipe_buffer *, void *);
@@ -475,4 +475,55 @@ struct tc_netem_corrupt
 
 #define NETEM_DIST_SCALE	8192
 
+/* FQ_CODEL section */
+
+enum
+{
+	TCA_FQ_CODEL_UNSPEC,
+	TCA_FQ_CODEL_TARGET,	/* target sojourn time (us) */
+	TCA_FQ_CODEL_LIMIT,	/* hard limit (packets) */
+	TCA_FQ_CODEL_INTERVAL,	/* width of the moving window (us) */
+	TCA_FQ_CODEL_ECN,	/* mark ECN capable packets instead of dropping */
+	TCA_FQ_CODEL_FLOWS,	/* number of flow queues, only at creation */
+	TCA_FQ_CODEL_QUANTUM,	/* DRR quantum (bytes) */
+	__TCA_FQ_CODEL_MAX
+};
+
+#define TCA_FQ_CODEL_MAX	(__TCA_FQ_CODEL_MAX - 1)
+
+enum
+{
+	TCA_FQ_CODEL_XSTATS_QDISC,
+	TCA_FQ_CODEL_XSTATS_CLASS,
+};
+
+struct tc_fq_codel_qd_stats
+{
+	__u32	maxpacket;	/* largest packet we've seen so far */
+	__u32	drop_overlimit;	/* drops because the hard limit was hit */
+	__u32	ecn_mark;	/* packets marked with ECN instead of dropped */
+	__u32	new_flow_count;	/* flows that became active */
+	__u32	new_flows_len;	/* count of flows in new list */
+	__u32	old_flows_len;	/* count of flows in old list */
+};
+
+struct tc_fq_codel_cl_stats
+{
+	__s32	deficit;
+	__u32	ldelay;		/* sojourn time of last dequeued packet (us) */
+	__u32	count;
+	__u32	lastcount;
+	__u32	dropping;
+	__s32	drop_next;
+};
+
+struct tc_fq_codel_xstats
+{
+	__u32	type;
+	union {
+		struct tc_fq_codel_qd_stats qdisc_stats;
+		struct tc_fq_codel_cl_stats class_stats;
+	};
+};
+
 #endif
@@ -76,6 +76,11 @@ struct udp_sock {
 	 * For encapsulation sockets.
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
+	/*
+	 * Secondary hash on (local address, local port).
+	 */
+	struct hlist_node udp_portaddr_node;
+	unsigned int	 udp_portaddr_hash;
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
@@ -17,6 +17,7 @@
 #ifdef __KERNEL__
 #include <linux/bitops.h>
 #include <linux/compiler.h>
+#include <linux/rcupdate.h>
 #include <asm/atomic.h>
 
 #include <linux/netfilter/nf_conntrack_tcp.h>
@@ -129,6 +130,9 @@ struct nf_conn
 
 	/* Extensions */
 	struct nf_ct_ext *ext;
+
+	/* Lookups walk the hash under RCU, so freeing is deferred */
+	struct rcu_head rcu;
 };
 
 static inline struct nf_conn *
@@ -250,6 +254,8 @@ static inline int nf_ct_is_untracked(const struct sk_buff *skb)
 }
 
 extern int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp);
+extern int nf_conntrack_resize(unsigned int hashsize);
+extern int nf_conntrack_hash_autoresize;
 extern unsigned int nf_conntrack_htable_size;
 extern int nf_conntrack_checksum;
 extern atomic_t nf_conntrack_count;
@@ -23,6 +23,7 @@
 #define _UDP_H
 
 #include <linux/list.h>
+#include <linux/jhash.h>
 #include <net/inet_sock.h>
 #include <net/sock.h>
 #include <net/snmp.h>
@@ -50,9 +51,50 @@ struct udp_skb_cb {
 };
 #define UDP_SKB_CB(__skb)	((struct udp_skb_cb *)((__skb)->cb))
 
-extern struct hlist_head udp_hash[UDP_HTABLE_SIZE];
+/**
+ *	struct udp_hslot - UDP hash slot
+ *
+ *	@head:	chain of sockets
+ *	@count:	number of sockets in the chain
+ */
+struct udp_hslot {
+	struct hlist_head	head;
+	int			count;
+};
+
+/**
+ *	struct udp_table - UDP(-Lite) socket hash tables
+ *
+ *	@hash:	sockets hashed by local port (sk_node)
+ *	@hash2:	sockets hashed by local address and port (udp_portaddr_node)
+ *
+ *	Both are protected by udp_hash_lock.
+ */
+struct udp_table {
+	struct udp_hslot	hash[UDP_HTABLE_SIZE];
+	struct udp_hslot	hash2[UDP_HTABLE_SIZE];
+};
+extern struct udp_table udp_table;
 extern rwlock_t udp_hash_lock;
 
+/*
+ * Above this many sockets in a port chain, receive lookups switch to the
+ * (local address, port) chains when those are shorter.
+ */
+#define UDP_HASH2_THRESHOLD	10
+
+static inline struct udp_hslot *udp_hashslot2(struct udp_table *table,
+					      unsigned int hash)
+{
+	return &table->hash2[hash & (UDP_HTABLE_SIZE - 1)];
+}
+
+/* Wildcard and v4-mapped IPv6 sockets must hash like their IPv4 twins */
+static inline unsigned int udp4_portaddr_hash(__be32 saddr, unsigned int port)
+{
+	return jhash_1word((__force u32)saddr, 0) ^ port;
+}
+
 
 /* Note: this must match 'valbool' in sock_setsockopt */
 #define UDP_CSUM_NOXMIT		1
@@ -103,15 +145,8 @@ static inline void udp_lib_hash(struct sock *sk)
 	BUG();
 }
 
-static inline void udp_lib_unhash(struct sock *sk)
-{
-	write_lock_bh(&udp_hash_lock);
-	if (sk_del_node_init(sk)) {
-		inet_sk(sk)->num = 0;
-		sock_prot_dec_use(sk->sk_prot);
-	}
-	write_unlock_bh(&udp_hash_lock);
-}
+extern void	udp_lib_unhash(struct sock *sk);
+extern void	udp_lib_rehash(struct sock *sk, unsigned int newhash);
 
 static inline void udp_lib_close(struct sock *sk, long timeout)
 {
@@ -121,7 +156,8 @@ static inline void udp_lib_close(struct sock *sk, long timeout)
 
 /* net/ipv4/udp.c */
 extern int	udp_get_port(struct sock *sk, unsigned short snum,
-			     int (*saddr_cmp)(const struct sock *, const struct sock *));
+			     int (*saddr_cmp)(const struct sock *, const struct sock *),
+			     unsigned int hash2_partial);
 extern void	udp_err(struct sk_buff *, u32);
 
 extern int	udp_sendmsg(struct kiocb *iocb, struct sock *sk,
@@ -154,14 +190,14 @@ struct udp_seq_afinfo {
 	struct module		*owner;
 	char			*name;
 	sa_family_t		family;
-	struct hlist_head	*hashtable;
+	struct udp_table	*udp_table;
 	int 			(*seq_show) (struct seq_file *m, void *v);
 	struct file_operations	*seq_fops;
 };
 
 struct udp_iter_state {
 	sa_family_t		family;
-	struct hlist_head	*hashtable;
+	struct udp_table	*udp_table;
 	int			bucket;
 	struct seq_operations	seq_ops;
 };
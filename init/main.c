@@ -57,6 +57,7 @@
 #include <linux/device.h>
 #include <linux/kthread.h>
 #include <linux/sched.h>
+#include <linux/async.h>
 
 #include <asm/io.h>
 #include <asm/bugs.h>
@@ -654,7 +655,7 @@ asmlinkage void __init start_kernel(void)
 	rest_init();
 }
 
-static int __initdata initcall_debug;
+int initcall_debug;
 
 static int __init initcall_debug_setup(char *str)
 {
@@ -669,6 +670,7 @@ static void __init do_initcalls(void)
 {
 	initcall_t *call;
 	int count = preempt_count();
+	ktime_t start = ktime_get();
 
 	for (call = __initcall_start; call < __initcall_end; call++) {
 		ktime_t t0, t1, delta;
@@ -723,6 +725,10 @@ static void __init do_initcalls(void)
 
 	/* Make sure there is no pending stuff from the initcall sequence */
 	flush_scheduled_work();
+
+	if (initcall_debug)
+		printk("initcalls done after %Ld msecs\n", (unsigned long long)
+		       ktime_to_ns(ktime_sub(ktime_get(), start)) >> 20);
 }
 
 /*
@@ -772,6 +778,8 @@ static void run_init_process(char *init_filename)
  */
 static int noinline init_post(void)
 {
+	/* Asynchronous initcalls may still be running __init code */
+	async_synchronize_full();
 	free_initmem();
 	unlock_kernel();
 	mark_rodata_ro();
@@ -850,6 +858,8 @@ static int __init kernel_init(void * unused)
 
 	if (sys_access((const char __user *) ramdisk_execute_command, 0) != 0) {
 		ramdisk_execute_command = NULL;
+		/* The root device may be probed asynchronously */
+		async_synchronize_full();
 		prepare_namespace();
 	}
 
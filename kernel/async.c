@@ -0,0 +1,302 @@
+/*
+ * async.c: Asynchronous function calls for boot performance
+ *
+ * Released under the GPLv2.
+ */
+
+/*
+
+Goals and Theory of Operation
+
+The primary goal of this feature is to reduce the kernel boot time,
+by running the slow parts of the initcall sequence (hardware probes that
+spend most of their time waiting on a NAND scan, a PHY or a card) in
+parallel with the rest of it.
+
+The initcall sequence is strictly ordered, and a lot of code depends on
+that ordering.  So we only let a driver move work out of line when it
+asks for it explicitly:
+
+	static void __init foo_probe_async(void *data, async_cookie_t cookie)
+	{
+		...
+	}
+
+	static int __init foo_init(void)
+	{
+		async_schedule(foo_probe_async, NULL);
+		return 0;
+	}
+
+Every scheduled call gets a monotonically increasing "sequence cookie".
+async_synchronize_cookie(cookie) waits until every call with a lower
+cookie has completed, and async_synchronize_full() waits for all of them.
+The latter is used before the root filesystem is mounted and before init
+is executed (after which the __init code of the scheduled calls is gone),
+and by subsystems which need the devices that are probed asynchronously.
+
+An asynchronous function must never call async_synchronize_full() itself:
+it would wait for its own completion.  It may use
+async_synchronize_cookie() with its own cookie to wait for the calls
+scheduled before it.
+
+The calls are run by a small pool of "async/N" kernel threads.  Threads
+are started on demand, up to MAX_THREADS, and exit again when they have
+been idle for a while, so there is no cost after boot.
+
+Unless the kernel is booted with "fastboot", async_schedule() simply
+runs the function in the caller's context, and the boot is exactly as
+ordered as it has always been.
+
+*/
+
+#include <linux/async.h>
+#include <linux/init.h>
+#include <linux/kallsyms.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#define MAX_THREADS	8
+#define IDLE_TIMEOUT	(5 * HZ)
+
+struct async_entry {
+	struct list_head list;
+	async_cookie_t cookie;
+	async_func_ptr *func;
+	void *data;
+};
+
+static async_cookie_t next_cookie = 1;
+
+/* Both lists are kept sorted by cookie */
+static LIST_HEAD(async_pending);
+static LIST_HEAD(async_running);
+static DEFINE_SPINLOCK(async_lock);
+
+static int pending_count;
+static int thread_count;
+static int idle_count;
+
+static DECLARE_WAIT_QUEUE_HEAD(async_new);
+static DECLARE_WAIT_QUEUE_HEAD(async_done);
+
+static int async_enabled;
+
+static int __init setup_fastboot(char *str)
+{
+	async_enabled = 1;
+	return 1;
+}
+__setup("fastboot", setup_fastboot);
+
+/* Only meaningful while booting; initcall_debug is set from the command line */
+static inline int async_debug(void)
+{
+	return initcall_debug && system_state == SYSTEM_BOOTING;
+}
+
+static async_cookie_t lowest_in_progress(void)
+{
+	struct async_entry *entry;
+	async_cookie_t ret = next_cookie;
+	unsigned long flags;
+
+	spin_lock_irqsave(&async_lock, flags);
+	if (!list_empty(&async_running)) {
+		entry = list_first_entry(&async_running, struct async_entry, list);
+		ret = entry->cookie;
+	} else if (!list_empty(&async_pending)) {
+		entry = list_first_entry(&async_pending, struct async_entry, list);
+		ret = entry->cookie;
+	}
+	spin_unlock_irqrestore(&async_lock, flags);
+	return ret;
+}
+
+static void run_entry(async_func_ptr *func, void *data, async_cookie_t cookie)
+{
+	ktime_t t0, delta;
+
+	if (!async_debug()) {
+		func(data, cookie);
+		return;
+	}
+
+	printk("async %lli: calling 0x%p", (long long)cookie, func);
+	print_fn_descriptor_symbol(": %s()", (unsigned long)func);
+	printk(" in %s\n", current->comm);
+	t0 = ktime_get();
+
+	func(data, cookie);
+
+	delta = ktime_sub(ktime_get(), t0);
+	printk("async %lli: 0x%p ran for %Ld msecs: ", (long long)cookie,
+	       func, (unsigned long long)ktime_to_ns(delta) >> 20);
+	print_fn_descriptor_symbol("%s()\n", (unsigned long)func);
+}
+
+/*
+ * Take the oldest pending entry, run it and retire it.  Returns 0 if there
+ * was nothing to run.
+ */
+static int run_one_entry(void)
+{
+	struct async_entry *entry;
+	unsigned long flags;
+
+	spin_lock_irqsave(&async_lock, flags);
+	if (list_empty(&async_pending)) {
+		spin_unlock_irqrestore(&async_lock, flags);
+		return 0;
+	}
+	entry = list_first_entry(&async_pending, struct async_entry, list);
+	list_move_tail(&entry->list, &async_running);
+	pending_count--;
+	spin_unlock_irqrestore(&async_lock, flags);
+
+	run_entry(entry->func, entry->data, entry->cookie);
+
+	spin_lock_irqsave(&async_lock, flags);
+	list_del(&entry->list);
+	spin_unlock_irqrestore(&async_lock, flags);
+
+	kfree(entry);
+	wake_up(&async_done);
+	return 1;
+}
+
+static int async_thread(void *unused)
+{
+	unsigned long flags;
+	long left;
+
+	for (;;) {
+		while (run_one_entry())
+			;
+
+		spin_lock_irqsave(&async_lock, flags);
+		idle_count++;
+		spin_unlock_irqrestore(&async_lock, flags);
+
+		left = wait_event_timeout(async_new,
+					  !list_empty(&async_pending),
+					  IDLE_TIMEOUT);
+
+		spin_lock_irqsave(&async_lock, flags);
+		idle_count--;
+		if (!left && list_empty(&async_pending)) {
+			/* Decided under async_lock, so async_schedule()
+			   either sees us gone or we see its entry */
+			thread_count--;
+			spin_unlock_irqrestore(&async_lock, flags);
+			return 0;
+		}
+		spin_unlock_irqrestore(&async_lock, flags);
+	}
+}
+
+/**
+ * async_schedule - schedule a function for asynchronous execution
+ * @ptr: function to execute asynchronously
+ * @data: data pointer to pass to the function
+ *
+ * Returns an async_cookie_t that may be used for checkpointing later.
+ * Must be called from process context; may sleep.
+ */
+async_cookie_t async_schedule(async_func_ptr *ptr, void *data)
+{
+	struct async_entry *entry = NULL;
+	struct task_struct *t;
+	async_cookie_t cookie;
+	unsigned long flags;
+	int spawn = 0;
+
+	if (async_enabled)
+		entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+
+	spin_lock_irqsave(&async_lock, flags);
+	cookie = next_cookie++;
+	if (!entry) {
+		spin_unlock_irqrestore(&async_lock, flags);
+		/* Not enabled, or out of memory: do the work right now */
+		run_entry(ptr, data, cookie);
+		return cookie;
+	}
+	entry->func = ptr;
+	entry->data = data;
+	entry->cookie = cookie;
+	list_add_tail(&entry->list, &async_pending);
+	pending_count++;
+	if (pending_count > idle_count && thread_count < MAX_THREADS) {
+		thread_count++;
+		spawn = thread_count;
+	}
+	spin_unlock_irqrestore(&async_lock, flags);
+
+	if (spawn) {
+		t = kthread_run(async_thread, NULL, "async/%d", spawn - 1);
+		if (IS_ERR(t)) {
+			spin_lock_irqsave(&async_lock, flags);
+			spawn = --thread_count;
+			spin_unlock_irqrestore(&async_lock, flags);
+			/* Nobody left to pick the work up, so do it here */
+			if (!spawn)
+				while (run_one_entry())
+					;
+		}
+	}
+
+	wake_up(&async_new);
+	return cookie;
+}
+EXPORT_SYMBOL_GPL(async_schedule);
+
+/**
+ * async_synchronize_cookie - synchronize asynchronous function calls
+ * @cookie: async_cookie_t to use as checkpoint
+ *
+ * Waits until all asynchronous function calls prior to @cookie are done.
+ */
+void async_synchronize_cookie(async_cookie_t cookie)
+{
+	ktime_t t0, delta;
+
+	if (async_debug()) {
+		printk("async: %s waiting for calls before %lli\n",
+		       current->comm, (long long)cookie);
+		t0 = ktime_get();
+	}
+
+	wait_event(async_done, lowest_in_progress() >= cookie);
+
+	if (async_debug()) {
+		delta = ktime_sub(ktime_get(), t0);
+		printk("async: %s waited %Ld msecs\n", current->comm,
+		       (unsigned long long)ktime_to_ns(delta) >> 20);
+	}
+}
+EXPORT_SYMBOL_GPL(async_synchronize_cookie);
+
+/**
+ * async_synchronize_full - synchronize all asynchronous function calls
+ *
+ * Waits until all asynchronous function calls scheduled so far are done.
+ */
+void async_synchronize_full(void)
+{
+	unsigned long flags;
+	async_cookie_t cookie;
+
+	spin_lock_irqsave(&async_lock, flags);
+	cookie = next_cookie;
+	spin_unlock_irqrestore(&async_lock, flags);
+
+	async_synchronize_cookie(cookie);
+}
+EXPORT_SYMBOL_GPL(async_synchronize_full);
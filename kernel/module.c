@@ -19,6 +19,7 @@
 #include <linux/module.h>
 #include <linux/moduleloader.h>
 #include <linux/init.h>
+#include <linux/async.h>
 #include <linux/kallsyms.h>
 #include <linux/sysfs.h>
 #include <linux/kernel.h>
@@ -2136,6 +2137,9 @@ sys_init_module(void __user *umod,
 		return ret;
 	}
 
+	/* The init section is about to go, wait for async work using it */
+	async_synchronize_full();
+
 	/* Now it's a first class citizen! */
 	mutex_lock(&module_mutex);
 	mod->state = MODULE_STATE_LIVE;
@@ -119,6 +119,11 @@
 #include <linux/err.h>
 #include <linux/ctype.h>
 #include <linux/if_arp.h>
+#include <net/ip.h>
+#include <linux/ipv6.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/kthread.h>
 
 #include "net-sysfs.h"
 
@@ -1741,40 +1746,167 @@ int weight_p __read_mostly = 64;            /* old backlog weight */
 
 DEFINE_PER_CPU(struct netif_rx_stats, netdev_rx_stat) = { 0, };
 
+#ifdef CONFIG_RPS
+/*
+ * With receive packet steering a CPU may queue packets to another CPU's
+ * backlog, so the input_pkt_queue lock is needed on top of disabling
+ * interrupts.
+ */
+static inline void rps_lock(struct softnet_data *queue)
+{
+	spin_lock(&queue->input_pkt_queue.lock);
+}
 
-/**
- *	netif_rx	-	post buffer to the network code
- *	@skb: buffer to post
- *
- *	This function receives a packet from a device driver and queues it for
- *	the upper (protocol) levels to process.  It always succeeds. The buffer
- *	may be dropped during processing for congestion control or by the
- *	protocol layers.
- *
- *	return values:
- *	NET_RX_SUCCESS	(no congestion)
- *	NET_RX_DROP     (packet was dropped)
- *
+static inline void rps_unlock(struct softnet_data *queue)
+{
+	spin_unlock(&queue->input_pkt_queue.lock);
+}
+
+static u32 rps_hashrnd __read_mostly;
+
+/*
+ * get_rps_cpu is called from netif_rx and netif_receive_skb and returns
+ * the CPU that should process the packet, or -1 to process it on the
+ * current one. The flow hash covers the IP addresses and, for unfragmented
+ * packets of protocols with a port pair up front, the ports.
  */
+static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb)
+{
+	struct rps_map *map;
+	u32 addr1, addr2, ports = 0;
+	int cpu = -1;
+	u8 ip_proto;
+	u32 hash;
+	int ihl;
 
-int netif_rx(struct sk_buff *skb)
+	rcu_read_lock();
+	map = rcu_dereference(dev->rps_map);
+	if (!map)
+		goto done;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP): {
+		struct iphdr *ip;
+
+		if (!pskb_may_pull(skb, sizeof(*ip)))
+			goto done;
+
+		ip = (struct iphdr *) skb->data;
+		if (ip->frag_off & htons(IP_MF | IP_OFFSET))
+			ip_proto = 0;
+		else
+			ip_proto = ip->protocol;
+		addr1 = (__force u32) ip->saddr;
+		addr2 = (__force u32) ip->daddr;
+		ihl = ip->ihl;
+		break;
+	}
+	case __constant_htons(ETH_P_IPV6): {
+		struct ipv6hdr *ip6;
+
+		if (!pskb_may_pull(skb, sizeof(*ip6)))
+			goto done;
+
+		ip6 = (struct ipv6hdr *) skb->data;
+		ip_proto = ip6->nexthdr;
+		addr1 = (__force u32) ip6->saddr.s6_addr32[3];
+		addr2 = (__force u32) ip6->daddr.s6_addr32[3];
+		ihl = (40 >> 2);
+		break;
+	}
+	default:
+		goto done;
+	}
+
+	switch (ip_proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_DCCP:
+	case IPPROTO_SCTP:
+	case IPPROTO_UDPLITE:
+		if (pskb_may_pull(skb, (ihl * 4) + 4))
+			ports = *((u32 *) (skb->data + (ihl * 4)));
+		break;
+	default:
+		break;
+	}
+
+	hash = jhash_3words(addr1, addr2, ports, rps_hashrnd);
+	cpu = map->cpus[((u64) hash * map->len) >> 32];
+	if (!cpu_online(cpu))
+		cpu = -1;
+done:
+	rcu_read_unlock();
+	return cpu;
+}
+
+/*
+ * There is no way to raise a softirq on another CPU, so each CPU has a
+ * bound thread that schedules its backlog when a remote CPU queued
+ * packets to it. Waking it sends the rescheduling IPI.
+ */
+static void rps_kick(struct softnet_data *queue)
+{
+	struct task_struct *tsk = queue->rps_kick_task;
+
+	set_bit(0, &queue->rps_kick);
+	if (tsk)
+		wake_up_process(tsk);
+}
+
+static int rps_kickd(void *__bind_cpu)
+{
+	struct softnet_data *queue = &per_cpu(softnet_data, (long)__bind_cpu);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	while (!kthread_should_stop()) {
+		if (!test_and_clear_bit(0, &queue->rps_kick)) {
+			schedule();
+			set_current_state(TASK_INTERRUPTIBLE);
+			continue;
+		}
+
+		__set_current_state(TASK_RUNNING);
+
+		/* The backlog runs from local_bh_enable() */
+		local_bh_disable();
+		if (!cpu_is_offline((long)__bind_cpu))
+			__napi_schedule(&queue->backlog);
+		local_bh_enable();
+
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+#else
+static inline void rps_lock(struct softnet_data *queue)
+{
+}
+
+static inline void rps_unlock(struct softnet_data *queue)
+{
+}
+#endif /* CONFIG_RPS */
+
+/*
+ * enqueue_to_backlog is called to queue an skb to a per CPU backlog
+ * queue (may be a remote CPU queue).
+ */
+static int enqueue_to_backlog(struct sk_buff *skb, int cpu)
 {
 	struct softnet_data *queue;
 	unsigned long flags;
 
-	/* if netpoll wants it, pretend we never saw it */
-	if (netpoll_rx(skb))
-		return NET_RX_DROP;
-
-	if (!skb->tstamp.tv64)
-		net_timestamp(skb);
+	queue = &per_cpu(softnet_data, cpu);
 
 	/*
 	 * The code is rearranged so that the path is the most
 	 * short when CPU is congested, but is still operating.
 	 */
 	local_irq_save(flags);
-	queue = &__get_cpu_var(softnet_data);
+	rps_lock(queue);
 
 	__get_cpu_var(netdev_rx_stat).total++;
 	if (queue->input_pkt_queue.qlen <= netdev_max_backlog) {
@@ -1782,21 +1914,72 @@ int netif_rx(struct sk_buff *skb)
 enqueue:
 			dev_hold(skb->dev);
 			__skb_queue_tail(&queue->input_pkt_queue, skb);
+			rps_unlock(queue);
 			local_irq_restore(flags);
 			return NET_RX_SUCCESS;
 		}
 
-		napi_schedule(&queue->backlog);
+		/* Schedule NAPI for backlog device */
+		if (napi_schedule_prep(&queue->backlog)) {
+#ifdef CONFIG_RPS
+			if (cpu != smp_processor_id())
+				rps_kick(queue);
+			else
+#endif
+				__napi_schedule(&queue->backlog);
+		}
 		goto enqueue;
 	}
 
 	__get_cpu_var(netdev_rx_stat).dropped++;
+	rps_unlock(queue);
 	local_irq_restore(flags);
 
 	kfree_skb(skb);
 	return NET_RX_DROP;
 }
 
+/**
+ *	netif_rx	-	post buffer to the network code
+ *	@skb: buffer to post
+ *
+ *	This function receives a packet from a device driver and queues it for
+ *	the upper (protocol) levels to process.  It always succeeds. The buffer
+ *	may be dropped during processing for congestion control or by the
+ *	protocol layers.
+ *
+ *	return values:
+ *	NET_RX_SUCCESS	(no congestion)
+ *	NET_RX_DROP     (packet was dropped)
+ *
+ */
+
+int netif_rx(struct sk_buff *skb)
+{
+	int cpu, ret;
+
+	/* if netpoll wants it, pretend we never saw it */
+	if (netpoll_rx(skb))
+		return NET_RX_DROP;
+
+	if (!skb->tstamp.tv64)
+		net_timestamp(skb);
+
+	cpu = get_cpu();
+#ifdef CONFIG_RPS
+	{
+		int rps_cpu = get_rps_cpu(skb->dev, skb);
+
+		if (rps_cpu >= 0)
+			cpu = rps_cpu;
+	}
+#endif
+	ret = enqueue_to_backlog(skb, cpu);
+	put_cpu();
+
+	return ret;
+}
+
 int netif_rx_ni(struct sk_buff *skb)
 {
 	int err;
@@ -2000,22 +2183,7 @@ out:
 }
 #endif
 
-/**
- *	netif_receive_skb - process receive buffer from network
- *	@skb: buffer to process
- *
- *	netif_receive_skb() is the main receive data processing function.
- *	It always succeeds. The buffer may be dropped during processing
- *	for congestion control or by the protocol layers.
- *
- *	This function may only be called from softirq context and interrupts
- *	should be enabled.
- *
- *	Return values (usually ignored):
- *	NET_RX_SUCCESS: no congestion
- *	NET_RX_DROP: packet was dropped
- */
-int netif_receive_skb(struct sk_buff *skb)
+static int __netif_receive_skb(struct sk_buff *skb)
 {
 	struct packet_type *ptype, *pt_prev;
 	struct net_device *orig_dev;
@@ -2101,6 +2269,184 @@ out:
 	return ret;
 }
 
+/* Number of flows held for merging on one CPU */
+#define MAX_GRO_SKBS 8
+
+static int dev_gro_complete(struct sk_buff *skb)
+{
+	struct packet_type *ptype;
+	__be16 type = skb->protocol;
+	struct list_head *head = &ptype_base[ntohs(type)&15];
+	int err = -ENOENT;
+
+	if (NAPI_GRO_CB(skb)->count == 1) {
+		skb_shinfo(skb)->gso_size = 0;
+		goto out;
+	}
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
+			continue;
+
+		err = ptype->gro_complete(skb);
+		break;
+	}
+	rcu_read_unlock();
+
+	if (err) {
+		WARN_ON(&ptype->list == head);
+		kfree_skb(skb);
+		return NET_RX_SUCCESS;
+	}
+
+out:
+	__skb_push(skb, -skb_network_offset(skb));
+	return __netif_receive_skb(skb);
+}
+
+static void dev_gro_flush(struct softnet_data *queue)
+{
+	struct sk_buff *skb, *next;
+
+	skb = queue->gro_list;
+	queue->gro_list = NULL;
+
+	for (; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		dev_gro_complete(skb);
+	}
+}
+
+/*
+ * dev_gro_receive tries to merge skb into a packet of the same flow held
+ * on this CPU. The protocol gro_receive handlers pull their headers and
+ * return the list position of a held packet that must be delivered now.
+ * Returns 0 if skb was held or merged, -1 if it has to be delivered as is.
+ */
+static int dev_gro_receive(struct softnet_data *queue, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct packet_type *ptype;
+	__be16 type = skb->protocol;
+	struct list_head *head = &ptype_base[ntohs(type)&15];
+	int count = 0;
+	int same_flow;
+	int mac_len;
+
+	if (skb_is_gso(skb) || skb_shinfo(skb)->frag_list || skb_cloned(skb))
+		return -1;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype, head, list) {
+		struct sk_buff *p;
+
+		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
+			continue;
+
+		skb_reset_network_header(skb);
+		mac_len = skb->network_header - skb->mac_header;
+		skb->mac_len = mac_len;
+		NAPI_GRO_CB(skb)->same_flow = 0;
+		NAPI_GRO_CB(skb)->flush = 0;
+
+		for (p = queue->gro_list; p; p = p->next) {
+			count++;
+			NAPI_GRO_CB(p)->same_flow =
+				p->dev == skb->dev && p->mac_len == mac_len &&
+				!memcmp(skb_mac_header(p), skb_mac_header(skb),
+					mac_len);
+			NAPI_GRO_CB(p)->flush = 0;
+		}
+
+		pp = ptype->gro_receive(&queue->gro_list, skb);
+		break;
+	}
+	rcu_read_unlock();
+
+	if (&ptype->list == head)
+		return -1;
+
+	same_flow = NAPI_GRO_CB(skb)->same_flow;
+
+	if (pp) {
+		struct sk_buff *nskb = *pp;
+
+		*pp = nskb->next;
+		nskb->next = NULL;
+		dev_gro_complete(nskb);
+		count--;
+	}
+
+	if (same_flow)
+		return 0;
+
+	if (NAPI_GRO_CB(skb)->flush || count >= MAX_GRO_SKBS) {
+		__skb_push(skb, -skb_network_offset(skb));
+		return -1;
+	}
+
+	NAPI_GRO_CB(skb)->count = 1;
+	skb_shinfo(skb)->gso_size = skb->len;
+	skb->next = queue->gro_list;
+	queue->gro_list = skb;
+
+	return 0;
+}
+
+/*
+ * Merging only happens while net_rx_action runs a poll routine, which
+ * flushes the held packets once the poll returns. gro_allowed is cleared
+ * while delivering so that packets re-entering netif_receive_skb from
+ * the protocols (e.g. the bridge) are not held again. Devices can opt
+ * out by clearing NETIF_F_GRO (ethtool -K <dev> gro off).
+ */
+static int netif_gro_receive(struct sk_buff *skb)
+{
+	struct softnet_data *queue = &__get_cpu_var(softnet_data);
+	int ret = NET_RX_SUCCESS;
+
+	if (!queue->gro_allowed || !(skb->dev->features & NETIF_F_GRO))
+		return __netif_receive_skb(skb);
+
+	queue->gro_allowed = 0;
+	if (dev_gro_receive(queue, skb))
+		ret = __netif_receive_skb(skb);
+	queue->gro_allowed = 1;
+
+	return ret;
+}
+
+/**
+ *	netif_receive_skb - process receive buffer from network
+ *	@skb: buffer to process
+ *
+ *	netif_receive_skb() is the main receive data processing function.
+ *	It always succeeds. The buffer may be dropped during processing
+ *	for congestion control or by the protocol layers.
+ *
+ *	This function may only be called from softirq context and interrupts
+ *	should be enabled.
+ *
+ *	Return values (usually ignored):
+ *	NET_RX_SUCCESS: no congestion
+ *	NET_RX_DROP: packet was dropped
+ */
+int netif_receive_skb(struct sk_buff *skb)
+{
+#ifdef CONFIG_RPS
+	int cpu = get_rps_cpu(skb->dev, skb);
+
+	if (cpu >= 0 && cpu != smp_processor_id()) {
+		if (!skb->tstamp.tv64)
+			net_timestamp(skb);
+		return enqueue_to_backlog(skb, cpu);
+	}
+#endif
+	return netif_gro_receive(skb);
+}
+
 static int process_backlog(struct napi_struct *napi, int quota)
 {
 	int work = 0;
@@ -2113,18 +2459,20 @@ static int process_backlog(struct napi_struct *napi, int quota)
 		struct net_device *dev;
 
 		local_irq_disable();
+		rps_lock(queue);
 		skb = __skb_dequeue(&queue->input_pkt_queue);
 		if (!skb) {
 			__napi_complete(napi);
+			rps_unlock(queue);
 			local_irq_enable();
 			break;
 		}
-
+		rps_unlock(queue);
 		local_irq_enable();
 
 		dev = skb->dev;
 
-		netif_receive_skb(skb);
+		netif_gro_receive(skb);
 
 		dev_put(dev);
 	} while (++work < quota && jiffies == start_time);
@@ -2152,7 +2500,8 @@ EXPORT_SYMBOL(__napi_schedule);
 
 static void net_rx_action(struct softirq_action *h)
 {
-	struct list_head *list = &__get_cpu_var(softnet_data).poll_list;
+	struct softnet_data *queue = &__get_cpu_var(softnet_data);
+	struct list_head *list = &queue->poll_list;
 	unsigned long start_time = jiffies;
 	int budget = netdev_budget;
 	void *have;
@@ -2193,8 +2542,15 @@ static void net_rx_action(struct softirq_action *h)
 		 * accidently calling ->poll() when NAPI is not scheduled.
 		 */
 		work = 0;
-		if (test_bit(NAPI_STATE_SCHED, &n->state))
+		if (test_bit(NAPI_STATE_SCHED, &n->state)) {
+			queue->gro_allowed = 1;
 			work = n->poll(n, weight);
+			queue->gro_allowed = 0;
+
+			/* Push merged packets up before the next poll */
+			if (queue->gro_list)
+				dev_gro_flush(queue);
+		}
 
 		WARN_ON_ONCE(work > weight);
 
@@ -3686,6 +4042,9 @@ int register_netdevice(struct net_device *dev)
 		}
 	}
 
+	/* GRO is done in software, it can be turned off with ethtool */
+	dev->features |= NETIF_F_GRO;
+
 	ret = netdev_register_kobject(dev);
 	if (ret)
 		goto err_uninit;
@@ -4168,6 +4527,69 @@ static int dev_cpu_callback(struct notifier_block *nfb,
 	return NOTIFY_OK;
 }
 
+#ifdef CONFIG_RPS
+static int __cpuinit rps_cpu_callback(struct notifier_block *nfb,
+				      unsigned long action,
+				      void *hcpu)
+{
+	int hotcpu = (unsigned long)hcpu;
+	struct softnet_data *queue = &per_cpu(softnet_data, hotcpu);
+	struct task_struct *p;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+	case CPU_UP_PREPARE_FROZEN:
+		p = kthread_create(rps_kickd, hcpu, "krpsd/%d", hotcpu);
+		if (IS_ERR(p)) {
+			printk(KERN_ERR "krpsd for %i failed\n", hotcpu);
+			return NOTIFY_BAD;
+		}
+		kthread_bind(p, hotcpu);
+		queue->rps_kick_task = p;
+		break;
+	case CPU_ONLINE:
+	case CPU_ONLINE_FROZEN:
+		wake_up_process(queue->rps_kick_task);
+		break;
+#ifdef CONFIG_HOTPLUG_CPU
+	case CPU_UP_CANCELED:
+	case CPU_UP_CANCELED_FROZEN:
+		if (!queue->rps_kick_task)
+			break;
+		/* Unbind so it can run.  Fall thru. */
+		kthread_bind(queue->rps_kick_task,
+			     any_online_cpu(cpu_online_map));
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+		p = queue->rps_kick_task;
+		queue->rps_kick_task = NULL;
+		kthread_stop(p);
+		break;
+#endif /* CONFIG_HOTPLUG_CPU */
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata rps_cpu_nfb = {
+	.notifier_call = rps_cpu_callback
+};
+
+static void __init rps_init(void)
+{
+	int cpu;
+
+	get_random_bytes(&rps_hashrnd, sizeof(rps_hashrnd));
+
+	for_each_online_cpu(cpu) {
+		void *hcpu = (void *)(long)cpu;
+
+		rps_cpu_callback(&rps_cpu_nfb, CPU_UP_PREPARE, hcpu);
+		rps_cpu_callback(&rps_cpu_nfb, CPU_ONLINE, hcpu);
+	}
+	register_hotcpu_notifier(&rps_cpu_nfb);
+}
+#endif /* CONFIG_RPS */
+
 #ifdef CONFIG_NET_DMA
 /**
  * net_dma_rebalance - try to maintain one DMA channel per CPU
@@ -4435,6 +4857,7 @@ static int __init net_dev_init(void)
 		queue = &per_cpu(softnet_data, i);
 		skb_queue_head_init(&queue->input_pkt_queue);
 		queue->completion_queue = NULL;
+		queue->gro_list = NULL;
 		INIT_LIST_HEAD(&queue->poll_list);
 
 		queue->backlog.poll = process_backlog;
@@ -4449,6 +4872,9 @@ static int __init net_dev_init(void)
 	open_softirq(NET_RX_SOFTIRQ, net_rx_action, NULL);
 
 	hotcpu_notifier(dev_cpu_callback, 0);
+#ifdef CONFIG_RPS
+	rps_init();
+#endif
 	dst_init();
 	dev_mcast_init();
 	rc = 0;
@@ -219,6 +219,87 @@ static ssize_t store_tx_queue_len(struct device *dev,
 	return netdev_store(dev, attr, buf, len, change_tx_queue_len);
 }
 
+#ifdef CONFIG_RPS
+static ssize_t show_rps_cpus(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_map *map;
+	cpumask_t mask;
+	size_t len = 0;
+	int i;
+
+	cpus_clear(mask);
+	rcu_read_lock();
+	map = rcu_dereference(net->rps_map);
+	if (map)
+		for (i = 0; i < map->len; i++)
+			cpu_set(map->cpus[i], mask);
+	rcu_read_unlock();
+
+	len += cpumask_scnprintf(buf + len, PAGE_SIZE, mask);
+	if (PAGE_SIZE - len < 2)
+		return -EINVAL;
+
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static void rps_map_release(struct rcu_head *rcu)
+{
+	struct rps_map *map = container_of(rcu, struct rps_map, rcu);
+
+	kfree(map);
+}
+
+static DEFINE_SPINLOCK(rps_map_lock);
+
+static ssize_t store_rps_cpus(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t len)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_map *old_map, *map;
+	cpumask_t mask;
+	int err, cpu, i;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	err = bitmap_parse(buf, len, cpus_addr(mask), NR_CPUS);
+	if (err)
+		return err;
+
+	map = kzalloc(max_t(unsigned,
+			    RPS_MAP_SIZE(cpus_weight(mask)), L1_CACHE_BYTES),
+		      GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+
+	i = 0;
+	for_each_cpu_mask(cpu, mask)
+		if (cpu_online(cpu))
+			map->cpus[i++] = cpu;
+
+	if (i)
+		map->len = i;
+	else {
+		kfree(map);
+		map = NULL;
+	}
+
+	spin_lock(&rps_map_lock);
+	old_map = net->rps_map;
+	rcu_assign_pointer(net->rps_map, map);
+	spin_unlock(&rps_map_lock);
+
+	if (old_map)
+		call_rcu(&old_map->rcu, rps_map_release);
+
+	return len;
+}
+#endif /* CONFIG_RPS */
+
 static struct device_attribute net_class_attributes[] = {
 	__ATTR(addr_len, S_IRUGO, show_addr_len, NULL),
 	__ATTR(iflink, S_IRUGO, show_iflink, NULL),
@@ -235,6 +316,9 @@ static struct device_attribute net_class_attributes[] = {
 	__ATTR(flags, S_IRUGO | S_IWUSR, show_flags, store_flags),
 	__ATTR(tx_queue_len, S_IRUGO | S_IWUSR, show_tx_queue_len,
 	       store_tx_queue_len),
+#ifdef CONFIG_RPS
+	__ATTR(rps_cpus, S_IRUGO | S_IWUSR, show_rps_cpus, store_rps_cpus),
+#endif
 	{}
 };
 
@@ -428,6 +512,9 @@ static void netdev_release(struct device *d)
 
 	BUG_ON(dev->reg_state != NETREG_RELEASED);
 
+#ifdef CONFIG_RPS
+	kfree(dev->rps_map);
+#endif
 	kfree((char *)dev - dev->padded);
 }
 
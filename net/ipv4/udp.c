@@ -111,16 +111,16 @@
 
 DEFINE_SNMP_STAT(struct udp_mib, udp_statistics) __read_mostly;
 
-struct hlist_head udp_hash[UDP_HTABLE_SIZE];
+struct udp_table udp_table;
 DEFINE_RWLOCK(udp_hash_lock);
 
 static inline int __udp_lib_lport_inuse(__u16 num,
-					const struct hlist_head udptable[])
+					const struct udp_table *udptable)
 {
 	struct sock *sk;
 	struct hlist_node *node;
 
-	sk_for_each(sk, node, &udptable[num & (UDP_HTABLE_SIZE - 1)])
+	sk_for_each(sk, node, &udptable->hash[num & (UDP_HTABLE_SIZE - 1)].head)
 		if (sk->sk_hash == num)
 			return 1;
 	return 0;
@@ -131,16 +131,18 @@ static inline int __udp_lib_lport_inuse(__u16 num,
  *
  *  @sk:          socket struct in question
  *  @snum:        port number to look up
- *  @udptable:    hash list table, must be of UDP_HTABLE_SIZE
+ *  @udptable:    hash tables of the protocol
  *  @saddr_comp:  AF-dependent comparison of bound local IP addresses
+ *  @hash2_partial: AF-dependent hash of the bound local address, port 0
  */
 int __udp_lib_get_port(struct sock *sk, unsigned short snum,
-		       struct hlist_head udptable[],
+		       struct udp_table *udptable,
 		       int (*saddr_comp)(const struct sock *sk1,
-					 const struct sock *sk2 )    )
+					 const struct sock *sk2 ),
+		       unsigned int hash2_partial)
 {
 	struct hlist_node *node;
-	struct hlist_head *head;
+	struct udp_hslot *hslot;
 	struct sock *sk2;
 	int    error = 1;
 
@@ -158,19 +160,14 @@ int __udp_lib_get_port(struct sock *sk, unsigned short snum,
 
 		/* 1st pass: look for empty (or shortest) hash chain */
 		for (i = 0; i < UDP_HTABLE_SIZE; i++) {
-			int size = 0;
-
-			head = &udptable[rover & (UDP_HTABLE_SIZE - 1)];
-			if (hlist_empty(head))
+			hslot = &udptable->hash[rover & (UDP_HTABLE_SIZE - 1)];
+			if (!hslot->count)
 				goto gotit;
 
-			sk_for_each(sk2, node, head) {
-				if (++size >= best_size_so_far)
-					goto next;
+			if (hslot->count < best_size_so_far) {
+				best_size_so_far = hslot->count;
+				best = rover;
 			}
-			best_size_so_far = size;
-			best = rover;
-		next:
 			/* fold back if end of range */
 			if (++rover > high)
 				rover = low + ((rover - low)
@@ -197,9 +194,9 @@ int __udp_lib_get_port(struct sock *sk, unsigned short snum,
 gotit:
 		snum = rover;
 	} else {
-		head = &udptable[snum & (UDP_HTABLE_SIZE - 1)];
+		hslot = &udptable->hash[snum & (UDP_HTABLE_SIZE - 1)];
 
-		sk_for_each(sk2, node, head)
+		sk_for_each(sk2, node, &hslot->head)
 			if (sk2->sk_hash == snum                             &&
 			    sk2 != sk                                        &&
 			    (!sk2->sk_reuse        || !sk->sk_reuse)         &&
@@ -212,9 +209,18 @@ gotit:
 	inet_sk(sk)->num = snum;
 	sk->sk_hash = snum;
 	if (sk_unhashed(sk)) {
-		head = &udptable[snum & (UDP_HTABLE_SIZE - 1)];
-		sk_add_node(sk, head);
+		struct udp_sock *up = udp_sk(sk);
+		struct udp_hslot *hslot2;
+
+		hslot = &udptable->hash[snum & (UDP_HTABLE_SIZE - 1)];
+		sk_add_node(sk, &hslot->head);
+		hslot->count++;
 		sock_prot_inc_use(sk->sk_prot);
+
+		up->udp_portaddr_hash = hash2_partial ^ snum;
+		hslot2 = udp_hashslot2(udptable, up->udp_portaddr_hash);
+		hlist_add_head(&up->udp_portaddr_node, &hslot2->head);
+		hslot2->count++;
 	}
 	error = 0;
 fail:
@@ -223,9 +229,10 @@ fail:
 }
 
 int udp_get_port(struct sock *sk, unsigned short snum,
-			int (*scmp)(const struct sock *, const struct sock *))
+			int (*scmp)(const struct sock *, const struct sock *),
+			unsigned int hash2_partial)
 {
-	return  __udp_lib_get_port(sk, snum, udp_hash, scmp);
+	return  __udp_lib_get_port(sk, snum, &udp_table, scmp, hash2_partial);
 }
 
 int ipv4_rcv_saddr_equal(const struct sock *sk1, const struct sock *sk2)
@@ -239,7 +246,119 @@ int ipv4_rcv_saddr_equal(const struct sock *sk1, const struct sock *sk2)
 
 static inline int udp_v4_get_port(struct sock *sk, unsigned short snum)
 {
-	return udp_get_port(sk, snum, ipv4_rcv_saddr_equal);
+	return udp_get_port(sk, snum, ipv4_rcv_saddr_equal,
+			    udp4_portaddr_hash(inet_sk(sk)->rcv_saddr, 0));
+}
+
+static inline struct udp_table *udp_sk_table(struct sock *sk)
+{
+	return IS_UDPLITE(sk) ? &udplite_table : &udp_table;
+}
+
+void udp_lib_unhash(struct sock *sk)
+{
+	struct udp_table *udptable = udp_sk_table(sk);
+
+	write_lock_bh(&udp_hash_lock);
+	if (sk_del_node_init(sk)) {
+		struct udp_sock *up = udp_sk(sk);
+
+		udptable->hash[sk->sk_hash & (UDP_HTABLE_SIZE - 1)].count--;
+		hlist_del_init(&up->udp_portaddr_node);
+		udp_hashslot2(udptable, up->udp_portaddr_hash)->count--;
+
+		inet_sk(sk)->num = 0;
+		sock_prot_dec_use(sk->sk_prot);
+	}
+	write_unlock_bh(&udp_hash_lock);
+}
+
+/*
+ * Move a hashed socket to the secondary chain of its new local address,
+ * for when connect() or disconnect() changes the address after binding.
+ */
+void udp_lib_rehash(struct sock *sk, unsigned int newhash)
+{
+	struct udp_table *udptable = udp_sk_table(sk);
+	struct udp_sock *up = udp_sk(sk);
+	struct udp_hslot *hslot2, *nhslot2;
+
+	write_lock_bh(&udp_hash_lock);
+	if (sk_hashed(sk) && newhash != up->udp_portaddr_hash) {
+		hslot2 = udp_hashslot2(udptable, up->udp_portaddr_hash);
+		nhslot2 = udp_hashslot2(udptable, newhash);
+
+		hlist_del(&up->udp_portaddr_node);
+		hslot2->count--;
+		hlist_add_head(&up->udp_portaddr_node, &nhslot2->head);
+		nhslot2->count++;
+	}
+	up->udp_portaddr_hash = newhash;
+	write_unlock_bh(&udp_hash_lock);
+}
+
+void udp_v4_rehash(struct sock *sk)
+{
+	struct inet_sock *inet = inet_sk(sk);
+
+	udp_lib_rehash(sk, udp4_portaddr_hash(inet->rcv_saddr, inet->num));
+}
+
+static inline int compute_score(struct sock *sk, unsigned short hnum,
+				__be32 saddr, __be16 sport,
+				__be32 daddr, int dif)
+{
+	struct inet_sock *inet = inet_sk(sk);
+	int score;
+
+	if (sk->sk_hash != hnum || ipv6_only_sock(sk))
+		return -1;
+
+	score = (sk->sk_family == PF_INET ? 1 : 0);
+	if (inet->rcv_saddr) {
+		if (inet->rcv_saddr != daddr)
+			return -1;
+		score+=2;
+	}
+	if (inet->daddr) {
+		if (inet->daddr != saddr)
+			return -1;
+		score+=2;
+	}
+	if (inet->dport) {
+		if (inet->dport != sport)
+			return -1;
+		score+=2;
+	}
+	if (sk->sk_bound_dev_if) {
+		if (sk->sk_bound_dev_if != dif)
+			return -1;
+		score+=2;
+	}
+	return score;
+}
+
+/* Best match in a secondary chain, starting from the current best */
+static struct sock *udp4_lib_lookup2(__be32 saddr, __be16 sport,
+				     __be32 daddr, unsigned short hnum,
+				     int dif, struct udp_hslot *hslot2,
+				     struct sock *result, int *badness)
+{
+	struct udp_sock *up;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(up, node, &hslot2->head, udp_portaddr_node) {
+		struct sock *sk = (struct sock *)up;
+		int score = compute_score(sk, hnum, saddr, sport, daddr, dif);
+
+		if (score > *badness) {
+			result = sk;
+			*badness = score;
+			if (score == 9)
+				break;
+		}
+	}
+	return result;
 }
 
 /* UDP is nearly always wildcards out the wazoo, it makes no sense to try
@@ -247,48 +366,55 @@ static inline int udp_v4_get_port(struct sock *sk, unsigned short snum)
  */
 static struct sock *__udp4_lib_lookup(__be32 saddr, __be16 sport,
 				      __be32 daddr, __be16 dport,
-				      int dif, struct hlist_head udptable[])
+				      int dif, struct udp_table *udptable)
 {
 	struct sock *sk, *result = NULL;
 	struct hlist_node *node;
 	unsigned short hnum = ntohs(dport);
+	struct udp_hslot *hslot = &udptable->hash[hnum & (UDP_HTABLE_SIZE - 1)];
 	int badness = -1;
 
 	read_lock(&udp_hash_lock);
-	sk_for_each(sk, node, &udptable[hnum & (UDP_HTABLE_SIZE - 1)]) {
-		struct inet_sock *inet = inet_sk(sk);
-
-		if (sk->sk_hash == hnum && !ipv6_only_sock(sk)) {
-			int score = (sk->sk_family == PF_INET ? 1 : 0);
-			if (inet->rcv_saddr) {
-				if (inet->rcv_saddr != daddr)
-					continue;
-				score+=2;
-			}
-			if (inet->daddr) {
-				if (inet->daddr != saddr)
-					continue;
-				score+=2;
-			}
-			if (inet->dport) {
-				if (inet->dport != sport)
-					continue;
-				score+=2;
-			}
-			if (sk->sk_bound_dev_if) {
-				if (sk->sk_bound_dev_if != dif)
-					continue;
-				score+=2;
-			}
-			if (score == 9) {
-				result = sk;
-				break;
-			} else if (score > badness) {
-				result = sk;
-				badness = score;
-			}
+
+	/*
+	 * A matching socket is bound either to daddr or to INADDR_ANY, so
+	 * the two secondary chains hold every candidate of the port chain.
+	 */
+	if (hslot->count > UDP_HASH2_THRESHOLD) {
+		struct udp_hslot *hslot2, *hslot2_any;
+		int count;
+
+		hslot2 = udp_hashslot2(udptable, udp4_portaddr_hash(daddr, hnum));
+		hslot2_any = udp_hashslot2(udptable,
+					   udp4_portaddr_hash(htonl(INADDR_ANY),
+							      hnum));
+		count = hslot2->count;
+		if (hslot2_any != hslot2)
+			count += hslot2_any->count;
+
+		if (count < hslot->count) {
+			result = udp4_lib_lookup2(saddr, sport, daddr, hnum, dif,
+						  hslot2, NULL, &badness);
+			if (hslot2_any != hslot2 && badness < 9)
+				result = udp4_lib_lookup2(saddr, sport, daddr,
+							  hnum, dif, hslot2_any,
+							  result, &badness);
+			goto found;
+		}
+	}
+
+	sk_for_each(sk, node, &hslot->head) {
+		int score = compute_score(sk, hnum, saddr, sport, daddr, dif);
+
+		if (score == 9) {
+			result = sk;
+			break;
+		} else if (score > badness) {
+			result = sk;
+			badness = score;
 		}
 	}
+found:
 	if (result)
 		sock_hold(result);
 	read_unlock(&udp_hash_lock);
@@ -334,7 +460,7 @@ found:
  * to find the appropriate port.
  */
 
-void __udp4_lib_err(struct sk_buff *skb, u32 info, struct hlist_head udptable[])
+void __udp4_lib_err(struct sk_buff *skb, u32 info, struct udp_table *udptable)
 {
 	struct inet_sock *inet;
 	struct iphdr *iph = (struct iphdr*)skb->data;
@@ -402,7 +528,7 @@ out:
 
 void udp_err(struct sk_buff *skb, u32 info)
 {
-	return __udp4_lib_err(skb, info, udp_hash);
+	return __udp4_lib_err(skb, info, &udp_table);
 }
 
 /*
@@ -917,8 +1043,12 @@ int udp_disconnect(struct sock *sk, int flags)
 	inet->daddr = 0;
 	inet->dport = 0;
 	sk->sk_bound_dev_if = 0;
-	if (!(sk->sk_userlocks & SOCK_BINDADDR_LOCK))
+	if (!(sk->sk_userlocks & SOCK_BINDADDR_LOCK)) {
 		inet_reset_saddr(sk);
+		if (sk->sk_prot->rehash &&
+		    (sk->sk_userlocks & SOCK_BINDPORT_LOCK))
+			sk->sk_prot->rehash(sk);
+	}
 
 	if (!(sk->sk_userlocks & SOCK_BINDPORT_LOCK)) {
 		sk->sk_prot->unhash(sk);
@@ -1041,13 +1171,13 @@ drop:
 static int __udp4_lib_mcast_deliver(struct sk_buff *skb,
 				    struct udphdr  *uh,
 				    __be32 saddr, __be32 daddr,
-				    struct hlist_head udptable[])
+				    struct udp_table *udptable)
 {
 	struct sock *sk;
 	int dif;
 
 	read_lock(&udp_hash_lock);
-	sk = sk_head(&udptable[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)]);
+	sk = sk_head(&udptable->hash[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)].head);
 	dif = skb->dev->ifindex;
 	sk = udp_v4_mcast_next(sk, uh->dest, daddr, uh->source, saddr, dif);
 	if (sk) {
@@ -1118,7 +1248,7 @@ static inline int udp4_csum_init(struct sk_buff *skb, struct udphdr *uh,
  *	All we need to do is get the socket, and then do a checksum.
  */
 
-int __udp4_lib_rcv(struct sk_buff *skb, struct hlist_head udptable[],
+int __udp4_lib_rcv(struct sk_buff *skb, struct udp_table *udptable,
 		   int proto)
 {
 	struct sock *sk;
@@ -1215,7 +1345,7 @@ drop:
 
 int udp_rcv(struct sk_buff *skb)
 {
-	return __udp4_lib_rcv(skb, udp_hash, IPPROTO_UDP);
+	return __udp4_lib_rcv(skb, &udp_table, IPPROTO_UDP);
 }
 
 int udp_destroy_sock(struct sock *sk)
@@ -1448,6 +1578,7 @@ struct proto udp_prot = {
 	.backlog_rcv	   = udp_queue_rcv_skb,
 	.hash		   = udp_lib_hash,
 	.unhash		   = udp_lib_unhash,
+	.rehash		   = udp_v4_rehash,
 	.get_port	   = udp_v4_get_port,
 	.obj_size	   = sizeof(struct udp_sock),
 #ifdef CONFIG_COMPAT
@@ -1467,7 +1598,7 @@ static struct sock *udp_get_first(struct seq_file *seq)
 
 	for (state->bucket = 0; state->bucket < UDP_HTABLE_SIZE; ++state->bucket) {
 		struct hlist_node *node;
-		sk_for_each(sk, node, state->hashtable + state->bucket) {
+		sk_for_each(sk, node, &state->udp_table->hash[state->bucket].head) {
 			if (sk->sk_family == state->family)
 				goto found;
 		}
@@ -1488,7 +1619,7 @@ try_again:
 	} while (sk && sk->sk_family != state->family);
 
 	if (!sk && ++state->bucket < UDP_HTABLE_SIZE) {
-		sk = sk_head(state->hashtable + state->bucket);
+		sk = sk_head(&state->udp_table->hash[state->bucket].head);
 		goto try_again;
 	}
 	return sk;
@@ -1538,7 +1669,7 @@ static int udp_seq_open(struct inode *inode, struct file *file)
 	if (!s)
 		goto out;
 	s->family		= afinfo->family;
-	s->hashtable		= afinfo->hashtable;
+	s->udp_table		= afinfo->udp_table;
 	s->seq_ops.start	= udp_seq_start;
 	s->seq_ops.next		= udp_seq_next;
 	s->seq_ops.show		= afinfo->seq_show;
@@ -1628,7 +1759,7 @@ static struct udp_seq_afinfo udp4_seq_afinfo = {
 	.owner		= THIS_MODULE,
 	.name		= "udp",
 	.family		= AF_INET,
-	.hashtable	= udp_hash,
+	.udp_table	= &udp_table,
 	.seq_show	= udp4_seq_show,
 	.seq_fops	= &udp4_seq_fops,
 };
@@ -1645,10 +1776,12 @@ void udp4_proc_exit(void)
 #endif /* CONFIG_PROC_FS */
 
 EXPORT_SYMBOL(udp_disconnect);
-EXPORT_SYMBOL(udp_hash);
+EXPORT_SYMBOL(udp_table);
 EXPORT_SYMBOL(udp_hash_lock);
 EXPORT_SYMBOL(udp_ioctl);
 EXPORT_SYMBOL(udp_get_port);
+EXPORT_SYMBOL(udp_lib_unhash);
+EXPORT_SYMBOL(udp_lib_rehash);
 EXPORT_SYMBOL(udp_prot);
 EXPORT_SYMBOL(udp_sendmsg);
 EXPORT_SYMBOL(udp_lib_getsockopt);
@@ -5,13 +5,15 @@
 #include <net/protocol.h>
 #include <net/inet_common.h>
 
-extern int  	__udp4_lib_rcv(struct sk_buff *, struct hlist_head [], int );
-extern void 	__udp4_lib_err(struct sk_buff *, u32, struct hlist_head []);
+extern int  	__udp4_lib_rcv(struct sk_buff *, struct udp_table *, int );
+extern void 	__udp4_lib_err(struct sk_buff *, u32, struct udp_table *);
 
 extern int	__udp_lib_get_port(struct sock *sk, unsigned short snum,
-				   struct hlist_head udptable[],
-				   int (*)(const struct sock*,const struct sock*));
+				   struct udp_table *udptable,
+				   int (*)(const struct sock*,const struct sock*),
+				   unsigned int hash2_partial);
 extern int	ipv4_rcv_saddr_equal(const struct sock *, const struct sock *);
+extern void	udp_v4_rehash(struct sock *sk);
 
 
 extern int	udp_setsockopt(struct sock *sk, int level, int optname,
@@ -15,27 +15,29 @@
 #include "udp_impl.h"
 DEFINE_SNMP_STAT(struct udp_mib, udplite_statistics)	__read_mostly;
 
-struct hlist_head 	udplite_hash[UDP_HTABLE_SIZE];
+struct udp_table	udplite_table;
 
 int udplite_get_port(struct sock *sk, unsigned short p,
-		     int (*c)(const struct sock *, const struct sock *))
+		     int (*c)(const struct sock *, const struct sock *),
+		     unsigned int hash2_partial)
 {
-	return  __udp_lib_get_port(sk, p, udplite_hash, c);
+	return  __udp_lib_get_port(sk, p, &udplite_table, c, hash2_partial);
 }
 
 static int udplite_v4_get_port(struct sock *sk, unsigned short snum)
 {
-	return udplite_get_port(sk, snum, ipv4_rcv_saddr_equal);
+	return udplite_get_port(sk, snum, ipv4_rcv_saddr_equal,
+				udp4_portaddr_hash(inet_sk(sk)->rcv_saddr, 0));
 }
 
 static int udplite_rcv(struct sk_buff *skb)
 {
-	return __udp4_lib_rcv(skb, udplite_hash, IPPROTO_UDPLITE);
+	return __udp4_lib_rcv(skb, &udplite_table, IPPROTO_UDPLITE);
 }
 
 static void udplite_err(struct sk_buff *skb, u32 info)
 {
-	return __udp4_lib_err(skb, info, udplite_hash);
+	return __udp4_lib_err(skb, info, &udplite_table);
 }
 
 static	struct net_protocol udplite_protocol = {
@@ -63,6 +65,7 @@ struct proto 	udplite_prot = {
 	.backlog_rcv	   = udp_queue_rcv_skb,
 	.hash		   = udp_lib_hash,
 	.unhash		   = udp_lib_unhash,
+	.rehash		   = udp_v4_rehash,
 	.get_port	   = udplite_v4_get_port,
 	.obj_size	   = sizeof(struct udp_sock),
 #ifdef CONFIG_COMPAT
@@ -88,7 +91,7 @@ static struct udp_seq_afinfo udplite4_seq_afinfo = {
 	.owner		= THIS_MODULE,
 	.name		= "udplite",
 	.family		= AF_INET,
-	.hashtable	= udplite_hash,
+	.udp_table	= &udplite_table,
 	.seq_show	= udp4_seq_show,
 	.seq_fops	= &udplite4_seq_fops,
 };
@@ -116,6 +119,6 @@ out_register_err:
 	printk(KERN_CRIT "%s: Cannot add UDP-Lite protocol.\n", __FUNCTION__);
 }
 
-EXPORT_SYMBOL(udplite_hash);
+EXPORT_SYMBOL(udplite_table);
 EXPORT_SYMBOL(udplite_prot);
 EXPORT_SYMBOL(udplite_get_port);
@@ -52,56 +52,133 @@
 
 DEFINE_SNMP_STAT(struct udp_mib, udp_stats_in6) __read_mostly;
 
+unsigned int udp6_portaddr_hash(const struct in6_addr *addr6, unsigned int port)
+{
+	if (ipv6_addr_any(addr6))
+		return udp4_portaddr_hash(htonl(INADDR_ANY), port);
+	if (ipv6_addr_v4mapped(addr6))
+		return udp4_portaddr_hash(addr6->s6_addr32[3], port);
+	return jhash2((__force const u32 *)addr6->s6_addr32, 4, 0) ^ port;
+}
+
 static inline int udp_v6_get_port(struct sock *sk, unsigned short snum)
 {
-	return udp_get_port(sk, snum, ipv6_rcv_saddr_equal);
+	return udp_get_port(sk, snum, ipv6_rcv_saddr_equal,
+			    udp6_portaddr_hash(&inet6_sk(sk)->rcv_saddr, 0));
+}
+
+void udp_v6_rehash(struct sock *sk)
+{
+	udp_lib_rehash(sk, udp6_portaddr_hash(&inet6_sk(sk)->rcv_saddr,
+					      inet_sk(sk)->num));
+}
+
+static inline int compute_score(struct sock *sk, unsigned short hnum,
+				struct in6_addr *saddr, __be16 sport,
+				struct in6_addr *daddr, int dif)
+{
+	struct inet_sock *inet = inet_sk(sk);
+	struct ipv6_pinfo *np;
+	int score = 0;
+
+	if (sk->sk_hash != hnum || sk->sk_family != PF_INET6)
+		return -1;
+
+	np = inet6_sk(sk);
+	if (inet->dport) {
+		if (inet->dport != sport)
+			return -1;
+		score++;
+	}
+	if (!ipv6_addr_any(&np->rcv_saddr)) {
+		if (!ipv6_addr_equal(&np->rcv_saddr, daddr))
+			return -1;
+		score++;
+	}
+	if (!ipv6_addr_any(&np->daddr)) {
+		if (!ipv6_addr_equal(&np->daddr, saddr))
+			return -1;
+		score++;
+	}
+	if (sk->sk_bound_dev_if) {
+		if (sk->sk_bound_dev_if != dif)
+			return -1;
+		score++;
+	}
+	return score;
+}
+
+/* Best match in a secondary chain, starting from the current best */
+static struct sock *udp6_lib_lookup2(struct in6_addr *saddr, __be16 sport,
+				     struct in6_addr *daddr, unsigned short hnum,
+				     int dif, struct udp_hslot *hslot2,
+				     struct sock *result, int *badness)
+{
+	struct udp_sock *up;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(up, node, &hslot2->head, udp_portaddr_node) {
+		struct sock *sk = (struct sock *)up;
+		int score = compute_score(sk, hnum, saddr, sport, daddr, dif);
+
+		if (score > *badness) {
+			result = sk;
+			*badness = score;
+			if (score == 4)
+				break;
+		}
+	}
+	return result;
 }
 
 static struct sock *__udp6_lib_lookup(struct in6_addr *saddr, __be16 sport,
 				      struct in6_addr *daddr, __be16 dport,
-				      int dif, struct hlist_head udptable[])
+				      int dif, struct udp_table *udptable)
 {
 	struct sock *sk, *result = NULL;
 	struct hlist_node *node;
 	unsigned short hnum = ntohs(dport);
+	struct udp_hslot *hslot = &udptable->hash[hnum & (UDP_HTABLE_SIZE - 1)];
 	int badness = -1;
 
 	read_lock(&udp_hash_lock);
-	sk_for_each(sk, node, &udptable[hnum & (UDP_HTABLE_SIZE - 1)]) {
-		struct inet_sock *inet = inet_sk(sk);
 
-		if (sk->sk_hash == hnum && sk->sk_family == PF_INET6) {
-			struct ipv6_pinfo *np = inet6_sk(sk);
-			int score = 0;
-			if (inet->dport) {
-				if (inet->dport != sport)
-					continue;
-				score++;
-			}
-			if (!ipv6_addr_any(&np->rcv_saddr)) {
-				if (!ipv6_addr_equal(&np->rcv_saddr, daddr))
-					continue;
-				score++;
-			}
-			if (!ipv6_addr_any(&np->daddr)) {
-				if (!ipv6_addr_equal(&np->daddr, saddr))
-					continue;
-				score++;
-			}
-			if (sk->sk_bound_dev_if) {
-				if (sk->sk_bound_dev_if != dif)
-					continue;
-				score++;
-			}
-			if (score == 4) {
-				result = sk;
-				break;
-			} else if (score > badness) {
-				result = sk;
-				badness = score;
-			}
+	/* See __udp4_lib_lookup() */
+	if (hslot->count > UDP_HASH2_THRESHOLD) {
+		struct udp_hslot *hslot2, *hslot2_any;
+		int count;
+
+		hslot2 = udp_hashslot2(udptable, udp6_portaddr_hash(daddr, hnum));
+		hslot2_any = udp_hashslot2(udptable,
+					   udp6_portaddr_hash(&in6addr_any,
+							      hnum));
+		count = hslot2->count;
+		if (hslot2_any != hslot2)
+			count += hslot2_any->count;
+
+		if (count < hslot->count) {
+			result = udp6_lib_lookup2(saddr, sport, daddr, hnum, dif,
+						  hslot2, NULL, &badness);
+			if (hslot2_any != hslot2 && badness < 4)
+				result = udp6_lib_lookup2(saddr, sport, daddr,
+							  hnum, dif, hslot2_any,
+							  result, &badness);
+			goto found;
+		}
+	}
+
+	sk_for_each(sk, node, &hslot->head) {
+		int score = compute_score(sk, hnum, saddr, sport, daddr, dif);
+
+		if (score == 4) {
+			result = sk;
+			break;
+		} else if (score > badness) {
+			result = sk;
+			badness = score;
 		}
 	}
+found:
 	if (result)
 		sock_hold(result);
 	read_unlock(&udp_hash_lock);
@@ -215,7 +292,7 @@ csum_copy_err:
 
 void __udp6_lib_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 		    int type, int code, int offset, __be32 info,
-		    struct hlist_head udptable[]                    )
+		    struct udp_table *udptable                    )
 {
 	struct ipv6_pinfo *np;
 	struct ipv6hdr *hdr = (struct ipv6hdr*)skb->data;
@@ -251,7 +328,7 @@ static __inline__ void udpv6_err(struct sk_buff *skb,
 				 struct inet6_skb_parm *opt, int type,
 				 int code, int offset, __be32 info     )
 {
-	return __udp6_lib_err(skb, opt, type, code, offset, info, udp_hash);
+	return __udp6_lib_err(skb, opt, type, code, offset, info, &udp_table);
 }
 
 int udpv6_queue_rcv_skb(struct sock * sk, struct sk_buff *skb)
@@ -342,14 +419,14 @@ static struct sock *udp_v6_mcast_next(struct sock *sk,
  * so we don't need to lock the hashes.
  */
 static int __udp6_lib_mcast_deliver(struct sk_buff *skb, struct in6_addr *saddr,
-			   struct in6_addr *daddr, struct hlist_head udptable[])
+			   struct in6_addr *daddr, struct udp_table *udptable)
 {
 	struct sock *sk, *sk2;
 	const struct udphdr *uh = udp_hdr(skb);
 	int dif;
 
 	read_lock(&udp_hash_lock);
-	sk = sk_head(&udptable[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)]);
+	sk = sk_head(&udptable->hash[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)].head);
 	dif = inet6_iif(skb);
 	sk = udp_v6_mcast_next(sk, uh->dest, daddr, uh->source, saddr, dif);
 	if (!sk) {
@@ -404,7 +481,7 @@ static inline int udp6_csum_init(struct sk_buff *skb, struct udphdr *uh,
 	return 0;
 }
 
-int __udp6_lib_rcv(struct sk_buff *skb, struct hlist_head udptable[],
+int __udp6_lib_rcv(struct sk_buff *skb, struct udp_table *udptable,
 		   int proto)
 {
 	struct sock *sk;
@@ -494,7 +571,7 @@ discard:
 
 static __inline__ int udpv6_rcv(struct sk_buff *skb)
 {
-	return __udp6_lib_rcv(skb, udp_hash, IPPROTO_UDP);
+	return __udp6_lib_rcv(skb, &udp_table, IPPROTO_UDP);
 }
 
 /*
@@ -953,7 +1030,7 @@ static struct udp_seq_afinfo udp6_seq_afinfo = {
 	.owner		= THIS_MODULE,
 	.name		= "udp6",
 	.family		= AF_INET6,
-	.hashtable	= udp_hash,
+	.udp_table	= &udp_table,
 	.seq_show	= udp6_seq_show,
 	.seq_fops	= &udp6_seq_fops,
 };
@@ -987,6 +1064,7 @@ struct proto udpv6_prot = {
 	.backlog_rcv	   = udpv6_queue_rcv_skb,
 	.hash		   = udp_lib_hash,
 	.unhash		   = udp_lib_unhash,
+	.rehash		   = udp_v6_rehash,
 	.get_port	   = udp_v6_get_port,
 	.obj_size	   = sizeof(struct udp6_sock),
 #ifdef CONFIG_COMPAT
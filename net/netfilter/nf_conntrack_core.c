@@ -29,6 +29,9 @@
 #include <linux/netdevice.h>
 #include <linux/socket.h>
 #include <linux/mm.h>
+#include <linux/seqlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
@@ -70,6 +73,26 @@ EXPORT_PER_CPU_SYMBOL(nf_conntrack_stat);
 static int nf_conntrack_hash_rnd_initted;
 static unsigned int nf_conntrack_hash_rnd;
 
+/* Lookups run under RCU without nf_conntrack_lock. A resize moves the
+ * entries to the new table under the lock and bumps the generation, so
+ * a lookup that raced with it and found nothing has to retry. */
+static seqcount_t nf_conntrack_generation = SEQCNT_ZERO;
+static DEFINE_MUTEX(nf_conntrack_resize_mutex);
+
+/* Grow the table when the average chain gets longer than this... */
+#define NF_CT_HASH_GROW_LOAD	2
+/* ... and shrink it when only this fraction of the buckets is in use,
+ * but never below the boot time or last explicitly requested size. */
+#define NF_CT_HASH_SHRINK_LOAD	8
+
+int nf_conntrack_hash_autoresize __read_mostly = 1;
+EXPORT_SYMBOL_GPL(nf_conntrack_hash_autoresize);
+
+static unsigned int nf_conntrack_htable_min __read_mostly;
+
+static void nf_conntrack_resize_work(struct work_struct *work);
+static DECLARE_WORK(nf_conntrack_resize_wq, nf_conntrack_resize_work);
+
 static u_int32_t __hash_conntrack(const struct nf_conntrack_tuple *tuple,
 				  unsigned int size, unsigned int rnd)
 {
@@ -84,12 +107,29 @@ static u_int32_t __hash_conntrack(const struct nf_conntrack_tuple *tuple,
 	return jhash_2words(a, b, rnd) % size;
 }
 
+/* Only valid with nf_conntrack_lock held, lockless readers have to
+ * sample the table under nf_conntrack_generation. */
 static inline u_int32_t hash_conntrack(const struct nf_conntrack_tuple *tuple)
 {
 	return __hash_conntrack(tuple, nf_conntrack_htable_size,
 				nf_conntrack_hash_rnd);
 }
 
+static void nf_conntrack_check_load(void)
+{
+	unsigned int count = atomic_read(&nf_conntrack_count);
+	unsigned int size = nf_conntrack_htable_size;
+
+	if (!nf_conntrack_hash_autoresize)
+		return;
+
+	if ((count / NF_CT_HASH_GROW_LOAD > size &&
+	     (!nf_conntrack_max || size < nf_conntrack_max)) ||
+	    (count < size / NF_CT_HASH_SHRINK_LOAD &&
+	     size > nf_conntrack_htable_min))
+		schedule_work(&nf_conntrack_resize_wq);
+}
+
 int
 nf_ct_get_tuple(const struct sk_buff *skb,
 		unsigned int nhoff,
@@ -166,8 +206,8 @@ static void
 clean_from_lists(struct nf_conn *ct)
 {
 	pr_debug("clean_from_lists(%p)\n", ct);
-	hlist_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode);
-	hlist_del(&ct->tuplehash[IP_CT_DIR_REPLY].hnode);
+	hlist_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode);
+	hlist_del_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnode);
 
 	/* Destroy all pending expectations */
 	nf_ct_remove_expectations(ct);
@@ -215,6 +255,8 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	NF_CT_STAT_INC(delete);
 	write_unlock_bh(&nf_conntrack_lock);
 
+	nf_conntrack_check_load();
+
 	if (ct->master)
 		nf_ct_put(ct->master);
 
@@ -245,22 +287,33 @@ static void death_by_timeout(unsigned long ul_conntrack)
 	nf_ct_put(ct);
 }
 
+/* Called with rcu_read_lock() or nf_conntrack_lock held. The entry
+ * may be dying already, take a reference with atomic_inc_not_zero(). */
 struct nf_conntrack_tuple_hash *
 __nf_conntrack_find(const struct nf_conntrack_tuple *tuple,
 		    const struct nf_conn *ignored_conntrack)
 {
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_head *table;
 	struct hlist_node *n;
-	unsigned int hash = hash_conntrack(tuple);
-
-	hlist_for_each_entry(h, n, &nf_conntrack_hash[hash], hnode) {
-		if (nf_ct_tuplehash_to_ctrack(h) != ignored_conntrack &&
-		    nf_ct_tuple_equal(tuple, &h->tuple)) {
-			NF_CT_STAT_INC(found);
-			return h;
+	unsigned int seq, hash;
+
+	do {
+		seq = read_seqcount_begin(&nf_conntrack_generation);
+		table = rcu_dereference(nf_conntrack_hash);
+		hash = hash_conntrack(tuple);
+		if (read_seqcount_retry(&nf_conntrack_generation, seq))
+			continue;
+
+		hlist_for_each_entry_rcu(h, n, &table[hash], hnode) {
+			if (nf_ct_tuplehash_to_ctrack(h) != ignored_conntrack &&
+			    nf_ct_tuple_equal(tuple, &h->tuple)) {
+				NF_CT_STAT_INC(found);
+				return h;
+			}
+			NF_CT_STAT_INC(searched);
 		}
-		NF_CT_STAT_INC(searched);
-	}
+	} while (read_seqcount_retry(&nf_conntrack_generation, seq));
 
 	return NULL;
 }
@@ -272,36 +325,40 @@ nf_conntrack_find_get(const struct nf_conntrack_tuple *tuple)
 {
 	struct nf_conntrack_tuple_hash *h;
 
-	read_lock_bh(&nf_conntrack_lock);
+	rcu_read_lock_bh();
 	h = __nf_conntrack_find(tuple, NULL);
-	if (h)
-		atomic_inc(&nf_ct_tuplehash_to_ctrack(h)->ct_general.use);
-	read_unlock_bh(&nf_conntrack_lock);
+	if (h && unlikely(!atomic_inc_not_zero(
+			&nf_ct_tuplehash_to_ctrack(h)->ct_general.use)))
+		h = NULL;
+	rcu_read_unlock_bh();
 
 	return h;
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_find_get);
 
+/* Must be called with nf_conntrack_lock held for writing, the hashes
+ * are only stable inside it. */
 static void __nf_conntrack_hash_insert(struct nf_conn *ct,
 				       unsigned int hash,
 				       unsigned int repl_hash)
 {
-	hlist_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode,
-		       &nf_conntrack_hash[hash]);
-	hlist_add_head(&ct->tuplehash[IP_CT_DIR_REPLY].hnode,
-		       &nf_conntrack_hash[repl_hash]);
+	hlist_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode,
+			   &nf_conntrack_hash[hash]);
+	hlist_add_head_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnode,
+			   &nf_conntrack_hash[repl_hash]);
 }
 
 void nf_conntrack_hash_insert(struct nf_conn *ct)
 {
 	unsigned int hash, repl_hash;
 
+	write_lock_bh(&nf_conntrack_lock);
 	hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
 	repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-
-	write_lock_bh(&nf_conntrack_lock);
 	__nf_conntrack_hash_insert(ct, hash, repl_hash);
 	write_unlock_bh(&nf_conntrack_lock);
+
+	nf_conntrack_check_load();
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_hash_insert);
 
@@ -325,9 +382,6 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	if (CTINFO2DIR(ctinfo) != IP_CT_DIR_ORIGINAL)
 		return NF_ACCEPT;
 
-	hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
 	   REJECT will give spurious warnings here. */
@@ -340,6 +394,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 
 	write_lock_bh(&nf_conntrack_lock);
 
+	/* A resize may have changed the table since we were looked up */
+	hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+	repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+
 	/* See if there's one in the list already, including reverse:
 	   NAT could have grabbed it without realizing, since we're
 	   not in the hash.  If there is, we lost race. */
@@ -365,6 +423,7 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	set_bit(IPS_CONFIRMED_BIT, &ct->status);
 	NF_CT_STAT_INC(insert);
 	write_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_check_load();
 	help = nfct_help(ct);
 	if (help && help->helper)
 		nf_conntrack_event_cache(IPCT_HELPER, skb);
@@ -392,9 +451,9 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 {
 	struct nf_conntrack_tuple_hash *h;
 
-	read_lock_bh(&nf_conntrack_lock);
+	rcu_read_lock_bh();
 	h = __nf_conntrack_find(tuple, ignored_conntrack);
-	read_unlock_bh(&nf_conntrack_lock);
+	rcu_read_unlock_bh();
 
 	return h != NULL;
 }
@@ -404,16 +463,17 @@ EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
 
 /* There's a small race here where we may free a just-assured
    connection.  Too bad: we're in trouble anyway. */
-static int early_drop(unsigned int hash)
+static int early_drop(const struct nf_conntrack_tuple *orig)
 {
 	/* Use oldest entry, which is roughly LRU */
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct = NULL, *tmp;
 	struct hlist_node *n;
-	unsigned int i, cnt = 0;
+	unsigned int i, hash, cnt = 0;
 	int dropped = 0;
 
 	read_lock_bh(&nf_conntrack_lock);
+	hash = hash_conntrack(orig);
 	for (i = 0; i < nf_conntrack_htable_size; i++) {
 		hlist_for_each_entry(h, n, &nf_conntrack_hash[hash], hnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
@@ -456,8 +516,7 @@ struct nf_conn *nf_conntrack_alloc(const struct nf_conntrack_tuple *orig,
 
 	if (nf_conntrack_max
 	    && atomic_read(&nf_conntrack_count) > nf_conntrack_max) {
-		unsigned int hash = hash_conntrack(orig);
-		if (!early_drop(hash)) {
+		if (!early_drop(orig)) {
 			atomic_dec(&nf_conntrack_count);
 			if (net_ratelimit())
 				printk(KERN_WARNING
@@ -485,12 +544,19 @@ struct nf_conn *nf_conntrack_alloc(const struct nf_conntrack_tuple *orig,
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_alloc);
 
-void nf_conntrack_free(struct nf_conn *conntrack)
+static void nf_conntrack_free_rcu(struct rcu_head *head)
 {
+	struct nf_conn *conntrack = container_of(head, struct nf_conn, rcu);
+
 	nf_ct_ext_free(conntrack);
 	kmem_cache_free(nf_conntrack_cachep, conntrack);
 	atomic_dec(&nf_conntrack_count);
 }
+
+void nf_conntrack_free(struct nf_conn *conntrack)
+{
+	call_rcu(&conntrack->rcu, nf_conntrack_free_rcu);
+}
 EXPORT_SYMBOL_GPL(nf_conntrack_free);
 
 /* Allocate a new conntrack: we return -ENOMEM if classification
@@ -926,6 +992,9 @@ nf_ct_iterate_cleanup(int (*iter)(struct nf_conn *i, void *data), void *data)
 	struct nf_conn *ct;
 	unsigned int bucket = 0;
 
+	/* The bucket cursor is only meaningful as long as the table is not
+	 * rehashed, and killing entries may itself trigger a shrink. */
+	mutex_lock(&nf_conntrack_resize_mutex);
 	while ((ct = get_next_corpse(iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
 		if (del_timer(&ct->timeout))
@@ -934,6 +1003,7 @@ nf_ct_iterate_cleanup(int (*iter)(struct nf_conn *i, void *data), void *data)
 
 		nf_ct_put(ct);
 	}
+	mutex_unlock(&nf_conntrack_resize_mutex);
 }
 EXPORT_SYMBOL_GPL(nf_ct_iterate_cleanup);
 
@@ -980,6 +1050,11 @@ void nf_conntrack_cleanup(void)
 	while (atomic_read(&nf_conntrack_untracked.ct_general.use) > 1)
 		schedule();
 
+	/* no more resizes, and let the last nf_conntrack_free_rcu() finish */
+	nf_conntrack_hash_autoresize = 0;
+	flush_scheduled_work();
+	rcu_barrier();
+
 	rcu_assign_pointer(nf_ct_destroy, NULL);
 
 	kmem_cache_destroy(nf_conntrack_cachep);
@@ -1016,53 +1091,113 @@ struct hlist_head *nf_ct_alloc_hashtable(int *sizep, int *vmalloced)
 }
 EXPORT_SYMBOL_GPL(nf_ct_alloc_hashtable);
 
-int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+/* Rehash all entries into a table of hashsize buckets. Lookups keep
+ * running under RCU, the old table is freed after a grace period. */
+static int __nf_conntrack_resize(unsigned int hashsize)
 {
-	int i, bucket, hashsize, vmalloced;
+	int i, bucket, vmalloced, size;
 	int old_vmalloced, old_size;
 	int rnd;
 	struct hlist_head *hash, *old_hash;
 	struct nf_conntrack_tuple_hash *h;
 
-	/* On boot, we can set this without any fancy locking. */
-	if (!nf_conntrack_htable_size)
-		return param_set_uint(val, kp);
-
-	hashsize = simple_strtol(val, NULL, 0);
 	if (!hashsize)
 		return -EINVAL;
 
-	hash = nf_ct_alloc_hashtable(&hashsize, &vmalloced);
-	if (!hash)
+	mutex_lock(&nf_conntrack_resize_mutex);
+
+	size = hashsize;
+	hash = nf_ct_alloc_hashtable(&size, &vmalloced);
+	if (!hash) {
+		mutex_unlock(&nf_conntrack_resize_mutex);
 		return -ENOMEM;
+	}
 
 	/* We have to rehahs for the new table anyway, so we also can
 	 * use a newrandom seed */
 	get_random_bytes(&rnd, 4);
 
 	write_lock_bh(&nf_conntrack_lock);
+	write_seqcount_begin(&nf_conntrack_generation);
 	for (i = 0; i < nf_conntrack_htable_size; i++) {
 		while (!hlist_empty(&nf_conntrack_hash[i])) {
 			h = hlist_entry(nf_conntrack_hash[i].first,
 					struct nf_conntrack_tuple_hash, hnode);
-			hlist_del(&h->hnode);
-			bucket = __hash_conntrack(&h->tuple, hashsize, rnd);
-			hlist_add_head(&h->hnode, &hash[bucket]);
+			hlist_del_rcu(&h->hnode);
+			bucket = __hash_conntrack(&h->tuple, size, rnd);
+			hlist_add_head_rcu(&h->hnode, &hash[bucket]);
 		}
 	}
 	old_size = nf_conntrack_htable_size;
 	old_vmalloced = nf_conntrack_vmalloc;
 	old_hash = nf_conntrack_hash;
 
-	nf_conntrack_htable_size = hashsize;
+	nf_conntrack_htable_size = size;
 	nf_conntrack_vmalloc = vmalloced;
-	nf_conntrack_hash = hash;
+	rcu_assign_pointer(nf_conntrack_hash, hash);
 	nf_conntrack_hash_rnd = rnd;
+	nf_conntrack_hash_rnd_initted = 1;
+	write_seqcount_end(&nf_conntrack_generation);
 	write_unlock_bh(&nf_conntrack_lock);
 
+	/* Lookups in progress may still walk the old buckets */
+	synchronize_net();
 	nf_ct_free_hashtable(old_hash, old_vmalloced, old_size);
+
+	mutex_unlock(&nf_conntrack_resize_mutex);
 	return 0;
 }
+
+/* An explicitly requested size is the floor for automatic shrinking */
+int nf_conntrack_resize(unsigned int hashsize)
+{
+	int ret;
+
+	ret = __nf_conntrack_resize(hashsize);
+	if (ret == 0)
+		nf_conntrack_htable_min = nf_conntrack_htable_size;
+	return ret;
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_resize);
+
+static void nf_conntrack_resize_work(struct work_struct *work)
+{
+	unsigned int count = atomic_read(&nf_conntrack_count);
+	unsigned int size = nf_conntrack_htable_size;
+	unsigned int max = nf_conntrack_max;
+
+	if (!nf_conntrack_hash_autoresize)
+		return;
+
+	/* Aim for a load factor of one when growing and of a half when
+	 * shrinking, so we don't bounce between the two. */
+	if (count / NF_CT_HASH_GROW_LOAD > size)
+		size = count;
+	else if (count < size / NF_CT_HASH_SHRINK_LOAD)
+		size = count * 2;
+	else
+		return;
+
+	if (max && size > max)
+		size = max;
+	if (size < nf_conntrack_htable_min)
+		size = nf_conntrack_htable_min;
+	if (size == nf_conntrack_htable_size)
+		return;
+
+	if (__nf_conntrack_resize(size) == 0)
+		pr_debug("nf_conntrack: resized hash to %u buckets for %u "
+			 "entries\n", nf_conntrack_htable_size, count);
+}
+
+int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+{
+	/* On boot, we can set this without any fancy locking. */
+	if (!nf_conntrack_htable_size)
+		return param_set_uint(val, kp);
+
+	return nf_conntrack_resize(simple_strtoul(val, NULL, 0));
+}
 EXPORT_SYMBOL_GPL(nf_conntrack_set_hashsize);
 
 module_param_call(hashsize, nf_conntrack_set_hashsize, param_get_uint,
@@ -1098,6 +1233,7 @@ int __init nf_conntrack_init(void)
 	}
 
 	nf_conntrack_max = max_factor * nf_conntrack_htable_size;
+	nf_conntrack_htable_min = nf_conntrack_htable_size;
 
 	printk("nf_conntrack version %s (%u buckets, %d max)\n",
 	       NF_CONNTRACK_VERSION, nf_conntrack_htable_size,
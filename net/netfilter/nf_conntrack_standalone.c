@@ -308,6 +308,35 @@ static int log_invalid_proto_max = 255;
 
 static struct ctl_table_header *nf_ct_sysctl_header;
 
+/* Writing the bucket count resizes the table in place */
+static int nf_conntrack_buckets_sysctl(ctl_table *table, int write,
+				       struct file *filp,
+				       void __user *buffer,
+				       size_t *lenp, loff_t *ppos)
+{
+	unsigned int size = nf_conntrack_htable_size;
+	ctl_table tmp = *table;
+	int ret;
+
+	tmp.data = &size;
+	ret = proc_dointvec(&tmp, write, filp, buffer, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	return nf_conntrack_resize(size);
+}
+
+static int nf_conntrack_buckets_strategy(ctl_table *table, int __user *name,
+					 int nlen, void __user *oldval,
+					 size_t __user *oldlenp,
+					 void __user *newval, size_t newlen)
+{
+	/* Only the proc handler knows how to resize */
+	if (newval && newlen)
+		return -EPERM;
+	return 0;
+}
+
 static ctl_table nf_ct_sysctl_table[] = {
 	{
 		.ctl_name	= NET_NF_CONNTRACK_MAX,
@@ -330,8 +359,17 @@ static ctl_table nf_ct_sysctl_table[] = {
 		.procname       = "nf_conntrack_buckets",
 		.data           = &nf_conntrack_htable_size,
 		.maxlen         = sizeof(unsigned int),
-		.mode           = 0444,
-		.proc_handler   = &proc_dointvec,
+		.mode           = 0644,
+		.proc_handler   = &nf_conntrack_buckets_sysctl,
+		.strategy	= &nf_conntrack_buckets_strategy,
+	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "nf_conntrack_hash_autoresize",
+		.data		= &nf_conntrack_hash_autoresize,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec,
 	},
 	{
 		.ctl_name	= NET_NF_CONNTRACK_CHECKSUM,
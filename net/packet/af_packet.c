@@ -68,6 +68,7 @@
 #include <net/sock.h>
 #include <linux/errno.h>
 #include <linux/timer.h>
+#include <linux/if_vlan.h>
 #include <asm/system.h>
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -162,7 +163,30 @@ struct packet_mreq_max
 };
 
 #ifdef CONFIG_PACKET_MMAP
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing);
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
+			   int closing);
+
+/*
+ * TPACKET_V3 receive state. Packets are packed into the current block
+ * and a block is handed to user space as a whole, when it is full or
+ * when the retire timer fires. Protected by sk_receive_queue.lock.
+ */
+struct tpacket_kbdq_core {
+	unsigned int		kactive_blk_num;	/* block being filled */
+	unsigned int		last_kactive_blk_num;	/* as seen by the timer */
+	unsigned int		knum_blocks;
+	unsigned int		kblk_size;
+	unsigned int		blk_sizeof_priv;
+	unsigned int		reset_pending_on_curr_blk:1, /* queue frozen */
+				delete_blk_timer:1;
+	char			*nxt_offset;	/* where the next packet goes */
+	char			*prev;		/* last packet in the block */
+	u64			knxt_seq_num;
+	atomic_t		blk_fill_in_prog; /* copies outside the lock */
+	unsigned int		freeze_q_cnt;
+	unsigned long		tov_in_jiffies;
+	struct timer_list	retire_blk_timer;
+};
 #endif
 
 static void packet_flush_mclist(struct sock *sk);
@@ -178,6 +202,9 @@ struct packet_sock {
 	unsigned int		frame_size;
 	unsigned int		frame_max;
 	int			copy_thresh;
+	unsigned int		tp_version;
+	unsigned int		tp_hdrlen;
+	struct tpacket_kbdq_core rx_kbdq;
 #endif
 	struct packet_type	prot_hook;
 	spinlock_t		bind_lock;
@@ -207,14 +234,318 @@ struct packet_skb_cb {
 
 #ifdef CONFIG_PACKET_MMAP
 
-static inline struct tpacket_hdr *packet_lookup_frame(struct packet_sock *po, unsigned int position)
+union tpacket_uhdr {
+	struct tpacket_hdr	*h1;
+	struct tpacket2_hdr	*h2;
+	struct tpacket3_hdr	*h3;
+	void			*raw;
+};
+
+#define BLK_HDR_LEN		TPACKET_ALIGN(sizeof(struct tpacket_block_desc))
+#define BLK_PLUS_PRIV(sz)	(BLK_HDR_LEN + TPACKET_ALIGN(sz))
+#define PRB_BLOCK(po, num)	((struct tpacket_block_desc *)(po)->pg_vec[num])
+#define PRB_DEF_RETIRE_TOV	8	/* msecs */
+
+static inline void *packet_lookup_frame(struct packet_sock *po, unsigned int position)
 {
 	unsigned int pg_vec_pos, frame_offset;
 
 	pg_vec_pos = position / po->frames_per_block;
 	frame_offset = position % po->frames_per_block;
 
-	return (struct tpacket_hdr *)(po->pg_vec[pg_vec_pos] + (frame_offset * po->frame_size));
+	return po->pg_vec[pg_vec_pos] + (frame_offset * po->frame_size);
+}
+
+static void __packet_set_status(struct packet_sock *po, void *frame, int status)
+{
+	union tpacket_uhdr h;
+
+	h.raw = frame;
+	if (po->tp_version == TPACKET_V1)
+		h.h1->tp_status = status;
+	else
+		h.h2->tp_status = status;
+}
+
+static int __packet_get_status(struct packet_sock *po, void *frame)
+{
+	union tpacket_uhdr h;
+
+	h.raw = frame;
+	if (po->tp_version == TPACKET_V1)
+		return h.h1->tp_status;
+	return h.h2->tp_status;
+}
+
+static void packet_flush_range(void *start, unsigned int len)
+{
+	struct page *p_start, *p_end;
+
+	p_start = virt_to_page(start);
+	p_end = virt_to_page((u8 *)start + len - 1);
+	while (p_start <= p_end) {
+		flush_dcache_page(p_start);
+		p_start++;
+	}
+}
+
+static void prb_open_block(struct packet_sock *po,
+			   struct tpacket_block_desc *pbd)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_kbdq;
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct timespec ts;
+
+	/* Pairs with the user space release of the block */
+	smp_rmb();
+
+	getnstimeofday(&ts);
+	pbd->version = TPACKET_V3;
+	pbd->offset_to_priv = BLK_HDR_LEN;
+	h1->num_pkts = 0;
+	h1->seq_num = pkc->knxt_seq_num++;
+	h1->offset_to_first_pkt = BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	h1->blk_len = h1->offset_to_first_pkt;
+	h1->ts_first_pkt.ts_sec = ts.tv_sec;
+	h1->ts_first_pkt.ts_nsec = ts.tv_nsec;
+	h1->ts_last_pkt = h1->ts_first_pkt;
+
+	pkc->nxt_offset = (char *)pbd + h1->offset_to_first_pkt;
+	pkc->prev = NULL;
+	pkc->reset_pending_on_curr_blk = 0;
+
+	h1->block_status = TP_STATUS_KERNEL;
+	smp_wmb();
+
+	pkc->last_kactive_blk_num = pkc->kactive_blk_num;
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+}
+
+static void prb_close_block(struct packet_sock *po,
+			    struct tpacket_block_desc *pbd, int status)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_kbdq;
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct sock *sk = &po->sk;
+
+	if (po->stats.tp_drops)
+		status |= TP_STATUS_LOSING;
+
+	if (pkc->prev) {
+		struct tpacket3_hdr *last = (struct tpacket3_hdr *)pkc->prev;
+
+		last->tp_next_offset = 0;
+		h1->ts_last_pkt.ts_sec = last->tp_sec;
+		h1->ts_last_pkt.ts_nsec = last->tp_nsec;
+	} else {
+		struct timespec ts;
+
+		getnstimeofday(&ts);
+		h1->ts_last_pkt.ts_sec = ts.tv_sec;
+		h1->ts_last_pkt.ts_nsec = ts.tv_nsec;
+	}
+
+	smp_wmb();
+	h1->block_status = status | TP_STATUS_USER;
+	smp_mb();
+	packet_flush_range(pbd, h1->blk_len);
+
+	pkc->kactive_blk_num = pkc->kactive_blk_num != pkc->knum_blocks - 1 ?
+			       pkc->kactive_blk_num + 1 : 0;
+
+	sk->sk_data_ready(sk, 0);
+}
+
+static void prb_retire_current_block(struct packet_sock *po, int status)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_kbdq;
+	struct tpacket_block_desc *pbd = PRB_BLOCK(po, pkc->kactive_blk_num);
+
+	if (pbd->hdr.bh1.block_status != TP_STATUS_KERNEL)
+		return;
+
+	/*
+	 * Another cpu may still be copying a packet into this block
+	 * outside the queue lock; it does not need the lock to finish.
+	 */
+	while (atomic_read(&pkc->blk_fill_in_prog))
+		cpu_relax();
+
+	prb_close_block(po, pbd, status);
+}
+
+/*
+ * Open the block after the one just retired, unless user space still
+ * owns it. In that case the queue is frozen and packets are dropped
+ * until the block comes back.
+ */
+static char *prb_dispatch_next_block(struct packet_sock *po)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_kbdq;
+	struct tpacket_block_desc *pbd = PRB_BLOCK(po, pkc->kactive_blk_num);
+
+	if (pbd->hdr.bh1.block_status & TP_STATUS_USER) {
+		pkc->reset_pending_on_curr_blk = 1;
+		pkc->freeze_q_cnt++;
+		return NULL;
+	}
+
+	prb_open_block(po, pbd);
+	return pkc->nxt_offset;
+}
+
+static void prb_retire_rx_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct tpacket_kbdq_core *pkc = &po->rx_kbdq;
+	struct tpacket_block_desc *pbd;
+
+	spin_lock(&po->sk.sk_receive_queue.lock);
+
+	if (unlikely(pkc->delete_blk_timer))
+		goto out;
+
+	/* A new block was opened since we last looked, give it a full period */
+	if (pkc->last_kactive_blk_num != pkc->kactive_blk_num)
+		goto refresh;
+
+	pbd = PRB_BLOCK(po, pkc->kactive_blk_num);
+	if (pkc->reset_pending_on_curr_blk) {
+		if (pbd->hdr.bh1.block_status & TP_STATUS_USER)
+			goto refresh;
+		prb_open_block(po, pbd);
+		goto out;
+	}
+
+	if (!pbd->hdr.bh1.num_pkts)
+		goto refresh;
+
+	prb_retire_current_block(po, TP_STATUS_BLK_TMO);
+	if (prb_dispatch_next_block(po))
+		goto out;
+
+refresh:
+	pkc->last_kactive_blk_num = pkc->kactive_blk_num;
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+out:
+	spin_unlock(&po->sk.sk_receive_queue.lock);
+}
+
+static void prb_shutdown_retire_blk_timer(struct packet_sock *po)
+{
+	spin_lock_bh(&po->sk.sk_receive_queue.lock);
+	po->rx_kbdq.delete_blk_timer = 1;
+	spin_unlock_bh(&po->sk.sk_receive_queue.lock);
+
+	del_timer_sync(&po->rx_kbdq.retire_blk_timer);
+}
+
+/* Called with sk_receive_queue.lock held, once pg_vec is in place */
+static void init_prb_bdqc(struct packet_sock *po, struct tpacket_req3 *req3)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_kbdq;
+	unsigned int tov = req3->tp_retire_blk_tov;
+
+	pkc->knum_blocks = req3->tp_block_nr;
+	pkc->kblk_size = req3->tp_block_size;
+	pkc->blk_sizeof_priv = req3->tp_sizeof_priv;
+	pkc->kactive_blk_num = 0;
+	pkc->knxt_seq_num = 1;
+	pkc->freeze_q_cnt = 0;
+	pkc->delete_blk_timer = 0;
+	atomic_set(&pkc->blk_fill_in_prog, 0);
+
+	pkc->tov_in_jiffies = msecs_to_jiffies(tov ? tov : PRB_DEF_RETIRE_TOV);
+	if (!pkc->tov_in_jiffies)
+		pkc->tov_in_jiffies = 1;
+
+	prb_open_block(po, PRB_BLOCK(po, 0));
+}
+
+static void *prb_lookup_frame(struct packet_sock *po, unsigned int len)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_kbdq;
+	struct tpacket_block_desc *pbd = PRB_BLOCK(po, pkc->kactive_blk_num);
+	struct tpacket3_hdr *ppd;
+	char *curr;
+
+	if (pkc->reset_pending_on_curr_blk) {
+		if (pbd->hdr.bh1.block_status & TP_STATUS_USER)
+			return NULL;
+		/* User space gave the block back, this thaws the queue */
+		prb_open_block(po, pbd);
+	}
+
+	len = TPACKET_ALIGN(len);
+	if (len > po->frame_size)
+		len = po->frame_size;
+
+	curr = pkc->nxt_offset;
+	if (curr + len > (char *)pbd + pkc->kblk_size) {
+		prb_retire_current_block(po, 0);
+		curr = prb_dispatch_next_block(po);
+		if (!curr)
+			return NULL;
+		pbd = PRB_BLOCK(po, pkc->kactive_blk_num);
+	}
+
+	ppd = (struct tpacket3_hdr *)curr;
+	ppd->tp_next_offset = len;
+	pkc->prev = curr;
+	pkc->nxt_offset += len;
+	pbd->hdr.bh1.blk_len += len;
+	pbd->hdr.bh1.num_pkts++;
+	atomic_inc(&pkc->blk_fill_in_prog);
+
+	return curr;
+}
+
+/* Called with sk_receive_queue.lock held */
+static void *packet_current_rx_frame(struct packet_sock *po, unsigned int len)
+{
+	void *frame;
+
+	if (po->tp_version == TPACKET_V3)
+		return prb_lookup_frame(po, len);
+
+	frame = packet_lookup_frame(po, po->head);
+	if (__packet_get_status(po, frame) != TP_STATUS_KERNEL)
+		return NULL;
+	po->head = po->head != po->frame_max ? po->head+1 : 0;
+	return frame;
+}
+
+/* Called with sk_receive_queue.lock held */
+static int packet_rx_ring_ready(struct packet_sock *po)
+{
+	if (po->tp_version == TPACKET_V3) {
+		struct tpacket_kbdq_core *pkc = &po->rx_kbdq;
+		unsigned int prev = pkc->kactive_blk_num ?
+				    pkc->kactive_blk_num - 1 :
+				    pkc->knum_blocks - 1;
+
+		return PRB_BLOCK(po, prev)->hdr.bh1.block_status &
+		       TP_STATUS_USER;
+	} else {
+		unsigned last = po->head ? po->head-1 : po->frame_max;
+
+		return __packet_get_status(po, packet_lookup_frame(po, last)) !=
+		       TP_STATUS_KERNEL;
+	}
+}
+
+/*
+ * Transmit VLAN acceleration keeps the tag in skb->cb instead of the
+ * frame, so that is the only case where the tag has to be reported
+ * separately.
+ */
+static int packet_vlan_tci(struct sk_buff *skb, unsigned short *tci)
+{
+	*tci = 0;
+	if (skb->pkt_type == PACKET_OUTGOING &&
+	    (skb->dev->features & NETIF_F_HW_VLAN_TX))
+		return !__vlan_hwaccel_get_tag(skb, tci);
+	return 0;
 }
 #endif
 
@@ -557,14 +888,14 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev, struct packe
 	struct sock *sk;
 	struct packet_sock *po;
 	struct sockaddr_ll *sll;
-	struct tpacket_hdr *h;
+	union tpacket_uhdr h;
 	u8 * skb_head = skb->data;
 	int skb_len = skb->len;
-	unsigned int snaplen, res;
+	unsigned int snaplen, res, hdrlen;
 	unsigned long status = TP_STATUS_LOSING|TP_STATUS_USER;
-	unsigned short macoff, netoff;
+	unsigned short macoff, netoff, vlan_tci;
 	struct sk_buff *copy_skb = NULL;
-	struct timeval tv;
+	struct timespec ts;
 
 	if (dev->nd_net != &init_net)
 		goto drop;
@@ -596,10 +927,10 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev, struct packe
 		snaplen = res;
 
 	if (sk->sk_type == SOCK_DGRAM) {
-		macoff = netoff = TPACKET_ALIGN(TPACKET_HDRLEN) + 16;
+		macoff = netoff = TPACKET_ALIGN(po->tp_hdrlen) + 16;
 	} else {
 		unsigned maclen = skb_network_offset(skb);
-		netoff = TPACKET_ALIGN(TPACKET_HDRLEN + (maclen < 16 ? 16 : maclen));
+		netoff = TPACKET_ALIGN(po->tp_hdrlen + (maclen < 16 ? 16 : maclen));
 		macoff = netoff - maclen;
 	}
 
@@ -622,11 +953,9 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev, struct packe
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h = packet_lookup_frame(po, po->head);
-
-	if (h->tp_status)
+	h.raw = packet_current_rx_frame(po, macoff + snaplen);
+	if (!h.raw)
 		goto ring_is_full;
-	po->head = po->head != po->frame_max ? po->head+1 : 0;
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -636,20 +965,54 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev, struct packe
 		status &= ~TP_STATUS_LOSING;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
-	skb_copy_bits(skb, 0, (u8*)h + macoff, snaplen);
+	skb_copy_bits(skb, 0, (u8 *)h.raw + macoff, snaplen);
 
-	h->tp_len = skb->len;
-	h->tp_snaplen = snaplen;
-	h->tp_mac = macoff;
-	h->tp_net = netoff;
 	if (skb->tstamp.tv64)
-		tv = ktime_to_timeval(skb->tstamp);
+		ts = ktime_to_timespec(skb->tstamp);
 	else
-		do_gettimeofday(&tv);
-	h->tp_sec = tv.tv_sec;
-	h->tp_usec = tv.tv_usec;
+		getnstimeofday(&ts);
+
+	if (po->tp_version != TPACKET_V1 && packet_vlan_tci(skb, &vlan_tci))
+		status |= TP_STATUS_VLAN_VALID;
+
+	switch (po->tp_version) {
+	case TPACKET_V1:
+		h.h1->tp_len = skb->len;
+		h.h1->tp_snaplen = snaplen;
+		h.h1->tp_mac = macoff;
+		h.h1->tp_net = netoff;
+		h.h1->tp_sec = ts.tv_sec;
+		h.h1->tp_usec = ts.tv_nsec / NSEC_PER_USEC;
+		hdrlen = sizeof(*h.h1);
+		break;
+	case TPACKET_V2:
+		h.h2->tp_len = skb->len;
+		h.h2->tp_snaplen = snaplen;
+		h.h2->tp_mac = macoff;
+		h.h2->tp_net = netoff;
+		h.h2->tp_sec = ts.tv_sec;
+		h.h2->tp_nsec = ts.tv_nsec;
+		h.h2->tp_vlan_tci = vlan_tci;
+		h.h2->tp_padding = 0;
+		hdrlen = sizeof(*h.h2);
+		break;
+	default:
+		/* tp_next_offset was set when the space was reserved */
+		h.h3->tp_status = status;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		h.h3->hv1.tp_rxhash = 0;
+		h.h3->hv1.tp_vlan_tci = vlan_tci;
+		memset(h.h3->tp_padding, 0, sizeof(h.h3->tp_padding));
+		hdrlen = sizeof(*h.h3);
+		break;
+	}
 
-	sll = (struct sockaddr_ll*)((u8*)h + TPACKET_ALIGN(sizeof(*h)));
+	sll = (struct sockaddr_ll *)((u8 *)h.raw + TPACKET_ALIGN(hdrlen));
 	sll->sll_halen = dev_parse_header(skb, sll->sll_addr);
 	sll->sll_family = AF_PACKET;
 	sll->sll_hatype = dev->type;
@@ -660,21 +1023,18 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev, struct packe
 	else
 		sll->sll_ifindex = dev->ifindex;
 
-	h->tp_status = status;
-	smp_mb();
-
-	{
-		struct page *p_start, *p_end;
-		u8 *h_end = (u8 *)h + macoff + snaplen - 1;
-
-		p_start = virt_to_page(h);
-		p_end = virt_to_page(h_end);
-		while (p_start <= p_end) {
-			flush_dcache_page(p_start);
-			p_start++;
-		}
+	if (po->tp_version == TPACKET_V3) {
+		/* The block is handed over, and readers woken, as a whole */
+		packet_flush_range(h.raw, macoff + snaplen);
+		smp_mb__before_atomic_dec();
+		atomic_dec(&po->rx_kbdq.blk_fill_in_prog);
+		goto drop_n_restore;
 	}
 
+	__packet_set_status(po, h.raw, status);
+	smp_mb();
+	packet_flush_range(h.raw, macoff + snaplen);
+
 	sk->sk_data_ready(sk, 0);
 
 drop_n_restore:
@@ -690,7 +1050,8 @@ ring_is_full:
 	po->stats.tp_drops++;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
-	sk->sk_data_ready(sk, 0);
+	if (po->tp_version != TPACKET_V3)
+		sk->sk_data_ready(sk, 0);
 	if (copy_skb)
 		kfree_skb(copy_skb);
 	goto drop_n_restore;
@@ -827,9 +1188,9 @@ static int packet_release(struct socket *sock)
 
 #ifdef CONFIG_PACKET_MMAP
 	if (po->pg_vec) {
-		struct tpacket_req req;
-		memset(&req, 0, sizeof(req));
-		packet_set_ring(sk, &req, 1);
+		union tpacket_req_u req_u;
+		memset(&req_u, 0, sizeof(req_u));
+		packet_set_ring(sk, &req_u, 1);
 	}
 #endif
 
@@ -1007,6 +1368,12 @@ static int packet_create(struct net *net, struct socket *sock, int protocol)
 
 	spin_lock_init(&po->bind_lock);
 	po->prot_hook.func = packet_rcv;
+#ifdef CONFIG_PACKET_MMAP
+	po->tp_version = TPACKET_V1;
+	po->tp_hdrlen = TPACKET_HDRLEN;
+	setup_timer(&po->rx_kbdq.retire_blk_timer,
+		    prb_retire_rx_blk_timer_expired, (unsigned long)po);
+#endif
 
 	if (sock->type == SOCK_PACKET)
 		po->prot_hook.func = packet_rcv_spkt;
@@ -1343,13 +1710,18 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 #ifdef CONFIG_PACKET_MMAP
 	case PACKET_RX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen<sizeof(req))
+		if (po->tp_version == TPACKET_V3)
+			len = sizeof(req_u.req3);
+		else
+			len = sizeof(req_u.req);
+		if (optlen < len)
 			return -EINVAL;
-		if (copy_from_user(&req,optval,sizeof(req)))
+		if (copy_from_user(&req_u, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0);
+		return packet_set_ring(sk, &req_u, 0);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1363,6 +1735,37 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		pkt_sk(sk)->copy_thresh = val;
 		return 0;
 	}
+	case PACKET_VERSION:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		switch (val) {
+		case TPACKET_V1:
+		case TPACKET_V2:
+		case TPACKET_V3:
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		lock_sock(sk);
+		if (po->pg_vec) {
+			ret = -EBUSY;
+		} else {
+			po->tp_version = val;
+			po->tp_hdrlen = val == TPACKET_V1 ? TPACKET_HDRLEN :
+					val == TPACKET_V2 ? TPACKET2_HDRLEN :
+					TPACKET3_HDRLEN;
+			ret = 0;
+		}
+		release_sock(sk);
+		return ret;
+	}
 #endif
 	case PACKET_AUXDATA:
 	{
@@ -1402,6 +1805,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
 	struct tpacket_stats st;
+#ifdef CONFIG_PACKET_MMAP
+	struct tpacket_stats_v3 st3;
+#endif
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -1414,14 +1820,30 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch(optname)	{
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
-			len = sizeof(struct tpacket_stats);
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
 		memset(&po->stats, 0, sizeof(st));
+#ifdef CONFIG_PACKET_MMAP
+		if (po->tp_version == TPACKET_V3) {
+			st3.tp_freeze_q_cnt = po->rx_kbdq.freeze_q_cnt;
+			po->rx_kbdq.freeze_q_cnt = 0;
+		}
+#endif
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
 		st.tp_packets += st.tp_drops;
 
+#ifdef CONFIG_PACKET_MMAP
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+			st3.tp_packets = st.tp_packets;
+			st3.tp_drops = st.tp_drops;
+			data = &st3;
+			break;
+		}
+#endif
+		if (len > sizeof(struct tpacket_stats))
+			len = sizeof(struct tpacket_stats);
 		data = &st;
 		break;
 	case PACKET_AUXDATA:
@@ -1438,6 +1860,36 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 		data = &val;
 		break;
+#ifdef CONFIG_PACKET_MMAP
+	case PACKET_VERSION:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		val = po->tp_version;
+
+		data = &val;
+		break;
+	case PACKET_HDRLEN:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		if (copy_from_user(&val, optval, len))
+			return -EFAULT;
+		switch (val) {
+		case TPACKET_V1:
+			val = sizeof(struct tpacket_hdr);
+			break;
+		case TPACKET_V2:
+			val = sizeof(struct tpacket2_hdr);
+			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		data = &val;
+		break;
+#endif
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1569,15 +2021,8 @@ static unsigned int packet_poll(struct file * file, struct socket *sock,
 	unsigned int mask = datagram_poll(file, sock, wait);
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
-	if (po->pg_vec) {
-		unsigned last = po->head ? po->head-1 : po->frame_max;
-		struct tpacket_hdr *h;
-
-		h = packet_lookup_frame(po, last);
-
-		if (h->tp_status)
-			mask |= POLLIN | POLLRDNORM;
-	}
+	if (po->pg_vec && packet_rx_ring_ready(po))
+		mask |= POLLIN | POLLRDNORM;
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
 	return mask;
 }
@@ -1654,37 +2099,53 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing)
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
+			   int closing)
 {
 	char **pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
+	/* The V3 request starts with the same four fields */
+	struct tpacket_req *req = &req_u->req;
 	int was_running, order = 0;
 	__be16 num;
-	int err = 0;
+	int err;
+
+	/* Keeps tp_version stable against PACKET_VERSION */
+	lock_sock(sk);
 
 	if (req->tp_block_nr) {
 		int i, l;
 
 		/* Sanity tests and some calculations */
 
+		err = -EBUSY;
 		if (unlikely(po->pg_vec))
-			return -EBUSY;
+			goto out;
 
+		err = -EINVAL;
 		if (unlikely((int)req->tp_block_size <= 0))
-			return -EINVAL;
+			goto out;
 		if (unlikely(req->tp_block_size & (PAGE_SIZE - 1)))
-			return -EINVAL;
-		if (unlikely(req->tp_frame_size < TPACKET_HDRLEN))
-			return -EINVAL;
+			goto out;
+		if (unlikely(req->tp_frame_size < po->tp_hdrlen))
+			goto out;
 		if (unlikely(req->tp_frame_size & (TPACKET_ALIGNMENT - 1)))
-			return -EINVAL;
+			goto out;
 
 		po->frames_per_block = req->tp_block_size/req->tp_frame_size;
 		if (unlikely(po->frames_per_block <= 0))
-			return -EINVAL;
+			goto out;
 		if (unlikely((po->frames_per_block * req->tp_block_nr) !=
 			     req->tp_frame_nr))
-			return -EINVAL;
+			goto out;
+
+		/* A full sized packet must fit behind the block descriptor */
+		if (po->tp_version == TPACKET_V3 &&
+		    (req_u->req3.tp_feature_req_word ||
+		     req_u->req3.tp_sizeof_priv >= req->tp_block_size ||
+		     BLK_PLUS_PRIV(req_u->req3.tp_sizeof_priv) +
+		     req->tp_frame_size > req->tp_block_size))
+			goto out;
 
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
@@ -1695,23 +2156,23 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 		l = 0;
 		for (i = 0; i < req->tp_block_nr; i++) {
 			char *ptr = pg_vec[i];
-			struct tpacket_hdr *header;
 			int k;
 
+			/* V3 blocks are set up when they are opened */
+			if (po->tp_version == TPACKET_V3)
+				break;
 			for (k = 0; k < po->frames_per_block; k++) {
-				header = (struct tpacket_hdr *) ptr;
-				header->tp_status = TP_STATUS_KERNEL;
+				__packet_set_status(po, ptr, TP_STATUS_KERNEL);
 				ptr += req->tp_frame_size;
 			}
 		}
 		/* Done */
 	} else {
+		err = -EINVAL;
 		if (unlikely(req->tp_frame_nr))
-			return -EINVAL;
+			goto out;
 	}
 
-	lock_sock(sk);
-
 	/* Detach socket from network */
 	spin_lock(&po->bind_lock);
 	was_running = po->running;
@@ -1731,11 +2192,16 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 		err = 0;
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 
+		if (po->pg_vec && po->tp_version == TPACKET_V3)
+			prb_shutdown_retire_blk_timer(po);
+
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		pg_vec = XC(po->pg_vec, pg_vec);
 		po->frame_max = (req->tp_frame_nr - 1);
 		po->head = 0;
 		po->frame_size = req->tp_frame_size;
+		if (po->pg_vec && po->tp_version == TPACKET_V3)
+			init_prb_bdqc(po, &req_u->req3);
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
 
 		order = XC(po->pg_vec_order, order);
@@ -1758,11 +2224,11 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 	}
 	spin_unlock(&po->bind_lock);
 
+out:
 	release_sock(sk);
 
 	if (pg_vec)
 		free_pg_vec(pg_vec, order, req->tp_block_nr);
-out:
 	return err;
 }
 
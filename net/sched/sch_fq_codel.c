@@ -0,0 +1,532 @@
+/*
+ * net/sched/sch_fq_codel.c	Fair Queue CoDel discipline.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/in.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/ipv6.h>
+#include <linux/skbuff.h>
+#include <linux/jhash.h>
+#include <linux/list.h>
+#include <net/ip.h>
+#include <net/netlink.h>
+#include <net/pkt_sched.h>
+#include <net/codel.h>
+
+/*	Fair Queue CoDel.
+	=================
+
+	Packets are classified by a perturbed hash of the flow into one of
+	"flows" queues, each managed by its own CoDel instance (see
+	<net/codel.h>). The queues are served by Deficit Round Robin with
+	a byte "quantum": a flow gets to send while its deficit is
+	positive, and is moved to the tail of the old flows list to be
+	refilled once it is exhausted.
+
+	Flows that just became active are kept on a separate new flows
+	list which is always served first, so sparse flows (DNS, ACKs,
+	interactive traffic) are sent ahead of the bulk flows.
+
+	When the hard "limit" is hit, a packet is dropped from the head
+	of the flow with the largest backlog.
+
+	Parameters, settable by user:
+	-----------------------------
+
+	target		- acceptable standing queue delay (us), default 5ms
+	interval	- width of the CoDel moving window (us), default 100ms
+	limit		- hard limit on the queue length (packets)
+	flows		- number of flow queues, only at creation time
+	quantum		- DRR quantum (bytes), default is the device MTU
+	ecn		- mark ECN capable packets instead of dropping them
+ */
+
+struct fq_codel_flow
+{
+	struct sk_buff	  *head;
+	struct sk_buff	  *tail;
+	struct list_head  flowchain;
+	int		  deficit;
+	u32		  dropped; /* number of drops (or ECN marks) on this flow */
+	struct codel_vars cvars;
+};
+
+struct fq_codel_sched_data
+{
+/* Parameters */
+	u32		limit;		/* hard limit (packets) */
+	u32		flows_cnt;	/* number of flows */
+	u32		quantum;	/* psched_mtu(sch->dev) by default */
+	struct codel_params cparams;
+
+/* Variables */
+	u32		perturbation;	/* hash perturbation */
+	struct fq_codel_flow *flows;	/* flows table [flows_cnt] */
+	u32		*backlogs;	/* backlog table [flows_cnt] */
+	struct codel_stats cstats;
+	u32		drop_overlimit;
+	u32		new_flow_count;
+
+	struct list_head new_flows;	/* list of new flows */
+	struct list_head old_flows;	/* list of old flows */
+};
+
+static unsigned int fq_codel_hash(const struct fq_codel_sched_data *q,
+				  const struct sk_buff *skb)
+{
+	u32 h, h2, h3 = 0;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP):
+	{
+		const struct iphdr *iph = ip_hdr(skb);
+		h = iph->daddr;
+		h2 = iph->saddr;
+		h3 = iph->protocol;
+		if (!(iph->frag_off&htons(IP_MF|IP_OFFSET)) &&
+		    (iph->protocol == IPPROTO_TCP ||
+		     iph->protocol == IPPROTO_UDP ||
+		     iph->protocol == IPPROTO_UDPLITE ||
+		     iph->protocol == IPPROTO_SCTP ||
+		     iph->protocol == IPPROTO_DCCP ||
+		     iph->protocol == IPPROTO_ESP))
+			h3 ^= *(((u32*)iph) + iph->ihl);
+		break;
+	}
+	case __constant_htons(ETH_P_IPV6):
+	{
+		const struct ipv6hdr *iph = ipv6_hdr(skb);
+		h = iph->daddr.s6_addr32[3] ^ iph->daddr.s6_addr32[2];
+		h2 = iph->saddr.s6_addr32[3] ^ iph->saddr.s6_addr32[2];
+		h3 = iph->nexthdr;
+		if (iph->nexthdr == IPPROTO_TCP ||
+		    iph->nexthdr == IPPROTO_UDP ||
+		    iph->nexthdr == IPPROTO_UDPLITE ||
+		    iph->nexthdr == IPPROTO_SCTP ||
+		    iph->nexthdr == IPPROTO_DCCP ||
+		    iph->nexthdr == IPPROTO_ESP)
+			h3 ^= *(u32*)&iph[1];
+		break;
+	}
+	default:
+		h = (u32)(unsigned long)skb->dst ^ skb->protocol;
+		h2 = (u32)(unsigned long)skb->sk;
+	}
+
+	h = jhash_3words(h, h2, h3, q->perturbation);
+	return ((u64)h * q->flows_cnt) >> 32;
+}
+
+/* helper functions : might be changed when/if skb use a standard list_head */
+
+/* remove one skb from head of slot queue */
+static inline struct sk_buff *dequeue_head(struct fq_codel_flow *flow)
+{
+	struct sk_buff *skb = flow->head;
+
+	flow->head = skb->next;
+	skb->next = NULL;
+	return skb;
+}
+
+/* add skb to flow queue (tail add) */
+static inline void flow_queue_add(struct fq_codel_flow *flow,
+				  struct sk_buff *skb)
+{
+	if (flow->head == NULL)
+		flow->head = skb;
+	else
+		flow->tail->next = skb;
+	flow->tail = skb;
+	skb->next = NULL;
+}
+
+static void fq_codel_activate(struct fq_codel_sched_data *q,
+			      struct fq_codel_flow *flow)
+{
+	list_add_tail(&flow->flowchain, &q->new_flows);
+	codel_vars_init(&flow->cvars);
+	q->new_flow_count++;
+	flow->deficit = q->quantum;
+	flow->dropped = 0;
+}
+
+static unsigned int fq_codel_drop(struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	unsigned int maxbacklog = 0, idx = 0, i, len;
+	struct fq_codel_flow *flow;
+
+	/* Queue is full! Find the fat flow and drop packet from it.
+	 * This might sound expensive, but with 1024 flows, we scan
+	 * 4KB of memory, and we dont need to handle a complex tree
+	 * in fast path (packet queue/enqueue) with many cache misses.
+	 */
+	for (i = 0; i < q->flows_cnt; i++) {
+		if (q->backlogs[i] > maxbacklog) {
+			maxbacklog = q->backlogs[i];
+			idx = i;
+		}
+	}
+	if (!maxbacklog)
+		return 0;
+
+	flow = &q->flows[idx];
+	skb = dequeue_head(flow);
+	len = skb->len;
+	q->backlogs[idx] -= len;
+	kfree_skb(skb);
+	sch->q.qlen--;
+	sch->qstats.drops++;
+	sch->qstats.backlog -= len;
+	flow->dropped++;
+	return len;
+}
+
+static int fq_codel_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	unsigned int idx;
+	struct fq_codel_flow *flow;
+
+	idx = fq_codel_hash(q, skb);
+	codel_set_enqueue_time(skb);
+	flow = &q->flows[idx];
+	flow_queue_add(flow, skb);
+	q->backlogs[idx] += skb->len;
+	sch->qstats.backlog += skb->len;
+	sch->bstats.bytes += skb->len;
+	sch->bstats.packets++;
+
+	if (list_empty(&flow->flowchain))
+		fq_codel_activate(q, flow);
+
+	if (++sch->q.qlen <= q->limit)
+		return NET_XMIT_SUCCESS;
+
+	/* The queue length did not change, so like sfq tell our
+	 * parents this packet was not queued.
+	 */
+	q->drop_overlimit++;
+	fq_codel_drop(sch);
+	return NET_XMIT_CN;
+}
+
+/* This is the specific function called from codel_dequeue()
+ * to dequeue a packet from queue. Note: backlog is handled in
+ * codel, we dont need to reduce it here.
+ */
+static struct sk_buff *dequeue(struct codel_vars *vars, struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct fq_codel_flow *flow;
+	struct sk_buff *skb = NULL;
+
+	flow = container_of(vars, struct fq_codel_flow, cvars);
+	if (flow->head) {
+		skb = dequeue_head(flow);
+		q->backlogs[flow - q->flows] -= skb->len;
+		sch->q.qlen--;
+	}
+	return skb;
+}
+
+static struct sk_buff *fq_codel_dequeue(struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	struct fq_codel_flow *flow;
+	struct list_head *head;
+	u32 prev_drop_count, prev_ecn_mark;
+
+begin:
+	head = &q->new_flows;
+	if (list_empty(head)) {
+		head = &q->old_flows;
+		if (list_empty(head))
+			return NULL;
+	}
+	flow = list_first_entry(head, struct fq_codel_flow, flowchain);
+
+	if (flow->deficit <= 0) {
+		flow->deficit += q->quantum;
+		list_move_tail(&flow->flowchain, &q->old_flows);
+		goto begin;
+	}
+
+	prev_drop_count = q->cstats.drop_count;
+	prev_ecn_mark = q->cstats.ecn_mark;
+
+	skb = codel_dequeue(sch, &q->cparams, &flow->cvars, &q->cstats,
+			    dequeue);
+
+	flow->dropped += q->cstats.drop_count - prev_drop_count;
+	flow->dropped += q->cstats.ecn_mark - prev_ecn_mark;
+
+	if (!skb) {
+		/* force a pass through old_flows to prevent starvation */
+		if ((head == &q->new_flows) && !list_empty(&q->old_flows))
+			list_move_tail(&flow->flowchain, &q->old_flows);
+		else
+			list_del_init(&flow->flowchain);
+		goto begin;
+	}
+	flow->deficit -= skb->len;
+
+	/* We cant call qdisc_tree_decrease_qlen() if our qlen is 0,
+	 * or HTB crashes. Defer it for next round.
+	 */
+	if (q->cstats.drop_count && sch->q.qlen) {
+		qdisc_tree_decrease_qlen(sch, q->cstats.drop_count);
+		q->cstats.drop_count = 0;
+	}
+	return skb;
+}
+
+static int fq_codel_requeue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	unsigned int idx = fq_codel_hash(q, skb);
+	struct fq_codel_flow *flow = &q->flows[idx];
+
+	/* Put it back at the head, keeping its original enqueue time */
+	skb->next = flow->head;
+	if (flow->head == NULL)
+		flow->tail = skb;
+	flow->head = skb;
+
+	q->backlogs[idx] += skb->len;
+	sch->qstats.backlog += skb->len;
+	sch->q.qlen++;
+	sch->qstats.requeues++;
+
+	if (list_empty(&flow->flowchain))
+		fq_codel_activate(q, flow);
+	return NET_XMIT_SUCCESS;
+}
+
+static void fq_codel_reset(struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	unsigned int i;
+
+	INIT_LIST_HEAD(&q->new_flows);
+	INIT_LIST_HEAD(&q->old_flows);
+	for (i = 0; i < q->flows_cnt; i++) {
+		struct fq_codel_flow *flow = q->flows + i;
+
+		while (flow->head) {
+			struct sk_buff *skb = dequeue_head(flow);
+
+			kfree_skb(skb);
+		}
+		INIT_LIST_HEAD(&flow->flowchain);
+		codel_vars_init(&flow->cvars);
+	}
+	if (q->backlogs)
+		memset(q->backlogs, 0, q->flows_cnt * sizeof(u32));
+	sch->q.qlen = 0;
+	sch->qstats.backlog = 0;
+	q->cstats.drop_count = 0;
+}
+
+static int fq_codel_get_u32(struct rtattr **tb, int type, u32 *val)
+{
+	if (tb[type-1] == NULL)
+		return 0;
+	if (RTA_PAYLOAD(tb[type-1]) < sizeof(u32))
+		return -EINVAL;
+	*val = *(u32 *)RTA_DATA(tb[type-1]);
+	return 1;
+}
+
+static int fq_codel_change(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct rtattr *tb[TCA_FQ_CODEL_MAX];
+	u32 target, interval, limit, ecn, flows, quantum;
+	int has_target, has_interval, has_limit, has_ecn, has_quantum;
+	int err;
+
+	if (opt == NULL || rtattr_parse_nested(tb, TCA_FQ_CODEL_MAX, opt))
+		return -EINVAL;
+
+	if ((err = fq_codel_get_u32(tb, TCA_FQ_CODEL_FLOWS, &flows)) != 0) {
+		if (err < 0 || q->flows)
+			return -EINVAL;
+		if (flows == 0 || flows > 65536)
+			return -EINVAL;
+		q->flows_cnt = flows;
+	}
+
+	if ((has_target = fq_codel_get_u32(tb, TCA_FQ_CODEL_TARGET,
+					   &target)) < 0 ||
+	    (has_interval = fq_codel_get_u32(tb, TCA_FQ_CODEL_INTERVAL,
+					     &interval)) < 0 ||
+	    (has_limit = fq_codel_get_u32(tb, TCA_FQ_CODEL_LIMIT,
+					  &limit)) < 0 ||
+	    (has_ecn = fq_codel_get_u32(tb, TCA_FQ_CODEL_ECN, &ecn)) < 0 ||
+	    (has_quantum = fq_codel_get_u32(tb, TCA_FQ_CODEL_QUANTUM,
+					    &quantum)) < 0)
+		return -EINVAL;
+
+	if ((has_limit && limit == 0) || (has_interval && interval == 0))
+		return -EINVAL;
+
+	sch_tree_lock(sch);
+
+	if (has_target)
+		q->cparams.target = codel_us_to_time(target);
+	if (has_interval)
+		q->cparams.interval = codel_us_to_time(interval);
+	if (has_limit)
+		q->limit = limit;
+	if (has_ecn)
+		q->cparams.ecn = !!ecn;
+	if (has_quantum)
+		q->quantum = max(256U, quantum);
+
+	while (sch->q.qlen > q->limit) {
+		struct sk_buff *skb = fq_codel_dequeue(sch);
+
+		kfree_skb(skb);
+		q->cstats.drop_count++;
+	}
+	qdisc_tree_decrease_qlen(sch, q->cstats.drop_count);
+	q->cstats.drop_count = 0;
+
+	sch_tree_unlock(sch);
+	return 0;
+}
+
+static void fq_codel_destroy(struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+
+	kfree(q->backlogs);
+	kfree(q->flows);
+}
+
+static int fq_codel_init(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	unsigned int i;
+	int err;
+
+	q->limit = 10*1024;
+	q->flows_cnt = 1024;
+	q->quantum = psched_mtu(sch->dev);
+	q->perturbation = net_random();
+	INIT_LIST_HEAD(&q->new_flows);
+	INIT_LIST_HEAD(&q->old_flows);
+	codel_params_init(&q->cparams);
+	codel_stats_init(&q->cstats);
+
+	if (opt) {
+		err = fq_codel_change(sch, opt);
+		if (err)
+			return err;
+	}
+
+	q->flows = kcalloc(q->flows_cnt, sizeof(struct fq_codel_flow),
+			   GFP_KERNEL);
+	if (!q->flows)
+		return -ENOMEM;
+	q->backlogs = kcalloc(q->flows_cnt, sizeof(u32), GFP_KERNEL);
+	if (!q->backlogs) {
+		kfree(q->flows);
+		q->flows = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < q->flows_cnt; i++) {
+		struct fq_codel_flow *flow = q->flows + i;
+
+		INIT_LIST_HEAD(&flow->flowchain);
+		codel_vars_init(&flow->cvars);
+	}
+	return 0;
+}
+
+static int fq_codel_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct rtattr *opts = NULL;
+
+	opts = RTA_NEST(skb, TCA_OPTIONS);
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_TARGET,
+		    codel_time_to_us(q->cparams.target));
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_LIMIT, q->limit);
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_INTERVAL,
+		    codel_time_to_us(q->cparams.interval));
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_ECN, q->cparams.ecn);
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_QUANTUM, q->quantum);
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_FLOWS, q->flows_cnt);
+	return RTA_NEST_END(skb, opts);
+
+rtattr_failure:
+	return RTA_NEST_CANCEL(skb, opts);
+}
+
+static int fq_codel_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct tc_fq_codel_xstats st;
+	struct list_head *pos;
+
+	/* no designated initializers into the anonymous union, for gcc < 4.6 */
+	memset(&st, 0, sizeof(st));
+	st.type = TCA_FQ_CODEL_XSTATS_QDISC;
+	st.qdisc_stats.maxpacket = q->cstats.maxpacket;
+	st.qdisc_stats.drop_overlimit = q->drop_overlimit;
+	st.qdisc_stats.ecn_mark = q->cstats.ecn_mark;
+	st.qdisc_stats.new_flow_count = q->new_flow_count;
+
+	list_for_each(pos, &q->new_flows)
+		st.qdisc_stats.new_flows_len++;
+
+	list_for_each(pos, &q->old_flows)
+		st.qdisc_stats.old_flows_len++;
+
+	return gnet_stats_copy_app(d, &st, sizeof(st));
+}
+
+static struct Qdisc_ops fq_codel_qdisc_ops = {
+	.next		=	NULL,
+	.cl_ops		=	NULL,
+	.id		=	"fq_codel",
+	.priv_size	=	sizeof(struct fq_codel_sched_data),
+	.enqueue	=	fq_codel_enqueue,
+	.dequeue	=	fq_codel_dequeue,
+	.requeue	=	fq_codel_requeue,
+	.drop		=	fq_codel_drop,
+	.init		=	fq_codel_init,
+	.reset		=	fq_codel_reset,
+	.destroy	=	fq_codel_destroy,
+	.change		=	fq_codel_change,
+	.dump		=	fq_codel_dump,
+	.dump_stats	=	fq_codel_dump_stats,
+	.owner		=	THIS_MODULE,
+};
+
+static int __init fq_codel_module_init(void)
+{
+	return register_qdisc(&fq_codel_qdisc_ops);
+}
+static void __exit fq_codel_module_exit(void)
+{
+	unregister_qdisc(&fq_codel_qdisc_ops);
+}
+module_init(fq_codel_module_init)
+module_exit(fq_codel_module_exit)
+MODULE_LICENSE("GPL");
@@ -110,8 +110,8 @@ static int Init_In_Out_queue(int fragstotal,int fragsize);
 static int Free_In_Out_queue(int fragstotal,int fragsize);
 static irqreturn_t jz_i2s_replay_dma_irq(int irqnr, void *ref);
 static irqreturn_t jz_i2s_record_dma_irq(int irqnr, void *ref);
-static void (*replay_filler)(signed long src_start, int count, int id);
-static int (*record_filler)(unsigned long dst_start, int count, int id);
+static int (*replay_filler)(const char __user *src, int count, int id);
+static int (*record_filler)(char __user *dst, int count, int id);
 //#if defined(CONFIG_I2S_ICODEC)
 static void write_mute_to_dma_buffer(signed long l_sample, signed long r_sample);
 //#endif
@@ -134,8 +134,8 @@ struct jz_i2s_controller_info
 	struct i2s_codec *i2s_codec[NR_I2S];
 	int opened1;
 	int opened2;
-	unsigned char *tmp1;  /* tmp buffer for sample conversions */
-	unsigned char *tmp2;
+	int mapped;		/* vmas mapping the replay fragments */
+	int mmap_trigger;	/* replay fragments looped for mmap */
 	spinlock_t lock;
 	spinlock_t ioctllock;
 	
@@ -269,12 +269,16 @@ static inline void audio_start_dma(int chan, void *dev_id, unsigned long phyaddr
 	struct jz_i2s_controller_info * controller = (struct jz_i2s_controller_info *) dev_id;
 	
 	spin_lock_irqsave(&controller->ioctllock, flags);
-	jz_audio_dma_tran_count = count / jz_audio_b;
+	if (controller->mmap_trigger)
+		jz_audio_dma_tran_count = count;
+	else
+		jz_audio_dma_tran_count = count / jz_audio_b;
 	spin_unlock_irqrestore(&controller->ioctllock, flags);
 	flags = claim_dma_lock();
 	disable_dma(chan);
 	clear_dma_ff(chan);
-	jz_set_oss_dma(chan, mode, jz_audio_format);
+	/* the DMA buffers always hold one 16 bit sample per 32 bit word */
+	jz_set_oss_dma(chan, mode, AFMT_S16_LE);
 	set_dma_addr(chan, phyaddr);
 	if (count == 0) {
 		count++;
@@ -363,7 +367,10 @@ static irqreturn_t jz_i2s_replay_dma_irq (int irq, void *dev_id)
 			spin_unlock_irqrestore(&controller->ioctllock, flags);
 			if ((id = get_buffer_id(&out_busy_queue)) < 0)
 				printk(KERN_DEBUG "Strange DMA finish interrupt for I2S module\n");
-			put_buffer_id(&out_empty_queue, id);
+			if (controller->mmap_trigger)
+				put_buffer_id(&out_full_queue, id); /* loop the ring */
+			else
+				put_buffer_id(&out_empty_queue, id);
 			if ((id = get_buffer_id(&out_full_queue)) >= 0) {
 				put_buffer_id(&out_busy_queue, id);
 				if(*(out_dma_buf_data_count + id) > 0) {
@@ -371,11 +378,15 @@ static irqreturn_t jz_i2s_replay_dma_irq (int irq, void *dev_id)
 							*(out_dma_buf_data_count + id),
 							DMA_MODE_WRITE);
 					last_dma_buffer_id = id;
+					if (controller->mmap_trigger)
+						controller->nextOut = id * jz_audio_fragsize;
 				}
 			} else
 				out_busy_queue.count = 0;
 
-			if (elements_in_queue(&out_empty_queue) > 0) {
+			if (controller->mmap_trigger)
+				wake_up(&controller->dac_wait);
+			else if (elements_in_queue(&out_empty_queue) > 0) {
 				wake_up(&tx_wait_queue);
 				wake_up(&controller->dac_wait);
 			}
@@ -603,225 +614,297 @@ static int jz_audio_set_speed(int dev, int rate)
 }
 
 
-static int record_fill_1x8_u(unsigned long dst_start, int count, int id)
-{
- 
-	int cnt = 0;
-	unsigned long data;
-	volatile unsigned long *s = (unsigned long*)(*(in_dma_buf + id));
-	volatile unsigned char *dp = (unsigned char*)dst_start;
+/*
+ * Sample conversion
+ *
+ * The AIC is fed one sample per 32 bit word, left and right interleaved.
+ * The fillers convert between that and the user format a 32 bit word of
+ * user data (two or four samples) at a time, moving the user data
+ * through a small on-stack bounce buffer that stays in the cache.
+ * u8 samples are expanded (and volume scaled) through a lookup table.
+ *
+ * Replay fillers convert @count user bytes into DMA fragment @id and
+ * record fillers convert @count user bytes out of it; both return a
+ * negative errno if the user buffer faults.
+ */
+#define FILL_CHUNK	256	/* user bytes per bounce */
 
-	while (count > 0) {
-		count -= 2;   /* count in dword */
-		cnt++;
-		data = *(s++);
-		*(dp ++) = ((data << 16) >> 24) + 0x80;
-		s++;	      /* skip the other channel */
-	}
+static signed long u8_to_sample[256];
+static int u8_to_sample_shift = -1;
 
-	return cnt;
+static void update_u8_table(void)
+{
+	int i;
+
+	if (u8_to_sample_shift == codec_volue_shift)
+		return;
+	for (i = 0; i < 256; i++)
+		u8_to_sample[i] = ((i - 0x80) * 256) >> codec_volue_shift;
+	u8_to_sample_shift = codec_volue_shift;
 }
 
+static inline unsigned char sample_to_u8(unsigned long d)
+{
+	return ((d << 16) >> 24) + 0x80;
+}
 
-static int record_fill_2x8_u(unsigned long dst_start, int count, int id)
+static int record_fill_1x8_u(char __user *dst, int count, int id)
 {
- 
-	int cnt = 0;
-	unsigned long d1, d2;
-	volatile unsigned long *s = (unsigned long*)(*(in_dma_buf + id));
-	volatile unsigned char *dp = (unsigned char*)dst_start;
-    
-	while (count > 0) {
-		count -= 2;
-		cnt += 2;
-		d1 = *(s++);
-		*(dp ++) = ((d1 << 16) >> 24) + 0x80;
-		d2 = *(s++);
-		*(dp ++) = ((d2 << 16) >> 24) + 0x80;
+	unsigned long *s = (unsigned long *)(*(in_dma_buf + id));
+	u32 buf[FILL_CHUNK / 4];
+	unsigned char *bp;
+	int done, n, i;
+
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, FILL_CHUNK);
+		/* four mono samples per word, taking the left channel */
+		for (i = 0; i < n / 4; i++, s += 8)
+			buf[i] = sample_to_u8(s[0]) | sample_to_u8(s[2]) << 8 |
+				sample_to_u8(s[4]) << 16 | sample_to_u8(s[6]) << 24;
+		bp = (unsigned char *)&buf[i];
+		for (i *= 4; i < n; i++, s += 2)
+			*bp++ = sample_to_u8(s[0]);
+		if (__copy_to_user(dst + done, buf, n))
+			return -EFAULT;
 	}
-	
-	return cnt;
-}
 
+	return count;
+}
 
-static int record_fill_1x16_s(unsigned long dst_start, int count, int id)
+static int record_fill_2x8_u(char __user *dst, int count, int id)
 {
- 
-    int cnt = 0;
-    unsigned long d1;
-    unsigned long *s = (unsigned long*)(*(in_dma_buf + id));
-    unsigned short *dp = (unsigned short *)dst_start;
-  
-    while (count > 0) {
-	    count -= 2;	   /* count in dword */
-	    cnt += 2;	   /* count in byte */
-	    d1 = *(s++);
-	    *(dp ++) = (d1 << 16) >> 16;
-	    s++;	   /* skip the other channel */
-    }
+	unsigned long *s = (unsigned long *)(*(in_dma_buf + id));
+	u32 buf[FILL_CHUNK / 4];
+	unsigned char *bp;
+	int done, n, i;
+
+	count &= ~1;	/* whole frames */
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, FILL_CHUNK);
+		for (i = 0; i < n / 4; i++, s += 4)
+			buf[i] = sample_to_u8(s[0]) | sample_to_u8(s[1]) << 8 |
+				sample_to_u8(s[2]) << 16 | sample_to_u8(s[3]) << 24;
+		if (n & 2) {
+			bp = (unsigned char *)&buf[i];
+			bp[0] = sample_to_u8(s[0]);
+			bp[1] = sample_to_u8(s[1]);
+			s += 2;
+		}
+		if (__copy_to_user(dst + done, buf, n))
+			return -EFAULT;
+	}
 
-    return cnt;
+	return count;
 }
 
-
-static int record_fill_2x16_s(unsigned long dst_start, int count, int id)
+static int record_fill_1x16_s(char __user *dst, int count, int id)
 {
- 
-    int cnt = 0;
-    unsigned long d1, d2;
-    unsigned long *s = (unsigned long*)(*(in_dma_buf + id));
-    unsigned short *dp = (unsigned short *)dst_start;
-    while (count > 0) {
-        count -= 2;	/* count in dword */
-        cnt += 4;	/* count in byte */
-        d1 = *(s++);
-        d2 = *(s++);
-	if(abnormal_data_count > 0) { 
-		d1 = d2 = 0;
-		abnormal_data_count --;
+	unsigned long *s = (unsigned long *)(*(in_dma_buf + id));
+	u32 buf[FILL_CHUNK / 4];
+	int done, n, i;
+
+	count &= ~1;	/* whole frames */
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, FILL_CHUNK);
+		/* two mono samples per word, taking the left channel */
+		for (i = 0; i < n / 4; i++, s += 4)
+			buf[i] = (s[0] & 0xffff) | s[2] << 16;
+		if (n & 2) {
+			*(unsigned short *)&buf[i] = s[0];
+			s += 2;
+		}
+		if (__copy_to_user(dst + done, buf, n))
+			return -EFAULT;
 	}
-	*(dp ++) = (d1 << 16) >> 16;
-        *(dp ++) = (d2 << 16) >> 16;
-    }
 
-    return cnt;
+	return count;
 }
 
-static void replay_fill_1x8_u(unsigned long src_start, int count, int id)
+static int record_fill_2x16_s(char __user *dst, int count, int id)
 {
- 
-	int cnt = 0;
-	unsigned char data;
-	unsigned long ddata;
-	volatile unsigned char *s = (unsigned char *)src_start;
-	volatile unsigned long *dp = (unsigned long*)(*(out_dma_buf + id));
+	unsigned long *s = (unsigned long *)(*(in_dma_buf + id));
+	u32 buf[FILL_CHUNK / 4];
+	int done, n, i, mute;
+
+	count &= ~3;	/* whole frames */
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, FILL_CHUNK);
+		i = 0;
+		if (abnormal_data_count > 0) {
+			mute = min(abnormal_data_count, n / 4);
+			abnormal_data_count -= mute;
+			for (; i < mute; i++, s += 2)
+				buf[i] = 0;
+		}
+		for (; i < n / 4; i++, s += 2)
+			buf[i] = (s[0] & 0xffff) | s[1] << 16;
+		if (__copy_to_user(dst + done, buf, n))
+			return -EFAULT;
+	}
 
-	while (count > 0) {
-		count--;
-		cnt += 1;
-		data = *(s++) - 0x80;
-		ddata = (unsigned long) data << 8;
-		*(dp ++) = ddata;
-		*(dp ++) = ddata;
+	return count;
+}
 
-		/* save last left and right */
-		if(count == 1) {
-			save_last_samples[id].left = ddata;
-			save_last_samples[id].right = ddata;
+static int replay_fill_1x8_u(const char __user *src, int count, int id)
+{
+	signed long *dp = (signed long *)(*(out_dma_buf + id));
+	u32 buf[FILL_CHUNK / 4];
+	unsigned char *bp;
+	int done, n, i;
+
+	update_u8_table();
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, FILL_CHUNK);
+		if (__copy_from_user(buf, src + done, n))
+			return -EFAULT;
+		for (i = 0; i < n / 4; i++, dp += 8) {
+			u32 w = buf[i];
+			dp[0] = dp[1] = u8_to_sample[w & 0xff];
+			dp[2] = dp[3] = u8_to_sample[(w >> 8) & 0xff];
+			dp[4] = dp[5] = u8_to_sample[(w >> 16) & 0xff];
+			dp[6] = dp[7] = u8_to_sample[w >> 24];
 		}
+		bp = (unsigned char *)&buf[i];
+		for (i *= 4; i < n; i++, dp += 2)
+			dp[0] = dp[1] = u8_to_sample[*bp++];
 	}
-	cnt = cnt * 2 * jz_audio_b;
-	*(out_dma_buf_data_count + id) = cnt;
-}
 
+	/* save last left and right */
+	if (count) {
+		save_last_samples[id].left = dp[-2];
+		save_last_samples[id].right = dp[-1];
+	}
+	*(out_dma_buf_data_count + id) = count * 8;
+	return 0;
+}
 
-static void replay_fill_2x8_u(unsigned long src_start, int count, int id)
+static int replay_fill_2x8_u(const char __user *src, int count, int id)
 {
- 
-	int cnt = 0;
-	unsigned char d1;
-	unsigned long dd1;
-	volatile unsigned char *s = (unsigned char *)src_start;
-	volatile unsigned long *dp = (unsigned long*)(*(out_dma_buf + id));
+	signed long *dp = (signed long *)(*(out_dma_buf + id));
+	u32 buf[FILL_CHUNK / 4];
+	unsigned char *bp;
+	int done, n, i;
+
+	count &= ~1;	/* whole frames */
+	update_u8_table();
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, FILL_CHUNK);
+		if (__copy_from_user(buf, src + done, n))
+			return -EFAULT;
+		for (i = 0; i < n / 4; i++, dp += 4) {
+			u32 w = buf[i];
+			dp[0] = u8_to_sample[w & 0xff];
+			dp[1] = u8_to_sample[(w >> 8) & 0xff];
+			dp[2] = u8_to_sample[(w >> 16) & 0xff];
+			dp[3] = u8_to_sample[w >> 24];
+		}
+		if (n & 2) {
+			bp = (unsigned char *)&buf[i];
+			dp[0] = u8_to_sample[bp[0]];
+			dp[1] = u8_to_sample[bp[1]];
+			dp += 2;
+		}
+	}
 
-	while (count > 0) {
-		count -= 1;
-		cnt += 1 ;
-		d1 = *(s++) - 0x80;
-		dd1 = (unsigned long) d1 << 8;
-		*(dp ++) = dd1;
-		/* save last left */
-		if(count == 2)
-			save_last_samples[id].left = dd1;
-		/* save last right */
-		if(count == 1)
-			save_last_samples[id].right = dd1;
+	/* save last left and right */
+	if (count) {
+		save_last_samples[id].left = dp[-2];
+		save_last_samples[id].right = dp[-1];
 	}
-	cnt *= jz_audio_b;
-	*(out_dma_buf_data_count + id) = cnt;
+	*(out_dma_buf_data_count + id) = count * 4;
+	return 0;
 }
 
-
-static void replay_fill_1x16_s(signed long src_start, int count, int id)
+static int replay_fill_1x16_s(const char __user *src, int count, int id)
 {
- 
-	int cnt = 0;
-	signed short d1;
-	signed long l1;
-	volatile signed short *s = (signed short *)src_start;
-	volatile signed long *dp = (signed long*)(*(out_dma_buf + id));
-       
-	while (count > 0) {
-		count -= 2;
-		cnt += 2 ;
-		d1 = *(s++);
-		l1 = (signed long)d1;
-		*(dp ++) = l1;
-		*(dp ++) = l1;
-
-		/* save last left and right */
-		if(count == 1) {
-			save_last_samples[id].left = l1;
-			save_last_samples[id].right = l1;
+	signed long *dp = (signed long *)(*(out_dma_buf + id));
+	int shift = codec_volue_shift;
+	u32 buf[FILL_CHUNK / 4];
+	signed long l1, l2;
+	int done, n, i;
+
+	count &= ~1;	/* whole frames */
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, FILL_CHUNK);
+		if (__copy_from_user(buf, src + done, n))
+			return -EFAULT;
+		for (i = 0; i < n / 4; i++, dp += 4) {
+			l1 = (signed short)buf[i] >> shift;
+			l2 = (s32)buf[i] >> (16 + shift);
+			dp[0] = dp[1] = l1;
+			dp[2] = dp[3] = l2;
+		}
+		if (n & 2) {
+			dp[0] = dp[1] = (signed short)buf[i] >> shift;
+			dp += 2;
 		}
 	}
-	cnt = cnt * 2 * jz_audio_b;
-	*(out_dma_buf_data_count + id) = cnt;
+
+	/* save last left and right */
+	if (count) {
+		save_last_samples[id].left = dp[-2];
+		save_last_samples[id].right = dp[-1];
+	}
+	*(out_dma_buf_data_count + id) = count * 4;
+	return 0;
 }
 
-static void replay_fill_2x16_s(signed long src_start, int count, int id)
+static int replay_fill_2x16_s(const char __user *src, int count, int id)
 {
- 
-	int cnt = 0;
-	signed short d1;
-	signed long l1;
+	signed long *dp = (signed long *)(*(out_dma_buf + id));
+	int shift = codec_volue_shift;
+	/*
+	 * mute_cnt counts two per frame and dp[-11] must stay inside the
+	 * buffer, so at least 7 frames of silence have to be seen first.
+	 */
+	int sam_rate = max(jz_audio_rate / 20, 14);
 	int mute_cnt = 0;
-	signed long tmp1,tmp2;
-	volatile signed short *s = (signed short *)src_start;
-	volatile signed long *dp = (signed long*)(*(out_dma_buf + id));
-	volatile signed long *before_dp;
-	int sam_rate = jz_audio_rate / 20;
-
-	tmp1 = tmp2 = 0;
-	while (count > 0) {
-		count -= 2;
-		cnt += 2;
-		d1 = *(s++);
-		
-		l1 = (signed long)d1;
-		l1 >>= codec_volue_shift;
-
-		if(l1 == 0) {
-			mute_cnt ++;
-			if(mute_cnt >= sam_rate) {
-				before_dp = dp - 10;
-				*(before_dp) = (signed long)1;
-				before_dp = dp - 11;
-				*(before_dp) = (signed long)1;
+	u32 buf[FILL_CHUNK / 4];
+	signed long l1, l2;
+	int done, n, i;
+
+	count &= ~3;	/* whole frames */
+	for (done = 0; done < count; done += n) {
+		n = min(count - done, FILL_CHUNK);
+		if (__copy_from_user(buf, src + done, n))
+			return -EFAULT;
+		for (i = 0; i < n / 4; i++, dp += 2) {
+			l1 = (signed short)buf[i] >> shift;
+			l2 = (s32)buf[i] >> (16 + shift);
+
+			/*
+			 * Keep the codec from muting itself on long runs
+			 * of silence.
+			 */
+			if ((l1 | l2) == 0) {
+				mute_cnt += 2;
+				if (mute_cnt >= sam_rate) {
+					dp[-10] = 1;
+					dp[-11] = 1;
+					mute_cnt = 0;
+				}
+			} else
 				mute_cnt = 0;
-			}
-		} else
-			mute_cnt = 0;
 
-		*(dp ++) = l1;
-		
-		tmp1 = tmp2;
-		tmp2 = l1;
+			dp[0] = l1;
+			dp[1] = l2;
+		}
 	}
-   
-	/* save last left */
-	save_last_samples[id].left = tmp1;
-	/* save last right */
-	save_last_samples[id].right = tmp2;
-	cnt *= jz_audio_b;
-	*(out_dma_buf_data_count + id) = cnt;
+
+	/* save last left and right */
+	if (count) {
+		save_last_samples[id].left = dp[-2];
+		save_last_samples[id].right = dp[-1];
+	}
+	*(out_dma_buf_data_count + id) = count * 2;
+	return 0;
 }
 
 static unsigned int jz_audio_set_format(int dev, unsigned int fmt)
 {
  
 	switch (fmt) {
-	case AFMT_U8:break;
+	case AFMT_U8:
 	case AFMT_S16_LE:
 		     jz_audio_format = fmt;
 		     jz_update_filler(jz_audio_format,jz_audio_channels);
@@ -884,6 +967,9 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file,unsigned int cm
 static ssize_t jz_audio_poll(struct file *file,struct poll_table_struct *wait);
 static ssize_t jz_audio_write(struct file *file, const char *buffer,size_t count, loff_t *ppos);
 static ssize_t jz_audio_read(struct file *file, char *buffer,size_t count, loff_t *ppos);
+static int jz_audio_mmap(struct file *file, struct vm_area_struct *vma);
+static void jz_audio_mmap_start(struct jz_i2s_controller_info *controller);
+static void jz_audio_mmap_stop(struct jz_i2s_controller_info *controller);
 
 /* static struct file_operations jz_i2s_audio_fops */
 static struct file_operations jz_i2s_audio_fops =
@@ -894,7 +980,8 @@ static struct file_operations jz_i2s_audio_fops =
 	write:              jz_audio_write,
 	read:               jz_audio_read,
 	poll:               jz_audio_poll,
-	ioctl:              jz_audio_ioctl
+	ioctl:              jz_audio_ioctl,
+	mmap:               jz_audio_mmap
 };
 
 static int jz_i2s_open_mixdev(struct inode *inode, struct file *file)
@@ -1107,22 +1194,22 @@ static void jz_update_filler(int format, int channels)
 	{
 
 	case TYPE(AFMT_U8, 1):
-		jz_audio_b = 4; /* 4bytes * 8bits =32bits */
+		jz_audio_b = 8; /* 1 byte -> 2 channels * 32bits */
 		replay_filler = replay_fill_1x8_u;
 		record_filler = record_fill_1x8_u;
 		break;
 	case TYPE(AFMT_U8, 2):
-		jz_audio_b = 4;
+		jz_audio_b = 4; /* 1 byte -> 32bits */
 		replay_filler = replay_fill_2x8_u;
 		record_filler = record_fill_2x8_u;
 		break;
 	case TYPE(AFMT_S16_LE, 1):
-		jz_audio_b = 2; /* 2bytes * 16bits =32bits */
+		jz_audio_b = 4; /* 2 bytes -> 2 channels * 32bits */
 		replay_filler = replay_fill_1x16_s;
 		record_filler = record_fill_1x16_s;
 		break;
 	case TYPE(AFMT_S16_LE, 2):
-		jz_audio_b = 2;
+		jz_audio_b = 2; /* 2 bytes -> 32bits */
 		replay_filler = replay_fill_2x16_s;
 		record_filler = record_fill_2x16_s;
 		break;
@@ -1177,17 +1264,6 @@ static void __init attach_jz_i2s(struct jz_i2s_controller_info *controller)
     }
 #endif
 
-	controller->tmp1 = (void *)__get_free_pages(GFP_KERNEL, 8);
-	if (!controller->tmp1) {
-		printk(KERN_ERR "%s: can't allocate tmp buffers.\n", controller->name);
-		goto tmp1_failed;
-	}
-	controller->tmp2 = (void *)__get_free_pages(GFP_KERNEL, 8);
-	if (!controller->tmp2) {
-		printk(KERN_ERR "%s: can't allocate tmp buffers.\n", controller->name);
-		goto tmp2_failed;
-	}
-
 	if ((controller->dma1 = jz_request_dma(DMA_ID_I2S_TX, "audio dac", jz_i2s_replay_dma_irq, IRQF_DISABLED, controller)) < 0) {
 		printk(KERN_ERR "%s: can't reqeust DMA DAC channel.\n", name);
 		goto dma1_failed;
@@ -1208,10 +1284,6 @@ static void __init attach_jz_i2s(struct jz_i2s_controller_info *controller)
 dma2_failed:
 	jz_free_dma(controller->dma1);
 dma1_failed:
-	free_pages((unsigned long)controller->tmp1, 8);
-tmp2_failed:
-	free_pages((unsigned long)controller->tmp2, 8);
-tmp1_failed:
 
 #ifdef CONFIG_PROC_FS
 	jz_i2s_cleanup_proc(controller);
@@ -1235,6 +1307,8 @@ static int __init probe_jz_i2s(struct jz_i2s_controller_info **controller)
 	(*controller)->name = "Jz I2S controller";
 	(*controller)->opened1 = 0;
 	(*controller)->opened2 = 0;
+	(*controller)->mapped = 0;
+	(*controller)->mmap_trigger = 0;
 	
 	init_waitqueue_head(&(*controller)->dac_wait); // RV order moved
         init_waitqueue_head(&(*controller)->adc_wait); // RV order moved
@@ -1266,8 +1340,6 @@ static void __exit unload_jz_i2s(struct jz_i2s_controller_info *controller)
  
 	jz_free_dma(controller->dma1);
 	jz_free_dma(controller->dma2);
-	free_pages((unsigned long)controller->tmp1, 8);
-	free_pages((unsigned long)controller->tmp2, 8);
 	free_pages((unsigned long)pop_turn_onoff_buf, 8);
     
 	if (adev >= 0) {
@@ -1417,6 +1489,10 @@ static int __init init_jz_i2s(void)
 	in_full_queue.id = NULL;
 	in_busy_queue.id = NULL;
 
+	jz_audio_format = AFMT_S16_LE;
+	jz_audio_channels = 2;
+	jz_update_filler(jz_audio_format, jz_audio_channels);
+
 	jz_audio_fragsize = JZCODEC_RW_BUFFER_SIZE * PAGE_SIZE;
 	jz_audio_fragstotal = JZCODEC_RW_BUFFER_TOTAL ;
 	Init_In_Out_queue(jz_audio_fragstotal,jz_audio_fragsize);
@@ -1668,6 +1744,122 @@ static int jz_audio_release(struct inode *inode, struct file *file)
 }
 #endif
 
+/*
+ * mmap of the replay fragments
+ *
+ * The fragments are mapped back to back, uncached, in the layout the AIC
+ * consumes: one 16 bit sample in the low half of each 32 bit word, left
+ * and right interleaved, whatever format was set. The mapping is
+ * SNDCTL_DSP_GETBLKSIZE * fragstotal bytes long. SNDCTL_DSP_SETTRIGGER
+ * starts the DMA looping over the ring; SNDCTL_DSP_GETOPTR reports the
+ * fragment being played and poll() returns when one has completed.
+ */
+static void jz_audio_mmap_start(struct jz_i2s_controller_info *controller)
+{
+	int i, id;
+
+	if (controller->mmap_trigger)
+		return;
+
+	out_empty_queue.count = 0;
+	out_busy_queue.count = 0;
+	out_full_queue.count = 0;
+	for (i = 0; i < jz_audio_fragstotal; i++) {
+		*(out_dma_buf_data_count + i) = jz_audio_fragsize;
+		put_buffer_id(&out_full_queue, i);
+	}
+	controller->mmap_trigger = 1;
+	controller->nextOut = 0;
+	controller->blocks = 0;
+
+	if(set_replay_hp_or_speaker)
+		set_replay_hp_or_speaker();
+	__i2s_enable_transmit_dma();
+	__i2s_enable_replay();
+
+	id = get_buffer_id(&out_full_queue);
+	put_buffer_id(&out_busy_queue, id);
+	audio_start_dma(controller->dma1, controller, *(out_dma_pbuf + id),
+			jz_audio_fragsize, DMA_MODE_WRITE);
+	last_dma_buffer_id = id;
+}
+
+static void jz_audio_mmap_stop(struct jz_i2s_controller_info *controller)
+{
+	unsigned long flags;
+	int i;
+
+	if (!controller->mmap_trigger)
+		return;
+
+	local_irq_save(flags);
+	disable_dma(controller->dma1);
+	controller->mmap_trigger = 0;
+	out_busy_queue.count = 0;
+	out_full_queue.count = 0;
+	out_empty_queue.count = jz_audio_fragstotal;
+	for (i = 0; i < jz_audio_fragstotal; i++)
+		*(out_empty_queue.id + i) = i;
+	local_irq_restore(flags);
+}
+
+static void jz_audio_vma_open(struct vm_area_struct *vma)
+{
+	struct jz_i2s_controller_info *controller = vma->vm_private_data;
+
+	controller->mapped++;
+}
+
+static void jz_audio_vma_close(struct vm_area_struct *vma)
+{
+	struct jz_i2s_controller_info *controller = vma->vm_private_data;
+
+	controller->mapped--;
+}
+
+static struct vm_operations_struct jz_audio_vm_ops = {
+	.open	= jz_audio_vma_open,
+	.close	= jz_audio_vma_close,
+};
+
+static int jz_audio_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct jz_i2s_controller_info *controller = (struct jz_i2s_controller_info *) file->private_data;
+	unsigned long start = vma->vm_start;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long len;
+	int i;
+
+	if (!(file->f_mode & FMODE_WRITE) || !out_dma_buf)
+		return -EINVAL;
+	if (vma->vm_pgoff != 0 ||
+	    size > (unsigned long)jz_audio_fragstotal * jz_audio_fragsize)
+		return -EINVAL;
+
+	/* start from silence */
+	if (!controller->mapped) {
+		for (i = 0; i < jz_audio_fragstotal; i++) {
+			memset((void *)*(out_dma_buf + i), 0, jz_audio_fragsize);
+			dma_cache_wback_inv(*(out_dma_buf + i), jz_audio_fragsize);
+		}
+	}
+
+	/* the DMA reads the same memory, so bypass the cache */
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	for (i = 0; i < jz_audio_fragstotal && start < vma->vm_end; i++) {
+		len = min(vma->vm_end - start, (unsigned long)jz_audio_fragsize);
+		if (remap_pfn_range(vma, start, *(out_dma_pbuf + i) >> PAGE_SHIFT,
+				    len, vma->vm_page_prot))
+			return -EAGAIN;
+		start += len;
+	}
+
+	vma->vm_ops = &jz_audio_vm_ops;
+	vma->vm_private_data = controller;
+	jz_audio_vma_open(vma);
+	return 0;
+}
+
 static int jz_audio_release(struct inode *inode, struct file *file)
 {
 	 
@@ -1686,6 +1878,7 @@ static int jz_audio_release(struct inode *inode, struct file *file)
 
 	pop_dma_flag = 0;
 	pop_wait_event = 0;
+	jz_audio_mmap_stop(controller);
 	
 	if (controller->opened1 == 1 && controller->opened2 == 1) {
 		controller->opened1 = 0; 
@@ -2055,13 +2248,9 @@ unsigned int cmd, unsigned long arg)
 		if (get_user(val, (int *)arg))
 			return -EFAULT;
 		if (val != AFMT_QUERY)
-			jz_audio_set_format(controller->dev_audio,val);
-		else {
-			if (file->f_mode & FMODE_READ)
-				val = (jz_audio_format == 16) ?  AFMT_S16_LE : AFMT_U8;
-			else
-				val = (jz_audio_format == 16) ?  AFMT_S16_LE : AFMT_U8;
-		}
+			val = jz_audio_set_format(controller->dev_audio,val);
+		else
+			val = jz_audio_format;
 
 		return put_user(val, (int *)arg);
 	case SNDCTL_DSP_CHANNELS:
@@ -2087,6 +2276,8 @@ unsigned int cmd, unsigned long arg)
 		if (newfragsize > (16 * PAGE_SIZE))
 			newfragsize = 16 * PAGE_SIZE;
 		
+		if (controller->mapped)
+			return -EBUSY;
 		newfragstotal = (val >> 16) & 0x7FFF;
 		if (newfragstotal < 2)
 			newfragstotal = 2;
@@ -2167,6 +2358,12 @@ unsigned int cmd, unsigned long arg)
  
 		if (get_user(val, (int *)arg))
 			return -EFAULT;
+		if ((file->f_mode & FMODE_WRITE) && controller->mapped) {
+			if (val & PCM_ENABLE_OUTPUT)
+				jz_audio_mmap_start(controller);
+			else
+				jz_audio_mmap_stop(controller);
+		}
 		return 0;
 	case SNDCTL_DSP_GETIPTR:
  
@@ -2246,6 +2443,11 @@ static ssize_t jz_audio_poll(struct file *file,struct poll_table_struct *wait)
  
 
 	if (file->f_mode & FMODE_WRITE) {
+		if (controller->mmap_trigger) {
+			/* a fragment of the mapped ring was played */
+			poll_wait(file, &controller->dac_wait, wait);
+			return controller->blocks ? POLLOUT | POLLWRNORM : 0;
+		}
 		if (elements_in_queue(&out_empty_queue) > 0)
 			return POLLOUT | POLLWRNORM;
 
@@ -2281,6 +2483,8 @@ static ssize_t jz_audio_read(struct file *file, char *buffer, size_t count, loff
 
 	if (count < 0)
 		return -EINVAL;
+	if (!access_ok(VERIFY_WRITE, buffer, count))
+		return -EFAULT;
 	
 	__i2s_enable_receive_dma();
 	__i2s_enable_record();
@@ -2324,10 +2528,14 @@ static ssize_t jz_audio_read(struct file *file, char *buffer, size_t count, loff
 		}
 
 		if ((id = get_buffer_id(&in_full_queue)) >= 0) {
-			spin_lock(&controller->lock);
-			cnt = record_filler((unsigned long)controller->tmp2+ret, copy_count, id);
-			spin_unlock(&controller->lock);
+			/* convert straight into the user buffer */
+			cnt = *(in_dma_buf_data_count + id) / jz_audio_b;
+			if (cnt > count - ret)
+				cnt = count - ret;
+			cnt = record_filler(buffer + ret, cnt, id);
 			put_buffer_id(&in_empty_queue, id);
+			if (cnt < 0)
+				return ret ? ret : cnt;
 		} else
 			goto audio_read_back_second;
 		
@@ -2345,13 +2553,8 @@ static ssize_t jz_audio_read(struct file *file, char *buffer, size_t count, loff
 						DMA_MODE_READ);
 			}
 		}
-		if (ret + cnt > count) {
-			spin_lock(&controller->lock);
-			cnt = count - ret;
-			spin_unlock(&controller->lock);
-		}
-		if (copy_to_user(buffer+ret, controller->tmp2+ret, cnt))
-			return ret ? ret : -EFAULT;
+		if (cnt == 0)	/* less than a frame left */
+			break;
 
 		spin_lock(&controller->lock);
 		ret += cnt;
@@ -2381,6 +2584,10 @@ static ssize_t jz_audio_write(struct file *file, const char *buffer, size_t coun
 	 
 	if (count <= 0)
 		return -EINVAL;
+	if (controller->mmap_trigger)
+		return -EBUSY;
+	if (!access_ok(VERIFY_READ, buffer, count))
+		return -EFAULT;
 	
 	if(set_replay_hp_or_speaker)
 		set_replay_hp_or_speaker();
@@ -2391,23 +2598,9 @@ static ssize_t jz_audio_write(struct file *file, const char *buffer, size_t coun
 	spin_lock_irqsave(&controller->ioctllock, flags);
 	controller->nextOut = 0;
 	spin_unlock_irqrestore(&controller->ioctllock, flags);
-	if (jz_audio_channels == 2)
-		{
-                copy_count = jz_audio_fragsize / jz_audio_b;
-                left_count = count/jz_audio_b;
-                }
-        else 
-                {
-                copy_count = jz_audio_fragsize / 4;
-                left_count = count;
-                }
-                  
-//if(jz_audio_channels == 1)
-		
-	if (copy_from_user(controller->tmp1, buffer, count)) {
-		printk("copy_from_user failed:%d",ret);
-		return ret ? ret : -EFAULT;
-	}
+	/* user bytes per fragment */
+	copy_count = jz_audio_fragsize / jz_audio_b;
+	left_count = count;
          
 	while (left_count > 0)
         {
@@ -2434,12 +2627,11 @@ static ssize_t jz_audio_write(struct file *file, const char *buffer, size_t coun
 			copy_count = count - ret;
 		if ((id = get_buffer_id(&out_empty_queue)) >= 0)
                     {
-			{
-                         
-                        // replay_filler((signed long)controller->tmp1 + ret, copy_count, id);
-			replay_fill_2x16_s((signed long)controller->tmp1 + ret, copy_count, id);
-                          
-                        }
+			/* convert straight into the DMA fragment */
+			if (replay_filler(buffer + ret, copy_count, id)) {
+				put_buffer_id(&out_empty_queue, id);
+				return ret ? ret : -EFAULT;
+			}
                          
 	
                         if(*(out_dma_buf_data_count + id) > 0) 